@@ -42,13 +42,12 @@ typedef struct AstNode {
   struct AstNode** children;/**< Child nodes. */
   size_t child_count;       /**< Number of children. */
   size_t child_capacity;    /**< Allocated child slots. */
-  const char* filename;     /**< Source filename for diagnostics. */
-  size_t row;               /**< 1-based line. */
-  size_t col;               /**< 1-based column. */
+  const char* filename;     /**< Source filename for diagnostics; NULL when the node has no location. */
+  size_t offset;            /**< Byte offset in filename; see morphl_sources_locate(). */
 } AstNode;
 
 AstNode* ast_new(AstKind kind);
-AstNode* ast_make_leaf(AstKind kind, Str value, const char* filename, size_t row, size_t col);
+AstNode* ast_make_leaf(AstKind kind, Str value, const char* filename, size_t offset);
 bool ast_append_child(AstNode* node, AstNode* child);
 void ast_free(AstNode* node);
 void ast_print(const AstNode* node, InternTable* interns);
@@ -11,6 +11,7 @@ typedef struct {
     AstNode* tree;          ///< The AST to compile
     const char* out_file;   ///< Output file path
     TypeContext* type_context; ///< Type context for type information
+    bool no_peephole;       ///< VM backend: skip the bytecode peephole pass
 } MorphlBackendContext;
 
 enum MorphlBackendType {
@@ -31,5 +32,13 @@ bool morphl_register_backend(enum MorphlBackendType type);
 /// @return true if compilation was successful, false otherwise
 bool morphl_compile(MorphlBackendContext* context);
 
+/// @brief Compile the given context with the given backend, ignoring the registered one
+/// @note Unlike morphl_register_backend, this touches no shared state, so threads can compile
+///       concurrently as long as each has its own tree, type context and intern table
+/// @param context The backend context to compile
+/// @param type The type of backend to use
+/// @return true if compilation was successful, false otherwise
+bool morphl_compile_with(MorphlBackendContext* context, enum MorphlBackendType type);
+
 #endif // MORPHL_BACKEND_BACKEND_H_
 
@@ -6,8 +6,8 @@
 #include <stdint.h>
 
 #define MORPHL_VM_MAGIC "MVMB"
-#define MORPHL_VM_VERSION_MAJOR 1
-#define MORPHL_VM_VERSION_MINOR 0
+#define MORPHL_VM_VERSION_MAJOR 4
+#define MORPHL_VM_VERSION_MINOR 4
 
 enum VmOpcode {
   /*
@@ -26,15 +26,43 @@ enum VmOpcode {
   VM_OP_MAKE_GROUP = 0x04,
   // set slot on object, operand=string table index for slot name, value on stack
   VM_OP_SET_SLOT = 0x05,
-  // perform operator, operand=string table index for operator name, operands on stack
+  // operator with no dedicated opcode, operand=string table index for operator name; rejected by the loader
   VM_OP_OPERATOR = 0x06,
+  // push frame-local slot onto stack, operand=slot index resolved at compile time
+  VM_OP_LOAD_LOCAL = 0x07,
+  // assign top of stack to frame-local slot (value stays on stack), operand=slot index
+  VM_OP_STORE_LOCAL = 0x08,
+  // push 64-bit integer constant, operand=constant pool index of a VM_CONST_I64 entry
+  VM_OP_PUSH_CONST_I64 = 0x09,
+  // push 64-bit float constant, operand=constant pool index of a VM_CONST_F64 entry
+  VM_OP_PUSH_CONST_F64 = 0x0A,
+  // discard top of stack
+  VM_OP_POP = 0x0B,
+
+  // Superinstructions, formed by the emitter's peephole pass
+  // pop top of stack into frame-local slot (STORE_LOCAL; POP), operand=slot index
+  VM_OP_STORE_LOCAL_POP = 0x0C,
+  // add 1 to frame-local slot, pushing nothing (LOAD_LOCAL; PUSH_CONST_I64 1; ADD; STORE_LOCAL; POP), operand=slot index
+  VM_OP_INC_LOCAL = 0x0D,
+  // add an integer constant to frame-local slot, pushing nothing, operands=slot index, constant pool index of a VM_CONST_I64 entry
+  VM_OP_ADD_LOCAL_CONST = 0x0E,
 
   // Call & stuffs
   // return from call, always return 1st item on stack as result
   VM_OP_RET = 0x10,
-  // call function, operand=function address, arguments on stack
+  // call function, operand=function table index, the function's param_count arguments on stack
   VM_OP_CALL = 0x11,
 
+  // Control flow; offsets are in bytes, relative to the end of the jump instruction
+  // jump forward, operand=offset
+  VM_OP_JUMP = 0x12,
+  // pop condition and jump forward if it is false, operand=offset
+  VM_OP_JUMP_IF_FALSE = 0x13,
+  // jump backward, operand=offset
+  VM_OP_LOOP = 0x14,
+  // call function and return its result, reusing the current frame, operand=function table index
+  VM_OP_TAIL_CALL = 0x15,
+
   // Scope management
   // push new scope
   VM_OP_PUSH_SCOPE = 0x20,
@@ -43,12 +71,57 @@ enum VmOpcode {
   // unwind scope on error (e.g. during return or unwinding), operand=scope depth to unwind to
   VM_OP_UNWIND_SCOPE = 0x22,
 
-
+  // Runtime operators, lowered from the operator registry; no payload, operands on stack
+  // arithmetic
+  VM_OP_ADD = 0x30,
+  VM_OP_SUB = 0x31,
+  VM_OP_MUL = 0x32,
+  VM_OP_DIV = 0x33,
+  VM_OP_MOD = 0x34,
+  VM_OP_REM = 0x35,
+  VM_OP_FADD = 0x36,
+  VM_OP_FSUB = 0x37,
+  VM_OP_FMUL = 0x38,
+  VM_OP_FDIV = 0x39,
+  // comparison
+  VM_OP_EQ = 0x3A,
+  VM_OP_NEQ = 0x3B,
+  VM_OP_LT = 0x3C,
+  VM_OP_GT = 0x3D,
+  VM_OP_LTE = 0x3E,
+  VM_OP_GTE = 0x3F,
+  // logic
+  VM_OP_AND = 0x40,
+  VM_OP_OR = 0x41,
+  VM_OP_NOT = 0x42,
+  // bitwise
+  VM_OP_BAND = 0x43,
+  VM_OP_BOR = 0x44,
+  VM_OP_BXOR = 0x45,
+  VM_OP_BNOT = 0x46,
+  VM_OP_LSHIFT = 0x47,
+  VM_OP_RSHIFT = 0x48,
+  // assign to an identifier that was not resolved to a local, (ident, value) on stack
+  VM_OP_SET = 0x49,
 
   // fallback descriptor for node kinds not lowered yet, operand=ast node kind, string table index for op name, operand=child count, children on stack
   VM_OP_NODE_META = 0xE0,
 };
 
+#define VM_OP_FIRST_OPERATOR VM_OP_ADD
+#define VM_OP_LAST_OPERATOR VM_OP_SET
+
+// Open-addressing index over a table's entries, used by the emitter to deduplicate in O(1).
+typedef struct VmHashSlot {
+    uint32_t hash;
+    uint32_t entry;     // entry index + 1; 0 marks an empty slot
+} VmHashSlot;
+
+typedef struct VmHashIndex {
+    VmHashSlot* slots;
+    size_t capacity;    // power of two, kept at least twice the entry count
+} VmHashIndex;
+
 typedef struct VmString {
     char* ptr;
     uint32_t len;
@@ -58,8 +131,35 @@ typedef struct VmStringTable {
     VmString* items;
     size_t count;
     size_t capacity;
+    VmHashIndex index;
 } VmStringTable;
 
+// Kind byte of a constant pool entry; the 8-byte payload is stored little-endian.
+enum VmConstKind {
+  VM_CONST_I64 = 0,   // payload is a two's complement int64
+  VM_CONST_F64 = 1,   // payload is the IEEE-754 bit pattern of a double
+};
+
+// Bytes per constant pool entry in a bytecode file: kind byte plus payload.
+#define VM_CONST_ENTRY_SIZE 9
+// Bytes per function table entry: name index, entry point, parameter count, local count (u32 LE each).
+#define VM_FUNCTION_ENTRY_SIZE 16
+
+// Bytes per line table entry: code offset, file name string index, row, column (u32 LE each).
+#define VM_LINE_ENTRY_SIZE 16
+
+typedef struct VmConst {
+    uint8_t kind;
+    uint64_t bits;
+} VmConst;
+
+typedef struct VmConstPool {
+    VmConst* items;
+    size_t count;
+    size_t capacity;
+    VmHashIndex index;
+} VmConstPool;
+
 typedef struct VmBytes {
     uint8_t* data;
     size_t len;
@@ -77,20 +177,30 @@ typedef struct VmMetadataTable {
     size_t capacity;
 } VmMetadataTable;
 
+// One line table entry: the code from offset up to the next entry's offset was compiled from
+// file:row:col. Offsets are strictly increasing.
+typedef struct VmLine {
+    uint32_t offset;
+    uint32_t file_index;    // string table index of the source file name
+    uint32_t row;
+    uint32_t col;
+} VmLine;
+
+typedef struct VmLineTable {
+    VmLine* items;
+    size_t count;
+    size_t capacity;
+} VmLineTable;
+
 typedef uint32_t VmFunctionIdx;
 
+// One function table entry as stored in a bytecode file. Function 0 is the top-level code; entry
+// points are strictly increasing, so function i's body runs up to function i + 1's entry point.
 typedef struct {
-  const char *dbg_name;   // for debugging purposes only, not used in execution
-  size_t entry_point;     // index into code where function body starts
-  uint32_t local_count;   // number of local variables (slots) used by this function, used for stack management
-  uint32_t flags;
+  uint32_t name_index;    // string table index of the function's name, for diagnostics only
+  uint32_t entry_point;   // byte offset into the code section where the function body starts
+  uint32_t param_count;   // arguments CALL moves into locals 0..param_count-1
+  uint32_t local_count;   // frame-local slots, parameters included
 } VmFunctionMeta;
 
-
-
-
-
-
-
-
 #endif // MORPHL_BACKEND_VM_H_
\ No newline at end of file
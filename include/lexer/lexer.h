@@ -19,7 +19,10 @@ extern const char* const LEXER_KIND_EOF;
  * The lexer recognizes identifiers (`[A-Za-z_][A-Za-z0-9_]*`), decimal
  * numbers (`[0-9]+`), float numbers (`[0-9]+\\.[0-9]+`), string literals (`"..."`), and punctuation sequences
  * (any run of non-whitespace characters that are not alphanumeric or an
- * underscore). Whitespace is ignored while tracking row/column positions.
+ * underscore). Whitespace is ignored. Tokens record byte offsets; the source
+ * is added to the source table (util/sources.h), whose line index gives rows
+ * and columns when a diagnostic needs them. Characters are classified as in
+ * the "C" locale: bytes outside ASCII are punctuation.
  * An explicit EOF token is appended to every stream. All token kinds are
  * interned using the provided table, allowing the parser to reference kinds
  * symbolically.
@@ -37,6 +40,119 @@ bool lexer_tokenize(const char* filename,
                     struct token** out_tokens,
                     size_t* out_count);
 
+/**
+ * @brief Byte-scanning strategy used to find the end of whitespace, identifier,
+ * number and string runs. Every strategy produces the same tokens.
+ */
+typedef enum {
+  LEXER_SCAN_AUTO,    /**< The widest strategy this CPU supports. */
+  LEXER_SCAN_SCALAR,  /**< One byte at a time through the character-class table. */
+  LEXER_SCAN_SSE2,    /**< 16 bytes at a time (x86 only). */
+  LEXER_SCAN_AVX2,    /**< 32 bytes at a time (x86 CPUs with AVX2 only). */
+} LexerScan;
+
+/** @brief Options for lexer_tokenize_with(). Zero-initialized options mean the defaults. */
+typedef struct {
+  LexerScan scan;    /**< Scanning strategy; LEXER_SCAN_AUTO by default. */
+  unsigned threads;  /**< Lex this many chunks concurrently; 0 or 1 lexes on the calling thread. */
+  size_t min_chunk;  /**< Smallest chunk worth a thread, in bytes; 0 for the default of 256 KiB. */
+} LexerOptions;
+
+/**
+ * @brief Tokenize like lexer_tokenize(), with explicit options.
+ *
+ * With options->threads above 1, the source is cut into up to that many
+ * chunks of at least options->min_chunk bytes. Each cut is just after a
+ * newline outside any string literal, found by a pre-scan of quote parity,
+ * so no token straddles two chunks. The chunks are lexed on their own
+ * threads and their tokens joined in order: the result is the one the
+ * serial lexer produces. Platforms without POSIX threads always lex serially.
+ *
+ * @param options May be NULL for the defaults.
+ * @return false also when options->scan is not available on this CPU.
+ */
+bool lexer_tokenize_with(const char* filename,
+                         Str source,
+                         InternTable* interns,
+                         const LexerOptions* options,
+                         struct token** out_tokens,
+                         size_t* out_count);
+
+/**
+ * @brief Tokenize a source buffer into a structure-of-arrays TokenStream.
+ *
+ * Produces the same tokens as lexer_tokenize_with(), ending with EOF, and
+ * appends them to `stream` with `source` registered as a new file.
+ *
+ * @param source Must outlive the stream and be smaller than 4 GiB.
+ * @param options May be NULL for the defaults.
+ * @return false on allocation or interning failure, an unterminated string,
+ *         or an unavailable scanning strategy; tokens appended before the
+ *         failure stay in the stream.
+ */
+bool lexer_tokenize_stream(const char* filename,
+                           Str source,
+                           InternTable* interns,
+                           const LexerOptions* options,
+                           TokenStream* stream);
+
+/**
+ * @brief Pull-based lexer over a file descriptor.
+ *
+ * Reads the source through a fixed window that is refilled as tokens are
+ * consumed, so the source text held is bounded by the window (grown only to
+ * fit a token longer than it) however large the input is. Produces the same
+ * tokens as lexer_tokenize_with(), offsets included, ending with EOF.
+ *
+ * With a filename, the file is added to the source table one chunk at a time
+ * so diagnostics still get rows. That line index lives as long as the table
+ * and grows with the input, by 8 bytes per line; a NULL filename skips it.
+ */
+typedef struct LexerReader LexerReader;
+
+/**
+ * @brief Start lexing the file open on `fd`.
+ *
+ * @param filename Must outlive the reader and the tokens it produces; NULL
+ *                 lexes without indexing lines for diagnostics.
+ * @param fd       Read until end of file; not closed by the reader.
+ * @param window   Window size in bytes; 0 for the default of 64 KiB.
+ * @param options  May be NULL for the defaults.
+ * @return NULL on allocation or interning failure, or when options->scan is
+ *         not available on this CPU.
+ */
+LexerReader* lexer_reader_new(const char* filename,
+                              int fd,
+                              InternTable* interns,
+                              const LexerOptions* options,
+                              size_t window);
+
+/** @brief Free the reader and its window. */
+void lexer_reader_free(LexerReader* reader);
+
+/**
+ * @brief Consume the next token.
+ *
+ * The token's lexeme points into the window and stays valid until the next
+ * call to lexer_next_token() or lexer_peek_token() that has to scan. After
+ * EOF, every call returns EOF again.
+ *
+ * @return false on a read error, an unterminated string, or allocation failure.
+ */
+bool lexer_next_token(LexerReader* reader, struct token* out);
+
+/** @brief Look at the next token without consuming it; see lexer_next_token(). */
+bool lexer_peek_token(LexerReader* reader, struct token* out);
+
+/** @brief Whether the scanning strategy can run on this CPU. */
+bool lexer_scan_available(LexerScan scan);
+
+/**
+ * @brief Name of the strategy that `scan` runs ("scalar", "sse2" or "avx2"),
+ * with LEXER_SCAN_AUTO resolved; NULL when it is not available.
+ */
+const char* lexer_scan_name(LexerScan scan);
+
 /** @name Built-in token kinds */
 ///@{
 extern const char* const LEXER_KIND_IDENT;   /**< Identifier token kind name. */
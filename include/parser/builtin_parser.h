@@ -6,6 +6,7 @@
 
 #include "tokens/tokens.h"
 #include "ast/ast.h"
+#include "lexer/lexer.h"
 
 /**
  * @brief Parse a token stream using builtin operator rules only.
@@ -60,4 +61,26 @@ bool builtin_parse_expr(const struct token* tokens,
                         InternTable* interns,
                         AstNode** out_node);
 
+/**
+ * @brief builtin_parse_ast() over tokens pulled from a LexerReader.
+ *
+ * Consumes the reader up to EOF without ever holding more than its window of
+ * the source. What the parse keeps still grows with the input: the AST, the
+ * reader's line index (see LexerReader), and the text of every identifier and
+ * literal, which is copied into `arena` since the window it was read from
+ * moves on. The arena does not grow, so size it for that text: when it is
+ * full the parse fails the same way a syntax error does.
+ *
+ * @param reader   Token source, consumed up to and including EOF.
+ * @param interns  Intern table for symbol names.
+ * @param arena    Receives the text of identifiers and literals; must outlive the AST.
+ * @param out_root On success, receives the root AST node. Caller owns and must free.
+ * @return true on success, false on a parse error, when the reader fails or
+ *         when `arena` is full.
+ */
+bool builtin_parse_reader(LexerReader* reader,
+                          InternTable* interns,
+                          Arena* arena,
+                          AstNode** out_root);
+
 #endif // MORPHL_PARSER_BUILTIN_PARSER_H_
@@ -95,11 +95,22 @@ struct OperatorInfo {
 
 /**
  * @brief Initialize operator registry by interning builtin operator names.
+ *
+ * The registry is shared by every intern table in the process, so the
+ * builtin names must get the same symbols in each: call this on a fresh
+ * table, before anything else is interned. It is safe to call from several
+ * threads at once.
+ *
+ * @return false on allocation failure, or if interns assigns the builtin
+ *         names other symbols than the first table did
  */
 bool operator_registry_init(InternTable* interns);
 
 /**
  * @brief Lookup operator metadata by interned symbol.
+ *
+ * The result points into the registry and stays valid; it is never
+ * overwritten by a later lookup.
  */
 const OperatorInfo* operator_info_lookup(Sym op);
 
@@ -147,4 +147,19 @@ bool grammar_parse_ast(const Grammar* grammar,
                        size_t token_count,
                        AstNode** out_root);
 
+/**
+ * @brief grammar_parse() over a structure-of-arrays TokenStream.
+ *
+ * Matching reads only the kind and lexeme arrays.
+ */
+bool grammar_parse_stream(const Grammar* grammar, Sym start_rule, const TokenStream* stream);
+
+/**
+ * @brief grammar_parse_ast() over a structure-of-arrays TokenStream.
+ *
+ * The resulting tree is the one grammar_parse_ast() builds from the same
+ * source.
+ */
+bool grammar_parse_ast_stream(const Grammar* grammar, Sym start_rule, const TokenStream* stream, AstNode** out_root);
+
 #endif // MORPHL_PARSER_PARSER_H_
@@ -12,22 +12,133 @@
 typedef struct MorphlVmProgram MorphlVmProgram;
 typedef struct MorphlVm MorphlVm;
 
+/// Execution engines available to a VM instance.
+typedef enum MorphlVmEngine {
+  MORPHL_VM_ENGINE_TYPED = 0,   ///< Tagged int/float/bool/string/group values (default).
+  MORPHL_VM_ENGINE_TEXT,        ///< Legacy engine that keeps every value as literal text.
+} MorphlVmEngine;
+
+/// Kinds of argument morphl_vm_call can pass to an entry function.
+typedef enum MorphlVmArgKind {
+  MORPHL_VM_ARG_INT = 0,
+  MORPHL_VM_ARG_FLOAT,
+  MORPHL_VM_ARG_BOOL,
+} MorphlVmArgKind;
+
+/// One argument for morphl_vm_call.
+typedef struct MorphlVmArg {
+  MorphlVmArgKind kind;
+  union {
+    int64_t i;
+    double f;
+    bool b;
+  } as;
+} MorphlVmArg;
+
+/// Options for morphl_vm_run_file_with. Zero-initialize for defaults.
+typedef struct MorphlVmRunOptions {
+  MorphlVmEngine engine;
+  const char* profile_path;     ///< Write an opcode profile here (MORPHL_VM_PROFILE builds only).
+  const char* sample_path;      ///< Write sampled call stacks here, as folded stacks.
+  uint32_t sample_interval_us;  ///< Sampling interval in microseconds of CPU time; 0 selects 1000.
+} MorphlVmRunOptions;
+
 /// Load a MorphL VM bytecode program from disk (out.mbc format).
 bool morphl_vm_program_load(const char* path, MorphlVmProgram** out_program);
 
 /// Release memory associated with a loaded program.
 void morphl_vm_program_free(MorphlVmProgram* program);
 
-/// Build a VM instance that can execute the loaded program.
+/// Number of instructions in a loaded program's code section, across all functions.
+uint32_t morphl_vm_program_instruction_count(const MorphlVmProgram* program);
+
+/// Source position that instruction instr_index (< morphl_vm_program_instruction_count) was
+/// compiled from, taken from the program's line table. Returns false when the program has none.
+bool morphl_vm_program_source_location(const MorphlVmProgram* program,
+                                       uint32_t instr_index,
+                                       const char** out_file,
+                                       uint32_t* out_row,
+                                       uint32_t* out_col);
+
+/// Build a VM instance that can execute the loaded program. The program is only read, so VMs on
+/// different threads may share it; each VM must be used by one thread at a time.
 MorphlVm* morphl_vm_new(const MorphlVmProgram* program);
 
+/// Select the engine used by subsequent morphl_vm_execute calls.
+void morphl_vm_set_engine(MorphlVm* vm, MorphlVmEngine engine);
+
 /// Destroy a VM instance.
 void morphl_vm_free(MorphlVm* vm);
 
+/// Name of the dispatch strategy compiled into the typed engine: "computed-goto" or "switch".
+const char* morphl_vm_dispatch_name(void);
+
+/// Whether the runtime was built with the opcode profiler (CMake option MORPHL_VM_PROFILE).
+bool morphl_vm_profile_available(void);
+
+/// Whether the sampling profiler is supported on this platform (it needs POSIX interval timers).
+bool morphl_vm_sampling_available(void);
+
+/// Sample the VM's call stack every interval_us microseconds of CPU time (0 selects 1000) during
+/// subsequent morphl_vm_execute calls. When each call ends, all samples so far are written to path
+/// as folded stacks (`frame;frame;frame count` per line, outermost first), one frame per function
+/// and source line, for flamegraph tools. Only one VM per process can be sampled at a time. NULL
+/// stops sampling. Returns false when sampling is unsupported, or on OOM.
+bool morphl_vm_set_sample_output(MorphlVm* vm, const char* path, uint32_t interval_us);
+
+/// Count executed opcodes, opcode bigrams/trigrams and operators in subsequent morphl_vm_execute calls,
+/// and write the totals as JSON to path when each call ends. NULL stops profiling. Returns false when
+/// the profiler is not compiled in, or on OOM.
+bool morphl_vm_set_profile_output(MorphlVm* vm, const char* path);
+
 /// Execute bytecode in the VM. Returns exit code (0 for success, nonzero for error).
 morphl_exit_code_t morphl_vm_execute(MorphlVm* vm, FILE* err_stream);
 
+/// Run function `entry` of the program (NULL for the main program) with arg_count arguments, which
+/// must match its parameter count. The main program does not run first, so the function only sees
+/// its own arguments and locals. Its return value is the exit code, as with morphl_vm_execute; an
+/// unknown entry or a wrong argument count fails with 1. Every call starts from a clean state, so a
+/// VM can run any number of calls. Only the typed engine can call functions other than main.
+morphl_exit_code_t morphl_vm_call(MorphlVm* vm,
+                                  const char* entry,
+                                  const MorphlVmArg* args,
+                                  uint32_t arg_count,
+                                  FILE* err_stream);
+
+/// A fixed set of worker threads that run MorphlVmJobs, each worker on its own reusable VM. Every
+/// worker has a deque of jobs; an idle worker steals the oldest job from another worker's deque.
+typedef struct MorphlVmPool MorphlVmPool;
+
+/// One call for a MorphlVmPool: the same arguments as morphl_vm_call on a VM over program.
+typedef struct MorphlVmJob {
+  const MorphlVmProgram* program;
+  const char* entry;            ///< Function to run; NULL for the main program.
+  const MorphlVmArg* args;
+  uint32_t arg_count;
+  morphl_exit_code_t exit_code; ///< Set once the job has run, as morphl_vm_call would return it.
+} MorphlVmJob;
+
+/// Start a pool of worker_count threads (0 for one per online CPU). Runtime errors from jobs are
+/// reported to err_stream. Returns NULL if the pool cannot be created.
+MorphlVmPool* morphl_vm_pool_new(size_t worker_count, FILE* err_stream);
+
+/// Number of worker threads in the pool.
+size_t morphl_vm_pool_worker_count(const MorphlVmPool* pool);
+
+/// Queue job. The job, its program and its arguments must stay alive and unchanged until
+/// morphl_vm_pool_wait returns. Returns false on OOM, in which case the job is not queued.
+bool morphl_vm_pool_submit(MorphlVmPool* pool, MorphlVmJob* job);
+
+/// Block until every submitted job has run and its exit_code is set.
+void morphl_vm_pool_wait(MorphlVmPool* pool);
+
+/// Run any jobs still queued, then stop the workers and free the pool.
+void morphl_vm_pool_free(MorphlVmPool* pool);
+
 /// Convenience helper for load + execute + teardown.
 morphl_exit_code_t morphl_vm_run_file(const char* path, FILE* err_stream);
 
+/// Same as morphl_vm_run_file, with explicit options (NULL for defaults).
+morphl_exit_code_t morphl_vm_run_file_with(const char* path, const MorphlVmRunOptions* options, FILE* err_stream);
+
 #endif // MORPHL_RUNTIME_RUNTIME_H_
@@ -11,14 +11,87 @@ typedef Sym TokenKind;
 
 /**
  * @brief Represents a lexical token with source location metadata.
+ *
+ * The location is a byte offset; morphl_sources_locate() (util/sources.h)
+ * turns it into a row and column for files the lexer has seen.
  */
 struct token {
   TokenKind kind;      /**< Interned token kind. */
   Str lexeme;          /**< Token text. */
   const char* filename;/**< Originating filename. */
-  size_t row;          /**< 1-based line number. */
-  size_t col;          /**< 1-based column number. */
+  size_t offset;       /**< Byte offset of the lexeme in its source. */
 };
 
+/**
+ * @brief A source file that tokens of a TokenStream point into.
+ */
+typedef struct {
+  const char* filename;   /**< Originating filename. */
+  Str text;               /**< Source text; owned by the caller, must outlive the stream. */
+} TokenSource;
+
+/**
+ * @brief Token stream in structure-of-arrays form.
+ *
+ * Token i is kinds[i], with its lexeme at byte starts[i] of source files[i],
+ * lens[i] bytes long: 16 bytes per token, against 40 for a `struct token`.
+ * A parser matching kinds or lexemes only touches the arrays it reads. Rows
+ * and columns are not stored; token_stream_locate() recovers them from the
+ * line index of the token's source (util/sources.h). Offsets and lengths are
+ * 32-bit, so a single source must be smaller than 4 GiB.
+ */
+typedef struct {
+  TokenKind* kinds;       /**< Interned token kinds. */
+  uint32_t* starts;       /**< Byte offset of each lexeme in its source. */
+  uint32_t* lens;         /**< Lexeme lengths in bytes. */
+  uint32_t* files;        /**< Index of each token's source in sources. */
+  size_t count;           /**< Number of tokens. */
+  size_t capacity;        /**< Allocated length of the four arrays. */
+  TokenSource* sources;   /**< Files the tokens come from. */
+  size_t source_count;    /**< Number of sources. */
+  size_t source_capacity; /**< Allocated length of sources. */
+} TokenStream;
+
+/** @brief Initialize an empty stream. */
+void token_stream_init(TokenStream* stream);
+
+/** @brief Free the stream's arrays (not the source texts). */
+void token_stream_free(TokenStream* stream);
+
+/**
+ * @brief Register a source whose tokens will be appended, and add it to this
+ * thread's source table (morphl_sources_add()) so its lines are indexed once.
+ * @param out_file Receives the source index to pass to token_stream_push().
+ * @return false when out of memory or when text is 4 GiB or larger.
+ */
+bool token_stream_add_source(TokenStream* stream, const char* filename, Str text, uint32_t* out_file);
+
+/** @brief Grow the token arrays to hold at least `needed` tokens. */
+bool token_stream_reserve(TokenStream* stream, size_t needed);
+
+/** @brief Append a token whose lexeme is bytes [start, start + len) of source `file`. */
+static inline bool token_stream_push(TokenStream* stream, TokenKind kind, uint32_t file, uint32_t start, uint32_t len) {
+  if (stream->count == stream->capacity && !token_stream_reserve(stream, stream->count + 1)) return false;
+  size_t i = stream->count++;
+  stream->kinds[i] = kind;
+  stream->starts[i] = start;
+  stream->lens[i] = len;
+  stream->files[i] = file;
+  return true;
+}
+
+/** @brief Text of token i. */
+static inline Str token_stream_lexeme(const TokenStream* stream, size_t i) {
+  return str_from(stream->sources[stream->files[i]].text.ptr + stream->starts[i], stream->lens[i]);
+}
+
+/**
+ * @brief 1-based row and column where token i starts, by binary search in the
+ * line index of its source. Call it on the thread that added the source.
+ */
+void token_stream_locate(const TokenStream* stream, size_t i, size_t* row, size_t* col);
+
+/** @brief Token i as a `struct token`. */
+struct token token_stream_token(const TokenStream* stream, size_t i);
 
 #endif // MORPHL_TOKENS_TOKENS_H_
@@ -0,0 +1,27 @@
+#ifndef MORPHL_TYPING_OPTIMIZE_H_
+#define MORPHL_TYPING_OPTIMIZE_H_
+
+#include "typing/type_context.h"
+#include "ast/ast.h"
+#include <stdbool.h>
+
+/**
+ * @brief Simplify a type-checked AST in place before code generation.
+ *
+ * - Runtime operators whose operands are numeric literals (as typed by
+ *   morphl_infer_type_of_ast) are folded into a single literal, with the
+ *   VM's semantics: int64 arithmetic wraps, and an operation that would fail
+ *   at run time (division by zero, bad shift) is left alone.
+ * - `$if` with a constant condition is replaced by the branch taken, and
+ *   `$while` with a constant false condition by an empty block.
+ * - In function bodies, a `$decl` of a pure expression whose name is never
+ *   read is dropped. Declarations in files and plain blocks are kept, since
+ *   they are visible as fields.
+ *
+ * @param ctx TypeContext the tree was checked with (literal types, interning)
+ * @param root Tree to rewrite
+ * @return true on success, false on allocation failure (the tree stays valid)
+ */
+bool morphl_optimize_ast(TypeContext* ctx, AstNode* root);
+
+#endif  // MORPHL_TYPING_OPTIMIZE_H_
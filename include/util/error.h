@@ -47,7 +47,8 @@ typedef struct MorphlSpan {
     uint32_t line;
     uint32_t col;
 
-    // Optional byte offsets (0 means "unknown")
+    // Optional byte offsets (0 means "unknown"). When line is 0 and end is not, line/col are
+    // looked up from start in the source table (util/sources.h) when the error is formatted.
     uint32_t start;
     uint32_t end;
 } MorphlSpan;
@@ -72,6 +73,19 @@ static inline MorphlSpan morphl_span_from_loc(const char *path, size_t line, siz
     return s;
 }
 
+// Span of bytes [start, end) of path, with line/col left for morphl_error_format() to resolve.
+// It covers at least one byte so that end is never 0.
+static inline MorphlSpan morphl_span_from_offset(const char *path, size_t start, size_t end) {
+    MorphlSpan s;
+    s.path = path;
+    s.line = 0;
+    s.col = 0;
+    s.start = (start > UINT32_MAX - 1) ? UINT32_MAX - 1 : (uint32_t)start;
+    s.end = (end > UINT32_MAX) ? UINT32_MAX : (uint32_t)end;
+    if (s.end <= s.start) s.end = s.start + 1;
+    return s;
+}
+
 // ----------------------------
 // Error object
 // ----------------------------
@@ -109,7 +123,7 @@ typedef struct MorphlErrorSink {
     void *user;                 // User data pointer
 } MorphlErrorSink;
 
-// Set a global sink
+// Set the global sink of the calling thread; other threads keep their own
 void morphl_error_set_global_sink(MorphlErrorSink sink);
 MorphlErrorSink morphl_error_get_global_sink(void);
 
@@ -8,6 +8,11 @@
 // The caller owns the returned buffer and must free it with free().
 bool morphl_file_read_all(const char* path, char** buffer, size_t* len);
 
+/// @brief Read up to cap bytes from the open file descriptor fd, retrying reads a signal interrupts.
+/// @param got Receives the number of bytes read; 0 means end of file.
+/// @return false on a read error.
+bool morphl_file_read_fd(int fd, char* buf, size_t cap, size_t* got);
+
 /// @brief Dynamically allocate a specific line from a file.
 /// @param path The path to the file.
 /// @param line_number The line number to retrieve (1-based).
@@ -0,0 +1,32 @@
+#ifndef MORPHL_UTIL_LINE_INDEX_H_
+#define MORPHL_UTIL_LINE_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "util/util.h"
+
+/// Byte offset at which each line of a source text starts, so that a byte offset can be turned
+/// into a row and column without rescanning the text.
+typedef struct {
+  size_t* starts;  ///< starts[0] is 0; one entry per line
+  size_t count;
+  size_t capacity;
+} MorphlLineIndex;
+
+/// @brief Record where every line of text starts.
+/// @return false when out of memory; the index is then empty.
+bool morphl_line_index_build(MorphlLineIndex* index, Str text);
+
+/// @brief Add the lines of `chunk`, the bytes at offset `base` of a text whose earlier bytes are
+/// already indexed. Indexes a text read piece by piece; start from a zeroed index.
+/// @return false when out of memory; lines of the chunk may then be missing.
+bool morphl_line_index_append(MorphlLineIndex* index, size_t base, Str chunk);
+
+/// @brief Free the index's table and reset it to empty.
+void morphl_line_index_free(MorphlLineIndex* index);
+
+/// @brief Find the 1-based row and column of byte offset in the indexed text, by binary search.
+/// The column counts bytes from the start of the line. An empty index puts everything on row 1.
+void morphl_line_index_locate(const MorphlLineIndex* index, size_t offset, size_t* row, size_t* col);
+
+#endif // MORPHL_UTIL_LINE_INDEX_H_
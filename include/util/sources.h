@@ -0,0 +1,34 @@
+#ifndef MORPHL_UTIL_SOURCES_H_
+#define MORPHL_UTIL_SOURCES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "util/util.h"
+
+/// Source files seen by the lexer, each with a line index built once when it is added. Tokens,
+/// AST nodes and error spans carry byte offsets only; this table turns an offset into a row and
+/// column when one is actually needed (formatting a diagnostic, writing a line table).
+///
+/// The table is per thread, like the global error sink: a compile registers and looks up its own
+/// files. It only grows, so a thread that compiles again and again should call
+/// morphl_sources_clear() once each compile's diagnostics are written. On POSIX systems a thread
+/// that exits clears its table itself.
+
+/// @brief Record `text` as the contents of `path` and index its lines. A path added again gets
+/// the new index. The path is copied; the text is not kept.
+/// @return false when out of memory.
+bool morphl_sources_add(const char* path, Str text);
+
+/// @brief Index `chunk`, the bytes of `path` at offset `base`, for a file read piece by piece.
+/// Chunks must arrive in order; base 0 starts the file over.
+/// @return false when out of memory.
+bool morphl_sources_append(const char* path, size_t base, Str chunk);
+
+/// @brief Find the 1-based row and column of byte `offset` in `path`.
+/// @return false when `path` was never added on this thread.
+bool morphl_sources_locate(const char* path, size_t offset, size_t* row, size_t* col);
+
+/// @brief Forget every source added on this thread.
+void morphl_sources_clear(void);
+
+#endif // MORPHL_UTIL_SOURCES_H_
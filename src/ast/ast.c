@@ -22,13 +22,12 @@ AstNode* ast_new(AstKind kind) {
   return n;
 }
 
-AstNode* ast_make_leaf(AstKind kind, Str value, const char* filename, size_t row, size_t col) {
+AstNode* ast_make_leaf(AstKind kind, Str value, const char* filename, size_t offset) {
   AstNode* n = ast_new(kind);
   if (!n) return NULL;
   n->value = value;
   n->filename = filename;
-  n->row = row;
-  n->col = col;
+  n->offset = offset;
   return n;
 }
 
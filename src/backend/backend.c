@@ -1,6 +1,7 @@
 
 
 #include "backend/backend.h"
+#include "typing/optimize.h"
 
 extern bool morphl_backend_func_c(MorphlBackendContext* context);
 extern bool morphl_backend_func_vm(MorphlBackendContext* context);
@@ -8,26 +9,51 @@ extern bool morphl_backend_func_vm(MorphlBackendContext* context);
 static MorphlBackendFunc registered_backend = NULL;
 
 
-bool morphl_register_backend(enum MorphlBackendType type) {
+static MorphlBackendFunc backend_func(enum MorphlBackendType type) {
     switch (type) {
         case MORPHL_BACKEND_TYPE_C:
-            // Register the C backend
-            registered_backend = morphl_backend_func_c;
-            return true;
+            return morphl_backend_func_c;
         case MORPHL_BACKEND_TYPE_VM:
-            // Register the VM backend
-            registered_backend = morphl_backend_func_vm;
-            return true;
+            return morphl_backend_func_vm;
         default:
-            return false;
+            return NULL;
+    }
+}
+
+
+bool morphl_register_backend(enum MorphlBackendType type) {
+    MorphlBackendFunc func = backend_func(type);
+    if (func == NULL) {
+        return false;
     }
+    registered_backend = func;
+    return true;
+}
+
+
+static bool compile_with_func(MorphlBackendContext* context, MorphlBackendFunc func) {
+    // Every backend sees the folded tree
+    if (context->type_context && !morphl_optimize_ast(context->type_context, context->tree)) {
+        return false;
+    }
+    return func(context);
 }
 
 
 bool morphl_compile(MorphlBackendContext* context) {
-    if (registered_backend == NULL) {
+    MorphlBackendFunc func = registered_backend;
+    if (func == NULL) {
         // fallback to C backend if none registered
-        registered_backend = morphl_backend_func_c;
+        func = morphl_backend_func_c;
     }
-    return registered_backend(context);
-}
\ No newline at end of file
+    return compile_with_func(context, func);
+}
+
+
+bool morphl_compile_with(MorphlBackendContext* context, enum MorphlBackendType type) {
+    MorphlBackendFunc func = backend_func(type);
+    if (func == NULL) {
+        return false;
+    }
+    return compile_with_func(context, func);
+}
@@ -9,10 +9,17 @@
 #include "util/util.h"
 #include "typing/type_context.h"
 
+struct TypeArray;
+
+// Output buffer plus everything one C backend run needs, so concurrent runs share no state.
 typedef struct EmitBuffer {
     char *data;
     size_t capacity;
     size_t pos;
+    size_t indent;              // current indentation level
+    struct TypeArray *types;    // named compound types collected from the type context
+    InternTable *interns;
+    char type_name[64];         // backs the name find_decl_type returns
 } EmitBuffer;
 
 static void emit_append(EmitBuffer *out, const char *text) {
@@ -53,10 +60,9 @@ static void emit_indent(EmitBuffer *out, size_t indent) {
 }
 
 typedef void (*emit_func_t)(AstNode *node, EmitBuffer *out);
-static size_t indent_level = 0;
 
 static void emit_line(emit_func_t fn, EmitBuffer *out, AstNode *node, const char* extra) {
-    emit_indent(out, indent_level);
+    emit_indent(out, out->indent);
     fn(node, out);
     if (extra) {
         emit_append(out, extra);
@@ -70,9 +76,9 @@ static void emit_node_builtin(AstNode *node, EmitBuffer *out);
 static void emit_group_expr(AstNode *node, EmitBuffer *out);
 
 // forward declaration
-static const char *find_decl_type(AstNode *value);
+static const char *find_decl_type(AstNode *value, EmitBuffer *out);
 
-static const char *infer_decl_type(AstNode *value) {
+static const char *infer_decl_type(AstNode *value, EmitBuffer *out) {
     if (!value) {
         return "void";
     }
@@ -89,7 +95,7 @@ static const char *infer_decl_type(AstNode *value) {
         return "long long";
     }
     // Try to find type from the value node
-    const char *type_name = find_decl_type(value);
+    const char *type_name = find_decl_type(value, out);
     if (type_name) {
         return type_name;
     }
@@ -151,10 +157,10 @@ static void emit_node_expr(AstNode *node, EmitBuffer *out) {
                 if (value->kind == AST_BUILTIN && value->op == operator_sym_from_enum(FORWARD)) {
                     break;
                 }
-                const char *type_name = infer_decl_type(value);
+                const char *type_name = infer_decl_type(value, out);
                 if (strcmp(type_name, "void") == 0) {
                     // try to resolve to infered type by name
-                    type_name = find_decl_type(name);
+                    type_name = find_decl_type(name, out);
                 }
                 emit_append(out, type_name);
                 emit_append(out, " ");
@@ -179,13 +185,13 @@ static void emit_node_expr(AstNode *node, EmitBuffer *out) {
             // For now, naively emit each child separated by semicolons
             // In future, seperate into struct and scope logic
             emit_append(out, "{\n");
-            indent_level++;
+            out->indent++;
             for (size_t i = 0; i < node->child_count; ++i) {
                 // Indent child statements
                 emit_line(emit_node_expr, out, node->children[i], ";");
             }
-            indent_level--;
-            emit_indent(out, indent_level);
+            out->indent--;
+            emit_indent(out, out->indent);
             emit_append(out, "}");
             break;
         default:
@@ -212,7 +218,7 @@ struct OperatorMapping {
     const char *c_repr_fmt;     /**< C representation format string. */
 };
 
-struct OperatorMapping operator_mappings[] = {
+static const struct OperatorMapping operator_mappings[] = {
     { SYNTAX, "" },
     { IMPORT, "" },
     { PROP, "" },
@@ -457,7 +463,8 @@ static void ctx_type_check(TypeContext *ctx, TypeArray *type_arr) {
     }
 }
 
-static Str get_ctype_name(MorphlType *type, InternTable *interns, TypeArray *type_arr) {
+// C name of type. Names of compound types are built in buffer, which must hold 64 bytes.
+static Str get_ctype_name(MorphlType *type, InternTable *interns, TypeArray *type_arr, char *buffer) {
     if (morphl_type_is_primitive(type)) {
         switch (type->kind) {
             case MORPHL_TYPE_INT:
@@ -475,18 +482,17 @@ static Str get_ctype_name(MorphlType *type, InternTable *interns, TypeArray *typ
         }
     } else {
         // traverse type_arr to find the type name
-        static char buffer[64];
         for (size_t i = 0; i < type_arr->count; ++i) {
             struct TypeEntry *entry = type_array_get(type_arr, i);
             if (morphl_type_equals(&entry->type, type)) {
                 if (entry->name != 0) {
                     // put name in buffer
                     Str type_str = interns_lookup(interns, entry->name);
-                    snprintf(buffer, sizeof(buffer), "%.*s", (int)type_str.len, type_str.ptr);
+                    snprintf(buffer, 64, "%.*s", (int)type_str.len, type_str.ptr);
                     
                 } else {
                     // unnamed type, put anon<i> in buffer
-                    snprintf(buffer, sizeof(buffer), "anon%zu", i);
+                    snprintf(buffer, 64, "anon%zu", i);
                     
                 }
                 // append type kind suffix
@@ -512,6 +518,7 @@ static Str get_ctype_name(MorphlType *type, InternTable *interns, TypeArray *typ
 }
 
 static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContext *ctx) {
+    char name_buffer[64];
     for (size_t i = 0; i < type_arr->count; ++i) {
         struct TypeEntry *entry = type_array_get(type_arr, i);
         if (morphl_type_is_primitive(&entry->type)) {
@@ -519,13 +526,13 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
         }
         if (entry->type.kind == MORPHL_TYPE_BLOCK) {
             emit_append(out, "typedef struct {\n");
-            indent_level++;
+            out->indent++;
             MorphlBlockType *block = &entry->type.data.block;
             for (size_t j = 0; j < block->field_count; ++j) {
                 MorphlType *field_type = block->field_types[j];
-                emit_indent(out, indent_level);
+                emit_indent(out, out->indent);
 
-                Str type_str = get_ctype_name(field_type, ctx->interns, type_arr);
+                Str type_str = get_ctype_name(field_type, ctx->interns, type_arr, name_buffer);
                 emit_append_n(out, type_str.ptr, type_str.len);
 
                 emit_append(out, " ");
@@ -535,7 +542,7 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
                                interns_lookup(ctx->interns, field_sym).len);
                 emit_append(out, ";\n");
             }
-            indent_level--;
+            out->indent--;
             emit_append(out, "} ");
             
             char type_name[64];
@@ -553,13 +560,13 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
             emit_append(out, ";\n\n");
         } else if (entry->type.kind == MORPHL_TYPE_GROUP) {
             emit_append(out, "typedef struct {\n");
-            indent_level++;
+            out->indent++;
             MorphlGroupType *group = &entry->type.data.group;
             for (size_t j = 0; j < group->elem_count; ++j) {
                 MorphlType *elem_type = group->elem_types[j];
-                emit_indent(out, indent_level);
+                emit_indent(out, out->indent);
 
-                Str type_str = get_ctype_name(elem_type, ctx->interns, type_arr);
+                Str type_str = get_ctype_name(elem_type, ctx->interns, type_arr, name_buffer);
                 emit_append_n(out, type_str.ptr, type_str.len);
 
                 emit_append(out, " ");
@@ -570,7 +577,7 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
                 emit_append(out, elem_name);
                 emit_append(out, ";\n");
             }
-            indent_level--;
+            out->indent--;
             emit_append(out, "} ");
             // print type name as <name>_group_t
             char type_name[96];
@@ -590,7 +597,7 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
             emit_append(out, "typedef ");
             MorphlType *ret_type = entry->type.data.func.return_type;
 
-            Str type_str = get_ctype_name(ret_type, ctx->interns, type_arr);
+            Str type_str = get_ctype_name(ret_type, ctx->interns, type_arr, name_buffer);
             emit_append_n(out, type_str.ptr, type_str.len);
                 
             emit_append(out, " (*");
@@ -613,7 +620,7 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
                 }
                 MorphlType *param_type = entry->type.data.func.param_types[j];
 
-                Str type_str = get_ctype_name(param_type, ctx->interns, type_arr);
+                Str type_str = get_ctype_name(param_type, ctx->interns, type_arr, name_buffer);
                 emit_append_n(out, type_str.ptr, type_str.len);
                     
             }
@@ -622,22 +629,19 @@ static void emit_type_signature(EmitBuffer *out, TypeArray *type_arr, TypeContex
     }
 }
 
-static TypeArray type_arr;
-static InternTable* interns;
-
-static const char *find_decl_type(AstNode *value) {
+static const char *find_decl_type(AstNode *value, EmitBuffer *out) {
     if (!value) {
         return NULL;
     }
-    if (value->kind == AST_LITERAL) return infer_decl_type(value);
+    if (value->kind == AST_LITERAL) return infer_decl_type(value, out);
     // try to find from type_arr
     MorphlType *type = NULL;
     // For simplicity, only handle IDENT nodes here
     if (value->kind == AST_IDENT) {
         Str ident_str = value->value;
-        for (size_t i = 0; i < type_arr.count; ++i) {
-            struct TypeEntry *entry = type_array_get(&type_arr, i);
-            Str type_name = interns_lookup(interns, entry->name);
+        for (size_t i = 0; i < out->types->count; ++i) {
+            struct TypeEntry *entry = type_array_get(out->types, i);
+            Str type_name = interns_lookup(out->interns, entry->name);
             if (type_name.len == ident_str.len &&
                 strncmp(type_name.ptr, ident_str.ptr, ident_str.len) == 0) {
                 type = &entry->type;
@@ -646,10 +650,10 @@ static const char *find_decl_type(AstNode *value) {
         }
     }
     if (type) {
-        Str type_str = get_ctype_name(type, interns, &type_arr);
-        static char buffer[64];
-        snprintf(buffer, sizeof(buffer), "%.*s", (int)type_str.len, type_str.ptr);
-        return buffer;
+        char buffer[64];
+        Str type_str = get_ctype_name(type, out->interns, out->types, buffer);
+        snprintf(out->type_name, sizeof(out->type_name), "%.*s", (int)type_str.len, type_str.ptr);
+        return out->type_name;
     }
     return NULL;
 }
@@ -665,10 +669,14 @@ bool morphl_backend_func_c(MorphlBackendContext* context) {
 
     // emit C code from AST
     char out_str[65536];
+    TypeArray type_arr;
     EmitBuffer out = {
         .data = out_str,
         .capacity = sizeof(out_str),
         .pos = 0,
+        .indent = 0,
+        .types = &type_arr,
+        .interns = context->type_context->interns,
     };
     emit_append(&out, "#include <stdio.h>\n\n");
     // handle type signatures, global variables, function declarations, etc. here
@@ -677,17 +685,16 @@ bool morphl_backend_func_c(MorphlBackendContext* context) {
         ctx_type_check(context->type_context, &type_arr);
         emit_type_signature(&out, &type_arr, context->type_context);
     }
-    interns = context->type_context->interns;
 
     // handle main function
     emit_append(&out, "int main(void) {\n");
-    indent_level++;
+    out.indent++;
     if (context->tree && context->tree->kind == AST_BLOCK) {
         emit_line(emit_node_expr, &out, context->tree, "");
     } else if (context->tree) {
         emit_line(emit_node_expr, &out, context->tree, ";");
     }
-    indent_level--;
+    out.indent--;
     emit_append(&out, "  return 0;\n}\n");
     out.data[out.pos] = '\0';
 
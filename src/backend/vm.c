@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,6 +6,10 @@
 
 #include "ast/ast.h"
 #include "backend/backend.h"
+#include "lexer/lexer.h"
+#include "parser/operators.h"
+#include "util/error.h"
+#include "util/sources.h"
 #include "util/util.h"
 #include "runtime/runtime.h"
 
@@ -16,11 +21,51 @@
 
 
 
+// A declared name bound to a frame-local slot.
+typedef struct VmLocal {
+    Str name;
+    uint32_t slot;
+} VmLocal;
+
+// Compile-time view of the current frame: visible locals plus the scope boundaries that hide them again.
+typedef struct VmLocalTable {
+    VmLocal* items;
+    size_t count;
+    size_t capacity;
+    size_t* scope_marks;
+    size_t scope_count;
+    size_t scope_capacity;
+    uint32_t slot_count;    // slots allocated so far in this frame
+    const struct VmLocalTable* enclosing;   // frame of the enclosing function, NULL at the top level
+} VmLocalTable;
+
+// A function body being compiled into its own code region. Index 0 is the top-level code.
+typedef struct VmEmitFunction {
+    Str name;
+    AstNode* params;        // parameter list; defaults fill in arguments a call leaves out
+    uint32_t param_count;
+    uint32_t local_count;
+    VmBytes code;
+    VmLineTable lines;      // offsets relative to the start of code
+} VmEmitFunction;
+
 typedef struct VmEmitter {
     VmStringTable strings;
+    VmConstPool constants;
     VmMetadataTable metadata;
-    VmBytes code;
+    VmBytes code;               // region of the function being compiled
+    VmLineTable lines;          // line table of that region
+    const char* line_file;      // file name of the last line entry, and its string table index
+    uint32_t line_file_index;
+    VmLocalTable locals;        // frame of the function being compiled
+    VmLocalTable functions;     // names bound to function indices; visible across frames
+    VmEmitFunction* funcs;
+    size_t func_count;
+    size_t func_capacity;
     InternTable* interns;
+    uint32_t* sym_strings;      // string table index + 1 per interned Sym, 0 if not added yet
+    size_t sym_capacity;
+    bool peephole;              // run peephole_region over each finished function region
 } VmEmitter;
 
 static bool vm_grow(void** ptr, size_t* current_capacity, size_t elem_size, size_t min_count) {
@@ -77,15 +122,68 @@ static bool bytes_push_u32_le(VmBytes* bytes, uint32_t value) {
     return bytes_push(bytes, raw, sizeof(raw));
 }
 
+// FNV-1a, as used by the compiler's intern table.
+static uint32_t vm_hash_bytes(const void* data, size_t len) {
+    const uint8_t* bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void hash_index_place(VmHashIndex* index, uint32_t hash, uint32_t entry) {
+    size_t mask = index->capacity - 1;
+    size_t at = hash & mask;
+    while (index->slots[at].entry != 0) {
+        at = (at + 1) & mask;
+    }
+    index->slots[at].hash = hash;
+    index->slots[at].entry = entry + 1;
+}
+
+// Make room for one more entry, keeping the load factor at or below one half.
+static bool hash_index_reserve(VmHashIndex* index, size_t count) {
+    if ((count + 1) * 2 <= index->capacity) {
+        return true;
+    }
+    size_t new_capacity = (index->capacity == 0) ? 64 : index->capacity * 2;
+    VmHashSlot* slots = calloc(new_capacity, sizeof(VmHashSlot));
+    if (!slots) {
+        return false;
+    }
+    VmHashIndex grown = {.slots = slots, .capacity = new_capacity};
+    for (size_t i = 0; i < index->capacity; ++i) {
+        if (index->slots[i].entry != 0) {
+            hash_index_place(&grown, index->slots[i].hash, index->slots[i].entry - 1);
+        }
+    }
+    free(index->slots);
+    *index = grown;
+    return true;
+}
+
 static bool string_table_add(VmStringTable* table, Str text, uint32_t* out_index) {
-    for (size_t i = 0; i < table->count; ++i) {
-        VmString* item = &table->items[i];
-        if (item->len == text.len && memcmp(item->ptr, text.ptr, text.len) == 0) {
-            *out_index = (uint32_t)i;
-            return true;
+    uint32_t hash = vm_hash_bytes(text.ptr, text.len);
+    if (table->index.capacity != 0) {
+        size_t mask = table->index.capacity - 1;
+        for (size_t at = hash & mask; table->index.slots[at].entry != 0; at = (at + 1) & mask) {
+            if (table->index.slots[at].hash != hash) {
+                continue;
+            }
+            uint32_t entry = table->index.slots[at].entry - 1;
+            VmString* item = &table->items[entry];
+            if (item->len == text.len && (text.len == 0 || memcmp(item->ptr, text.ptr, text.len) == 0)) {
+                *out_index = entry;
+                return true;
+            }
         }
     }
 
+    if (!hash_index_reserve(&table->index, table->count)) {
+        return false;
+    }
     if (table->count == table->capacity) {
         if (!vm_grow((void**)&table->items, &table->capacity, sizeof(VmString), table->count + 1)) {
             return false;
@@ -103,11 +201,43 @@ static bool string_table_add(VmStringTable* table, Str text, uint32_t* out_index
 
     table->items[table->count].ptr = dup;
     table->items[table->count].len = (uint32_t)text.len;
+    hash_index_place(&table->index, hash, (uint32_t)table->count);
     *out_index = (uint32_t)table->count;
     table->count++;
     return true;
 }
 
+static bool const_pool_add(VmConstPool* pool, uint8_t kind, uint64_t bits, uint32_t* out_index) {
+    uint8_t key[9] = {kind};
+    memcpy(key + 1, &bits, sizeof(bits));
+    uint32_t hash = vm_hash_bytes(key, sizeof(key));
+    if (pool->index.capacity != 0) {
+        size_t mask = pool->index.capacity - 1;
+        for (size_t at = hash & mask; pool->index.slots[at].entry != 0; at = (at + 1) & mask) {
+            uint32_t entry = pool->index.slots[at].entry - 1;
+            if (pool->index.slots[at].hash == hash && pool->items[entry].kind == kind && pool->items[entry].bits == bits) {
+                *out_index = entry;
+                return true;
+            }
+        }
+    }
+
+    if (!hash_index_reserve(&pool->index, pool->count)) {
+        return false;
+    }
+    if (pool->count == pool->capacity) {
+        if (!vm_grow((void**)&pool->items, &pool->capacity, sizeof(VmConst), pool->count + 1)) {
+            return false;
+        }
+    }
+    pool->items[pool->count].kind = kind;
+    pool->items[pool->count].bits = bits;
+    hash_index_place(&pool->index, hash, (uint32_t)pool->count);
+    *out_index = (uint32_t)pool->count;
+    pool->count++;
+    return true;
+}
+
 static bool metadata_add(VmMetadataTable* table, uint32_t key_index, uint32_t value_index) {
     if (table->count == table->capacity) {
         if (!vm_grow((void**)&table->items, &table->capacity, sizeof(VmMetadata), table->count + 1)) {
@@ -120,6 +250,114 @@ static bool metadata_add(VmMetadataTable* table, uint32_t key_index, uint32_t va
     return true;
 }
 
+// Note that the code emitted next comes from node's source line. Entries are kept per line, not
+// per node: a node on the line of the previous entry adds nothing, and a node emitted at the same
+// offset as the previous entry replaces it, since the next instruction belongs to the inner node.
+static bool line_mark(VmEmitter* emitter, const AstNode* node) {
+    size_t row = 0;
+    size_t col = 0;
+    if (!node->filename || !morphl_sources_locate(node->filename, node->offset, &row, &col)) {
+        return true;
+    }
+    if (node->filename != emitter->line_file) {
+        if (!string_table_add(&emitter->strings, str_from(node->filename, strlen(node->filename)),
+                              &emitter->line_file_index)) {
+            return false;
+        }
+        emitter->line_file = node->filename;
+    }
+
+    VmLineTable* lines = &emitter->lines;
+    VmLine line = {
+        .offset = (uint32_t)emitter->code.len,
+        .file_index = emitter->line_file_index,
+        .row = (uint32_t)row,
+        .col = (uint32_t)col,
+    };
+    if (lines->count > 0) {
+        VmLine* last = &lines->items[lines->count - 1];
+        if (last->file_index == line.file_index && last->row == line.row) {
+            return true;
+        }
+        if (last->offset == line.offset) {
+            *last = line;
+            return true;
+        }
+    }
+    if (lines->count == lines->capacity) {
+        if (!vm_grow((void**)&lines->items, &lines->capacity, sizeof(VmLine), lines->count + 1)) {
+            return false;
+        }
+    }
+    lines->items[lines->count++] = line;
+    return true;
+}
+
+static bool locals_push_scope(VmLocalTable* locals) {
+    if (locals->scope_count == locals->scope_capacity) {
+        if (!vm_grow((void**)&locals->scope_marks, &locals->scope_capacity, sizeof(size_t), locals->scope_count + 1)) {
+            return false;
+        }
+    }
+    locals->scope_marks[locals->scope_count++] = locals->count;
+    return true;
+}
+
+static void locals_pop_scope(VmLocalTable* locals) {
+    if (locals->scope_count > 0) {
+        locals->count = locals->scope_marks[--locals->scope_count];
+    }
+}
+
+static bool locals_bind(VmLocalTable* locals, Str name, uint32_t slot) {
+    if (locals->count == locals->capacity) {
+        if (!vm_grow((void**)&locals->items, &locals->capacity, sizeof(VmLocal), locals->count + 1)) {
+            return false;
+        }
+    }
+    locals->items[locals->count].name = name;
+    locals->items[locals->count].slot = slot;
+    locals->count++;
+    return true;
+}
+
+// Bind name to a fresh slot in the current frame. Slots are never reused, so shadowed values stay intact.
+static bool locals_declare(VmLocalTable* locals, Str name, uint32_t* out_slot) {
+    if (!locals_bind(locals, name, locals->slot_count)) {
+        return false;
+    }
+    *out_slot = locals->slot_count++;
+    return true;
+}
+
+static bool locals_resolve(const VmLocalTable* locals, Str name, uint32_t* out_slot) {
+    for (size_t i = locals->count; i > 0; --i) {
+        if (str_eq(locals->items[i - 1].name, name)) {
+            *out_slot = locals->items[i - 1].slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A function body has no access to the frames around it, so a name only they declare could never
+// be resolved at run time. Report it instead of emitting a PUSH_IDENT that cannot work.
+static bool locals_check_outer(const VmLocalTable* locals, const AstNode* name) {
+    uint32_t slot = 0;
+    for (const VmLocalTable* outer = locals->enclosing; outer; outer = outer->enclosing) {
+        if (locals_resolve(outer, name->value, &slot)) {
+            MorphlSpan span = morphl_span_from_offset(name->filename, name->offset, name->offset + name->value.len);
+            MorphlError err = MORPHL_ERR_FROM(MORPHL_E_SEMA,
+                                              "'%.*s' is declared outside this function; the VM backend cannot "
+                                              "use it from the function body",
+                                              span, (int)name->value.len, name->value.ptr);
+            morphl_error_emit(NULL, &err);
+            return false;
+        }
+    }
+    return true;
+}
+
 static Str op_name_from_node(const VmEmitter* emitter, const AstNode* node) {
     if (!emitter || !node || !emitter->interns || node->op == 0) {
         return str_from("<none>", 6);
@@ -127,6 +365,32 @@ static Str op_name_from_node(const VmEmitter* emitter, const AstNode* node) {
     return interns_lookup(emitter->interns, node->op);
 }
 
+// Add the name of node->op to the string table. Names the compiler already interned are cached by
+// Sym, so each one is hashed at most once per module.
+static bool string_table_add_op(VmEmitter* emitter, const AstNode* node, uint32_t* out_index) {
+    if (!emitter->interns || node->op == 0) {
+        return string_table_add(&emitter->strings, op_name_from_node(emitter, node), out_index);
+    }
+
+    Sym sym = node->op;
+    if (sym < emitter->sym_capacity && emitter->sym_strings[sym] != 0) {
+        *out_index = emitter->sym_strings[sym] - 1;
+        return true;
+    }
+    if (!string_table_add(&emitter->strings, interns_lookup(emitter->interns, sym), out_index)) {
+        return false;
+    }
+    if (sym >= emitter->sym_capacity) {
+        size_t old_capacity = emitter->sym_capacity;
+        if (!vm_grow((void**)&emitter->sym_strings, &emitter->sym_capacity, sizeof(uint32_t), (size_t)sym + 1)) {
+            return false;
+        }
+        memset(emitter->sym_strings + old_capacity, 0, (emitter->sym_capacity - old_capacity) * sizeof(uint32_t));
+    }
+    emitter->sym_strings[sym] = *out_index + 1;
+    return true;
+}
+
 static bool is_compile_time_operator(Str op_name) {
     static const char* compile_time_ops[] = {
         "$syntax", "$import", "$prop", "$decl", "$forward", "$file", "$global", "$inline", "$this"
@@ -142,6 +406,39 @@ static bool is_compile_time_operator(Str op_name) {
     return false;
 }
 
+// Map a registry operator to its dedicated VM opcode. Returns false for operators the VM cannot run.
+static bool runtime_operator_opcode(enum Operator op, uint8_t* out_opcode) {
+    switch (op) {
+        case ADD: *out_opcode = VM_OP_ADD; return true;
+        case SUB: *out_opcode = VM_OP_SUB; return true;
+        case MUL: *out_opcode = VM_OP_MUL; return true;
+        case DIV: *out_opcode = VM_OP_DIV; return true;
+        case MOD: *out_opcode = VM_OP_MOD; return true;
+        case REM: *out_opcode = VM_OP_REM; return true;
+        case FADD: *out_opcode = VM_OP_FADD; return true;
+        case FSUB: *out_opcode = VM_OP_FSUB; return true;
+        case FMUL: *out_opcode = VM_OP_FMUL; return true;
+        case FDIV: *out_opcode = VM_OP_FDIV; return true;
+        case EQ: *out_opcode = VM_OP_EQ; return true;
+        case NEQ: *out_opcode = VM_OP_NEQ; return true;
+        case LT: *out_opcode = VM_OP_LT; return true;
+        case GT: *out_opcode = VM_OP_GT; return true;
+        case LTE: *out_opcode = VM_OP_LTE; return true;
+        case GTE: *out_opcode = VM_OP_GTE; return true;
+        case AND: *out_opcode = VM_OP_AND; return true;
+        case OR: *out_opcode = VM_OP_OR; return true;
+        case NOT: *out_opcode = VM_OP_NOT; return true;
+        case BAND: *out_opcode = VM_OP_BAND; return true;
+        case BOR: *out_opcode = VM_OP_BOR; return true;
+        case BXOR: *out_opcode = VM_OP_BXOR; return true;
+        case BNOT: *out_opcode = VM_OP_BNOT; return true;
+        case LSHIFT: *out_opcode = VM_OP_LSHIFT; return true;
+        case RSHIFT: *out_opcode = VM_OP_RSHIFT; return true;
+        case SET: *out_opcode = VM_OP_SET; return true;
+        default: return false;
+    }
+}
+
 static bool emit_opcode(VmEmitter* emitter, uint8_t opcode) {
     return bytes_push_u8(&emitter->code, opcode);
 }
@@ -150,22 +447,541 @@ static bool emit_opcode_u32(VmEmitter* emitter, uint8_t opcode, uint32_t imm) {
     return emit_opcode(emitter, opcode) && bytes_push_u32_le(&emitter->code, imm);
 }
 
-static bool emit_set_slot(VmEmitter* emitter, Str name) {
-    uint32_t name_idx = 0;
-    if (!string_table_add(&emitter->strings, name, &name_idx)) {
+// Emit a forward jump with a placeholder offset; *out_patch receives the offset's position in the
+// code buffer for patch_jump.
+static bool emit_jump(VmEmitter* emitter, uint8_t opcode, size_t* out_patch) {
+    *out_patch = emitter->code.len + 1;
+    return emit_opcode_u32(emitter, opcode, UINT32_MAX);
+}
+
+// Point a jump emitted by emit_jump at the current end of the code buffer.
+static bool patch_jump(VmEmitter* emitter, size_t patch) {
+    size_t offset = emitter->code.len - (patch + 4);
+    if (offset > UINT32_MAX) {
+        return false;
+    }
+    for (int i = 0; i < 4; ++i) {
+        emitter->code.data[patch + (size_t)i] = (uint8_t)((offset >> (8 * i)) & 0xFF);
+    }
+    return true;
+}
+
+// Jump back to loop_start, a position in the code buffer.
+static bool emit_loop(VmEmitter* emitter, size_t loop_start) {
+    size_t offset = emitter->code.len + 5 - loop_start;
+    return offset <= UINT32_MAX && emit_opcode_u32(emitter, VM_OP_LOOP, (uint32_t)offset);
+}
+
+static bool emit_node(VmEmitter* emitter, AstNode* node);
+
+// Parse a NUMBER or FLOAT literal into a constant pool entry, so the runtime never sees its text.
+// NUMBER literals too large for int64 become f64 constants. Returns false if the literal is not
+// a numeric token or its text does not parse; the caller then emits it as a plain string literal.
+static bool literal_constant(const VmEmitter* emitter, const AstNode* node, uint8_t* out_kind, uint64_t* out_bits) {
+    if (!emitter->interns || node->value.len == 0 || node->value.len >= 64) {
+        return false;
+    }
+    Str kind = interns_lookup(emitter->interns, node->op);
+    bool is_number = str_eq(kind, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
+    bool is_float = str_eq(kind, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
+    if (!is_number && !is_float) {
+        return false;
+    }
+
+    char text[64];
+    memcpy(text, node->value.ptr, node->value.len);
+    text[node->value.len] = '\0';
+    char* end = NULL;
+
+    if (is_number) {
+        errno = 0;
+        long long parsed = strtoll(text, &end, 10);
+        if (errno == 0 && *end == '\0') {
+            int64_t value = (int64_t)parsed;
+            *out_kind = VM_CONST_I64;
+            memcpy(out_bits, &value, sizeof(value));
+            return true;
+        }
+    }
+
+    errno = 0;
+    double parsed_float = strtod(text, &end);
+    if (errno != 0 || *end != '\0') {
         return false;
     }
-    return emit_opcode_u32(emitter, VM_OP_SET_SLOT, name_idx);
+    *out_kind = VM_CONST_F64;
+    memcpy(out_bits, &parsed_float, sizeof(parsed_float));
+    return true;
+}
+
+// One instruction of a finished function region, decoded for the peephole pass.
+typedef struct VmPeepInstr {
+    uint8_t op;
+    uint8_t meta_kind;  // NODE_META: AST node kind
+    uint32_t a;         // first operand; for jumps, the target's instruction index
+    uint32_t b;         // NODE_META child count, ADD_LOCAL_CONST constant index
+    bool is_target;     // a jump lands here, so no fused window may start after it
+} VmPeepInstr;
+
+// Encoded size of an instruction, opcode byte included.
+static size_t vm_instr_size(uint8_t op) {
+    switch (op) {
+        case VM_OP_PUSH_LITERAL:
+        case VM_OP_PUSH_IDENT:
+        case VM_OP_MAKE_GROUP:
+        case VM_OP_SET_SLOT:
+        case VM_OP_OPERATOR:
+        case VM_OP_LOAD_LOCAL:
+        case VM_OP_STORE_LOCAL:
+        case VM_OP_PUSH_CONST_I64:
+        case VM_OP_PUSH_CONST_F64:
+        case VM_OP_STORE_LOCAL_POP:
+        case VM_OP_INC_LOCAL:
+        case VM_OP_CALL:
+        case VM_OP_TAIL_CALL:
+        case VM_OP_JUMP:
+        case VM_OP_JUMP_IF_FALSE:
+        case VM_OP_LOOP:
+        case VM_OP_UNWIND_SCOPE:
+            return 5;
+        case VM_OP_ADD_LOCAL_CONST:
+            return 9;
+        case VM_OP_NODE_META:
+            return 10;
+        default:
+            return 1;
+    }
+}
+
+static uint32_t read_u32_le(const uint8_t* at) {
+    return (uint32_t)at[0] | ((uint32_t)at[1] << 8) | ((uint32_t)at[2] << 16) | ((uint32_t)at[3] << 24);
+}
+
+static bool is_jump(uint8_t op) {
+    return op == VM_OP_JUMP || op == VM_OP_JUMP_IF_FALSE || op == VM_OP_LOOP;
+}
+
+// Instructions that only push a value, so pushing and then popping it does nothing.
+static bool is_pure_push(uint8_t op) {
+    return op == VM_OP_PUSH_NULL || op == VM_OP_PUSH_LITERAL || op == VM_OP_PUSH_IDENT ||
+           op == VM_OP_PUSH_CONST_I64 || op == VM_OP_PUSH_CONST_F64 || op == VM_OP_LOAD_LOCAL;
+}
+
+// Rewrite the instructions ending at out[*count - 1] while a pattern matches. A pattern never
+// spans the start of a jump target other than its first instruction. *carry_target is set when a
+// removed pair started at a jump target: the jump now lands on the next instruction appended.
+static bool peephole_reduce(VmEmitter* emitter, VmPeepInstr* out, size_t* count, bool* carry_target) {
+    for (;;) {
+        size_t n = *count;
+        if (n >= 2 && out[n - 1].op == VM_OP_POP && !out[n - 1].is_target) {
+            VmPeepInstr* prev = &out[n - 2];
+            if (is_pure_push(prev->op)) {
+                *carry_target = *carry_target || prev->is_target;
+                *count = n - 2;
+                return true;
+            }
+            if (prev->op == VM_OP_STORE_LOCAL) {
+                prev->op = VM_OP_STORE_LOCAL_POP;
+                *count = n - 1;
+                continue;
+            }
+        }
+
+        // LOAD_LOCAL s; PUSH_CONST_I64 k; ADD|SUB; STORE_LOCAL_POP s  ->  INC_LOCAL s | ADD_LOCAL_CONST s k
+        if (n >= 4 && out[n - 1].op == VM_OP_STORE_LOCAL_POP) {
+            VmPeepInstr* w = &out[n - 4];
+            if (w[0].op != VM_OP_LOAD_LOCAL || w[1].op != VM_OP_PUSH_CONST_I64 ||
+                (w[2].op != VM_OP_ADD && w[2].op != VM_OP_SUB) || w[0].a != w[3].a ||
+                w[1].is_target || w[2].is_target || w[3].is_target) {
+                return true;
+            }
+            int64_t delta = 0;
+            memcpy(&delta, &emitter->constants.items[w[1].a].bits, sizeof(delta));
+            if (w[2].op == VM_OP_SUB) {
+                // x - k and x + (-k) agree for ints (wrapping) and doubles, except for k = INT64_MIN.
+                if (delta == INT64_MIN) {
+                    return true;
+                }
+                delta = -delta;
+            }
+            uint32_t slot = w[0].a;
+            if (delta == 1) {
+                w[0].op = VM_OP_INC_LOCAL;
+            } else {
+                uint64_t bits = 0;
+                memcpy(&bits, &delta, sizeof(bits));
+                if (!const_pool_add(&emitter->constants, VM_CONST_I64, bits, &w[0].b)) {
+                    return false;
+                }
+                w[0].op = VM_OP_ADD_LOCAL_CONST;
+            }
+            w[0].a = slot;
+            *count = n - 3;
+        }
+        return true;
+    }
+}
+
+// Peephole pass over one function region: fuse common sequences into superinstructions and drop
+// values that are pushed only to be popped. Jump offsets and the region's line table are
+// recomputed for the shorter code.
+static bool peephole_region(VmEmitter* emitter, VmBytes* code, VmLineTable* lines) {
+    if (code->len == 0) {
+        return true;
+    }
+    VmPeepInstr* instrs = calloc(code->len, sizeof(VmPeepInstr));
+    uint32_t* index_at = calloc(code->len + 1, sizeof(uint32_t));    // byte offset -> instruction index
+    if (!instrs || !index_at) {
+        free(instrs);
+        free(index_at);
+        return false;
+    }
+
+    size_t count = 0;
+    for (size_t off = 0; off < code->len; ++count) {
+        VmPeepInstr* in = &instrs[count];
+        const uint8_t* at = code->data + off;
+        in->op = at[0];
+        index_at[off] = (uint32_t)count;
+        size_t size = vm_instr_size(in->op);
+        if (in->op == VM_OP_NODE_META) {
+            in->meta_kind = at[1];
+            in->a = read_u32_le(at + 2);
+            in->b = read_u32_le(at + 6);
+        } else if (in->op == VM_OP_ADD_LOCAL_CONST) {
+            in->a = read_u32_le(at + 1);
+            in->b = read_u32_le(at + 5);
+        } else if (size == 5) {
+            in->a = read_u32_le(at + 1);
+            if (is_jump(in->op)) {
+                // Keep the target's byte offset until every instruction has an index.
+                in->a = (uint32_t)((in->op == VM_OP_LOOP) ? off + size - in->a : off + size + in->a);
+            }
+        }
+        off += size;
+    }
+    index_at[code->len] = (uint32_t)count;
+    // Line entries start at instructions; keep their instruction index until the new offsets are known.
+    for (size_t i = 0; i < lines->count; ++i) {
+        lines->items[i].offset = index_at[lines->items[i].offset];
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (is_jump(instrs[i].op)) {
+            instrs[i].a = index_at[instrs[i].a];
+            instrs[instrs[i].a].is_target = true;
+        }
+    }
+
+    // Rewrite in place: out_count never passes i. new_index[i] is the position instruction i
+    // ends up at, or of the instruction that replaced it.
+    uint32_t* new_index = index_at;
+    size_t out_count = 0;
+    bool carry_target = false;
+    bool ok = true;
+    for (size_t i = 0; ok && i < count; ++i) {
+        new_index[i] = (uint32_t)out_count;
+        instrs[out_count] = instrs[i];
+        instrs[out_count].is_target = instrs[i].is_target || carry_target;
+        carry_target = false;
+        out_count++;
+        ok = peephole_reduce(emitter, instrs, &out_count, &carry_target);
+    }
+    new_index[count] = (uint32_t)out_count;
+
+    VmBytes rewritten = {0};
+    size_t* starts = malloc((out_count + 1) * sizeof(size_t));
+    ok = ok && starts != NULL;
+    size_t offset = 0;
+    for (size_t i = 0; ok && i <= out_count; ++i) {
+        starts[i] = offset;
+        offset += (i < out_count) ? vm_instr_size(instrs[i].op) : 0;
+    }
+    for (size_t i = 0; ok && i < out_count; ++i) {
+        const VmPeepInstr* in = &instrs[i];
+        size_t size = vm_instr_size(in->op);
+        ok = bytes_push_u8(&rewritten, in->op);
+        if (in->op == VM_OP_NODE_META) {
+            ok = ok && bytes_push_u8(&rewritten, in->meta_kind) && bytes_push_u32_le(&rewritten, in->a) &&
+                 bytes_push_u32_le(&rewritten, in->b);
+        } else if (in->op == VM_OP_ADD_LOCAL_CONST) {
+            ok = ok && bytes_push_u32_le(&rewritten, in->a) && bytes_push_u32_le(&rewritten, in->b);
+        } else if (is_jump(in->op)) {
+            size_t target = starts[new_index[in->a]];
+            size_t end = starts[i] + size;
+            ok = ok && bytes_push_u32_le(&rewritten, (uint32_t)((in->op == VM_OP_LOOP) ? end - target : target - end));
+        } else if (size == 5) {
+            ok = ok && bytes_push_u32_le(&rewritten, in->a);
+        }
+    }
+
+    // An entry whose instructions were all removed now starts where the next one does; the later
+    // entry wins, and entries past the end of the code are dropped.
+    size_t line_count = 0;
+    for (size_t i = 0; ok && i < lines->count; ++i) {
+        VmLine line = lines->items[i];
+        line.offset = (uint32_t)starts[new_index[line.offset]];
+        if (line.offset >= rewritten.len) {
+            continue;
+        }
+        if (line_count > 0 && lines->items[line_count - 1].offset == line.offset) {
+            line_count--;
+        }
+        lines->items[line_count++] = line;
+    }
+    lines->count = line_count;
+
+    free(starts);
+    free(instrs);
+    free(index_at);
+    if (!ok) {
+        free(rewritten.data);
+        return false;
+    }
+    free(code->data);
+    *code = rewritten;
+    return true;
+}
+
+static size_t param_count_of(const AstNode* params) {
+    if (!params) {
+        return 0;
+    }
+    return (params->kind == AST_GROUP) ? params->child_count : 1;
+}
+
+static AstNode* param_at(AstNode* params, size_t index) {
+    return (params->kind == AST_GROUP) ? params->children[index] : params;
+}
+
+// A parameter is `name` or `name := default`.
+static Str param_name(const AstNode* param) {
+    if (param && param->kind == AST_IDENT) {
+        return param->value;
+    }
+    if (param && (param->kind == AST_DECL || param->kind == AST_BUILTIN) && param->child_count > 0 &&
+        param->children[0] && param->children[0]->kind == AST_IDENT) {
+        return param->children[0]->value;
+    }
+    return str_from("<anonymous>", 11);
+}
+
+static AstNode* param_default(AstNode* param) {
+    if (param && (param->kind == AST_DECL || param->kind == AST_BUILTIN) && param->child_count > 1) {
+        return param->children[1];
+    }
+    return NULL;
+}
+
+// Reserve the next function index. Bodies are compiled by emit_function once the index is bound,
+// so a function can call itself.
+static bool function_reserve(VmEmitter* emitter, Str name, uint32_t* out_index) {
+    if (emitter->func_count == emitter->func_capacity) {
+        if (!vm_grow((void**)&emitter->funcs, &emitter->func_capacity, sizeof(VmEmitFunction), emitter->func_count + 1)) {
+            return false;
+        }
+    }
+    memset(&emitter->funcs[emitter->func_count], 0, sizeof(VmEmitFunction));
+    emitter->funcs[emitter->func_count].name = name;
+    *out_index = (uint32_t)emitter->func_count++;
+    return true;
+}
+
+// Compile an AST_FUNC ([params, body]) into its own code region: parameters take locals
+// 0..param_count-1, and the body's value is returned if it does not return explicitly.
+static bool emit_function(VmEmitter* emitter, uint32_t index, AstNode* func) {
+    AstNode* params = (func->child_count > 0) ? func->children[0] : NULL;
+    AstNode* body = (func->child_count > 1) ? func->children[1] : NULL;
+
+    VmBytes outer_code = emitter->code;
+    VmLineTable outer_lines = emitter->lines;
+    VmLocalTable outer_locals = emitter->locals;
+    memset(&emitter->code, 0, sizeof(emitter->code));
+    memset(&emitter->lines, 0, sizeof(emitter->lines));
+    memset(&emitter->locals, 0, sizeof(emitter->locals));
+    emitter->locals.enclosing = &outer_locals;
+
+    // Recursive calls in the body need the parameter list already.
+    size_t param_count = param_count_of(params);
+    emitter->funcs[index].params = params;
+    emitter->funcs[index].param_count = (uint32_t)param_count;
+    bool ok = locals_push_scope(&emitter->locals) && locals_push_scope(&emitter->functions);
+    for (size_t i = 0; ok && i < param_count; ++i) {
+        uint32_t slot = 0;
+        ok = locals_declare(&emitter->locals, param_name(param_at(params, i)), &slot);
+    }
+    ok = ok && line_mark(emitter, func) && emit_node(emitter, body) && emit_opcode(emitter, VM_OP_RET) &&
+         (!emitter->peephole || peephole_region(emitter, &emitter->code, &emitter->lines));
+    locals_pop_scope(&emitter->functions);
+
+    VmEmitFunction* fn = &emitter->funcs[index];
+    fn->local_count = emitter->locals.slot_count;
+    fn->code = emitter->code;
+    fn->lines = emitter->lines;
+    free(emitter->locals.items);
+    free(emitter->locals.scope_marks);
+    emitter->code = outer_code;
+    emitter->lines = outer_lines;
+    emitter->locals = outer_locals;
+    return ok;
+}
+
+// Lower `$decl name rhs`: evaluate rhs, then store it into a newly bound frame slot.
+// A function is bound by name before its body is compiled, and its slot holds null.
+static bool emit_decl(VmEmitter* emitter, AstNode* node) {
+    AstNode* rhs = (node->child_count > 1) ? node->children[1] : NULL;
+    Str name = str_from("<anonymous>", 11);
+    if (node->child_count > 0 && node->children[0] && node->children[0]->kind == AST_IDENT) {
+        name = node->children[0]->value;
+    }
+
+    if (rhs && rhs->kind == AST_FUNC) {
+        uint32_t index = 0;
+        if (!function_reserve(emitter, name, &index) ||
+            !locals_bind(&emitter->functions, name, index) ||
+            !emit_function(emitter, index, rhs) ||
+            !emit_opcode(emitter, VM_OP_PUSH_NULL)) {
+            return false;
+        }
+    } else if (!emit_node(emitter, rhs)) {
+        return false;
+    }
+
+    uint32_t slot = 0;
+    if (!locals_declare(&emitter->locals, name, &slot)) {
+        return false;
+    }
+    return emit_opcode_u32(emitter, VM_OP_STORE_LOCAL, slot);
+}
+
+// Lower `$set target value`. Assignments to resolved locals become STORE_LOCAL; anything else
+// goes through the runtime `$set` operator.
+static bool emit_set(VmEmitter* emitter, AstNode* node) {
+    uint32_t slot = 0;
+    AstNode* target = (node->child_count == 2) ? node->children[0] : NULL;
+    if (target && target->kind == AST_IDENT && locals_resolve(&emitter->locals, target->value, &slot)) {
+        return emit_node(emitter, node->children[1]) && emit_opcode_u32(emitter, VM_OP_STORE_LOCAL, slot);
+    }
+
+    for (size_t i = 0; i < node->child_count; ++i) {
+        if (!emit_node(emitter, node->children[i])) {
+            return false;
+        }
+    }
+    return emit_opcode(emitter, VM_OP_SET);
+}
+
+// Fallback for node kinds not lowered yet: a descriptor followed by the children.
+static bool emit_node_meta(VmEmitter* emitter, AstNode* node) {
+    uint32_t op_idx = 0;
+    if (!string_table_add_op(emitter, node, &op_idx)) {
+        return false;
+    }
+    if (!emit_opcode(emitter, VM_OP_NODE_META) ||
+        !bytes_push_u8(&emitter->code, (uint8_t)node->kind) ||
+        !bytes_push_u32_le(&emitter->code, op_idx) ||
+        !bytes_push_u32_le(&emitter->code, (uint32_t)node->child_count)) {
+        return false;
+    }
+    for (size_t i = 0; i < node->child_count; ++i) {
+        if (!emit_node(emitter, node->children[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Lower `$if cond then_else`, where then_else is `then` or the group `(then, else)`:
+//   cond; JUMP_IF_FALSE else; then; JUMP end; else: else-or-null; end:
+static bool emit_if(VmEmitter* emitter, AstNode* node) {
+    AstNode* cond = (node->child_count > 0) ? node->children[0] : NULL;
+    AstNode* then_else = (node->child_count > 1) ? node->children[1] : NULL;
+    AstNode* then_branch = then_else;
+    AstNode* else_branch = NULL;
+    if (then_else && then_else->kind == AST_GROUP && then_else->child_count == 2) {
+        then_branch = then_else->children[0];
+        else_branch = then_else->children[1];
+    }
+
+    size_t to_else = 0;
+    size_t to_end = 0;
+    return emit_node(emitter, cond) &&
+           emit_jump(emitter, VM_OP_JUMP_IF_FALSE, &to_else) &&
+           emit_node(emitter, then_branch) &&
+           emit_jump(emitter, VM_OP_JUMP, &to_end) &&
+           patch_jump(emitter, to_else) &&
+           emit_node(emitter, else_branch) &&
+           patch_jump(emitter, to_end);
+}
+
+// Lower `$while cond body`; the loop itself evaluates to null:
+//   start: cond; JUMP_IF_FALSE end; body; POP; LOOP start; end: PUSH_NULL
+static bool emit_while(VmEmitter* emitter, AstNode* node) {
+    AstNode* cond = (node->child_count > 0) ? node->children[0] : NULL;
+    AstNode* body = (node->child_count > 1) ? node->children[1] : NULL;
+
+    size_t loop_start = emitter->code.len;
+    size_t to_end = 0;
+    return emit_node(emitter, cond) &&
+           emit_jump(emitter, VM_OP_JUMP_IF_FALSE, &to_end) &&
+           emit_node(emitter, body) &&
+           emit_opcode(emitter, VM_OP_POP) &&
+           emit_loop(emitter, loop_start) &&
+           patch_jump(emitter, to_end) &&
+           emit_opcode(emitter, VM_OP_PUSH_NULL);
+}
+
+// Lower `$call callee args` to CALL <function index> when callee names a function compiled in
+// this module. Missing trailing arguments take the parameter's default (or null). A call in tail
+// position (the operand of `$ret`) becomes TAIL_CALL, which returns too, and reuses the frame.
+static bool emit_call(VmEmitter* emitter, AstNode* node, bool tail) {
+    AstNode* callee = (node->child_count > 0) ? node->children[0] : NULL;
+    AstNode* args = (node->child_count > 1) ? node->children[1] : NULL;
+    uint32_t index = 0;
+    if (!callee || callee->kind != AST_IDENT || !locals_resolve(&emitter->functions, callee->value, &index)) {
+        return emit_node_meta(emitter, node) && (!tail || emit_opcode(emitter, VM_OP_RET));
+    }
+
+    size_t arg_count = param_count_of(args);
+    VmEmitFunction* fn = &emitter->funcs[index];
+    size_t param_count = param_count_of(fn->params);
+    if (arg_count > param_count) {
+        return emit_node_meta(emitter, node) && (!tail || emit_opcode(emitter, VM_OP_RET));
+    }
+    for (size_t i = 0; i < arg_count; ++i) {
+        if (!emit_node(emitter, param_at(args, i))) {
+            return false;
+        }
+    }
+    for (size_t i = arg_count; i < param_count; ++i) {
+        // emit_node may grow emitter->funcs, so look the function up again each time
+        if (!emit_node(emitter, param_default(param_at(emitter->funcs[index].params, i)))) {
+            return false;
+        }
+    }
+    return emit_opcode_u32(emitter, tail ? VM_OP_TAIL_CALL : VM_OP_CALL, index);
 }
 
 static bool emit_node(VmEmitter* emitter, AstNode* node) {
     if (!node) {
         return emit_opcode(emitter, VM_OP_PUSH_NULL);
     }
+    if (!line_mark(emitter, node)) {
+        return false;
+    }
 
     switch (node->kind) {
         case AST_LITERAL: {
             uint32_t idx = 0;
+            uint8_t const_kind = 0;
+            uint64_t const_bits = 0;
+            if (literal_constant(emitter, node, &const_kind, &const_bits)) {
+                if (!const_pool_add(&emitter->constants, const_kind, const_bits, &idx)) {
+                    return false;
+                }
+                return emit_opcode_u32(emitter,
+                                       (const_kind == VM_CONST_I64) ? VM_OP_PUSH_CONST_I64 : VM_OP_PUSH_CONST_F64,
+                                       idx);
+            }
             if (!string_table_add(&emitter->strings, node->value, &idx)) {
                 return false;
             }
@@ -173,7 +989,10 @@ static bool emit_node(VmEmitter* emitter, AstNode* node) {
         }
         case AST_IDENT: {
             uint32_t idx = 0;
-            if (!string_table_add(&emitter->strings, node->value, &idx)) {
+            if (locals_resolve(&emitter->locals, node->value, &idx)) {
+                return emit_opcode_u32(emitter, VM_OP_LOAD_LOCAL, idx);
+            }
+            if (!locals_check_outer(&emitter->locals, node) || !string_table_add(&emitter->strings, node->value, &idx)) {
                 return false;
             }
             return emit_opcode_u32(emitter, VM_OP_PUSH_IDENT, idx);
@@ -185,58 +1004,30 @@ static bool emit_node(VmEmitter* emitter, AstNode* node) {
                 }
             }
             return emit_opcode_u32(emitter, VM_OP_MAKE_GROUP, (uint32_t)node->child_count);
-        case AST_CALL: {
-            for (size_t i = 0; i < node->child_count; ++i) {
-                if (!emit_node(emitter, node->children[i])) {
-                    return false;
-                }
-            }
-            uint32_t idx = 0;
-            if (!string_table_add(&emitter->strings, str_from("$call", 5), &idx)) {
-                return false;
-            }
-
-            // TODO: handle function table
-            return emit_opcode_u32(emitter, VM_OP_CALL, idx);
-        }
-        case AST_DECL: {
-            AstNode* rhs = (node->child_count > 1) ? node->children[1] : NULL;
-            if (!emit_node(emitter, rhs)) {
-                return false;
-            }
-            Str name = str_from("<anonymous>", 11);
-            if (node->child_count > 0 && node->children[0] && node->children[0]->kind == AST_IDENT) {
-                name = node->children[0]->value;
-            }
-            return emit_set_slot(emitter, name);
-        }
-        case AST_SET: {
-            for (size_t i = 0; i < node->child_count; ++i) {
-                if (!emit_node(emitter, node->children[i])) {
-                    return false;
-                }
-            }
-            uint32_t idx = 0;
-            if (!string_table_add(&emitter->strings, str_from("$set", 4), &idx)) {
-                return false;
-            }
-            return emit_opcode_u32(emitter, VM_OP_OPERATOR, idx);
+        case AST_CALL:
+            return emit_call(emitter, node, false);
+        case AST_FUNC: {
+            // An anonymous function still gets its region, but nothing can call it by name yet.
+            uint32_t index = 0;
+            return function_reserve(emitter, str_from("<anonymous>", 11), &index) &&
+                   emit_function(emitter, index, node) && emit_opcode(emitter, VM_OP_PUSH_NULL);
         }
+        case AST_DECL:
+            return emit_decl(emitter, node);
+        case AST_SET:
+            return emit_set(emitter, node);
+        case AST_IF:
+            return emit_if(emitter, node);
+        case AST_OVERLOAD:
+            // Left unresolved when an operand type is unknown, e.g. the result of a recursive call.
+            // The first candidate is the generic form, which the VM dispatches on operand kinds.
+            return (node->child_count > 0) ? emit_node(emitter, node->children[0]) : emit_node_meta(emitter, node);
         case AST_BUILTIN: {
             Str op_name = op_name_from_node(emitter, node);
 
             if (is_compile_time_operator(op_name)) {
                 if (op_name.len == 5 && memcmp(op_name.ptr, "$decl", 5) == 0) {
-                    AstNode* rhs = (node->child_count > 1) ? node->children[1] : NULL;
-                    if (!emit_node(emitter, rhs)) {
-                        return false;
-                    }
-
-                    Str name = str_from("<anonymous>", 11);
-                    if (node->child_count > 0 && node->children[0] && node->children[0]->kind == AST_IDENT) {
-                        name = node->children[0]->value;
-                    }
-                    return emit_set_slot(emitter, name);
+                    return emit_decl(emitter, node);
                 }
 
                 for (size_t i = 0; i < node->child_count; ++i) {
@@ -249,48 +1040,60 @@ static bool emit_node(VmEmitter* emitter, AstNode* node) {
 
             // if '$ret', evaluate return expression then emit RET opcode with no operand 
             if (op_name.len == 4 && memcmp(op_name.ptr, "$ret", 4) == 0) {
-                return emit_node(emitter, node->children[0]) && emit_opcode(emitter, VM_OP_RET);
+                AstNode* value = node->children[0];
+                if (value && value->kind == AST_CALL) {
+                    return emit_call(emitter, value, true);
+                }
+                return emit_node(emitter, value) && emit_opcode(emitter, VM_OP_RET);
+            }
+
+            // storage modifiers only matter to the type checker
+            const OperatorInfo* info = operator_info_lookup(node->op);
+            if (info && (info->op_enum == MUT || info->op_enum == CONST) && node->child_count == 1) {
+                return emit_node(emitter, node->children[0]);
+            }
+            if (info && info->op_enum == WHILE) {
+                return emit_while(emitter, node);
             }
 
+            uint8_t opcode = 0;
+            bool has_opcode = info && runtime_operator_opcode(info->op_enum, &opcode);
             for (size_t i = 0; i < node->child_count; ++i) {
                 if (!emit_node(emitter, node->children[i])) {
                     return false;
                 }
             }
 
+            if (has_opcode) {
+                return emit_opcode(emitter, opcode);
+            }
+
+            // no dedicated opcode: keep the name so the loader can report it
             uint32_t idx = 0;
-            if (!string_table_add(&emitter->strings, op_name, &idx)) {
+            if (!string_table_add_op(emitter, node, &idx)) {
                 return false;
             }
             return emit_opcode_u32(emitter, VM_OP_OPERATOR, idx);
         }
         case AST_FILE:
         case AST_BLOCK:
-            for (size_t i = 0; i < node->child_count; ++i) {
-                if (!emit_node(emitter, node->children[i])) {
-                    return false;
-                }
-            }
-            return true;
-        default: {
-            uint32_t op_idx = 0;
-            Str op_name = op_name_from_node(emitter, node);
-            if (!string_table_add(&emitter->strings, op_name, &op_idx)) {
+            // A block evaluates to its last statement (null when empty); earlier values are popped.
+            if (!locals_push_scope(&emitter->locals) || !locals_push_scope(&emitter->functions)) {
                 return false;
             }
-            if (!emit_opcode(emitter, VM_OP_NODE_META) ||
-                !bytes_push_u8(&emitter->code, (uint8_t)node->kind) ||
-                !bytes_push_u32_le(&emitter->code, op_idx) ||
-                !bytes_push_u32_le(&emitter->code, (uint32_t)node->child_count)) {
+            if (node->child_count == 0 && !emit_opcode(emitter, VM_OP_PUSH_NULL)) {
                 return false;
             }
             for (size_t i = 0; i < node->child_count; ++i) {
-                if (!emit_node(emitter, node->children[i])) {
+                if ((i > 0 && !emit_opcode(emitter, VM_OP_POP)) || !emit_node(emitter, node->children[i])) {
                     return false;
                 }
             }
+            locals_pop_scope(&emitter->functions);
+            locals_pop_scope(&emitter->locals);
             return true;
-        }
+        default:
+            return emit_node_meta(emitter, node);
     }
 }
 
@@ -305,13 +1108,13 @@ static bool emit_metadata(VmEmitter* emitter) {
     }
 
     if (!string_table_add(&emitter->strings, str_from("format_version", 14), &key_idx) ||
-        !string_table_add(&emitter->strings, str_from("1.0", 3), &val_idx) ||
+        !string_table_add(&emitter->strings, str_from("4.4", 3), &val_idx) ||
         !metadata_add(&emitter->metadata, key_idx, val_idx)) {
         return false;
     }
 
     if (!string_table_add(&emitter->strings, str_from("operators", 9), &key_idx) ||
-        !string_table_add(&emitter->strings, str_from("runtime-verbatim", 16), &val_idx) ||
+        !string_table_add(&emitter->strings, str_from("opcodes", 7), &val_idx) ||
         !metadata_add(&emitter->metadata, key_idx, val_idx)) {
         return false;
     }
@@ -324,8 +1127,22 @@ static void emitter_free(VmEmitter* emitter) {
         free(emitter->strings.items[i].ptr);
     }
     free(emitter->strings.items);
+    free(emitter->strings.index.slots);
+    free(emitter->constants.items);
+    free(emitter->constants.index.slots);
+    free(emitter->sym_strings);
     free(emitter->metadata.items);
     free(emitter->code.data);
+    free(emitter->lines.items);
+    free(emitter->locals.items);
+    free(emitter->locals.scope_marks);
+    free(emitter->functions.items);
+    free(emitter->functions.scope_marks);
+    for (size_t i = 0; i < emitter->func_count; ++i) {
+        free(emitter->funcs[i].code.data);
+        free(emitter->funcs[i].lines.items);
+    }
+    free(emitter->funcs);
     memset(emitter, 0, sizeof(*emitter));
 }
 
@@ -337,14 +1154,37 @@ bool morphl_backend_func_vm(MorphlBackendContext* context) {
     VmEmitter emitter;
     memset(&emitter, 0, sizeof(emitter));
     emitter.interns = (context->type_context ? context->type_context->interns : NULL);
+    emitter.peephole = !context->no_peephole;
+
+    // Function 0 is the top-level code; its region is emitter.code itself.
+    uint32_t main_index = 0;
+    if (!function_reserve(&emitter, str_from("<main>", 6), &main_index) ||
+        !emit_node(&emitter, context->tree) || !emit_opcode(&emitter, VM_OP_HALT) ||
+        (emitter.peephole && !peephole_region(&emitter, &emitter.code, &emitter.lines))) {
+        emitter_free(&emitter);
+        return false;
+    }
+    emitter.funcs[main_index].local_count = emitter.locals.slot_count;
+    emitter.funcs[main_index].code = emitter.code;
+    emitter.funcs[main_index].lines = emitter.lines;
+    memset(&emitter.code, 0, sizeof(emitter.code));
+    memset(&emitter.lines, 0, sizeof(emitter.lines));
 
-    if (!emit_node(&emitter, context->tree) || !emit_opcode(&emitter, VM_OP_HALT) || !emit_metadata(&emitter)) {
+    // Function names go into the string table before it is written.
+    uint32_t* func_names = calloc(emitter.func_count, sizeof(uint32_t));
+    bool named = func_names != NULL;
+    for (size_t i = 0; named && i < emitter.func_count; ++i) {
+        named = string_table_add(&emitter.strings, emitter.funcs[i].name, &func_names[i]);
+    }
+    if (!named || !emit_metadata(&emitter)) {
+        free(func_names);
         emitter_free(&emitter);
         return false;
     }
 
     FILE* out = fopen(context->out_file, "wb");
     if (!out) {
+        free(func_names);
         emitter_free(&emitter);
         return false;
     }
@@ -357,10 +1197,43 @@ bool morphl_backend_func_vm(MorphlBackendContext* context) {
     ok = ok && bytes_push_u16_le(&file, MORPHL_VM_VERSION_MINOR);
     ok = ok && bytes_push_u32_le(&file, 0);
 
+    // String table: offset index first, then length-prefixed NUL-terminated entries, so the loader
+    // can map the file and hand out pointers without copying.
+    uint32_t string_data_len = 0;
+    for (size_t i = 0; i < emitter.strings.count; ++i) {
+        string_data_len += 4 + emitter.strings.items[i].len + 1;
+    }
     ok = ok && bytes_push_u32_le(&file, (uint32_t)emitter.strings.count);
+    ok = ok && bytes_push_u32_le(&file, string_data_len);
+    uint32_t string_offset = 0;
+    for (size_t i = 0; ok && i < emitter.strings.count; ++i) {
+        ok = ok && bytes_push_u32_le(&file, string_offset);
+        string_offset += 4 + emitter.strings.items[i].len + 1;
+    }
     for (size_t i = 0; ok && i < emitter.strings.count; ++i) {
         ok = ok && bytes_push_u32_le(&file, emitter.strings.items[i].len);
         ok = ok && bytes_push(&file, emitter.strings.items[i].ptr, emitter.strings.items[i].len);
+        ok = ok && bytes_push_u8(&file, 0);
+    }
+
+    // Constant pool: a kind byte plus an 8-byte little-endian payload per entry.
+    ok = ok && bytes_push_u32_le(&file, (uint32_t)emitter.constants.count);
+    for (size_t i = 0; ok && i < emitter.constants.count; ++i) {
+        uint64_t bits = emitter.constants.items[i].bits;
+        ok = ok && bytes_push_u8(&file, emitter.constants.items[i].kind);
+        ok = ok && bytes_push_u32_le(&file, (uint32_t)(bits & 0xFFFFFFFFu));
+        ok = ok && bytes_push_u32_le(&file, (uint32_t)(bits >> 32));
+    }
+
+    // Function table: regions are laid out in index order, so entry points are increasing.
+    ok = ok && bytes_push_u32_le(&file, (uint32_t)emitter.func_count);
+    uint32_t entry_point = 0;
+    for (size_t i = 0; ok && i < emitter.func_count; ++i) {
+        ok = ok && bytes_push_u32_le(&file, func_names[i]);
+        ok = ok && bytes_push_u32_le(&file, entry_point);
+        ok = ok && bytes_push_u32_le(&file, emitter.funcs[i].param_count);
+        ok = ok && bytes_push_u32_le(&file, emitter.funcs[i].local_count);
+        entry_point += (uint32_t)emitter.funcs[i].code.len;
     }
 
     ok = ok && bytes_push_u32_le(&file, (uint32_t)emitter.metadata.count);
@@ -369,8 +1242,28 @@ bool morphl_backend_func_vm(MorphlBackendContext* context) {
         ok = ok && bytes_push_u32_le(&file, emitter.metadata.items[i].value_index);
     }
 
-    ok = ok && bytes_push_u32_le(&file, (uint32_t)emitter.code.len);
-    ok = ok && bytes_push(&file, emitter.code.data, emitter.code.len);
+    ok = ok && bytes_push_u32_le(&file, entry_point);
+    for (size_t i = 0; ok && i < emitter.func_count; ++i) {
+        ok = ok && bytes_push(&file, emitter.funcs[i].code.data, emitter.funcs[i].code.len);
+    }
+
+    // Line table: every region's entries, rebased onto the region's entry point.
+    size_t line_count = 0;
+    for (size_t i = 0; i < emitter.func_count; ++i) {
+        line_count += emitter.funcs[i].lines.count;
+    }
+    ok = ok && bytes_push_u32_le(&file, (uint32_t)line_count);
+    entry_point = 0;
+    for (size_t i = 0; ok && i < emitter.func_count; ++i) {
+        const VmLineTable* lines = &emitter.funcs[i].lines;
+        for (size_t j = 0; ok && j < lines->count; ++j) {
+            ok = bytes_push_u32_le(&file, entry_point + lines->items[j].offset) &&
+                 bytes_push_u32_le(&file, lines->items[j].file_index) &&
+                 bytes_push_u32_le(&file, lines->items[j].row) &&
+                 bytes_push_u32_le(&file, lines->items[j].col);
+        }
+        entry_point += (uint32_t)emitter.funcs[i].code.len;
+    }
 
     if (ok) {
         ok = (fwrite(file.data, 1, file.len, out) == file.len);
@@ -378,6 +1271,7 @@ bool morphl_backend_func_vm(MorphlBackendContext* context) {
 
     fclose(out);
     free(file.data);
+    free(func_names);
     emitter_free(&emitter);
     return ok;
 }
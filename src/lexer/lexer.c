@@ -1,11 +1,19 @@
 #include "lexer/lexer.h"
 
-#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MORPHL_LEXER_HAVE_THREADS 1
+#include <pthread.h>
+#else
+#define MORPHL_LEXER_HAVE_THREADS 0
+#endif
+
+#include "lexer_scan.h"
 #include "util/file.h"
+#include "util/sources.h"
 
 const char* const LEXER_KIND_IDENT = "IDENT";
 const char* const LEXER_KIND_NUMBER = "NUMBER";
@@ -25,20 +33,100 @@ static bool ensure_token_capacity(struct token** tokens, size_t* cap, size_t nee
   return true;
 }
 
-static bool intern_kinds(InternTable* interns,
-                         TokenKind* ident,
-                         TokenKind* number,
-                         TokenKind* number_float,
-                         TokenKind* string,
-                         TokenKind* symbol,
-                         TokenKind* eof) {
-  *ident = interns_intern(interns, str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
-  *number = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
-  *number_float = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
-  *string = interns_intern(interns, str_from(LEXER_KIND_STRING, strlen(LEXER_KIND_STRING)));
-  *symbol = interns_intern(interns, str_from(LEXER_KIND_SYMBOL, strlen(LEXER_KIND_SYMBOL)));
-  *eof = interns_intern(interns, str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
-  return *ident && *number && *number_float && *string && *symbol && *eof;
+// Interned kinds of the tokens the lexer produces.
+typedef struct {
+  TokenKind ident;
+  TokenKind number;
+  TokenKind number_float;
+  TokenKind string;
+  TokenKind symbol;
+  TokenKind eof;
+} LexerKinds;
+
+static bool intern_kinds(InternTable* interns, LexerKinds* kinds) {
+  kinds->ident = interns_intern(interns, str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
+  kinds->number = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
+  kinds->number_float = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
+  kinds->string = interns_intern(interns, str_from(LEXER_KIND_STRING, strlen(LEXER_KIND_STRING)));
+  kinds->symbol = interns_intern(interns, str_from(LEXER_KIND_SYMBOL, strlen(LEXER_KIND_SYMBOL)));
+  kinds->eof = interns_intern(interns, str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
+  return kinds->ident && kinds->number && kinds->number_float && kinds->string && kinds->symbol && kinds->eof;
+}
+
+typedef struct {
+  TokenKind kind;
+  size_t start;
+  size_t len;
+} LexerToken;
+
+typedef enum {
+  LEXER_STEP_TOKEN,
+  LEXER_STEP_END,
+  LEXER_STEP_UNTERMINATED,  // a string runs to the end of the source
+} LexerStep;
+
+// Scan the token at or after *offset into out and move *offset past it. Runs of blanks,
+// identifier characters, digits and string bodies are measured by the scanner, several bytes at a
+// time; everything else is classified one byte at a time through the table. No row or column is
+// tracked: tokens carry offsets, and the source's line index turns those into rows on demand.
+static inline LexerStep lexer_step(const LexerScanner* scanner,
+                                   const LexerKinds* kinds,
+                                   const char* src,
+                                   size_t len,
+                                   size_t* offset,
+                                   LexerToken* out) {
+  size_t at = *offset;
+  while (at < len) {
+    unsigned char c = (unsigned char)src[at];
+    uint8_t cls = lexer_char_class[c];
+    if (cls & LEXER_CLASS_BLANK) {
+      at = scanner->blanks_end(src, at + 1, len);
+      continue;
+    }
+    if (cls & LEXER_CLASS_NEWLINE) {
+      at++;
+      continue;
+    }
+
+    size_t start = at;
+    TokenKind kind = kinds->symbol;
+    if (cls & LEXER_CLASS_ALPHA) {
+      at = scanner->ident_end(src, at + 1, len);
+      kind = kinds->ident;
+    } else if (c == '$' && at + 1 < len && (lexer_char_class[(unsigned char)src[at + 1]] & LEXER_CLASS_ALPHA)) {
+      // $identifier is a single token (builtin operators)
+      at = scanner->ident_end(src, at + 2, len);
+      kind = kinds->ident;
+    } else if (cls & LEXER_CLASS_DIGIT) {
+      at = scanner->digits_end(src, at + 1, len);
+      kind = kinds->number;
+      if (at + 1 < len && src[at] == '.' && (lexer_char_class[(unsigned char)src[at + 1]] & LEXER_CLASS_DIGIT)) {
+        at = scanner->digits_end(src, at + 2, len);
+        kind = kinds->number_float;
+      }
+    } else if (cls & LEXER_CLASS_QUOTE) {
+      // String literals: "..."; they may span lines.
+      at = scanner->quote_or_newline(src, at + 1, len);
+      while (at < len && src[at] != '"') {
+        at = scanner->quote_or_newline(src, at + 1, len);
+      }
+      if (at >= len) {
+        *offset = start;
+        return LEXER_STEP_UNTERMINATED;
+      }
+      at++;  // Skip closing quote
+      kind = kinds->string;
+    } else {
+      // Symbol characters: tokenize one at a time
+      at++;
+    }
+
+    *out = (LexerToken){.kind = kind, .start = start, .len = at - start};
+    *offset = at;
+    return LEXER_STEP_TOKEN;
+  }
+  *offset = at;
+  return LEXER_STEP_END;
 }
 
 bool lexer_tokenize(const char* filename,
@@ -46,144 +134,350 @@ bool lexer_tokenize(const char* filename,
                     InternTable* interns,
                     struct token** out_tokens,
                     size_t* out_count) {
+  return lexer_tokenize_with(filename, source, interns, NULL, out_tokens, out_count);
+}
+
+static bool push_token(struct token** tokens, size_t* count, size_t* cap, struct token token) {
+  if (!ensure_token_capacity(tokens, cap, *count + 1)) return false;
+  (*tokens)[(*count)++] = token;
+  return true;
+}
+
+// Tokens of bytes [start, end) of source, appended to *tokens. start and end must fall outside any
+// token, as they do at either end of the source and just after a newline outside a string.
+static bool lex_range(const LexerScanner* scanner,
+                      const LexerKinds* kinds,
+                      const char* filename,
+                      Str source,
+                      size_t start,
+                      size_t end,
+                      struct token** tokens,
+                      size_t* count,
+                      size_t* cap) {
+  size_t offset = start;
+  LexerToken tok;
+  LexerStep step;
+  while ((step = lexer_step(scanner, kinds, source.ptr, end, &offset, &tok)) == LEXER_STEP_TOKEN) {
+    if (!push_token(tokens, count, cap, (struct token){
+          .kind = tok.kind,
+          .lexeme = str_from(source.ptr + tok.start, tok.len),
+          .filename = filename,
+          .offset = tok.start,
+        })) {
+      return false;
+    }
+  }
+  return step != LEXER_STEP_UNTERMINATED;
+}
+
+#define LEXER_DEFAULT_MIN_CHUNK (256u * 1024u)
+
+// Split source into at most `chunks` pieces of about equal size, each ending just after a newline
+// outside any string literal; splits[0..n] receives their bounds and n is returned. A quote outside
+// a string always opens one and the next quote closes it, so whether a byte is inside a string is
+// the parity of the quotes before it: the scanner hops from quote to quote up to each target,
+// counting them, and then walks to the next newline that is outside.
+static size_t find_splits(const LexerScanner* scanner, Str source, size_t chunks, size_t* splits) {
+  size_t n = 0;
+  size_t at = 0;
+  unsigned quotes = 0;
+  splits[n++] = 0;
+  for (size_t k = 1; k < chunks; ++k) {
+    size_t target = source.len / chunks * k;
+    if (target <= at) continue;
+    while ((at = scanner->quote(source.ptr, at, target)) < target) {
+      quotes++;
+      at++;
+    }
+    for (;;) {
+      at = scanner->quote_or_newline(source.ptr, at, source.len);
+      if (at >= source.len || (source.ptr[at] == '\n' && (quotes & 1) == 0)) break;
+      quotes += source.ptr[at] == '"';
+      at++;
+    }
+    if (at >= source.len) break;
+    splits[n++] = ++at;
+  }
+  splits[n] = source.len;
+  return n;
+}
+
+typedef struct {
+  const LexerScanner* scanner;
+  const LexerKinds* kinds;
+  const char* filename;
+  Str source;
+  size_t start;
+  size_t end;
+  struct token* tokens;
+  size_t count;
+  size_t cap;
+  bool ok;
+} LexerChunk;
+
+static void* lex_chunk(void* arg) {
+  LexerChunk* chunk = arg;
+  chunk->ok = lex_range(chunk->scanner, chunk->kinds, chunk->filename, chunk->source, chunk->start, chunk->end,
+                        &chunk->tokens, &chunk->count, &chunk->cap);
+  return NULL;
+}
+
+// Lex the chunks between splits on threads of their own, the first on the calling thread, and
+// join their tokens in order. A chunk whose thread cannot start is lexed here instead.
+static bool lex_parallel(const LexerChunk* proto,
+                         const size_t* splits,
+                         size_t chunk_count,
+                         struct token** out_tokens,
+                         size_t* out_count) {
+  LexerChunk* chunks = calloc(chunk_count, sizeof(LexerChunk));
+#if MORPHL_LEXER_HAVE_THREADS
+  pthread_t* threads = calloc(chunk_count, sizeof(pthread_t));
+  bool* started = calloc(chunk_count, sizeof(bool));
+  bool ok = chunks && threads && started;
+#else
+  bool ok = chunks != NULL;
+#endif
+  if (ok) {
+    for (size_t i = 0; i < chunk_count; ++i) {
+      chunks[i] = *proto;
+      chunks[i].start = splits[i];
+      chunks[i].end = splits[i + 1];
+    }
+#if MORPHL_LEXER_HAVE_THREADS
+    for (size_t i = 1; i < chunk_count; ++i) {
+      started[i] = pthread_create(&threads[i], NULL, lex_chunk, &chunks[i]) == 0;
+    }
+#endif
+    lex_chunk(&chunks[0]);
+    for (size_t i = 1; i < chunk_count; ++i) {
+#if MORPHL_LEXER_HAVE_THREADS
+      if (started[i]) {
+        pthread_join(threads[i], NULL);
+        continue;
+      }
+#endif
+      lex_chunk(&chunks[i]);
+    }
+  }
+
+  // The first chunk's array grows to hold the rest, so only the later chunks are copied.
+  size_t total = 1;
+  for (size_t i = 0; ok && i < chunk_count; ++i) {
+    ok = chunks[i].ok;
+    total += chunks[i].count;
+  }
+  if (ok) ok = ensure_token_capacity(&chunks[0].tokens, &chunks[0].cap, total);
+  if (ok) {
+    *out_tokens = chunks[0].tokens;
+    *out_count = chunks[0].count;
+    chunks[0].tokens = NULL;
+    for (size_t i = 1; i < chunk_count; ++i) {
+      if (chunks[i].count == 0) continue;  // a chunk of blanks has no array
+      memcpy(*out_tokens + *out_count, chunks[i].tokens, chunks[i].count * sizeof(struct token));
+      *out_count += chunks[i].count;
+    }
+  }
+  for (size_t i = 0; chunks && i < chunk_count; ++i) free(chunks[i].tokens);
+  free(chunks);
+#if MORPHL_LEXER_HAVE_THREADS
+  free(threads);
+  free(started);
+#endif
+  return ok;
+}
+
+bool lexer_tokenize_with(const char* filename,
+                         Str source,
+                         InternTable* interns,
+                         const LexerOptions* options,
+                         struct token** out_tokens,
+                         size_t* out_count) {
   if (!interns || !out_tokens || !out_count) return false;
   *out_tokens = NULL;
   *out_count = 0;
   size_t cap = 0;
 
-  TokenKind ident_kind, number_kind, float_kind, string_kind, symbol_kind, eof_kind;
-  if (!intern_kinds(interns, &ident_kind, &number_kind, &float_kind, &string_kind, &symbol_kind, &eof_kind)) {
+  const LexerScanner* scanner = lexer_scanner(options ? options->scan : LEXER_SCAN_AUTO);
+  LexerKinds kinds;
+  if (!scanner || !intern_kinds(interns, &kinds)) return false;
+  // One newline scan indexes the lines, so diagnostics can place the offsets tokens carry.
+  if (filename && !morphl_sources_add(filename, source)) return false;
+
+#if MORPHL_LEXER_HAVE_THREADS
+  size_t chunk_count = (options && options->threads > 1) ? options->threads : 1;
+#else
+  size_t chunk_count = 1;  // no threads to lex chunks on, so options->threads is ignored
+#endif
+  size_t min_chunk = (options && options->min_chunk) ? options->min_chunk : LEXER_DEFAULT_MIN_CHUNK;
+  if (chunk_count > 1 && source.len / min_chunk < chunk_count) chunk_count = source.len / min_chunk;
+  size_t* splits = (chunk_count > 1) ? malloc((chunk_count + 1) * sizeof(size_t)) : NULL;
+  if (splits) chunk_count = find_splits(scanner, source, chunk_count, splits);
+
+  if (splits && chunk_count > 1) {
+    LexerChunk proto = {.scanner = scanner, .kinds = &kinds, .filename = filename, .source = source};
+    bool ok = lex_parallel(&proto, splits, chunk_count, out_tokens, out_count);
+    free(splits);
+    if (!ok) return false;
+    cap = *out_count + 1;
+  } else {
+    free(splits);
+    if (!lex_range(scanner, &kinds, filename, source, 0, source.len, out_tokens, out_count, &cap)) return false;
+  }
+
+  return push_token(out_tokens, out_count, &cap, (struct token){
+    .kind = kinds.eof,
+    .lexeme = str_from(NULL, 0),
+    .filename = filename,
+    .offset = source.len,
+  });
+}
+
+bool lexer_tokenize_stream(const char* filename,
+                           Str source,
+                           InternTable* interns,
+                           const LexerOptions* options,
+                           TokenStream* stream) {
+  if (!interns || !stream) return false;
+  const LexerScanner* scanner = lexer_scanner(options ? options->scan : LEXER_SCAN_AUTO);
+  LexerKinds kinds;
+  uint32_t file = 0;
+  if (!scanner || !intern_kinds(interns, &kinds) || !token_stream_add_source(stream, filename, source, &file)) {
     return false;
   }
 
   size_t offset = 0;
-  size_t row = 1, col = 1;
-  while (offset < source.len) {
-    char c = source.ptr[offset];
-    if (c == '\n') { row++; col = 1; offset++; continue; }
-    if (c == ' ' || c == '\t' || c == '\r') { col++; offset++; continue; }
-
-    // Handle $identifier as a single token (builtin operators)
-    if (c == '$' && offset + 1 < source.len) {
-      char next = source.ptr[offset + 1];
-      if (isalpha((unsigned char)next) || next == '_') {
-        size_t start = offset;
-        offset++; col++; // Skip $
-        while (offset < source.len) {
-          char cc = source.ptr[offset];
-          if (!(isalnum((unsigned char)cc) || cc == '_')) break;
-          offset++; col++;
-        }
-        size_t len = offset - start;
-        if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-        (*out_tokens)[(*out_count)++] = (struct token){
-          .kind = ident_kind,
-          .lexeme = str_from(source.ptr + start, len),
-          .filename = filename,
-          .row = row,
-          .col = col - len,
-        };
-        continue;
-      }
-    }
+  LexerToken tok;
+  LexerStep step;
+  while ((step = lexer_step(scanner, &kinds, source.ptr, source.len, &offset, &tok)) == LEXER_STEP_TOKEN) {
+    if (!token_stream_push(stream, tok.kind, file, (uint32_t)tok.start, (uint32_t)tok.len)) return false;
+  }
+  if (step == LEXER_STEP_UNTERMINATED) return false;
+  return token_stream_push(stream, kinds.eof, file, (uint32_t)source.len, 0);
+}
 
-    if (isalpha((unsigned char)c) || c == '_') {
-      size_t start = offset;
-      while (offset < source.len) {
-        char cc = source.ptr[offset];
-        if (!(isalnum((unsigned char)cc) || cc == '_')) break;
-        offset++; col++;
-      }
-      size_t len = offset - start;
-      if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-      (*out_tokens)[(*out_count)++] = (struct token){
-        .kind = ident_kind,
-        .lexeme = str_from(source.ptr + start, len),
-        .filename = filename,
-        .row = row,
-        .col = col - len,
-      };
-      continue;
-    }
+#define LEXER_READER_DEFAULT_WINDOW (64u * 1024u)
 
-    if (isdigit((unsigned char)c)) {
-      size_t start = offset;
-      while (offset < source.len && isdigit((unsigned char)source.ptr[offset])) {
-        offset++; col++;
-      }
-      bool is_float = false;
-      if (offset + 1 < source.len && source.ptr[offset] == '.' &&
-          isdigit((unsigned char)source.ptr[offset + 1])) {
-        is_float = true;
-        offset++; col++;
-        while (offset < source.len && isdigit((unsigned char)source.ptr[offset])) {
-          offset++; col++;
-        }
-      }
-      size_t len = offset - start;
-      if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-      (*out_tokens)[(*out_count)++] = (struct token){
-        .kind = is_float ? float_kind : number_kind,
-        .lexeme = str_from(source.ptr + start, len),
-        .filename = filename,
-        .row = row,
-        .col = col - len,
+struct LexerReader {
+  const LexerScanner* scanner;
+  LexerKinds kinds;
+  const char* filename;
+  int fd;
+  char* buf;         // bytes [base, base + len) of the file
+  size_t cap;
+  size_t len;
+  size_t base;
+  size_t pos;        // scan position in buf
+  bool at_eof;       // fd has no more bytes
+  bool has_peek;
+  struct token peek;
+};
+
+LexerReader* lexer_reader_new(const char* filename,
+                              int fd,
+                              InternTable* interns,
+                              const LexerOptions* options,
+                              size_t window) {
+  if (!interns || fd < 0) return NULL;
+  const LexerScanner* scanner = lexer_scanner(options ? options->scan : LEXER_SCAN_AUTO);
+  LexerKinds kinds;
+  if (!scanner || !intern_kinds(interns, &kinds)) return NULL;
+  // An empty first chunk starts the file's line index over.
+  if (filename && !morphl_sources_append(filename, 0, str_from("", 0))) return NULL;
+
+  LexerReader* reader = calloc(1, sizeof(LexerReader));
+  if (!reader) return NULL;
+  reader->cap = window ? window : LEXER_READER_DEFAULT_WINDOW;
+  reader->buf = malloc(reader->cap);
+  if (!reader->buf) {
+    free(reader);
+    return NULL;
+  }
+  reader->scanner = scanner;
+  reader->kinds = kinds;
+  reader->filename = filename;
+  reader->fd = fd;
+  return reader;
+}
+
+void lexer_reader_free(LexerReader* reader) {
+  if (!reader) return;
+  free(reader->buf);
+  free(reader);
+}
+
+// Drop the window's bytes before `keep` and read more after the rest. The window doubles only
+// when the bytes kept fill it, i.e. for a token longer than the window.
+static bool reader_refill(LexerReader* reader, size_t keep) {
+  memmove(reader->buf, reader->buf + keep, reader->len - keep);
+  reader->base += keep;
+  reader->len -= keep;
+  reader->pos = 0;
+  if (reader->len == reader->cap) {
+    char* grown = realloc(reader->buf, reader->cap * 2);
+    if (!grown) return false;
+    reader->buf = grown;
+    reader->cap *= 2;
+  }
+
+  size_t got;
+  if (!morphl_file_read_fd(reader->fd, reader->buf + reader->len, reader->cap - reader->len, &got)) return false;
+  if (got == 0) {
+    reader->at_eof = true;
+    return true;
+  }
+  Str chunk = str_from(reader->buf + reader->len, got);
+  if (reader->filename && !morphl_sources_append(reader->filename, reader->base + reader->len, chunk)) return false;
+  reader->len += got;
+  return true;
+}
+
+// Scan the next token. A token is only taken once two bytes follow it in the window: the lexer
+// looks one byte past a token (for `$name`) and two past the digits of a number (for `1.5`), so
+// anything closer to the end of the window could still grow with the next read.
+static bool reader_scan(LexerReader* reader, struct token* out) {
+  for (;;) {
+    size_t offset = reader->pos;
+    LexerToken tok;
+    LexerStep step = lexer_step(reader->scanner, &reader->kinds, reader->buf, reader->len, &offset, &tok);
+    if (step == LEXER_STEP_TOKEN && (reader->at_eof || tok.start + tok.len + 2 <= reader->len)) {
+      reader->pos = offset;
+      *out = (struct token){
+        .kind = tok.kind,
+        .lexeme = str_from(reader->buf + tok.start, tok.len),
+        .filename = reader->filename,
+        .offset = reader->base + tok.start,
       };
-      continue;
+      return true;
     }
-
-    // String literals: "..."
-    if (c == '"') {
-      size_t start = offset;
-      offset++; col++; // Skip opening quote
-      while (offset < source.len && source.ptr[offset] != '"') {
-        if (source.ptr[offset] == '\n') {
-          row++; col = 1;
-        } else {
-          col++;
-        }
-        offset++;
-      }
-      if (offset >= source.len) {
-        // Unterminated string
-        return false;
-      }
-      offset++; col++; // Skip closing quote
-      size_t len = offset - start;
-      if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-      (*out_tokens)[(*out_count)++] = (struct token){
-        .kind = string_kind,
-        .lexeme = str_from(source.ptr + start, len),
-        .filename = filename,
-        .row = row,
-        .col = col - len,
+    if (reader->at_eof) {
+      if (step == LEXER_STEP_UNTERMINATED) return false;
+      reader->pos = reader->len;
+      *out = (struct token){
+        .kind = reader->kinds.eof,
+        .lexeme = str_from(NULL, 0),
+        .filename = reader->filename,
+        .offset = reader->base + reader->len,
       };
-      continue;
+      return true;
     }
-
-    // Symbol characters: tokenize one at a time
-    size_t start = offset;
-    offset++; col++;
-    size_t len = 1;
-
-    if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-    (*out_tokens)[(*out_count)++] = (struct token){
-      .kind = symbol_kind,
-      .lexeme = str_from(source.ptr + start, len),
-      .filename = filename,
-      .row = row,
-      .col = col - len,
-    };
+    // Keep the token (or unterminated string) that may continue; blanks need not be kept.
+    size_t keep = (step == LEXER_STEP_TOKEN) ? tok.start : offset;
+    if (!reader_refill(reader, keep)) return false;
   }
+}
 
-  if (!ensure_token_capacity(out_tokens, &cap, *out_count + 1)) return false;
-  (*out_tokens)[(*out_count)++] = (struct token){
-    .kind = eof_kind,
-    .lexeme = str_from(NULL, 0),
-    .filename = filename,
-    .row = row,
-    .col = col,
-  };
+bool lexer_peek_token(LexerReader* reader, struct token* out) {
+  if (!reader || !out) return false;
+  if (!reader->has_peek) {
+    if (!reader_scan(reader, &reader->peek)) return false;
+    reader->has_peek = true;
+  }
+  *out = reader->peek;
+  return true;
+}
 
+bool lexer_next_token(LexerReader* reader, struct token* out) {
+  if (!lexer_peek_token(reader, out)) return false;
+  reader->has_peek = false;
   return true;
 }
@@ -0,0 +1,200 @@
+#include "lexer_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define LEXER_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define LEXER_HAVE_X86_SIMD 0
+#endif
+
+#define B LEXER_CLASS_BLANK
+#define N LEXER_CLASS_NEWLINE
+#define A LEXER_CLASS_ALPHA
+#define D LEXER_CLASS_DIGIT
+#define Q LEXER_CLASS_QUOTE
+
+const uint8_t lexer_char_class[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, B, N, 0, 0, B, 0, 0,  // 0x00
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x10
+  B, 0, Q, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 0x20  !"#$%&'()*+,-./
+  D, D, D, D, D, D, D, D, D, D, 0, 0, 0, 0, 0, 0,  // 0x30 0123456789:;<=>?
+  0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,  // 0x40 @ABCDEFGHIJKLMNO
+  A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, A,  // 0x50 PQRSTUVWXYZ[\]^_
+  0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,  // 0x60 `abcdefghijklmno
+  A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0,  // 0x70 pqrstuvwxyz{|}~
+};
+
+#undef B
+#undef N
+#undef A
+#undef D
+#undef Q
+
+static inline size_t scalar_run(const char* src, size_t at, size_t len, uint8_t classes) {
+  while (at < len && (lexer_char_class[(unsigned char)src[at]] & classes)) at++;
+  return at;
+}
+
+static size_t scalar_blanks_end(const char* src, size_t at, size_t len) {
+  return scalar_run(src, at, len, LEXER_CLASS_BLANK);
+}
+
+static size_t scalar_ident_end(const char* src, size_t at, size_t len) {
+  return scalar_run(src, at, len, LEXER_CLASS_ALPHA | LEXER_CLASS_DIGIT);
+}
+
+static size_t scalar_digits_end(const char* src, size_t at, size_t len) {
+  return scalar_run(src, at, len, LEXER_CLASS_DIGIT);
+}
+
+static size_t scalar_quote_or_newline(const char* src, size_t at, size_t len) {
+  while (at < len && !(lexer_char_class[(unsigned char)src[at]] & (LEXER_CLASS_QUOTE | LEXER_CLASS_NEWLINE))) at++;
+  return at;
+}
+
+static size_t scalar_quote(const char* src, size_t at, size_t len) {
+  while (at < len && src[at] != '"') at++;
+  return at;
+}
+
+static const LexerScanner kScalarScanner = {
+  LEXER_SCAN_SCALAR, scalar_blanks_end, scalar_ident_end, scalar_digits_end, scalar_quote_or_newline, scalar_quote,
+};
+
+#if LEXER_HAVE_X86_SIMD
+
+// A run function tests `width` bytes per step: stop_mask sets bit i when byte i ends the run.
+// The tail shorter than one vector goes through the scalar version, so no load passes `len`.
+#define LEXER_SIMD_RUN(name, attr, vec, width, load, stop_mask, scalar)      \
+  static attr size_t name(const char* src, size_t at, size_t len) {          \
+    while (at + (width) <= len) {                                            \
+      uint32_t stop = stop_mask(load((const vec*)(src + at)));               \
+      if (stop != 0) return at + (size_t)__builtin_ctz(stop);                \
+      at += (width);                                                         \
+    }                                                                        \
+    return scalar(src, at, len);                                             \
+  }
+
+// Signed byte compares are enough: every class is ASCII, and bytes >= 0x80 compare as negative.
+static inline uint32_t sse2_blank_mask(__m128i v) {
+  __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+  return ~(uint32_t)_mm_movemask_epi8(blank) & 0xFFFFu;
+}
+
+static inline __m128i sse2_digits(__m128i v) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+}
+
+static inline uint32_t sse2_digit_mask(__m128i v) {
+  return ~(uint32_t)_mm_movemask_epi8(sse2_digits(v)) & 0xFFFFu;
+}
+
+static inline uint32_t sse2_ident_mask(__m128i v) {
+  // Setting bit 5 folds upper case onto lower case; no other byte lands in 'a'..'z'.
+  __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(folded, _mm_set1_epi8('z' + 1)));
+  __m128i ident = _mm_or_si128(_mm_or_si128(alpha, sse2_digits(v)), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+  return ~(uint32_t)_mm_movemask_epi8(ident) & 0xFFFFu;
+}
+
+static inline uint32_t sse2_quote_mask(__m128i v) {
+  __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+  return (uint32_t)_mm_movemask_epi8(stop);
+}
+
+static inline uint32_t sse2_quote_only_mask(__m128i v) {
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+}
+
+LEXER_SIMD_RUN(sse2_blanks_end, , __m128i, 16, _mm_loadu_si128, sse2_blank_mask, scalar_blanks_end)
+LEXER_SIMD_RUN(sse2_ident_end, , __m128i, 16, _mm_loadu_si128, sse2_ident_mask, scalar_ident_end)
+LEXER_SIMD_RUN(sse2_digits_end, , __m128i, 16, _mm_loadu_si128, sse2_digit_mask, scalar_digits_end)
+LEXER_SIMD_RUN(sse2_quote_or_newline, , __m128i, 16, _mm_loadu_si128, sse2_quote_mask, scalar_quote_or_newline)
+LEXER_SIMD_RUN(sse2_quote, , __m128i, 16, _mm_loadu_si128, sse2_quote_only_mask, scalar_quote)
+
+static const LexerScanner kSse2Scanner = {
+  LEXER_SCAN_SSE2, sse2_blanks_end, sse2_ident_end, sse2_digits_end, sse2_quote_or_newline, sse2_quote,
+};
+
+// The AVX2 versions are compiled for AVX2 whatever the target, and only chosen when the CPU has it.
+#define LEXER_AVX2 __attribute__((target("avx2")))
+
+static inline LEXER_AVX2 uint32_t avx2_blank_mask(__m256i v) {
+  __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+                                                  _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+  return ~(uint32_t)_mm256_movemask_epi8(blank);
+}
+
+static inline LEXER_AVX2 __m256i avx2_digits(__m256i v) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+}
+
+static inline LEXER_AVX2 uint32_t avx2_digit_mask(__m256i v) {
+  return ~(uint32_t)_mm256_movemask_epi8(avx2_digits(v));
+}
+
+static inline LEXER_AVX2 uint32_t avx2_ident_mask(__m256i v) {
+  __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(folded, _mm256_set1_epi8('a' - 1)),
+                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), folded));
+  __m256i ident = _mm256_or_si256(_mm256_or_si256(alpha, avx2_digits(v)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+  return ~(uint32_t)_mm256_movemask_epi8(ident);
+}
+
+static inline LEXER_AVX2 uint32_t avx2_quote_mask(__m256i v) {
+  __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+  return (uint32_t)_mm256_movemask_epi8(stop);
+}
+
+static inline LEXER_AVX2 uint32_t avx2_quote_only_mask(__m256i v) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+}
+
+LEXER_SIMD_RUN(avx2_blanks_end, LEXER_AVX2, __m256i, 32, _mm256_loadu_si256, avx2_blank_mask, sse2_blanks_end)
+LEXER_SIMD_RUN(avx2_ident_end, LEXER_AVX2, __m256i, 32, _mm256_loadu_si256, avx2_ident_mask, sse2_ident_end)
+LEXER_SIMD_RUN(avx2_digits_end, LEXER_AVX2, __m256i, 32, _mm256_loadu_si256, avx2_digit_mask, sse2_digits_end)
+LEXER_SIMD_RUN(avx2_quote_or_newline, LEXER_AVX2, __m256i, 32, _mm256_loadu_si256, avx2_quote_mask, sse2_quote_or_newline)
+LEXER_SIMD_RUN(avx2_quote, LEXER_AVX2, __m256i, 32, _mm256_loadu_si256, avx2_quote_only_mask, sse2_quote)
+
+static const LexerScanner kAvx2Scanner = {
+  LEXER_SCAN_AVX2, avx2_blanks_end, avx2_ident_end, avx2_digits_end, avx2_quote_or_newline, avx2_quote,
+};
+
+#endif
+
+const LexerScanner* lexer_scanner(LexerScan scan) {
+  switch (scan) {
+    case LEXER_SCAN_AUTO:
+#if LEXER_HAVE_X86_SIMD
+      return __builtin_cpu_supports("avx2") ? &kAvx2Scanner : &kSse2Scanner;
+#else
+      return &kScalarScanner;
+#endif
+    case LEXER_SCAN_SCALAR:
+      return &kScalarScanner;
+#if LEXER_HAVE_X86_SIMD
+    case LEXER_SCAN_SSE2:
+      return &kSse2Scanner;
+    case LEXER_SCAN_AVX2:
+      return __builtin_cpu_supports("avx2") ? &kAvx2Scanner : NULL;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+bool lexer_scan_available(LexerScan scan) {
+  return lexer_scanner(scan) != NULL;
+}
+
+const char* lexer_scan_name(LexerScan scan) {
+  const LexerScanner* scanner = lexer_scanner(scan);
+  if (!scanner) return NULL;
+  switch (scanner->scan) {
+    case LEXER_SCAN_SSE2: return "sse2";
+    case LEXER_SCAN_AVX2: return "avx2";
+    default: return "scalar";
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef MORPHL_LEXER_LEXER_SCAN_H_
+#define MORPHL_LEXER_LEXER_SCAN_H_
+
+// Internal to the lexer: byte classification and the run scanners behind lexer_tokenize.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lexer/lexer.h"
+
+/// Character classes, one bit each. `_` counts as a letter.
+enum {
+  LEXER_CLASS_BLANK = 1u << 0,    ///< ' ', '\t', '\r'
+  LEXER_CLASS_NEWLINE = 1u << 1,  ///< '\n'
+  LEXER_CLASS_ALPHA = 1u << 2,    ///< [A-Za-z_]
+  LEXER_CLASS_DIGIT = 1u << 3,    ///< [0-9]
+  LEXER_CLASS_QUOTE = 1u << 4,    ///< '"'
+};
+
+/// Class bits for every byte value. Bytes outside ASCII have none, as in the "C" locale.
+extern const uint8_t lexer_char_class[256];
+
+/// One scanning strategy. Each function starts at `at` and returns the offset of the first byte
+/// at or after it that ends the run, or `len` when the run reaches the end of the buffer. None of
+/// them reads past `len`.
+typedef struct {
+  LexerScan scan;
+  /// First byte that is not a blank.
+  size_t (*blanks_end)(const char* src, size_t at, size_t len);
+  /// First byte that is not a letter, digit or `_`.
+  size_t (*ident_end)(const char* src, size_t at, size_t len);
+  /// First byte that is not a digit.
+  size_t (*digits_end)(const char* src, size_t at, size_t len);
+  /// First `"` or newline.
+  size_t (*quote_or_newline)(const char* src, size_t at, size_t len);
+  /// First `"`.
+  size_t (*quote)(const char* src, size_t at, size_t len);
+} LexerScanner;
+
+/// The scanner for `scan`, with LEXER_SCAN_AUTO resolved to the widest one this CPU supports.
+/// Returns NULL when `scan` is not available.
+const LexerScanner* lexer_scanner(LexerScan scan);
+
+#endif // MORPHL_LEXER_LEXER_SCAN_H_
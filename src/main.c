@@ -9,12 +9,17 @@
 #include "parser/operators.h"
 #include "runtime/runtime.h"
 #include "util/file.h"
+#include "util/sources.h"
 #include "util/util.h"
 #include <backend/backend.h>
 
+static const char* const kUsage =
+    "usage: %s [--backend c|vm] [--run] [--vm-engine typed|text] [--no-peephole] [--vm-profile file] "
+    "[--vm-sample file] [--vm-sample-interval us] [grammar-file] <source-file>\n";
+
 int main(int argc, char** argv) {
   if (argc < 2) {
-    fprintf(stderr, "usage: %s [--backend c|vm] [--run] [grammar-file] <source-file>\n", argv[0]);
+    fprintf(stderr, kUsage, argv[0]);
     fprintf(stderr, "  If grammar-file is omitted, uses builtin operators only.\n");
     fprintf(stderr, "  Use $syntax \"file\" directive within source to load custom grammars.\n");
     return 1;
@@ -22,6 +27,8 @@ int main(int argc, char** argv) {
 
   enum MorphlBackendType backend_type = MORPHL_BACKEND_TYPE_C;
   bool run_bytecode = false;
+  bool no_peephole = false;
+  MorphlVmRunOptions run_options = {0};
   int arg_index = 1;
 
   while (argc > arg_index && strncmp(argv[arg_index], "--", 2) == 0) {
@@ -44,19 +51,76 @@ int main(int argc, char** argv) {
       continue;
     }
 
+    if (strcmp(argv[arg_index], "--vm-engine") == 0) {
+      if (argc <= arg_index + 1) {
+        fprintf(stderr, "missing engine value after --vm-engine\n");
+        return 1;
+      }
+
+      const char* engine_name = argv[arg_index + 1];
+      if (strcmp(engine_name, "typed") == 0) {
+        run_options.engine = MORPHL_VM_ENGINE_TYPED;
+      } else if (strcmp(engine_name, "text") == 0) {
+        run_options.engine = MORPHL_VM_ENGINE_TEXT;
+      } else {
+        fprintf(stderr, "unknown VM engine '%s' (expected 'typed' or 'text')\n", engine_name);
+        return 1;
+      }
+      arg_index += 2;
+      continue;
+    }
+
     if (strcmp(argv[arg_index], "--run") == 0) {
       run_bytecode = true;
       arg_index += 1;
       continue;
     }
 
+    if (strcmp(argv[arg_index], "--vm-profile") == 0) {
+      if (argc <= arg_index + 1) {
+        fprintf(stderr, "missing output file after --vm-profile\n");
+        return 1;
+      }
+      run_options.profile_path = argv[arg_index + 1];
+      arg_index += 2;
+      continue;
+    }
+
+    if (strcmp(argv[arg_index], "--vm-sample") == 0) {
+      if (argc <= arg_index + 1) {
+        fprintf(stderr, "missing output file after --vm-sample\n");
+        return 1;
+      }
+      run_options.sample_path = argv[arg_index + 1];
+      arg_index += 2;
+      continue;
+    }
+
+    if (strcmp(argv[arg_index], "--vm-sample-interval") == 0) {
+      char* end = NULL;
+      unsigned long interval = (argc > arg_index + 1) ? strtoul(argv[arg_index + 1], &end, 10) : 0;
+      if (argc <= arg_index + 1 || *end != '\0' || interval == 0 || interval > UINT32_MAX) {
+        fprintf(stderr, "expected a positive interval in microseconds after --vm-sample-interval\n");
+        return 1;
+      }
+      run_options.sample_interval_us = (uint32_t)interval;
+      arg_index += 2;
+      continue;
+    }
+
+    if (strcmp(argv[arg_index], "--no-peephole") == 0) {
+      no_peephole = true;
+      arg_index += 1;
+      continue;
+    }
+
     fprintf(stderr, "unknown option '%s'\n", argv[arg_index]);
     return 1;
   }
 
   int remaining = argc - arg_index;
   if (remaining < 1 || remaining > 2) {
-    fprintf(stderr, "usage: %s [--backend c|vm] [--run] [grammar-file] <source-file>\n", argv[0]);
+    fprintf(stderr, kUsage, argv[0]);
     return 1;
   }
 
@@ -143,6 +207,7 @@ int main(int argc, char** argv) {
     backend_ctx.tree = root;
     backend_ctx.out_file = (backend_type == MORPHL_BACKEND_TYPE_VM) ? "out.mbc" : "out.c";
     backend_ctx.type_context = parser_ctx.type_context;
+    backend_ctx.no_peephole = no_peephole;
 
     if (!morphl_register_backend(backend_type)) {
       printf("backend registration failed\n");
@@ -151,7 +216,7 @@ int main(int argc, char** argv) {
       printf("backend code generation succeeded, output written to %s\n", backend_ctx.out_file);
       if (run_bytecode) {
         printf("executing VM bytecode from %s...\n", backend_ctx.out_file);
-        int exit_code = morphl_vm_run_file(backend_ctx.out_file, stderr);
+        int exit_code = morphl_vm_run_file_with(backend_ctx.out_file, &run_options, stderr);
         if (exit_code != 0) {
           printf("VM execution failed: code %d\n", exit_code);
           accepted = false;
@@ -174,5 +239,6 @@ int main(int argc, char** argv) {
   scoped_parser_free(&parser_ctx);
   arena_free(&arena);
   interns_free(interns);
+  morphl_sources_clear();
   return accepted ? 0 : 1;
 }
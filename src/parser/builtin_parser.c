@@ -18,19 +18,77 @@ extern const char* const LEXER_KIND_STRING;
 extern const char* const LEXER_KIND_SYMBOL;
 extern const char* const LEXER_KIND_EOF;
 
-// Forward declaration for recursive parsing
-static bool parse_builtin_expr(const struct token* tokens,
-                               size_t token_count,
-                               size_t* cursor,
-                               InternTable* interns,
-                               TokenKind ident_kind,
-                               TokenKind number_kind,
-                               TokenKind float_kind,
-                               TokenKind string_kind,
-                               TokenKind symbol_kind,
-                               TokenKind eof_kind,
-                               size_t depth,
-                               AstNode** out_node);
+// Interned kinds of the lexer's tokens.
+typedef struct {
+  TokenKind ident;
+  TokenKind number;
+  TokenKind number_float;
+  TokenKind string;
+  TokenKind symbol;
+  TokenKind eof;
+} BuiltinKinds;
+
+// Where tokens come from: an array walked with a cursor, or a LexerReader. A reader's window
+// moves on as tokens are consumed, so leaf text is copied into the arena.
+typedef struct {
+  const struct token* tokens;
+  size_t token_count;
+  size_t* cursor;
+  LexerReader* reader;
+  Arena* arena;
+  bool failed;  // the reader could not produce a token
+  BuiltinKinds kinds;
+} BuiltinInput;
+
+static bool intern_kinds(InternTable* interns, BuiltinKinds* kinds) {
+  kinds->ident = interns_intern(interns, str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
+  kinds->number = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
+  kinds->number_float = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
+  kinds->string = interns_intern(interns, str_from(LEXER_KIND_STRING, strlen(LEXER_KIND_STRING)));
+  kinds->symbol = interns_intern(interns, str_from(LEXER_KIND_SYMBOL, strlen(LEXER_KIND_SYMBOL)));
+  kinds->eof = interns_intern(interns, str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
+  return kinds->ident && kinds->number && kinds->number_float && kinds->string && kinds->symbol && kinds->eof;
+}
+
+/**
+ * @brief Look at the next token; false at the end of the array or when the reader fails.
+ */
+static bool input_peek(BuiltinInput* in, struct token* out) {
+  if (in->reader) {
+    if (lexer_peek_token(in->reader, out)) return true;
+    in->failed = true;
+    return false;
+  }
+  if (*in->cursor >= in->token_count) return false;
+  *out = in->tokens[*in->cursor];
+  return true;
+}
+
+/**
+ * @brief Consume the token input_peek() returned.
+ */
+static void input_advance(BuiltinInput* in) {
+  if (in->reader) {
+    struct token consumed;
+    (void)lexer_next_token(in->reader, &consumed);
+  } else {
+    (*in->cursor)++;
+  }
+}
+
+/**
+ * @brief Leaf text that outlives the token: the lexeme itself for an array, a copy for a reader.
+ */
+static bool input_keep(BuiltinInput* in, Str lexeme, Str* out) {
+  if (!in->reader) {
+    *out = lexeme;
+    return true;
+  }
+  char* copy = arena_push(in->arena, lexeme.ptr, lexeme.len);
+  if (!copy && lexeme.len > 0) return false;
+  *out = str_from(copy, lexeme.len);
+  return true;
+}
 
 /**
  * @brief Check if a token is a builtin operator (starts with $).
@@ -46,38 +104,29 @@ static bool is_builtin_op(const struct token* tok, TokenKind ident_kind) {
  * - Literals: numbers, strings, identifiers
  * - Builtin operations: $op arg1 arg2 ...
  */
-static bool parse_builtin_expr(const struct token* tokens,
-                               size_t token_count,
-                               size_t* cursor,
+static bool parse_builtin_expr(BuiltinInput* in,
                                InternTable* interns,
-                               TokenKind ident_kind,
-                               TokenKind number_kind,
-                               TokenKind float_kind,
-                               TokenKind string_kind,
-                               TokenKind symbol_kind,
-                               TokenKind eof_kind,
                                size_t depth,
                                AstNode** out_node) {
   if (depth > BUILTIN_MAX_DEPTH) {
     return false; // Stack overflow protection
   }
 
-  if (*cursor >= token_count) {
+  struct token tok;
+  if (!input_peek(in, &tok)) {
     return false; // Unexpected end of input
   }
 
-  const struct token* tok = &tokens[*cursor];
-  
   // Check for EOF
-  if (tok->kind == eof_kind) {
+  if (tok.kind == in->kinds.eof) {
     return false;
   }
 
   // Handle builtin operations: $op arg1 arg2 ...
-  if (is_builtin_op(tok, ident_kind)) {
-    Sym op_sym = interns_intern(interns, tok->lexeme);
+  if (is_builtin_op(&tok, in->kinds.ident)) {
+    Sym op_sym = interns_intern(interns, tok.lexeme);
     if (!op_sym) return false;
-    (*cursor)++; // Consume operator
+    input_advance(in); // Consume operator
 
     // Parse arguments until we hit a delimiter or end
     AstNode** children = NULL;
@@ -87,17 +136,16 @@ static bool parse_builtin_expr(const struct token* tokens,
     // Determine arity based on operator
     // Most builtins are variadic; some are unary/binary
     // For simplicity, parse all available arguments
-    while (*cursor < token_count) {
-      const struct token* next = &tokens[*cursor];
-      
+    struct token next;
+    while (input_peek(in, &next)) {
       // Stop at EOF
-      if (next->kind == eof_kind) {
+      if (next.kind == in->kinds.eof) {
         break;
       }
       
       // Stop at closing delimiters or separators
-      if (next->kind == symbol_kind && next->lexeme.len == 1) {
-        char c = next->lexeme.ptr[0];
+      if (next.kind == in->kinds.symbol && next.lexeme.len == 1) {
+        char c = next.lexeme.ptr[0];
         if (c == ')' || c == '}' || c == ']' || c == ';' || c == ',') {
           break;
         }
@@ -118,13 +166,18 @@ static bool parse_builtin_expr(const struct token* tokens,
 
       // Parse argument
       AstNode* child = NULL;
-      if (!parse_builtin_expr(tokens, token_count, cursor, interns, ident_kind, number_kind, float_kind, string_kind, symbol_kind, eof_kind, depth + 1, &child)) {
+      if (!parse_builtin_expr(in, interns, depth + 1, &child)) {
         for (size_t i = 0; i < child_count; ++i) ast_free(children[i]);
         free(children);
         return false;
       }
       children[child_count++] = child;
     }
+    if (in->failed) {
+      for (size_t i = 0; i < child_count; ++i) ast_free(children[i]);
+      free(children);
+      return false;
+    }
 
     // Choose AST kind based on operator registry (defaults to builtin)
     AstKind op_kind = AST_BUILTIN;
@@ -148,24 +201,26 @@ static bool parse_builtin_expr(const struct token* tokens,
 
   // Handle literals and identifiers
   AstKind kind;
-  if (tok->kind == number_kind || tok->kind == float_kind || tok->kind == string_kind) {
+  if (tok.kind == in->kinds.number || tok.kind == in->kinds.number_float || tok.kind == in->kinds.string) {
     kind = AST_LITERAL;
-  } else if (tok->kind == ident_kind) {
+  } else if (tok.kind == in->kinds.ident) {
     kind = AST_IDENT;
   } else {
     // Unexpected token
     return false;
   }
 
-  (*cursor)++; // Consume token
+  Str value;
+  if (!input_keep(in, tok.lexeme, &value)) return false;
+  input_advance(in); // Consume token
 
   AstNode* node = ast_new(kind);
   if (!node) return false;
   
   if (kind == AST_LITERAL || kind == AST_IDENT) {
-    node->value = tok->lexeme;
+    node->value = value;
     if (kind == AST_LITERAL) {
-      node->op = tok->kind;
+      node->op = tok.kind;
     }
   }
 
@@ -180,42 +235,21 @@ bool builtin_parse_expr(const struct token* tokens,
                         AstNode** out_node) {
   if (!tokens || !cursor || !interns || !out_node) return false;
 
-  // Intern token kinds
-  TokenKind ident_kind = interns_intern(interns, str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
-  TokenKind number_kind = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
-  TokenKind float_kind = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
-  TokenKind string_kind = interns_intern(interns, str_from(LEXER_KIND_STRING, strlen(LEXER_KIND_STRING)));
-  TokenKind symbol_kind = interns_intern(interns, str_from(LEXER_KIND_SYMBOL, strlen(LEXER_KIND_SYMBOL)));
-  TokenKind eof_kind = interns_intern(interns, str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
-  if (!ident_kind || !number_kind || !float_kind || !string_kind || !symbol_kind || !eof_kind) return false;
+  BuiltinInput in = {.tokens = tokens, .token_count = token_count, .cursor = cursor};
+  if (!intern_kinds(interns, &in.kinds)) return false;
 
-  return parse_builtin_expr(tokens, token_count, cursor, interns, ident_kind, number_kind, float_kind, string_kind, symbol_kind, eof_kind, 0, out_node);
+  return parse_builtin_expr(&in, interns, 0, out_node);
 }
 
-bool builtin_parse_ast(const struct token* tokens,
-                       size_t token_count,
-                       InternTable* interns,
-                       AstNode** out_root) {
-  if (!tokens || !interns || !out_root) return false;
-
-  // Intern token kinds
-  TokenKind ident_kind = interns_intern(interns, str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
-  TokenKind number_kind = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
-  TokenKind float_kind = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
-  TokenKind string_kind = interns_intern(interns, str_from(LEXER_KIND_STRING, strlen(LEXER_KIND_STRING)));
-  TokenKind symbol_kind = interns_intern(interns, str_from(LEXER_KIND_SYMBOL, strlen(LEXER_KIND_SYMBOL)));
-  TokenKind eof_kind = interns_intern(interns, str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
-  if (!ident_kind || !number_kind || !float_kind || !string_kind || !symbol_kind || !eof_kind) return false;
-
-  size_t cursor = 0;
-  
-  // Parse a single top-level expression or implicit block
-  // If multiple top-level expressions exist, wrap them in an implicit block
+// Statements up to EOF, separated by optional semicolons; one statement is returned as is,
+// several are wrapped in an implicit block.
+static bool parse_builtin_program(BuiltinInput* in, InternTable* interns, AstNode** out_root) {
   AstNode** children = NULL;
   size_t child_count = 0;
   size_t child_capacity = 0;
 
-  while (cursor < token_count && tokens[cursor].kind != eof_kind) {
+  struct token tok;
+  while (input_peek(in, &tok) && tok.kind != in->kinds.eof) {
     // Grow children array
     if (child_count >= child_capacity) {
       size_t new_cap = child_capacity ? child_capacity * 2 : 4;
@@ -231,7 +265,7 @@ bool builtin_parse_ast(const struct token* tokens,
 
     // Parse top-level statement
     AstNode* child = NULL;
-    if (!parse_builtin_expr(tokens, token_count, &cursor, interns, ident_kind, number_kind, float_kind, string_kind, symbol_kind, eof_kind, 0, &child)) {
+    if (!parse_builtin_expr(in, interns, 0, &child)) {
       for (size_t i = 0; i < child_count; ++i) ast_free(children[i]);
       free(children);
       return false;
@@ -239,13 +273,16 @@ bool builtin_parse_ast(const struct token* tokens,
     children[child_count++] = child;
 
     // Skip optional semicolons between statements
-    if (cursor < token_count) {
-      const struct token* sep = &tokens[cursor];
-      if (sep->kind == symbol_kind && sep->lexeme.len == 1 && sep->lexeme.ptr[0] == ';') {
-        cursor++;
-      }
+    struct token sep;
+    if (input_peek(in, &sep) && sep.kind == in->kinds.symbol && sep.lexeme.len == 1 && sep.lexeme.ptr[0] == ';') {
+      input_advance(in);
     }
   }
+  if (in->failed) {
+    for (size_t i = 0; i < child_count; ++i) ast_free(children[i]);
+    free(children);
+    return false;
+  }
 
   // If single child, return it directly; otherwise wrap in implicit block
   if (child_count == 1) {
@@ -265,3 +302,26 @@ bool builtin_parse_ast(const struct token* tokens,
     return true;
   }
 }
+
+bool builtin_parse_ast(const struct token* tokens,
+                       size_t token_count,
+                       InternTable* interns,
+                       AstNode** out_root) {
+  if (!tokens || !interns || !out_root) return false;
+
+  size_t cursor = 0;
+  BuiltinInput in = {.tokens = tokens, .token_count = token_count, .cursor = &cursor};
+  if (!intern_kinds(interns, &in.kinds)) return false;
+  return parse_builtin_program(&in, interns, out_root);
+}
+
+bool builtin_parse_reader(LexerReader* reader,
+                          InternTable* interns,
+                          Arena* arena,
+                          AstNode** out_root) {
+  if (!reader || !interns || !arena || !out_root) return false;
+
+  BuiltinInput in = {.reader = reader, .arena = arena};
+  if (!intern_kinds(interns, &in.kinds)) return false;
+  return parse_builtin_program(&in, interns, out_root);
+}
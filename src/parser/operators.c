@@ -7,6 +7,7 @@
 #include "util/error.h"
 #include "util/file.h"
 #include "util/fs.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -14,28 +15,22 @@
 
 static MorphlSpan span_from_node(const AstNode* node) {
   if (!node) return morphl_span_unknown();
-  return morphl_span_from_loc(node->filename, node->row, node->col);
+  return morphl_span_from_offset(node->filename, node->offset, node->offset + node->value.len);
 }
 
 #define MORPHL_ERR_NODE(node, code, fmt, ...) \
   MORPHL_ERR_SPAN((code), MORPHL_SEV_ERROR, span_from_node(node), (fmt), ##__VA_ARGS__)
 
-// Static intern copy
-static InternTable *operator_interns = NULL;
-
-// Static table of builtin operators. sym is populated at init.
+// Static table of builtin operators. info.op is populated by the first operator_registry_init and
+// only read afterwards, so lookups hand out pointers into the table.
 typedef struct {
   const char* name;
-  AstKind ast_kind;
-  bool is_preprocessor;
-  size_t min_args;
-  size_t max_args;
-  OperatorPPActionFunc func;
-  Sym sym;
-  OperatorPPResultPolicy policy;
-  enum Operator op_enum;
+  OperatorInfo info;
 } OperatorRow;
 
+// 0: syms not set yet, 1: the first operator_registry_init is setting them, 2: ready.
+static atomic_int registry_state;
+
 // Helpers
 static const char* unquote_literal(const AstNode* node, char* buf, size_t buf_size) {
   if (!node || node->kind != AST_LITERAL || !node->value.ptr) return NULL;
@@ -656,97 +651,104 @@ static MorphlType* pp_action_const(const OperatorInfo* info,
 
 static OperatorRow kBuiltinOps[] = {
   // Structural
-  {"$group",  AST_GROUP,  false, 0, (size_t)-1, NULL,              0, OP_PP_KEEP_NODE, GROUP},
-  {"$block",  AST_BLOCK,  false, 0, (size_t)-1, NULL,              0, OP_PP_KEEP_NODE, BLOCK},
+  {"$group",    {GROUP,    0, AST_GROUP,   NULL,             0, (size_t)-1, false, OP_PP_KEEP_NODE}},
+  {"$block",    {BLOCK,    0, AST_BLOCK,   NULL,             0, (size_t)-1, false, OP_PP_KEEP_NODE}},
 
   // Core constructs
-  {"$call",   AST_CALL,   false, 2, 2,          pp_action_call,    0, OP_PP_KEEP_NODE, CALL},
-  {"$func",   AST_FUNC,   false, 2, 2,          pp_action_func,    0, OP_PP_KEEP_NODE, FUNC},
-  {"$if",     AST_IF,     false, 2, 2,          pp_action_if,      0, OP_PP_KEEP_NODE, IF},
-  {"$while",  AST_BUILTIN,false, 2, 2,          pp_action_while,   0, OP_PP_KEEP_NODE, WHILE},
-  {"$set",    AST_SET,    false, 2, 2,          pp_action_set,     0, OP_PP_KEEP_NODE, SET},
-  {"$decl",   AST_DECL,   true,  2, 2,          pp_action_decl,    0, OP_PP_KEEP_NODE, DECL},
-  {"$import", AST_BUILTIN,true,  1, 1,          pp_action_import,  0, OP_PP_KEEP_NODE, IMPORT},
-  {"$syntax", AST_BUILTIN,true,  1, 1,          pp_action_syntax,  0, OP_PP_DROP_NODE, SYNTAX},
-  {"$prop",   AST_PROP   ,true,  2, 2,          pp_action_prop,    0, OP_PP_KEEP_NODE, PROP},
-  {"$ret",    AST_BUILTIN,false, 1, 1,          pp_action_ret,     0, OP_PP_KEEP_NODE, RET},
-  {"$member", AST_BUILTIN,false, 2, 2,          pp_action_member,  0, OP_PP_KEEP_NODE, MEMBER},
-  {"$mut",    AST_BUILTIN,false, 1, 1,          pp_action_mut,     0, OP_PP_KEEP_NODE, MUT},
-  {"$const",  AST_BUILTIN,false, 1, 1,          pp_action_const,   0, OP_PP_KEEP_NODE, CONST},
-  {"$inline", AST_BUILTIN,false, 1, 1,          NULL,              0, OP_PP_KEEP_NODE, INLINE},
-  {"$this",   AST_BUILTIN,false, 0, 0,          NULL,              0, OP_PP_KEEP_NODE, THIS},
-  {"$file",   AST_BUILTIN,false, 0, 0,          NULL,              0, OP_PP_KEEP_NODE, FILE_},
-  {"$global", AST_BUILTIN,false, 0, 0,          NULL,              0, OP_PP_KEEP_NODE, GLOBAL},
-  {"$idtstr", AST_BUILTIN,false, 1, 1,          NULL,              0, OP_PP_KEEP_NODE, IDTSTR},
-  {"$strtid", AST_BUILTIN,false, 1, 1,          NULL,              0, OP_PP_KEEP_NODE, STRTID},
-  {"$forward",AST_BUILTIN,false, 1, 1,          NULL,              0, OP_PP_KEEP_NODE, FORWARD},
-  {"$break",  AST_BUILTIN, false, 0, 0,         NULL,              0, OP_PP_KEEP_NODE, BREAK},
-  {"$continue",AST_BUILTIN,false, 0, 0,         NULL,              0, OP_PP_KEEP_NODE, CONTINUE},
+  {"$call",     {CALL,     0, AST_CALL,    pp_action_call,   2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$func",     {FUNC,     0, AST_FUNC,    pp_action_func,   2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$if",       {IF,       0, AST_IF,      pp_action_if,     2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$while",    {WHILE,    0, AST_BUILTIN, pp_action_while,  2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$set",      {SET,      0, AST_SET,     pp_action_set,    2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$decl",     {DECL,     0, AST_DECL,    pp_action_decl,   2, 2,          true,  OP_PP_KEEP_NODE}},
+  {"$import",   {IMPORT,   0, AST_BUILTIN, pp_action_import, 1, 1,          true,  OP_PP_KEEP_NODE}},
+  {"$syntax",   {SYNTAX,   0, AST_BUILTIN, pp_action_syntax, 1, 1,          true,  OP_PP_DROP_NODE}},
+  {"$prop",     {PROP,     0, AST_PROP,    pp_action_prop,   2, 2,          true,  OP_PP_KEEP_NODE}},
+  {"$ret",      {RET,      0, AST_BUILTIN, pp_action_ret,    1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$member",   {MEMBER,   0, AST_BUILTIN, pp_action_member, 2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$mut",      {MUT,      0, AST_BUILTIN, pp_action_mut,    1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$const",    {CONST,    0, AST_BUILTIN, pp_action_const,  1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$inline",   {INLINE,   0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$this",     {THIS,     0, AST_BUILTIN, NULL,             0, 0,          false, OP_PP_KEEP_NODE}},
+  {"$file",     {FILE_,    0, AST_BUILTIN, NULL,             0, 0,          false, OP_PP_KEEP_NODE}},
+  {"$global",   {GLOBAL,   0, AST_BUILTIN, NULL,             0, 0,          false, OP_PP_KEEP_NODE}},
+  {"$idtstr",   {IDTSTR,   0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$strtid",   {STRTID,   0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$forward",  {FORWARD,  0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$break",    {BREAK,    0, AST_BUILTIN, NULL,             0, 0,          false, OP_PP_KEEP_NODE}},
+  {"$continue", {CONTINUE, 0, AST_BUILTIN, NULL,             0, 0,          false, OP_PP_KEEP_NODE}},
 
   // Arithmetic (no pp actions yet; type checker will use registry later)
-  {"$add",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, ADD},
-  {"$sub",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, SUB},
-  {"$mul",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, MUL},
-  {"$div",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, DIV},
-  {"$mod",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, MOD},
-  {"$rem",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, REM},
-  {"$fadd",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, FADD},
-  {"$fsub",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, FSUB},
-  {"$fmul",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, FMUL},
-  {"$fdiv",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, FDIV},
+  {"$add",      {ADD,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$sub",      {SUB,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$mul",      {MUL,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$div",      {DIV,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$mod",      {MOD,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$rem",      {REM,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$fadd",     {FADD,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$fsub",     {FSUB,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$fmul",     {FMUL,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$fdiv",     {FDIV,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
 
   // Comparison
-  {"$eq",     AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, EQ},
-  {"$neq",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, NEQ},
-  {"$lt",     AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, LT},
-  {"$gt",     AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, GT},
-  {"$lte",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, LTE},
-  {"$gte",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, GTE},
+  {"$eq",       {EQ,       0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$neq",      {NEQ,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$lt",       {LT,       0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$gt",       {GT,       0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$lte",      {LTE,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$gte",      {GTE,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
 
   // Logic
-  {"$and",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, AND},
-  {"$or",     AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, OR},
-  {"$not",    AST_BUILTIN,false, 1, 1,           NULL,              0, OP_PP_KEEP_NODE, NOT},
+  {"$and",      {AND,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$or",       {OR,       0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$not",      {NOT,      0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
 
   // Bitwise
-  {"$band",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, BAND},
-  {"$bor",    AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, BOR},
-  {"$bxor",   AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, BXOR},
-  {"$bnot",   AST_BUILTIN,false, 1, 1,           NULL,              0, OP_PP_KEEP_NODE, BNOT},
-  {"$lshift", AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, LSHIFT},
-  {"$rshift", AST_BUILTIN,false, 2, 2,           NULL,              0, OP_PP_KEEP_NODE, RSHIFT},
+  {"$band",     {BAND,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$bor",      {BOR,      0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$bxor",     {BXOR,     0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$bnot",     {BNOT,     0, AST_BUILTIN, NULL,             1, 1,          false, OP_PP_KEEP_NODE}},
+  {"$lshift",   {LSHIFT,   0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
+  {"$rshift",   {RSHIFT,   0, AST_BUILTIN, NULL,             2, 2,          false, OP_PP_KEEP_NODE}},
 
   // Preprocessor
-  {"$syntax", AST_BUILTIN,true,  1, 1,           pp_action_syntax,  0, OP_PP_DROP_NODE, SYNTAX},
-  {"$import", AST_BUILTIN,true,  1, 1,           pp_action_import,  0, OP_PP_KEEP_NODE, IMPORT},
+  {"$syntax",   {SYNTAX,   0, AST_BUILTIN, pp_action_syntax, 1, 1,          true,  OP_PP_DROP_NODE}},
+  {"$import",   {IMPORT,   0, AST_BUILTIN, pp_action_import, 1, 1,          true,  OP_PP_KEEP_NODE}},
 };
 static const size_t kBuiltinOpCount = sizeof(kBuiltinOps) / sizeof(kBuiltinOps[0]);
 
 bool operator_registry_init(InternTable* interns) {
   if (!interns) return false;
+  Sym syms[sizeof(kBuiltinOps) / sizeof(kBuiltinOps[0])];
   for (size_t i = 0; i < kBuiltinOpCount; ++i) {
     Str name = str_from(kBuiltinOps[i].name, strlen(kBuiltinOps[i].name));
-    Sym sym = interns_intern(interns, name);
-    if (!sym) return false;
-    kBuiltinOps[i].sym = sym;
+    syms[i] = interns_intern(interns, name);
+    if (!syms[i]) return false;
+  }
+
+  // The first call publishes the syms; every later call, from any thread, must agree with them.
+  int expected = 0;
+  if (atomic_compare_exchange_strong(&registry_state, &expected, 1)) {
+    for (size_t i = 0; i < kBuiltinOpCount; ++i) {
+      kBuiltinOps[i].info.op = syms[i];
+    }
+    atomic_store_explicit(&registry_state, 2, memory_order_release);
+    return true;
+  }
+  while (atomic_load_explicit(&registry_state, memory_order_acquire) != 2) {
+    // another thread is storing the same syms
+  }
+  for (size_t i = 0; i < kBuiltinOpCount; ++i) {
+    if (kBuiltinOps[i].info.op != syms[i]) return false;
   }
-  operator_interns = interns;
   return true;
 }
 
 const OperatorInfo* operator_info_lookup(Sym op) {
   if (!op) return NULL;
   for (size_t i = 0; i < kBuiltinOpCount; ++i) {
-    if (kBuiltinOps[i].sym == op) {
-      static OperatorInfo out;
-      out.op = kBuiltinOps[i].sym;
-      out.ast_kind = kBuiltinOps[i].ast_kind;
-      out.func = kBuiltinOps[i].func;
-      out.min_args = kBuiltinOps[i].min_args;
-      out.max_args = kBuiltinOps[i].max_args;
-      out.is_preprocessor = kBuiltinOps[i].is_preprocessor;
-      out.pp_policy = kBuiltinOps[i].policy;
-      return &out;
+    if (kBuiltinOps[i].info.op == op) {
+      return &kBuiltinOps[i].info;
     }
   }
   return NULL;
@@ -755,16 +757,8 @@ const OperatorInfo* operator_info_lookup(Sym op) {
 const OperatorInfo* operator_info_from_enum(enum Operator op) {
   if (op < 0 || (size_t)op >= kBuiltinOpCount) return NULL;
   for (size_t i = 0; i < kBuiltinOpCount; ++i) {
-    if (kBuiltinOps[i].op_enum == op) {
-      static OperatorInfo out;
-      out.op = kBuiltinOps[i].sym;
-      out.ast_kind = kBuiltinOps[i].ast_kind;
-      out.func = kBuiltinOps[i].func;
-      out.min_args = kBuiltinOps[i].min_args;
-      out.max_args = kBuiltinOps[i].max_args;
-      out.is_preprocessor = kBuiltinOps[i].is_preprocessor;
-      out.pp_policy = kBuiltinOps[i].policy;
-      return &out;
+    if (kBuiltinOps[i].info.op_enum == op) {
+      return &kBuiltinOps[i].info;
     }
   }
   return NULL;
@@ -26,13 +26,37 @@ typedef struct ParsedRuleContext {
   ParseFailure* failure;
 } ParsedRuleContext;
 
-static MorphlSpan span_from_token(const struct token* tok) {
-  if (!tok) return morphl_span_unknown();
-  return morphl_span_from_loc(tok->filename, tok->row, tok->col);
+// The tokens being parsed: an array of `struct token`, or a TokenStream. Either way a token's
+// location is a byte offset; rows and columns are only looked up when a diagnostic is formatted.
+typedef struct TokenView {
+  const struct token* tokens;
+  const TokenStream* stream;
+} TokenView;
+
+static inline TokenKind view_kind(const TokenView* view, size_t i) {
+  return view->stream ? view->stream->kinds[i] : view->tokens[i].kind;
+}
+
+static inline Str view_lexeme(const TokenView* view, size_t i) {
+  return view->stream ? token_stream_lexeme(view->stream, i) : view->tokens[i].lexeme;
+}
+
+static inline struct token view_token(const TokenView* view, size_t i) {
+  return view->stream ? token_stream_token(view->stream, i) : view->tokens[i];
+}
+
+static MorphlSpan view_span(const TokenView* view, size_t i) {
+  struct token tok = view_token(view, i);
+  return morphl_span_from_offset(tok.filename, tok.offset, tok.offset + tok.lexeme.len);
+}
+
+static AstNode* view_leaf(AstKind kind, const TokenView* view, size_t i) {
+  struct token tok = view_token(view, i);
+  return ast_make_leaf(kind, tok.lexeme, tok.filename, tok.offset);
 }
 
 static bool parse_rule_internal_ast(const ParsedRuleContext* ctx,
-                                    const struct token* tokens,
+                                    const TokenView* tokens,
                                     size_t token_count,
                                     size_t min_bp,
                                     size_t* cursor,
@@ -632,7 +656,7 @@ static GrammarRule* find_rule(const Grammar* grammar, Sym name) {
 }
 
 static bool parse_rule_internal(const ParsedRuleContext* ctx,
-                                const struct token* tokens,
+                                const TokenView* tokens,
                                 size_t token_count,
                                 size_t min_bp,
                                 size_t* cursor,
@@ -640,19 +664,19 @@ static bool parse_rule_internal(const ParsedRuleContext* ctx,
 
 static bool match_atom(const ParsedRuleContext* ctx,
                        const GrammarAtom* atom,
-                       const struct token* tokens,
+                       const TokenView* tokens,
                        size_t token_count,
                        size_t* cursor,
                        size_t depth) {
   switch (atom->kind) {
     case GRAMMAR_ATOM_LITERAL:
       if (*cursor >= token_count) return false;
-      if (!str_eq(tokens[*cursor].lexeme, atom->literal)) return false;
+      if (!str_eq(view_lexeme(tokens, *cursor), atom->literal)) return false;
       (*cursor)++;
       return true;
     case GRAMMAR_ATOM_TOKEN_KIND:
       if (*cursor >= token_count) return false;
-      if (tokens[*cursor].kind != atom->symbol) return false;
+      if (view_kind(tokens, *cursor) != atom->symbol) return false;
       (*cursor)++;
       return true;
     case GRAMMAR_ATOM_RULE: {
@@ -688,7 +712,7 @@ static bool match_atom(const ParsedRuleContext* ctx,
 
 static bool match_pattern(const ParsedRuleContext* ctx,
                           const Production* prod,
-                          const struct token* tokens,
+                          const TokenView* tokens,
                           size_t token_count,
                           size_t min_bp,
                           bool consume_leading_expr,
@@ -716,7 +740,7 @@ static bool match_pattern(const ParsedRuleContext* ctx,
 }
 
 static bool parse_rule_internal(const ParsedRuleContext* ctx,
-                                const struct token* tokens,
+                                const TokenView* tokens,
                                 size_t token_count,
                                 size_t min_bp,
                                 size_t* cursor,
@@ -755,15 +779,15 @@ static bool parse_rule_internal(const ParsedRuleContext* ctx,
   return true;
 }
 
-bool grammar_parse(const Grammar* grammar,
-                   Sym start_rule,
-                   const struct token* tokens,
-                   size_t token_count) {
+static bool grammar_parse_view(const Grammar* grammar,
+                               Sym start_rule,
+                               const TokenView* tokens,
+                               size_t token_count) {
   if (!grammar || grammar->rule_count == 0) return false;
   size_t parse_count = token_count;
   Sym eof_sym = interns_intern(grammar->names,
                                str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
-  if (parse_count > 0 && tokens[parse_count - 1].kind == eof_sym) {
+  if (parse_count > 0 && view_kind(tokens, parse_count - 1) == eof_sym) {
     parse_count--;
   }
   Sym start = start_rule ? start_rule : grammar->start_rule;
@@ -777,34 +801,48 @@ bool grammar_parse(const Grammar* grammar,
     Sym error_rule = failure.has_failure ? failure.best_rule : rule->name;
     Str rule_name = interns_lookup(grammar->names, error_rule);
     MorphlSpan span = (error_cursor < parse_count)
-                        ? span_from_token(&tokens[error_cursor])
+                        ? view_span(tokens, error_cursor)
                         : morphl_span_unknown();
     MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, span,
         "parse failed near rule '%.*s' at token %llu of %llu: '%.*s'",
         (int)rule_name.len, rule_name.ptr ? rule_name.ptr : "",
         (unsigned long long)error_cursor, (unsigned long long)parse_count,
-        (error_cursor < parse_count) ? (int)tokens[error_cursor].lexeme.len : 0,
-        (error_cursor < parse_count && tokens[error_cursor].lexeme.ptr) ? tokens[error_cursor].lexeme.ptr : "");
+        (error_cursor < parse_count) ? (int)view_lexeme(tokens, error_cursor).len : 0,
+        (error_cursor < parse_count && view_lexeme(tokens, error_cursor).ptr) ? view_lexeme(tokens, error_cursor).ptr : "");
     morphl_error_emit(NULL, &err);
     return false;
   }
   if (cursor != parse_count) {
     Str rule_name = interns_lookup(grammar->names, rule->name);
     MorphlSpan span = (cursor < parse_count)
-                        ? span_from_token(&tokens[cursor])
+                        ? view_span(tokens, cursor)
                         : morphl_span_unknown();
     MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, span,
         "parse stopped at token %llu of %llu near rule '%.*s': '%.*s'",
         (unsigned long long)cursor, (unsigned long long)parse_count,
         (int)rule_name.len, rule_name.ptr ? rule_name.ptr : "",
-        (cursor < parse_count) ? (int)tokens[cursor].lexeme.len : 0,
-        (cursor < parse_count && tokens[cursor].lexeme.ptr) ? tokens[cursor].lexeme.ptr : "");
+        (cursor < parse_count) ? (int)view_lexeme(tokens, cursor).len : 0,
+        (cursor < parse_count && view_lexeme(tokens, cursor).ptr) ? view_lexeme(tokens, cursor).ptr : "");
     morphl_error_emit(NULL, &err);
     return false;
   }
   return true;
 }
 
+bool grammar_parse(const Grammar* grammar,
+                   Sym start_rule,
+                   const struct token* tokens,
+                   size_t token_count) {
+  TokenView view = {.tokens = tokens, .stream = NULL};
+  return grammar_parse_view(grammar, start_rule, &view, token_count);
+}
+
+bool grammar_parse_stream(const Grammar* grammar, Sym start_rule, const TokenStream* stream) {
+  if (!stream) return false;
+  TokenView view = {.tokens = NULL, .stream = stream};
+  return grammar_parse_view(grammar, start_rule, &view, stream->count);
+}
+
 // ---------- AST construction path (experimental) ----------
 
 static AstNode* ast_group_from_list(AstNode** nodes, size_t count) {
@@ -815,8 +853,7 @@ static AstNode* ast_group_from_list(AstNode** nodes, size_t count) {
   }
   if (count > 0) {
     g->filename = nodes[0]->filename;
-    g->row = nodes[0]->row;
-    g->col = nodes[0]->col;
+    g->offset = nodes[0]->offset;
   }
   return g;
 }
@@ -841,8 +878,7 @@ static AstNode* ast_clone_tree(const AstNode* node) {
   copy->op = node->op;
   copy->value = node->value;
   copy->filename = node->filename;
-  copy->row = node->row;
-  copy->col = node->col;
+  copy->offset = node->offset;
 
   for (size_t i = 0; i < node->child_count; ++i) {
     AstNode* child = ast_clone_tree(node->children[i]);
@@ -1033,8 +1069,7 @@ static AstNode* build_template_ast(const Production* prod,
 
   if (root->child_count > 0) {
     root->filename = root->children[0]->filename;
-    root->row = root->children[0]->row;
-    root->col = root->children[0]->col;
+    root->offset = root->children[0]->offset;
   }
   return root;
 
@@ -1094,7 +1129,7 @@ static AstNode* build_prod_result(const Production* prod,
 
 static bool match_atom_ast(const ParsedRuleContext* ctx,
                            const GrammarAtom* atom,
-                           const struct token* tokens,
+                           const TokenView* tokens,
                            size_t token_count,
                            size_t* cursor,
                            size_t depth,
@@ -1105,12 +1140,11 @@ static bool match_atom_ast(const ParsedRuleContext* ctx,
   switch (atom->kind) {
     case GRAMMAR_ATOM_LITERAL:
       if (*cursor >= token_count) return false;
-      if (!str_eq(tokens[*cursor].lexeme, atom->literal)) return false;
+      if (!str_eq(view_lexeme(tokens, *cursor), atom->literal)) return false;
       if (out_node && atom->capture) {
-        AstNode* leaf = ast_make_leaf(AST_LITERAL, tokens[*cursor].lexeme,
-                                      tokens[*cursor].filename, tokens[*cursor].row, tokens[*cursor].col);
+        AstNode* leaf = view_leaf(AST_LITERAL, tokens, *cursor);
         if (leaf) {
-          leaf->op = tokens[*cursor].kind;
+          leaf->op = view_kind(tokens, *cursor);
         }
         *out_node = leaf;
         Capture* c = ensure_capture(captures, capture_count, atom->capture);
@@ -1125,10 +1159,10 @@ static bool match_atom_ast(const ParsedRuleContext* ctx,
                                         str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
         Sym float_sym = interns_intern(ctx->grammar->names,
                                        str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
-        if (tokens[*cursor].kind != atom->symbol) {
+        if (view_kind(tokens, *cursor) != atom->symbol) {
           if (!(number_sym && float_sym &&
                 atom->symbol == number_sym &&
-                tokens[*cursor].kind == float_sym)) {
+                view_kind(tokens, *cursor) == float_sym)) {
             return false;
           }
         }
@@ -1138,13 +1172,12 @@ static bool match_atom_ast(const ParsedRuleContext* ctx,
         // Heuristic: IDENT token kind -> AST_IDENT
         Sym ident_sym = interns_intern(ctx->grammar->names,
                                        str_from(LEXER_KIND_IDENT, strlen(LEXER_KIND_IDENT)));
-        if (ident_sym && tokens[*cursor].kind == ident_sym) {
+        if (ident_sym && view_kind(tokens, *cursor) == ident_sym) {
           kind = AST_IDENT;
         }
-        AstNode* leaf = ast_make_leaf(kind, tokens[*cursor].lexeme,
-                                      tokens[*cursor].filename, tokens[*cursor].row, tokens[*cursor].col);
+        AstNode* leaf = view_leaf(kind, tokens, *cursor);
         if (leaf && kind == AST_LITERAL) {
-          leaf->op = tokens[*cursor].kind;
+          leaf->op = view_kind(tokens, *cursor);
         }
         *out_node = leaf;
         if (atom->capture) {
@@ -1233,7 +1266,7 @@ static bool match_atom_ast(const ParsedRuleContext* ctx,
 
 static bool match_pattern_ast(const ParsedRuleContext* ctx,
                               const Production* prod,
-                              const struct token* tokens,
+                              const TokenView* tokens,
                               size_t token_count,
                               size_t min_bp,
                               bool consume_leading_expr,
@@ -1271,7 +1304,7 @@ static bool match_pattern_ast(const ParsedRuleContext* ctx,
 
 
 static bool parse_rule_internal_ast(const ParsedRuleContext* ctx,
-                                    const struct token* tokens,
+                                    const TokenView* tokens,
                                     size_t token_count,
                                     size_t min_bp,
                                     size_t* cursor,
@@ -1350,17 +1383,17 @@ static bool parse_rule_internal_ast(const ParsedRuleContext* ctx,
 }
 
 
-bool grammar_parse_ast(const Grammar* grammar,
-                       Sym start_rule,
-                       const struct token* tokens,
-                       size_t token_count,
-                       AstNode** out_root) {
+static bool grammar_parse_ast_view(const Grammar* grammar,
+                                   Sym start_rule,
+                                   const TokenView* tokens,
+                                   size_t token_count,
+                                   AstNode** out_root) {
   if (!grammar || grammar->rule_count == 0 || !out_root) return false;
   *out_root = NULL;
   size_t parse_count = token_count;
   Sym eof_sym = interns_intern(grammar->names,
                                str_from(LEXER_KIND_EOF, strlen(LEXER_KIND_EOF)));
-  if (parse_count > 0 && tokens[parse_count - 1].kind == eof_sym) {
+  if (parse_count > 0 && view_kind(tokens, parse_count - 1) == eof_sym) {
     parse_count--;
   }
   Sym start = start_rule ? start_rule : grammar->start_rule;
@@ -1379,25 +1412,25 @@ bool grammar_parse_ast(const Grammar* grammar,
     Sym error_rule = failure.has_failure ? failure.best_rule : rule->name;
     Str rule_name = interns_lookup(grammar->names, error_rule);
     MorphlSpan span = (error_cursor < parse_count)
-                        ? span_from_token(&tokens[error_cursor])
+                        ? view_span(tokens, error_cursor)
                         : morphl_span_unknown();
     MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, span,
         "parse failed near rule '%.*s' at token %llu of %llu: '%.*s'",
         (int)rule_name.len, rule_name.ptr ? rule_name.ptr : "",
         (unsigned long long)error_cursor, (unsigned long long)parse_count,
-        (error_cursor < parse_count) ? (int)tokens[error_cursor].lexeme.len : 0,
-        (error_cursor < parse_count && tokens[error_cursor].lexeme.ptr) ? tokens[error_cursor].lexeme.ptr : "");
+        (error_cursor < parse_count) ? (int)view_lexeme(tokens, error_cursor).len : 0,
+        (error_cursor < parse_count && view_lexeme(tokens, error_cursor).ptr) ? view_lexeme(tokens, error_cursor).ptr : "");
     morphl_error_emit(NULL, &err);
     return false;
   }
   if (cursor != parse_count) {
     Str rule_name = interns_lookup(grammar->names, rule->name);
-    MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, span_from_token(&tokens[cursor]),
+    MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, view_span(tokens, cursor),
         "parse stopped at token %llu of %llu near rule '%.*s': '%.*s'",
         (unsigned long long)cursor, (unsigned long long)parse_count,
         (int)rule_name.len, rule_name.ptr ? rule_name.ptr : "",
-        (int)tokens[cursor].lexeme.len,
-        tokens[cursor].lexeme.ptr ? tokens[cursor].lexeme.ptr : "");
+        (int)view_lexeme(tokens, cursor).len,
+        view_lexeme(tokens, cursor).ptr ? view_lexeme(tokens, cursor).ptr : "");
     morphl_error_emit(NULL, &err);
     ast_free(root);
     return false;
@@ -1405,3 +1438,18 @@ bool grammar_parse_ast(const Grammar* grammar,
   *out_root = root;
   return true;
 }
+
+bool grammar_parse_ast(const Grammar* grammar,
+                       Sym start_rule,
+                       const struct token* tokens,
+                       size_t token_count,
+                       AstNode** out_root) {
+  TokenView view = {.tokens = tokens, .stream = NULL};
+  return grammar_parse_ast_view(grammar, start_rule, &view, token_count, out_root);
+}
+
+bool grammar_parse_ast_stream(const Grammar* grammar, Sym start_rule, const TokenStream* stream, AstNode** out_root) {
+  if (!stream) return false;
+  TokenView view = {.tokens = NULL, .stream = stream};
+  return grammar_parse_ast_view(grammar, start_rule, &view, stream->count, out_root);
+}
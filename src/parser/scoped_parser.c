@@ -18,7 +18,7 @@ extern const char* const LEXER_KIND_SYMBOL;
 extern const char* const LEXER_KIND_EOF;
 
 #define MORPHL_SPAN_AT_CURSOR(cursor) \
-  morphl_span_from_loc(tokens[cursor].filename, tokens[cursor].row, tokens[cursor].col)
+  morphl_span_from_offset(tokens[cursor].filename, tokens[cursor].offset, tokens[cursor].offset + tokens[cursor].lexeme.len)
 
 bool scoped_parser_init(ScopedParserContext* ctx, InternTable* interns, Arena* arena, const char* filename) {
   if (!ctx || !interns || !arena) return false;
@@ -450,6 +450,7 @@ bool scoped_parse_ast(ScopedParserContext* ctx,
         return false;
       }
       (*out_root)->filename = group->filename;
+      (*out_root)->offset = group->offset;
       (*out_root)->children = group->children;
       (*out_root)->child_count = group->child_count;
       group->children = NULL;
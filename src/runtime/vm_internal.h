@@ -0,0 +1,309 @@
+#ifndef MORPHL_RUNTIME_VM_INTERNAL_H_
+#define MORPHL_RUNTIME_VM_INTERNAL_H_
+
+// Private runtime declarations shared by the loader and the execution engines.
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "runtime/runtime.h"
+
+/*
+ * Text engine values: every scalar is kept as its literal source text.
+ */
+
+typedef enum {
+    VM_VALUE_NULL,
+    VM_VALUE_LITERAL,
+    VM_VALUE_IDENT,
+    VM_VALUE_GROUP,
+} VmValueKind;
+
+typedef struct VmValue VmValue;
+
+/// Text computed at run time, shared by reference.
+typedef struct VmSharedText {
+    size_t refs;
+    char text[];
+} VmSharedText;
+
+typedef struct VmValueGroup VmValueGroup;
+
+// Copying a value only retains `owned` or `group`, so it is O(1) whatever the value holds.
+struct VmValue {
+    VmValueKind kind;
+    const char* text;       // LITERAL/IDENT: a string table entry, or owned->text
+    VmSharedText* owned;    // non-NULL when text was computed at run time
+    VmValueGroup* group;    // GROUP
+};
+
+/// Immutable group items, shared by reference.
+struct VmValueGroup {
+    size_t refs;
+    size_t count;
+    VmValue items[];
+};
+
+typedef struct {
+    const char* name;   // string table entry; the program outlives the VM
+    VmValue value;
+} VmSlot;
+
+/*
+ * Typed engine values: a small tag plus an unboxed payload.
+ */
+
+typedef enum {
+    VM_TYPED_NULL,
+    VM_TYPED_INT,
+    VM_TYPED_FLOAT,
+    VM_TYPED_BOOL,
+    VM_TYPED_STRING,    // payload is a string table index
+    VM_TYPED_IDENT,     // unresolved identifier, payload is the string table index of its name
+    VM_TYPED_GROUP,
+} VmTypedKind;
+
+typedef struct VmTypedGroup VmTypedGroup;
+
+typedef struct VmTypedValue {
+    VmTypedKind kind;
+    union {
+        int64_t i;
+        double f;
+        bool b;
+        uint32_t str;
+        VmTypedGroup* group;
+    } as;
+} VmTypedValue;
+
+// Immutable once built; shared by every value that refers to it.
+struct VmTypedGroup {
+    size_t refs;
+    size_t count;
+    VmTypedValue items[];
+};
+
+typedef struct {
+    uint32_t name_index;    // string table index of the slot name
+    VmTypedValue value;
+} VmTypedSlot;
+
+// Internal opcode appended after the last decoded instruction; never valid in a bytecode file.
+#define VM_INSTR_END 0xFF
+
+/// One decoded instruction. The loader widens and range-checks every operand once, so the engines
+/// never read raw code bytes.
+typedef struct VmInstr {
+    uint8_t op;
+    uint8_t meta_kind;                  // NODE_META: AST node kind
+    uint32_t a;                         // string/slot/constant/function index, group arity or jump target
+    union {
+        uint32_t b;                     // NODE_META: child count
+        int64_t i;                      // PUSH_CONST_I64: value of constant a; INC_LOCAL/ADD_LOCAL_CONST: amount added
+        double f;                       // PUSH_CONST_F64: value of constant a
+        const char* name;               // PUSH_IDENT/SET_SLOT: string a
+    } ref;
+} VmInstr;
+
+_Static_assert(sizeof(VmInstr) == 16, "VmInstr should stay two words wide");
+
+/// A function table entry resolved against the decoded instructions.
+typedef struct VmFunction {
+    const char* name;
+    uint32_t entry;         // index of the first instruction
+    uint32_t end;           // one past the last instruction of the body
+    uint32_t param_count;
+    uint32_t local_count;   // parameters included
+    uint32_t max_stack;     // deepest value stack the body reaches, valid when the program is verified
+} VmFunction;
+
+/// A line table entry resolved against the decoded instructions: instructions from instr up to the
+/// next entry's instr were compiled from file:row:col.
+typedef struct VmLineInfo {
+    uint32_t instr;
+    uint32_t row;
+    uint32_t col;
+    const char* file;       // points into the string table
+} VmLineInfo;
+
+struct MorphlVmProgram {
+    const uint8_t* image;           // the whole .mbc file: mmap'd when possible, otherwise one heap copy
+    size_t image_len;
+    bool image_mapped;
+    uint16_t version_major;
+    uint16_t version_minor;
+    const uint8_t* string_offsets;  // u32 LE offset of each entry within string_data
+    const uint8_t* string_data;     // entries of u32 LE length, bytes, NUL
+    uint32_t string_count;
+    const uint8_t* constants;       // constant pool entries of u8 kind plus 8-byte LE payload
+    uint32_t constant_count;
+    VmInstr* instrs;            // decoded code section, terminated by VM_INSTR_END
+    uint32_t instr_count;       // decoded instructions, excluding the terminator
+    VmFunction* functions;      // function 0 is the top-level code
+    uint32_t function_count;
+    VmLineInfo* lines;          // sorted by instr; empty for files older than format 4.3
+    uint32_t line_count;
+    bool verified;              // vm_verify_program proved stack safety; run the unchecked loop
+};
+
+#ifdef MORPHL_VM_PROFILE
+/// Count of one opcode sequence, packed one opcode per byte with the oldest in the high byte.
+typedef struct VmProfileEntry {
+    uint32_t key;
+    uint64_t count;     // 0 marks an empty slot
+} VmProfileEntry;
+
+typedef struct VmProfileTable {
+    VmProfileEntry* entries;
+    size_t count;
+    size_t capacity;    // power of two, kept at least twice count
+    uint64_t dropped;   // occurrences lost to a failed allocation
+} VmProfileTable;
+
+/// Opcode profile collected by a MORPHL_VM_PROFILE build (see morphl_vm_set_profile_output).
+typedef struct VmProfile {
+    char* path;                 // JSON output, rewritten after every morphl_vm_execute
+    uint64_t instructions;
+    uint64_t opcodes[256];
+    VmProfileTable bigrams;
+    VmProfileTable trigrams;
+    uint32_t last_index;        // instruction index recorded last
+    uint8_t prev[2];            // the two opcodes recorded last, most recent in prev[1]
+    uint8_t run;                // how many of them ran in code order up to last_index (0..2)
+} VmProfile;
+
+/// Count instruction index with opcode op as executed next.
+void vm_profile_record(VmProfile* profile, uint32_t index, uint8_t op);
+
+/// Write the profile as JSON to profile->path.
+bool vm_profile_write(const VmProfile* profile, MorphlVmEngine engine, FILE* err_stream);
+
+void vm_profile_free(VmProfile* profile);
+
+#define VM_PROFILE_RECORD(vm, index, op)                            \
+    do {                                                            \
+        if ((vm)->profile) {                                        \
+            vm_profile_record((vm)->profile, (uint32_t)(index), (op)); \
+        }                                                           \
+    } while (0)
+#else
+// Profiling is compiled out: dispatch loops carry no counters at all.
+#define VM_PROFILE_RECORD(vm, index, op) ((void)0)
+#endif
+
+/// Timer-driven sampler (see morphl_vm_set_sample_output). The signal handler only appends to
+/// words, which is allocated up front.
+typedef struct VmSampler {
+    char* path;                 // folded stacks, rewritten after every morphl_vm_execute
+    uint32_t interval_us;
+    uint32_t* words;            // each sample: depth, then depth instruction indices, innermost first
+    size_t capacity;
+    volatile size_t used;
+    volatile uint64_t dropped;  // samples that did not fit
+} VmSampler;
+
+/// Arm the interval timer for vm->sampler. Fails, with a message, if another VM is being sampled.
+bool vm_sample_start(MorphlVm* vm, FILE* err_stream);
+
+/// Disarm the timer armed by vm_sample_start, on the thread that armed it.
+void vm_sample_stop(MorphlVm* vm);
+
+/// Write vm->sampler's samples to its path as folded stacks.
+bool vm_sample_write(const MorphlVm* vm, FILE* err_stream);
+
+void vm_sampler_free(VmSampler* sampler);
+
+/// Call frames a VM can hold: deeper calls fail with a stack overflow. They are allocated with the
+/// VM, so calls never allocate.
+#define VM_MAX_CALL_DEPTH (1u << 14)
+
+/// Size of the typed engine's value stack, allocated whole before its first run. Each frame takes
+/// its locals followed by at most its verified max_stack operands.
+#define VM_TYPED_STACK_VALUES (1u << 18)
+
+typedef struct {
+    uint32_t func_index;    // index of function in program's function table
+    size_t base;            // value stack depth where the frame's operands start
+    size_t local_base;      // index of the frame's first local: in tstack (typed) or locals (text)
+    size_t return_ip;       // instruction to resume at in the caller
+    uint32_t scope_depth;   // scope depth at time of call, used for unwinding scopes on return or error
+} VmCallFrame;
+
+struct MorphlVm {
+    const MorphlVmProgram* program;
+    MorphlVmEngine engine;      // engine used by morphl_vm_execute
+    size_t ip;                  // index of the next instruction in program->instrs
+    VmValue* stack;             // Value stack (text engine)
+    size_t stack_count;
+    size_t stack_capacity;
+    VmSlot* slots;              // Named slots for variables, functions, etc. (text engine)
+    size_t slot_count;
+    size_t slot_capacity;
+    VmValue* locals;            // Frame-local slots of every active frame (text engine)
+    size_t local_count;
+    size_t local_capacity;
+    VmTypedValue* tstack;       // Value stack (typed engine): each frame's locals, then its operands
+    size_t tstack_count;
+    size_t tstack_capacity;     // VM_TYPED_STACK_VALUES once allocated; never grows
+    VmTypedSlot* tslots;        // Named slots (typed engine)
+    size_t tslot_count;
+    size_t tslot_capacity;
+    VmCallFrame* call_frames;   // Call stack, VM_MAX_CALL_DEPTH frames allocated with the VM
+    size_t call_frame_count;
+    VmSampler* sampler;         // NULL unless morphl_vm_set_sample_output asked for one
+#ifdef MORPHL_VM_PROFILE
+    VmProfile* profile;         // NULL unless morphl_vm_set_profile_output asked for one
+#endif
+};
+
+/// NUL-terminated text of string table entry index (< string_count), pointing into the image.
+static inline const char* vm_program_string(const MorphlVmProgram* program, uint32_t index) {
+    const uint8_t* at = program->string_offsets + (size_t)index * 4;
+    uint32_t offset = (uint32_t)at[0] | ((uint32_t)at[1] << 8) | ((uint32_t)at[2] << 16) | ((uint32_t)at[3] << 24);
+    return (const char*)(program->string_data + offset + 4);
+}
+
+/// Line table entry covering instruction index instr, or NULL when the program has none for it.
+const VmLineInfo* vm_program_line(const MorphlVmProgram* program, uint32_t instr);
+
+/// Index of the function whose body contains instruction index instr (< instr_count).
+uint32_t vm_program_function_at(const MorphlVmProgram* program, uint32_t instr);
+
+/// Name and operand count of a dedicated operator opcode.
+typedef struct {
+    const char* name;
+    uint8_t arity;
+} VmOperatorInfo;
+
+/// Look up an opcode in VM_OP_FIRST_OPERATOR..VM_OP_LAST_OPERATOR; NULL for any other opcode.
+const VmOperatorInfo* vm_operator_info(uint8_t opcode);
+
+/// Push a zeroed call frame. Returns NULL when VM_MAX_CALL_DEPTH frames are already active.
+VmCallFrame* vm_push_call_frame(MorphlVm* vm);
+
+/// Print a runtime diagnostic to err_stream (stderr when NULL).
+void vm_report_error(FILE* err_stream, const char* message);
+
+/// Check stack balance and compute each function's max_stack for a decoded program, following jumps. Returns false
+/// (after reporting to err_stream when non-NULL) if the code would underflow or reaches a block at two depths.
+/// Programs containing instructions without a modelled stack effect load unverified.
+bool vm_verify_program(MorphlVmProgram* program, FILE* err_stream);
+
+/// Run function func_index with the typed engine, from a clean state, passing arg_count arguments
+/// (exactly the function's param_count). Its return value is the exit code.
+morphl_exit_code_t vm_typed_execute(MorphlVm* vm,
+                                    uint32_t func_index,
+                                    const MorphlVmArg* args,
+                                    uint32_t arg_count,
+                                    FILE* err_stream);
+
+/// Release the values held by the typed engine and drop all call frames, keeping the buffers.
+void vm_typed_clear(MorphlVm* vm);
+
+/// Release all typed engine state held by the VM.
+void vm_typed_reset(MorphlVm* vm);
+
+#endif // MORPHL_RUNTIME_VM_INTERNAL_H_
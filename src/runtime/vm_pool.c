@@ -0,0 +1,295 @@
+#include "runtime/runtime.h"
+#include "vm_internal.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MORPHL_VM_HAVE_POOL_THREADS 1
+#include <pthread.h>
+#include <unistd.h>
+#else
+#define MORPHL_VM_HAVE_POOL_THREADS 0
+#endif
+
+// Run one job on vm, which is moved over to the job's program first. Every call starts from a
+// clean state, so a worker's VM can go from program to program.
+static void vm_pool_run_job(MorphlVm** vm, MorphlVmJob* job, FILE* err_stream) {
+    if (!job->program) {
+        vm_report_error(err_stream, "job has no program");
+        job->exit_code = 1;
+        return;
+    }
+    if (!*vm) {
+        *vm = morphl_vm_new(job->program);
+        if (!*vm) {
+            vm_report_error(err_stream, "failed to initialize VM");
+            job->exit_code = 1;
+            return;
+        }
+    }
+    (*vm)->program = job->program;
+    job->exit_code = morphl_vm_call(*vm, job->entry, job->args, job->arg_count, err_stream);
+}
+
+#if MORPHL_VM_HAVE_POOL_THREADS
+
+// Jobs queued on one worker. The owner takes from the back, newest first; thieves take from the
+// front, where the oldest jobs are. Jobs are short, so a lock per deque costs little next to them.
+typedef struct {
+    pthread_mutex_t lock;
+    MorphlVmJob** items;    // ring buffer
+    size_t head;            // index of the front job
+    size_t count;
+    size_t capacity;        // power of two
+} VmPoolDeque;
+
+typedef struct {
+    MorphlVmPool* pool;
+    size_t index;
+    pthread_t thread;
+    MorphlVm* vm;           // reused for every job this worker runs
+} VmPoolWorker;
+
+struct MorphlVmPool {
+    FILE* err_stream;
+    VmPoolDeque* deques;        // one per worker
+    VmPoolWorker* workers;
+    size_t worker_count;
+    atomic_size_t next_deque;   // submissions go round the deques
+    atomic_size_t queued;       // jobs in the deques
+    atomic_size_t unfinished;   // jobs submitted and not yet run
+    bool stopping;
+    pthread_mutex_t lock;       // guards stopping and sleeping on work_ready and all_done
+    pthread_cond_t work_ready;
+    pthread_cond_t all_done;
+};
+
+static bool vm_pool_deque_push(VmPoolDeque* deque, MorphlVmJob* job) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t capacity = (deque->capacity == 0) ? 64 : deque->capacity * 2;
+        MorphlVmJob** items = malloc(capacity * sizeof(MorphlVmJob*));
+        if (!items) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (size_t i = 0; i < deque->count; ++i) {
+            items[i] = deque->items[(deque->head + i) & (deque->capacity - 1)];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->items[(deque->head + deque->count) & (deque->capacity - 1)] = job;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static MorphlVmJob* vm_pool_deque_take(VmPoolDeque* deque, bool from_front) {
+    MorphlVmJob* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        if (from_front) {
+            job = deque->items[deque->head];
+            deque->head = (deque->head + 1) & (deque->capacity - 1);
+        } else {
+            job = deque->items[(deque->head + deque->count - 1) & (deque->capacity - 1)];
+        }
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Next job for worker: its own newest, or else the oldest job of another worker.
+static MorphlVmJob* vm_pool_find_job(MorphlVmPool* pool, size_t worker) {
+    MorphlVmJob* job = vm_pool_deque_take(&pool->deques[worker], false);
+    for (size_t k = 1; !job && k < pool->worker_count; ++k) {
+        job = vm_pool_deque_take(&pool->deques[(worker + k) % pool->worker_count], true);
+    }
+    if (job) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+    return job;
+}
+
+static void* vm_pool_worker_main(void* arg) {
+    VmPoolWorker* worker = arg;
+    MorphlVmPool* pool = worker->pool;
+    for (;;) {
+        MorphlVmJob* job = vm_pool_find_job(pool, worker->index);
+        if (job) {
+            vm_pool_run_job(&worker->vm, job, pool->err_stream);
+            if (atomic_fetch_sub(&pool->unfinished, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->all_done);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        // Submissions count jobs under the lock, so one queued after this check wakes us.
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        bool stopping = pool->stopping && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stopping) {
+            return NULL;
+        }
+    }
+}
+
+static void vm_pool_stop(MorphlVmPool* pool, size_t started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+static void vm_pool_release(MorphlVmPool* pool) {
+    for (size_t i = 0; i < pool->worker_count; ++i) {
+        morphl_vm_free(pool->workers[i].vm);
+        free(pool->deques[i].items);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool->deques);
+    free(pool);
+}
+
+MorphlVmPool* morphl_vm_pool_new(size_t worker_count, FILE* err_stream) {
+    if (worker_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cores > 0) ? (size_t)cores : 1;
+    }
+
+    MorphlVmPool* pool = calloc(1, sizeof(MorphlVmPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->deques = calloc(worker_count, sizeof(VmPoolDeque));
+    pool->workers = calloc(worker_count, sizeof(VmPoolWorker));
+    if (!pool->deques || !pool->workers) {
+        free(pool->deques);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pool->err_stream = err_stream;
+    pool->worker_count = worker_count;
+    atomic_init(&pool->next_deque, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->unfinished, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    for (size_t i = 0; i < worker_count; ++i) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    for (size_t i = 0; i < worker_count; ++i) {
+        if (pthread_create(&pool->workers[i].thread, NULL, vm_pool_worker_main, &pool->workers[i]) != 0) {
+            vm_pool_stop(pool, i);
+            vm_pool_release(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+size_t morphl_vm_pool_worker_count(const MorphlVmPool* pool) {
+    return pool ? pool->worker_count : 0;
+}
+
+bool morphl_vm_pool_submit(MorphlVmPool* pool, MorphlVmJob* job) {
+    if (!pool || !job) {
+        return false;
+    }
+
+    size_t target = atomic_fetch_add(&pool->next_deque, 1) % pool->worker_count;
+    atomic_fetch_add(&pool->unfinished, 1);
+    if (!vm_pool_deque_push(&pool->deques[target], job)) {
+        atomic_fetch_sub(&pool->unfinished, 1);
+        return false;
+    }
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+void morphl_vm_pool_wait(MorphlVmPool* pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->unfinished) != 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void morphl_vm_pool_free(MorphlVmPool* pool) {
+    if (!pool) {
+        return;
+    }
+    vm_pool_stop(pool, pool->worker_count);
+    vm_pool_release(pool);
+}
+
+#else
+
+// Without threads the pool runs each job as it is submitted, on the caller's thread.
+struct MorphlVmPool {
+    FILE* err_stream;
+    MorphlVm* vm;
+};
+
+MorphlVmPool* morphl_vm_pool_new(size_t worker_count, FILE* err_stream) {
+    (void)worker_count;
+    MorphlVmPool* pool = calloc(1, sizeof(MorphlVmPool));
+    if (pool) {
+        pool->err_stream = err_stream;
+    }
+    return pool;
+}
+
+size_t morphl_vm_pool_worker_count(const MorphlVmPool* pool) {
+    return pool ? 1 : 0;
+}
+
+bool morphl_vm_pool_submit(MorphlVmPool* pool, MorphlVmJob* job) {
+    if (!pool || !job) {
+        return false;
+    }
+    vm_pool_run_job(&pool->vm, job, pool->err_stream);
+    return true;
+}
+
+void morphl_vm_pool_wait(MorphlVmPool* pool) {
+    (void)pool;
+}
+
+void morphl_vm_pool_free(MorphlVmPool* pool) {
+    if (!pool) {
+        return;
+    }
+    morphl_vm_free(pool->vm);
+    free(pool);
+}
+
+#endif
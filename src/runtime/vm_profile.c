@@ -0,0 +1,267 @@
+#include "runtime/runtime.h"
+#include "vm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MORPHL_VM_PROFILE
+
+// Mnemonic of an opcode as used in profile output; NULL for bytes that are not opcodes.
+static const char* vm_opcode_mnemonic(uint8_t op) {
+    switch (op) {
+        case VM_OP_HALT: return "HALT";
+        case VM_OP_PUSH_NULL: return "PUSH_NULL";
+        case VM_OP_PUSH_LITERAL: return "PUSH_LITERAL";
+        case VM_OP_PUSH_IDENT: return "PUSH_IDENT";
+        case VM_OP_MAKE_GROUP: return "MAKE_GROUP";
+        case VM_OP_SET_SLOT: return "SET_SLOT";
+        case VM_OP_OPERATOR: return "OPERATOR";
+        case VM_OP_LOAD_LOCAL: return "LOAD_LOCAL";
+        case VM_OP_STORE_LOCAL: return "STORE_LOCAL";
+        case VM_OP_PUSH_CONST_I64: return "PUSH_CONST_I64";
+        case VM_OP_PUSH_CONST_F64: return "PUSH_CONST_F64";
+        case VM_OP_POP: return "POP";
+        case VM_OP_STORE_LOCAL_POP: return "STORE_LOCAL_POP";
+        case VM_OP_INC_LOCAL: return "INC_LOCAL";
+        case VM_OP_ADD_LOCAL_CONST: return "ADD_LOCAL_CONST";
+        case VM_OP_RET: return "RET";
+        case VM_OP_CALL: return "CALL";
+        case VM_OP_TAIL_CALL: return "TAIL_CALL";
+        case VM_OP_JUMP: return "JUMP";
+        case VM_OP_JUMP_IF_FALSE: return "JUMP_IF_FALSE";
+        case VM_OP_LOOP: return "LOOP";
+        case VM_OP_PUSH_SCOPE: return "PUSH_SCOPE";
+        case VM_OP_POP_SCOPE: return "POP_SCOPE";
+        case VM_OP_UNWIND_SCOPE: return "UNWIND_SCOPE";
+        case VM_OP_ADD: return "ADD";
+        case VM_OP_SUB: return "SUB";
+        case VM_OP_MUL: return "MUL";
+        case VM_OP_DIV: return "DIV";
+        case VM_OP_MOD: return "MOD";
+        case VM_OP_REM: return "REM";
+        case VM_OP_FADD: return "FADD";
+        case VM_OP_FSUB: return "FSUB";
+        case VM_OP_FMUL: return "FMUL";
+        case VM_OP_FDIV: return "FDIV";
+        case VM_OP_EQ: return "EQ";
+        case VM_OP_NEQ: return "NEQ";
+        case VM_OP_LT: return "LT";
+        case VM_OP_GT: return "GT";
+        case VM_OP_LTE: return "LTE";
+        case VM_OP_GTE: return "GTE";
+        case VM_OP_AND: return "AND";
+        case VM_OP_OR: return "OR";
+        case VM_OP_NOT: return "NOT";
+        case VM_OP_BAND: return "BAND";
+        case VM_OP_BOR: return "BOR";
+        case VM_OP_BXOR: return "BXOR";
+        case VM_OP_BNOT: return "BNOT";
+        case VM_OP_LSHIFT: return "LSHIFT";
+        case VM_OP_RSHIFT: return "RSHIFT";
+        case VM_OP_SET: return "SET";
+        case VM_OP_NODE_META: return "NODE_META";
+        default: return NULL;
+    }
+}
+
+// Sequence keys pack one opcode per byte, oldest first.
+static uint32_t vm_profile_hash(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x7feb352du;
+    key ^= key >> 15;
+    return key;
+}
+
+static bool vm_profile_table_grow(VmProfileTable* table) {
+    size_t capacity = (table->capacity == 0) ? 256 : table->capacity * 2;
+    VmProfileEntry* entries = calloc(capacity, sizeof(VmProfileEntry));
+    if (!entries) {
+        return false;
+    }
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].count == 0) {
+            continue;
+        }
+        size_t at = vm_profile_hash(table->entries[i].key) & (capacity - 1);
+        while (entries[at].count != 0) {
+            at = (at + 1) & (capacity - 1);
+        }
+        entries[at] = table->entries[i];
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    return true;
+}
+
+// Count one occurrence of key. A sequence that cannot be stored is counted as dropped instead.
+static void vm_profile_table_add(VmProfileTable* table, uint32_t key) {
+    if ((table->count + 1) * 2 > table->capacity && !vm_profile_table_grow(table)) {
+        table->dropped++;
+        return;
+    }
+    size_t mask = table->capacity - 1;
+    size_t at = vm_profile_hash(key) & mask;
+    while (table->entries[at].count != 0 && table->entries[at].key != key) {
+        at = (at + 1) & mask;
+    }
+    if (table->entries[at].count == 0) {
+        table->entries[at].key = key;
+        table->count++;
+    }
+    table->entries[at].count++;
+}
+
+void vm_profile_record(VmProfile* profile, uint32_t index, uint8_t op) {
+    if (op == VM_INSTR_END) {
+        return;
+    }
+    profile->instructions++;
+    profile->opcodes[op]++;
+
+    // Only instructions that are also adjacent in the code could be fused, so a taken jump, a call
+    // or a return starts a new sequence.
+    if (profile->run > 0 && index == profile->last_index + 1) {
+        vm_profile_table_add(&profile->bigrams, ((uint32_t)profile->prev[1] << 8) | op);
+        if (profile->run > 1) {
+            vm_profile_table_add(&profile->trigrams,
+                                 ((uint32_t)profile->prev[0] << 16) | ((uint32_t)profile->prev[1] << 8) | op);
+        }
+        profile->run = (profile->run < 2) ? profile->run + 1 : 2;
+    } else {
+        profile->run = 1;
+    }
+    profile->prev[0] = profile->prev[1];
+    profile->prev[1] = op;
+    profile->last_index = index;
+}
+
+static int vm_profile_entry_order(const void* lhs, const void* rhs) {
+    const VmProfileEntry* a = lhs;
+    const VmProfileEntry* b = rhs;
+    if (a->count != b->count) {
+        return (a->count < b->count) ? 1 : -1;
+    }
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+static void vm_profile_write_sequences(FILE* out, const char* name, const VmProfileTable* table, int length) {
+    fprintf(out, "  \"%s\": [", name);
+    VmProfileEntry* sorted = malloc((table->count + 1) * sizeof(VmProfileEntry));
+    size_t count = 0;
+    for (size_t i = 0; sorted && i < table->capacity; ++i) {
+        if (table->entries[i].count != 0) {
+            sorted[count++] = table->entries[i];
+        }
+    }
+    qsort(sorted, count, sizeof(VmProfileEntry), vm_profile_entry_order);
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(out, "%s\n    {\"ops\": [", (i == 0) ? "" : ",");
+        for (int k = length - 1; k >= 0; --k) {
+            const char* mnemonic = vm_opcode_mnemonic((uint8_t)(sorted[i].key >> (8 * k)));
+            fprintf(out, "%s\"%s\"", (k == length - 1) ? "" : ", ", mnemonic ? mnemonic : "?");
+        }
+        fprintf(out, "], \"count\": %llu}", (unsigned long long)sorted[i].count);
+    }
+    fprintf(out, "%s]", (count == 0) ? "" : "\n  ");
+    free(sorted);
+}
+
+bool vm_profile_write(const VmProfile* profile, MorphlVmEngine engine, FILE* err_stream) {
+    FILE* out = fopen(profile->path, "w");
+    if (!out) {
+        FILE* err = err_stream ? err_stream : stderr;
+        fprintf(err, "runtime error: cannot write opcode profile to '%s'\n", profile->path);
+        return false;
+    }
+
+    fprintf(out, "{\n  \"engine\": \"%s\",\n", (engine == MORPHL_VM_ENGINE_TEXT) ? "text" : "typed");
+    fprintf(out, "  \"instructions\": %llu,\n", (unsigned long long)profile->instructions);
+
+    fprintf(out, "  \"opcodes\": {");
+    bool first = true;
+    for (int op = 0; op < 256; ++op) {
+        if (profile->opcodes[op] != 0) {
+            const char* mnemonic = vm_opcode_mnemonic((uint8_t)op);
+            fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", mnemonic ? mnemonic : "?",
+                    (unsigned long long)profile->opcodes[op]);
+            first = false;
+        }
+    }
+    fprintf(out, "%s},\n", first ? "" : "\n  ");
+
+    fprintf(out, "  \"operators\": {");
+    first = true;
+    for (int op = VM_OP_FIRST_OPERATOR; op <= VM_OP_LAST_OPERATOR; ++op) {
+        if (profile->opcodes[op] != 0) {
+            fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", vm_operator_info((uint8_t)op)->name,
+                    (unsigned long long)profile->opcodes[op]);
+            first = false;
+        }
+    }
+    fprintf(out, "%s},\n", first ? "" : "\n  ");
+
+    vm_profile_write_sequences(out, "bigrams", &profile->bigrams, 2);
+    fprintf(out, ",\n");
+    vm_profile_write_sequences(out, "trigrams", &profile->trigrams, 3);
+    fprintf(out, ",\n  \"dropped_sequences\": %llu\n}\n",
+            (unsigned long long)(profile->bigrams.dropped + profile->trigrams.dropped));
+
+    bool ok = !ferror(out);
+    ok = (fclose(out) == 0) && ok;
+    if (!ok) {
+        vm_report_error(err_stream, "failed to write opcode profile");
+    }
+    return ok;
+}
+
+void vm_profile_free(VmProfile* profile) {
+    if (!profile) {
+        return;
+    }
+    free(profile->path);
+    free(profile->bigrams.entries);
+    free(profile->trigrams.entries);
+    free(profile);
+}
+
+bool morphl_vm_profile_available(void) {
+    return true;
+}
+
+bool morphl_vm_set_profile_output(MorphlVm* vm, const char* path) {
+    if (!vm) {
+        return false;
+    }
+    vm_profile_free(vm->profile);
+    vm->profile = NULL;
+    if (!path) {
+        return true;
+    }
+
+    VmProfile* profile = calloc(1, sizeof(VmProfile));
+    size_t len = strlen(path);
+    char* copy = malloc(len + 1);
+    if (!profile || !copy) {
+        free(profile);
+        free(copy);
+        return false;
+    }
+    memcpy(copy, path, len + 1);
+    profile->path = copy;
+    vm->profile = profile;
+    return true;
+}
+
+#else
+
+bool morphl_vm_profile_available(void) {
+    return false;
+}
+
+bool morphl_vm_set_profile_output(MorphlVm* vm, const char* path) {
+    (void)vm;
+    return path == NULL;
+}
+
+#endif
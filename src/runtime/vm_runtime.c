@@ -1,117 +1,100 @@
 #include "runtime/runtime.h"
+#include "vm_internal.h"
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MORPHL_VM_MAGIC "MVMB"
-
-
-
-typedef enum {
-    VM_VALUE_NULL,
-    VM_VALUE_LITERAL,
-    VM_VALUE_IDENT,
-    VM_VALUE_GROUP,
-} VmValueKind;
-
-typedef struct VmValue VmValue;
-
-struct VmValue {
-    VmValueKind kind;
-    char* text;
-    VmValue* items;
-    size_t item_count;
+#if defined(__unix__) || defined(__APPLE__)
+#define MORPHL_VM_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MORPHL_VM_HAVE_MMAP 0
+#endif
+
+// Indexed by opcode - VM_OP_FIRST_OPERATOR.
+static const VmOperatorInfo kVmOperators[] = {
+    {"$add", 2},
+    {"$sub", 2},
+    {"$mul", 2},
+    {"$div", 2},
+    {"$mod", 2},
+    {"$rem", 2},
+    {"$fadd", 2},
+    {"$fsub", 2},
+    {"$fmul", 2},
+    {"$fdiv", 2},
+    {"$eq", 2},
+    {"$neq", 2},
+    {"$lt", 2},
+    {"$gt", 2},
+    {"$lte", 2},
+    {"$gte", 2},
+    {"$and", 2},
+    {"$or", 2},
+    {"$not", 1},
+    {"$band", 2},
+    {"$bor", 2},
+    {"$bxor", 2},
+    {"$bnot", 1},
+    {"$lshift", 2},
+    {"$rshift", 2},
+    {"$set", 2},
 };
 
-typedef struct {
-    char* name;
-    VmValue value;
-} VmSlot;
-
-struct MorphlVmProgram {
-    uint16_t version_major;
-    uint16_t version_minor;
-    char** strings;
-    uint32_t string_count;
-    uint8_t* code;
-    uint32_t code_len;
-};
+_Static_assert(sizeof(kVmOperators) / sizeof(kVmOperators[0]) == VM_OP_LAST_OPERATOR - VM_OP_FIRST_OPERATOR + 1,
+               "kVmOperators must cover every operator opcode");
 
-typedef struct {
-    uint32_t func_index;    // index of function in program's function table
-    size_t ip;              // entry point in code
-    size_t base;            // base index in value stack for this call frame
-    size_t local_base;      // base index in slot list for this call frame's local variables
-    size_t return_ip;       // instruction pointer to return to after call
-    size_t return_base;     // base index in value stack to restore after call
-    size_t return_local_base; // base index in slot list to restore after call
-    uint32_t scope_depth;   // scope depth at time of call, used for unwinding scopes on return or error
-} VmCallFrame;
-
-struct MorphlVm {
-    const MorphlVmProgram* program;
-    size_t ip;                  // instruction pointer
-    VmValue* stack;             // Value stack
-    size_t stack_count;
-    size_t stack_capacity;
-    VmSlot* slots;              // Named slots for variables, functions, etc.
-    size_t slot_count;
-    size_t slot_capacity;
-    VmCallFrame* call_frames;   // Call stack
-    size_t call_frame_count;
-    size_t call_frame_capacity;
-};
+const VmOperatorInfo* vm_operator_info(uint8_t opcode) {
+    if (opcode < VM_OP_FIRST_OPERATOR || opcode > VM_OP_LAST_OPERATOR) {
+        return NULL;
+    }
+    return &kVmOperators[opcode - VM_OP_FIRST_OPERATOR];
+}
 
+
+// Release value's reference to its text or group; the last release frees it.
 static void vm_value_free(VmValue* value) {
     if (!value) {
         return;
     }
-    free(value->text);
-    value->text = NULL;
-    for (size_t i = 0; i < value->item_count; ++i) {
-        vm_value_free(&value->items[i]);
+    if (value->owned && --value->owned->refs == 0) {
+        free(value->owned);
     }
-    free(value->items);
-    value->items = NULL;
-    value->item_count = 0;
-    value->kind = VM_VALUE_NULL;
-}
-
-static bool vm_value_copy(const VmValue* src, VmValue* dst) {
-    memset(dst, 0, sizeof(*dst));
-    dst->kind = src->kind;
-
-    if (src->text) {
-        size_t n = strlen(src->text);
-        dst->text = malloc(n + 1);
-        if (!dst->text) {
-            return false;
+    if (value->group && --value->group->refs == 0) {
+        for (size_t i = 0; i < value->group->count; ++i) {
+            vm_value_free(&value->group->items[i]);
         }
-        memcpy(dst->text, src->text, n + 1);
+        free(value->group);
     }
+    memset(value, 0, sizeof(*value));
+}
 
-    if (src->item_count > 0) {
-        dst->items = calloc(src->item_count, sizeof(VmValue));
-        if (!dst->items) {
-            vm_value_free(dst);
-            return false;
-        }
-
-        for (size_t i = 0; i < src->item_count; ++i) {
-            if (!vm_value_copy(&src->items[i], &dst->items[i])) {
-                for (size_t j = 0; j < i; ++j) {
-                    vm_value_free(&dst->items[j]);
-                }
-                free(dst->items);
-                dst->items = NULL;
-                vm_value_free(dst);
-                return false;
-            }
-        }
-        dst->item_count = src->item_count;
+// Return another reference to src without copying its text or items.
+static VmValue vm_value_share(const VmValue* src) {
+    if (src->owned) {
+        src->owned->refs++;
+    }
+    if (src->group) {
+        src->group->refs++;
     }
+    return *src;
+}
 
+// Build a literal holding a heap copy of text. Returns false on OOM.
+static bool vm_value_new_literal(const char* text, size_t len, VmValue* out) {
+    VmSharedText* owned = malloc(sizeof(VmSharedText) + len + 1);
+    if (!owned) {
+        return false;
+    }
+    owned->refs = 1;
+    memcpy(owned->text, text, len);
+    owned->text[len] = '\0';
+    *out = (VmValue){.kind = VM_VALUE_LITERAL, .text = owned->text, .owned = owned, .group = NULL};
     return true;
 }
 
@@ -136,7 +119,7 @@ static bool read_u32(const uint8_t* bytes, size_t len, size_t* off, uint32_t* ou
     return true;
 }
 
-static void report_error(FILE* err_stream, const char* message) {
+void vm_report_error(FILE* err_stream, const char* message) {
     FILE* out = err_stream ? err_stream : stderr;
     fprintf(out, "runtime error: %s\n", message);
 }
@@ -167,12 +150,7 @@ static bool vm_stack_push(MorphlVm* vm, const VmValue* value) {
         vm->stack_capacity = new_capacity;
     }
 
-    VmValue copy = {0};
-    if (!vm_value_copy(value, &copy)) {
-        return false;
-    }
-
-    vm->stack[vm->stack_count++] = copy;
+    vm->stack[vm->stack_count++] = vm_value_share(value);
     return true;
 }
 
@@ -191,7 +169,8 @@ static bool vm_set_slot(MorphlVm* vm, const char* name, const VmValue* value) {
     for (size_t i = 0; i < vm->slot_count; ++i) {
         if (strcmp(vm->slots[i].name, name) == 0) {
             vm_value_free(&vm->slots[i].value);
-            return vm_value_copy(value, &vm->slots[i].value);
+            vm->slots[i].value = vm_value_share(value);
+            return true;
         }
     }
 
@@ -205,20 +184,8 @@ static bool vm_set_slot(MorphlVm* vm, const char* name, const VmValue* value) {
         vm->slot_capacity = new_capacity;
     }
 
-    char* dup_name = malloc(strlen(name) + 1);
-    if (!dup_name) {
-        return false;
-    }
-    strcpy(dup_name, name);
-
-    VmValue copy = {0};
-    if (!vm_value_copy(value, &copy)) {
-        free(dup_name);
-        return false;
-    }
-
-    vm->slots[vm->slot_count].name = dup_name;
-    vm->slots[vm->slot_count].value = copy;
+    vm->slots[vm->slot_count].name = name;
+    vm->slots[vm->slot_count].value = vm_value_share(value);
     vm->slot_count++;
     return true;
 }
@@ -239,14 +206,27 @@ static bool vm_value_to_number(const VmValue* value, double* out_num) {
     return true;
 }
 
-static bool vm_execute_operator(MorphlVm* vm, const char* op_name, FILE* err_stream) {
-    if (strcmp(op_name, "$add") == 0) {
+// Branch condition in the text engine, which has no booleans: null, the literal `false` and any
+// literal that parses as zero are false; everything else is true.
+static bool vm_value_truthy(const VmValue* value) {
+    if (!value || value->kind == VM_VALUE_NULL) {
+        return false;
+    }
+    if (value->kind == VM_VALUE_LITERAL && value->text && strcmp(value->text, "false") == 0) {
+        return false;
+    }
+    double number = 0;
+    return !vm_value_to_number(value, &number) || number != 0;
+}
+
+static bool vm_execute_operator(MorphlVm* vm, uint8_t op, FILE* err_stream) {
+    if (op == VM_OP_ADD) {
         VmValue rhs = {0};
         VmValue lhs = {0};
         if (!vm_stack_pop(vm, &rhs) || !vm_stack_pop(vm, &lhs)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "$add requires two operands");
+            vm_report_error(err_stream, "$add requires two operands");
             return false;
         }
 
@@ -258,7 +238,7 @@ static bool vm_execute_operator(MorphlVm* vm, const char* op_name, FILE* err_str
         if (!vm_value_to_number(lhs_resolved, &lhs_num) || !vm_value_to_number(rhs_resolved, &rhs_num)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "$add currently supports numeric literal operands only");
+            vm_report_error(err_stream, "$add currently supports numeric literal operands only");
             return false;
         }
 
@@ -267,55 +247,49 @@ static bool vm_execute_operator(MorphlVm* vm, const char* op_name, FILE* err_str
         if (written <= 0 || (size_t)written >= sizeof(buffer)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "failed to format $add result");
+            vm_report_error(err_stream, "failed to format $add result");
             return false;
         }
 
-        VmValue result = {
-            .kind = VM_VALUE_LITERAL,
-            .text = malloc((size_t)written + 1),
-            .items = NULL,
-            .item_count = 0,
-        };
-        if (!result.text) {
+        VmValue result = {0};
+        if (!vm_value_new_literal(buffer, (size_t)written, &result)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "out of memory building $add result");
+            vm_report_error(err_stream, "out of memory building $add result");
             return false;
         }
-        memcpy(result.text, buffer, (size_t)written + 1);
 
         bool ok = vm_stack_push(vm, &result);
         vm_value_free(&result);
         vm_value_free(&rhs);
         vm_value_free(&lhs);
         if (!ok) {
-            report_error(err_stream, "out of memory pushing $add result");
+            vm_report_error(err_stream, "out of memory pushing $add result");
         }
         return ok;
     }
 
-    if (strcmp(op_name, "$set") == 0) {
+    if (op == VM_OP_SET) {
         VmValue rhs = {0};
         VmValue lhs = {0};
         if (!vm_stack_pop(vm, &rhs) || !vm_stack_pop(vm, &lhs)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "$set requires identifier and value operands");
+            vm_report_error(err_stream, "$set requires identifier and value operands");
             return false;
         }
 
         if (lhs.kind != VM_VALUE_IDENT || !lhs.text) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "$set lhs must be an identifier");
+            vm_report_error(err_stream, "$set lhs must be an identifier");
             return false;
         }
 
         if (!vm_set_slot(vm, lhs.text, &rhs)) {
             vm_value_free(&rhs);
             vm_value_free(&lhs);
-            report_error(err_stream, "failed to write slot during $set");
+            vm_report_error(err_stream, "failed to write slot during $set");
             return false;
         }
 
@@ -323,7 +297,7 @@ static bool vm_execute_operator(MorphlVm* vm, const char* op_name, FILE* err_str
         vm_value_free(&rhs);
         vm_value_free(&lhs);
         if (!ok) {
-            report_error(err_stream, "out of memory pushing $set result");
+            vm_report_error(err_stream, "out of memory pushing $set result");
         }
         return ok;
     }
@@ -332,453 +306,1000 @@ static bool vm_execute_operator(MorphlVm* vm, const char* op_name, FILE* err_str
         FILE* out = err_stream ? err_stream : stderr;
         fprintf(out,
                 "runtime error: unsupported operator '%s' (supported in V0.1: $add, $set)\n",
-                op_name);
+                vm_operator_info(op)->name);
     }
     return false;
 }
 
-static bool vm_return(MorphlVm* vm, FILE* err_stream) {
-    // Unwind active scopes in the current call frame
-    if (vm->call_frame_count == 0) {
-        // No call frame to return from - i.e. return from top-level code. should be handled by caller (e.g. morphl_vm_execute)
-        // and not here so throw an error
-        report_error(err_stream, "attempted to return from top-level code");
-        return false;
+VmCallFrame* vm_push_call_frame(MorphlVm* vm) {
+    if (vm->call_frame_count == VM_MAX_CALL_DEPTH) {
+        return NULL;
     }
+    VmCallFrame* frame = &vm->call_frames[vm->call_frame_count];
+    memset(frame, 0, sizeof(*frame));
+    // The sampler reads every counted frame, so this one is zeroed before it is counted.
+    atomic_signal_fence(memory_order_release);
+    vm->call_frame_count++;
+    return frame;
+}
+
+// Return from the current (non-main) frame: its stack values and locals are released and the
+// resolved return value is pushed for the caller.
+static bool vm_return(MorphlVm* vm, FILE* err_stream) {
     VmCallFrame* frame = &vm->call_frames[vm->call_frame_count - 1];
 
-    // get top value on stack as return value
-    VmValue return_value = {0};
-    if (!vm_stack_pop(vm, &return_value)) {
-        report_error(err_stream, "stack underflow while trying to return value");
+    VmValue top = {0};
+    if (!vm_stack_pop(vm, &top)) {
+        vm_report_error(err_stream, "stack underflow while trying to return value");
         return false;
     }
+    // Identifiers are resolved before the callee's state goes away.
+    VmValue return_value = vm_value_share(vm_resolve_value(vm, &top));
+    vm_value_free(&top);
 
-    // Clean up slots created in this call frame
-    while (vm->slot_count > frame->base) {
-        vm_value_free(&vm->slots[--vm->slot_count].value);
-        free(vm->slots[vm->slot_count].name);
-        vm->slots[vm->slot_count].name = NULL;
+    while (vm->stack_count > frame->base) {
+        vm_value_free(&vm->stack[--vm->stack_count]);
+    }
+    while (vm->local_count > frame->local_base) {
+        vm_value_free(&vm->locals[--vm->local_count]);
     }
 
-    // Pop call frame
-    vm->call_frame_count--;
-
-    // Jump back to return address
     vm->ip = frame->return_ip;
+    vm->call_frame_count--;
 
-    // Push return value onto stack
-    if (!vm_stack_push(vm, &return_value)) {
-        vm_value_free(&return_value);
-        report_error(err_stream, "out of memory pushing return value onto stack");
-        return false;
+    bool ok = vm_stack_push(vm, &return_value);
+    vm_value_free(&return_value);
+    if (!ok) {
+        vm_report_error(err_stream, "out of memory pushing return value onto stack");
     }
-
-    return true;
+    return ok;
 }
 
-// Call a function by index, pushing a new call frame. Returns true on success, false on error.
-// TODO: finish implementing argument passing and function entry point lookup. For now just pushes a new call frame with ip set to 0 so it's possible to call into main function at index 0.
+// Call function func_index (range-checked by the loader): its arguments move from the stack into
+// the first locals of a new frame and execution continues at the function's entry point.
 static bool vm_call(MorphlVm* vm, uint32_t func_index, FILE* err_stream) {
-    // record return point
-    size_t return_ip = vm->ip + 4; // return to instruction after the call
-    size_t return_base = vm->stack_count;
-    size_t return_local_base = vm->slot_count;
-
-    // allocate new call frame
-    if (vm->call_frame_count == vm->call_frame_capacity) {
-        size_t new_capacity = (vm->call_frame_capacity == 0) ? 16 : vm->call_frame_capacity * 2;
-        VmCallFrame* grown = realloc(vm->call_frames, new_capacity * sizeof(VmCallFrame));
-        if (!grown) {
+    const VmFunction* fn = &vm->program->functions[func_index];
+    if (vm->stack_count < fn->param_count) {
+        vm_report_error(err_stream, "CALL requires the function's arguments on stack");
+        return false;
+    }
+
+    size_t local_base = vm->local_count;
+    size_t needed = local_base + fn->local_count;
+    if (needed > vm->local_capacity) {
+        size_t new_capacity = vm->local_capacity ? vm->local_capacity * 2 : 16;
+        if (new_capacity < needed) {
+            new_capacity = needed;
+        }
+        VmValue* locals = realloc(vm->locals, new_capacity * sizeof(VmValue));
+        if (!locals) {
+            vm_report_error(err_stream, "out of memory allocating locals");
             return false;
         }
-        vm->call_frames = grown;
-        vm->call_frame_capacity = new_capacity;
+        vm->locals = locals;
+        vm->local_capacity = new_capacity;
+    }
+    memset(&vm->locals[local_base], 0, fn->local_count * sizeof(VmValue));
+
+    VmCallFrame* frame = vm_push_call_frame(vm);
+    if (!frame) {
+        vm_report_error(err_stream, "call stack overflow");
+        return false;
+    }
+
+    VmValue* args = &vm->stack[vm->stack_count - fn->param_count];
+    for (uint32_t i = 0; i < fn->param_count; ++i) {
+        vm->locals[local_base + i] = vm_value_share(vm_resolve_value(vm, &args[i]));
+        vm_value_free(&args[i]);
     }
-    VmCallFrame* frame = &vm->call_frames[vm->call_frame_count++];
+    vm->stack_count -= fn->param_count;
+    vm->local_count = local_base + fn->local_count;
+
     frame->func_index = func_index;
-    frame->return_ip = return_ip;
-    frame->return_base = return_base;
-    frame->return_local_base = return_local_base;
-    frame->ip = 0; // will be set to function entry point after we read it from the program
     frame->base = vm->stack_count;
-    frame->local_base = vm->slot_count;
-    frame->scope_depth = vm->call_frame_count ? vm->call_frames[vm->call_frame_count - 2].scope_depth + 1 : 0;
+    frame->local_base = local_base;
+    frame->return_ip = vm->ip;
+    frame->scope_depth = (vm->call_frame_count > 1) ? frame[-1].scope_depth + 1 : 0;
+    vm->ip = fn->entry;
+    return true;
+}
+
+// Call func_index in place of the current frame: the caller's operands below the arguments and its
+// locals are released and the frame is popped, so the callee returns straight to the caller's caller.
+static bool vm_tail_call(MorphlVm* vm, uint32_t func_index, FILE* err_stream) {
+    const VmFunction* fn = &vm->program->functions[func_index];
+    const VmCallFrame* frame = &vm->call_frames[vm->call_frame_count - 1];
+    if (vm->stack_count < frame->base + fn->param_count) {
+        vm_report_error(err_stream, "TAIL_CALL requires the function's arguments on stack");
+        return false;
+    }
 
-    // TODO: read function entry point from program's function table using func_index and set frame->ip to it. For now just set to 0 to make it possible to call into main function at index 0.
-    frame->ip = 0;
+    size_t args_at = vm->stack_count - fn->param_count;
+    for (size_t i = frame->base; i < args_at; ++i) {
+        vm_value_free(&vm->stack[i]);
+    }
+    memmove(&vm->stack[frame->base], &vm->stack[args_at], fn->param_count * sizeof(VmValue));
+    vm->stack_count = frame->base + fn->param_count;
+    while (vm->local_count > frame->local_base) {
+        vm_value_free(&vm->locals[--vm->local_count]);
+    }
+
+    vm->ip = frame->return_ip;
+    vm->call_frame_count--;
+    return vm_call(vm, func_index, err_stream);
+}
 
-    // TODO: copy arguments from stack to callee's local variable slots
-    (void)err_stream;
-    
+// Release the values a previous text-engine run left behind and rewind to the first instruction.
+// The stack, slot and local buffers are kept for the next run.
+static void vm_text_clear(MorphlVm* vm) {
+    for (size_t i = 0; i < vm->stack_count; ++i) {
+        vm_value_free(&vm->stack[i]);
+    }
+    vm->stack_count = 0;
 
-    return true;
+    for (size_t i = 0; i < vm->slot_count; ++i) {
+        vm_value_free(&vm->slots[i].value);
+    }
+    vm->slot_count = 0;
+
+    for (size_t i = 0; i < vm->local_count; ++i) {
+        vm_value_free(&vm->locals[i]);
+    }
+    vm->local_count = 0;
+
+    vm->call_frame_count = 0;
+    vm->ip = 0;
 }
 
-// Initialize the main call frame and set the instruction pointer to the entry point. Returns true on success, false on error.
+// Push the frame of function 0 and allocate its locals. The VM must have been cleared.
 static bool vm_init_call_frame(MorphlVm* vm, FILE* err_stream) {
-    if (vm->call_frame_count == vm->call_frame_capacity) {
-        size_t new_capacity = (vm->call_frame_capacity == 0) ? 16 : vm->call_frame_capacity * 2;
-        VmCallFrame* grown = realloc(vm->call_frames, new_capacity * sizeof(VmCallFrame));
-        if (!grown) {
-            report_error(err_stream, "out of memory allocating call frames");
+    if (!vm_push_call_frame(vm)) {
+        vm_report_error(err_stream, "call stack overflow");
+        return false;
+    }
+
+    uint32_t local_count = vm->program->functions[0].local_count;
+    if (local_count > vm->local_capacity) {
+        VmValue* locals = realloc(vm->locals, local_count * sizeof(VmValue));
+        if (!locals) {
+            vm_report_error(err_stream, "out of memory allocating locals");
             return false;
         }
-        vm->call_frames = grown;
-        vm->call_frame_capacity = new_capacity;
+        vm->locals = locals;
+        vm->local_capacity = local_count;
     }
-    VmCallFrame* frame = &vm->call_frames[vm->call_frame_count++];
-    frame->func_index = 0; // main function is always at index 0
-    frame->return_ip = 0;
-    frame->base = 0;
-    frame->local_base = 0;
-    frame->scope_depth = 0;
-
-    frame->ip = vm->ip;
-
+    if (local_count > 0) {
+        memset(vm->locals, 0, local_count * sizeof(VmValue));
+    }
+    vm->local_count = local_count;
     return true;
 }
 
-bool morphl_vm_program_load(const char* path, MorphlVmProgram** out_program) {
-    if (!path || !out_program) {
+static bool vm_decode_fail(FILE* err_stream, const char* message, size_t offset) {
+    if (err_stream) {
+        fprintf(err_stream, "runtime error: %s at code offset %zu\n", message, offset);
+    }
+    return false;
+}
+
+// Decode the code section into program->instrs, ending with a VM_INSTR_END sentinel. Every operand
+// that does not depend on the function table is range-checked here, so the engines never re-read
+// raw bytes or repeat those checks. starts[i] receives the code offset of instruction i. Opcodes and
+// operators the engines cannot run are rejected.
+static bool vm_decode_code(MorphlVmProgram* program,
+                           const uint8_t* code,
+                           size_t code_len,
+                           uint32_t* starts,
+                           FILE* err_stream) {
+    // Every instruction takes at least one byte, so code_len + 1 entries always suffice.
+    VmInstr* instrs = calloc(code_len + 1, sizeof(VmInstr));
+    if (!instrs) {
         return false;
     }
+    program->instrs = instrs;
 
-    *out_program = NULL;
+    size_t off = 0;
+    uint32_t count = 0;
+    while (off < code_len) {
+        size_t start = off;
+        starts[count] = (uint32_t)start;
+        VmInstr* in = &instrs[count++];
+        in->op = code[off++];
+        if (vm_operator_info(in->op)) {
+            continue;
+        }
 
-    FILE* file = fopen(path, "rb");
-    if (!file) {
+        switch (in->op) {
+            case VM_OP_HALT:
+            case VM_OP_PUSH_NULL:
+            case VM_OP_POP:
+            case VM_OP_RET:
+            case VM_OP_PUSH_SCOPE:
+            case VM_OP_POP_SCOPE:
+                break;
+            case VM_OP_PUSH_LITERAL:
+            case VM_OP_PUSH_IDENT:
+            case VM_OP_SET_SLOT:
+                if (!read_u32(code, code_len, &off, &in->a)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                if (in->a >= program->string_count) {
+                    return vm_decode_fail(err_stream, "string index out of bounds", start);
+                }
+                if (in->op != VM_OP_PUSH_LITERAL) {
+                    in->ref.name = vm_program_string(program, in->a);
+                }
+                break;
+            case VM_OP_PUSH_CONST_I64:
+            case VM_OP_PUSH_CONST_F64:
+            case VM_OP_ADD_LOCAL_CONST: {
+                // ADD_LOCAL_CONST keeps its slot in a; the constant index follows it.
+                uint32_t const_index = 0;
+                if (!read_u32(code, code_len, &off, &in->a) ||
+                    (in->op == VM_OP_ADD_LOCAL_CONST && !read_u32(code, code_len, &off, &const_index))) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                if (in->op != VM_OP_ADD_LOCAL_CONST) {
+                    const_index = in->a;
+                }
+                if (const_index >= program->constant_count) {
+                    return vm_decode_fail(err_stream, "constant index out of bounds", start);
+                }
+                // Copy the payload into the instruction so the push needs no pool lookup.
+                const uint8_t* entry = program->constants + (size_t)const_index * VM_CONST_ENTRY_SIZE;
+                uint8_t expected = (in->op == VM_OP_PUSH_CONST_F64) ? VM_CONST_F64 : VM_CONST_I64;
+                if (entry[0] != expected) {
+                    return vm_decode_fail(err_stream, "constant kind does not match opcode", start);
+                }
+                uint64_t bits = 0;
+                for (int i = 7; i >= 0; --i) {
+                    bits = (bits << 8) | entry[1 + i];
+                }
+                if (in->op != VM_OP_PUSH_CONST_F64) {
+                    memcpy(&in->ref.i, &bits, sizeof(bits));
+                } else {
+                    memcpy(&in->ref.f, &bits, sizeof(bits));
+                }
+                break;
+            }
+            case VM_OP_LOAD_LOCAL:
+            case VM_OP_STORE_LOCAL:
+            case VM_OP_STORE_LOCAL_POP:
+            case VM_OP_MAKE_GROUP:
+            case VM_OP_CALL:
+            case VM_OP_TAIL_CALL:
+            case VM_OP_UNWIND_SCOPE:
+                if (!read_u32(code, code_len, &off, &in->a)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                break;
+            case VM_OP_INC_LOCAL:
+                if (!read_u32(code, code_len, &off, &in->a)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                // Runs as ADD_LOCAL_CONST with a constant of 1.
+                in->ref.i = 1;
+                break;
+            case VM_OP_JUMP:
+            case VM_OP_JUMP_IF_FALSE:
+            case VM_OP_LOOP: {
+                // a holds the target code offset until vm_resolve_functions maps it to an instruction.
+                uint32_t delta = 0;
+                if (!read_u32(code, code_len, &off, &delta)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                if ((in->op == VM_OP_LOOP) ? (delta > off) : (delta >= code_len - off)) {
+                    return vm_decode_fail(err_stream, "jump target out of bounds", start);
+                }
+                in->a = (uint32_t)((in->op == VM_OP_LOOP) ? off - delta : off + delta);
+                break;
+            }
+            case VM_OP_OPERATOR:
+                if (!read_u32(code, code_len, &off, &in->a)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                if (err_stream) {
+                    fprintf(err_stream,
+                            "runtime error: unsupported operator '%s'\n",
+                            (in->a < program->string_count) ? vm_program_string(program, in->a) : "<invalid>");
+                }
+                return false;
+            case VM_OP_NODE_META:
+                if (off >= code_len) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                in->meta_kind = code[off++];
+                if (!read_u32(code, code_len, &off, &in->a) || !read_u32(code, code_len, &off, &in->ref.b)) {
+                    return vm_decode_fail(err_stream, "truncated operand", start);
+                }
+                break;
+            default:
+                if (err_stream) {
+                    fprintf(err_stream, "runtime error: unknown opcode 0x%02X at code offset %zu\n", in->op, start);
+                }
+                return false;
+        }
+    }
+
+    instrs[count].op = VM_INSTR_END;
+    program->instr_count = count;
+    VmInstr* shrunk = realloc(instrs, ((size_t)count + 1) * sizeof(VmInstr));
+    if (shrunk) {
+        program->instrs = shrunk;
+    }
+    return true;
+}
+
+// Index of the instruction starting at code offset, or UINT32_MAX if offset is inside an instruction.
+static uint32_t vm_instr_at(const uint32_t* starts, uint32_t count, uint32_t offset) {
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (starts[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < count && starts[lo] == offset) ? lo : UINT32_MAX;
+}
+
+// Resolve the raw function table against the decoded code. Function 0 must start at offset 0 and
+// entry points must increase, so each body ends where the next one starts.
+static bool vm_resolve_functions(MorphlVmProgram* program,
+                                 const uint8_t* table,
+                                 const uint32_t* starts,
+                                 FILE* err_stream) {
+    program->functions = calloc(program->function_count, sizeof(VmFunction));
+    if (!program->functions) {
         return false;
     }
+    // vm_bind_function_table already checked that the whole table is inside the image.
+    size_t table_len = (size_t)program->function_count * VM_FUNCTION_ENTRY_SIZE;
+    for (uint32_t i = 0; i < program->function_count; ++i) {
+        size_t off = (size_t)i * VM_FUNCTION_ENTRY_SIZE;
+        uint32_t name_index = 0;
+        uint32_t entry_point = 0;
+        VmFunction* fn = &program->functions[i];
+        read_u32(table, table_len, &off, &name_index);
+        read_u32(table, table_len, &off, &entry_point);
+        read_u32(table, table_len, &off, &fn->param_count);
+        read_u32(table, table_len, &off, &fn->local_count);
+        if (name_index >= program->string_count || fn->param_count > fn->local_count) {
+            return vm_decode_fail(err_stream, "malformed function table entry", i);
+        }
+        fn->name = vm_program_string(program, name_index);
+        fn->entry = vm_instr_at(starts, program->instr_count, entry_point);
+        if (fn->entry == UINT32_MAX || (i == 0 && fn->entry != 0) || (i > 0 && fn->entry <= fn[-1].entry)) {
+            return vm_decode_fail(err_stream, "function entry point is not an instruction boundary in order", entry_point);
+        }
+        if (i > 0) {
+            fn[-1].end = fn->entry;
+        }
+    }
+    program->functions[program->function_count - 1].end = program->instr_count;
+
+    // Local slots, call targets and jump targets are checked against the function each instruction
+    // belongs to; a jump never leaves its function.
+    for (uint32_t f = 0; f < program->function_count; ++f) {
+        const VmFunction* fn = &program->functions[f];
+        for (uint32_t i = fn->entry; i < fn->end; ++i) {
+            VmInstr* in = &program->instrs[i];
+            if (in->op == VM_OP_JUMP || in->op == VM_OP_JUMP_IF_FALSE || in->op == VM_OP_LOOP) {
+                uint32_t target = vm_instr_at(starts, program->instr_count, in->a);
+                if (target == UINT32_MAX || target < fn->entry || target >= fn->end) {
+                    return vm_decode_fail(err_stream, "jump target is not an instruction of the same function", starts[i]);
+                }
+                in->a = target;
+            }
+            bool uses_local = in->op == VM_OP_LOAD_LOCAL || in->op == VM_OP_STORE_LOCAL || in->op == VM_OP_STORE_LOCAL_POP ||
+                              in->op == VM_OP_INC_LOCAL || in->op == VM_OP_ADD_LOCAL_CONST;
+            if (uses_local && in->a >= fn->local_count) {
+                return vm_decode_fail(err_stream, "local slot out of bounds", starts[i]);
+            }
+            if ((in->op == VM_OP_CALL || in->op == VM_OP_TAIL_CALL) && in->a >= program->function_count) {
+                return vm_decode_fail(err_stream, "function index out of bounds", starts[i]);
+            }
+        }
+    }
+    return true;
+}
 
-    if (fseek(file, 0, SEEK_END) != 0) {
-        fclose(file);
+// Resolve the raw line table against the decoded code. Entries must start at instructions in
+// increasing order and name their file by string table index.
+static bool vm_resolve_lines(MorphlVmProgram* program,
+                             const uint8_t* table,
+                             uint32_t line_count,
+                             const uint32_t* starts,
+                             FILE* err_stream) {
+    if (line_count == 0) {
+        return true;
+    }
+    program->lines = calloc(line_count, sizeof(VmLineInfo));
+    if (!program->lines) {
         return false;
     }
+    size_t table_len = (size_t)line_count * VM_LINE_ENTRY_SIZE;
+    for (uint32_t i = 0; i < line_count; ++i) {
+        size_t off = (size_t)i * VM_LINE_ENTRY_SIZE;
+        uint32_t offset = 0;
+        uint32_t file_index = 0;
+        VmLineInfo* line = &program->lines[i];
+        read_u32(table, table_len, &off, &offset);
+        read_u32(table, table_len, &off, &file_index);
+        read_u32(table, table_len, &off, &line->row);
+        read_u32(table, table_len, &off, &line->col);
+        line->instr = vm_instr_at(starts, program->instr_count, offset);
+        if (line->instr == UINT32_MAX || (i > 0 && line->instr <= line[-1].instr) || file_index >= program->string_count) {
+            return vm_decode_fail(err_stream, "malformed line table entry", i);
+        }
+        line->file = vm_program_string(program, file_index);
+    }
+    program->line_count = line_count;
+    return true;
+}
 
-    long file_size = ftell(file);
-    if (file_size < 0) {
-        fclose(file);
+// Decode the code section and bind it to the function and line tables.
+static bool vm_load_code(MorphlVmProgram* program,
+                         const uint8_t* code,
+                         size_t code_len,
+                         const uint8_t* function_table,
+                         const uint8_t* line_table,
+                         uint32_t line_count,
+                         FILE* err_stream) {
+    uint32_t* starts = malloc((code_len + 1) * sizeof(uint32_t));
+    bool ok = starts != NULL &&
+              vm_decode_code(program, code, code_len, starts, err_stream) &&
+              vm_resolve_functions(program, function_table, starts, err_stream) &&
+              vm_resolve_lines(program, line_table, line_count, starts, err_stream);
+    free(starts);
+    return ok;
+}
+
+// Map the file read-only, or read it into one heap buffer where mmap is unavailable or fails.
+static bool vm_image_open(const char* path, MorphlVmProgram* program) {
+#if MORPHL_VM_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         return false;
     }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            program->image = map;
+            program->image_len = (size_t)st.st_size;
+            program->image_mapped = true;
+            return true;
+        }
+    }
+    close(fd);
+#endif
 
-    if (fseek(file, 0, SEEK_SET) != 0) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+    if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0) {
         fclose(file);
         return false;
     }
 
-    uint8_t* bytes = malloc((size_t)file_size);
+    uint8_t* bytes = malloc(file_size > 0 ? (size_t)file_size : 1);
     if (!bytes) {
         fclose(file);
         return false;
     }
-
     bool ok = (fread(bytes, 1, (size_t)file_size, file) == (size_t)file_size);
     fclose(file);
     if (!ok) {
         free(bytes);
         return false;
     }
+    program->image = bytes;
+    program->image_len = (size_t)file_size;
+    program->image_mapped = false;
+    return true;
+}
+
+static void vm_image_close(MorphlVmProgram* program) {
+    if (!program->image) {
+        return;
+    }
+#if MORPHL_VM_HAVE_MMAP
+    if (program->image_mapped) {
+        munmap((void*)program->image, program->image_len);
+        program->image = NULL;
+        return;
+    }
+#endif
+    free((void*)program->image);
+    program->image = NULL;
+}
+
+// Point the program at the string table inside the image. Every entry is bounds-checked and must
+// end in NUL, so vm_program_string can hand out C strings without copying.
+static bool vm_bind_strings(MorphlVmProgram* program, size_t* off) {
+    const uint8_t* bytes = program->image;
+    size_t len = program->image_len;
+    uint32_t data_len = 0;
+    if (!read_u32(bytes, len, off, &program->string_count) || !read_u32(bytes, len, off, &data_len)) {
+        return false;
+    }
+    size_t index_len = (size_t)program->string_count * 4;
+    if (index_len > len - *off || data_len > len - *off - index_len) {
+        return false;
+    }
+    program->string_offsets = bytes + *off;
+    program->string_data = bytes + *off + index_len;
+    *off += index_len + data_len;
+
+    for (uint32_t i = 0; i < program->string_count; ++i) {
+        size_t entry = i * 4;
+        uint32_t offset = 0;
+        uint32_t text_len = 0;
+        if (!read_u32(program->string_offsets, index_len, &entry, &offset)) {
+            return false;
+        }
+        size_t at = offset;
+        if (!read_u32(program->string_data, data_len, &at, &text_len) ||
+            text_len >= data_len - at ||
+            program->string_data[at + text_len] != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Point the program at the constant pool inside the image. Entries are fixed-size; kinds are
+// checked against the opcodes that use them while decoding.
+static bool vm_bind_constants(MorphlVmProgram* program, size_t* off) {
+    if (!read_u32(program->image, program->image_len, off, &program->constant_count)) {
+        return false;
+    }
+    if (program->constant_count > (program->image_len - *off) / VM_CONST_ENTRY_SIZE) {
+        return false;
+    }
+    program->constants = program->image + *off;
+    *off += (size_t)program->constant_count * VM_CONST_ENTRY_SIZE;
+    return true;
+}
+
+// Read the function table header; entries are resolved once the code is decoded. At least one
+// function (the top-level code) is required.
+static bool vm_bind_function_table(MorphlVmProgram* program, size_t* off, const uint8_t** out_table) {
+    if (!read_u32(program->image, program->image_len, off, &program->function_count)) {
+        return false;
+    }
+    if (program->function_count == 0 ||
+        program->function_count > (program->image_len - *off) / VM_FUNCTION_ENTRY_SIZE) {
+        return false;
+    }
+    *out_table = program->image + *off;
+    *off += (size_t)program->function_count * VM_FUNCTION_ENTRY_SIZE;
+    return true;
+}
+
+// Load a program; when err_stream is non-NULL, code that fails validation is explained there.
+static bool vm_program_load(const char* path, MorphlVmProgram** out_program, FILE* err_stream) {
+    if (!path || !out_program) {
+        return false;
+    }
+
+    *out_program = NULL;
 
     MorphlVmProgram* program = calloc(1, sizeof(MorphlVmProgram));
     if (!program) {
-        free(bytes);
+        return false;
+    }
+    if (!vm_image_open(path, program)) {
+        free(program);
         return false;
     }
 
+    const uint8_t* bytes = program->image;
+    size_t len = program->image_len;
     size_t off = 0;
-    if ((size_t)file_size < 4 || memcmp(bytes, MORPHL_VM_MAGIC, 4) != 0) {
-        free(bytes);
+    if (len < 4 || memcmp(bytes, MORPHL_VM_MAGIC, 4) != 0) {
         morphl_vm_program_free(program);
         return false;
     }
     off += 4;
 
     uint32_t reserved = 0;
-    uint32_t metadata_count = 0;
-    if (!read_u16(bytes, (size_t)file_size, &off, &program->version_major) ||
-        !read_u16(bytes, (size_t)file_size, &off, &program->version_minor) ||
-        !read_u32(bytes, (size_t)file_size, &off, &reserved) ||
-        !read_u32(bytes, (size_t)file_size, &off, &program->string_count)) {
-        free(bytes);
+    if (!read_u16(bytes, len, &off, &program->version_major) ||
+        !read_u16(bytes, len, &off, &program->version_minor) ||
+        !read_u32(bytes, len, &off, &reserved)) {
         morphl_vm_program_free(program);
         return false;
     }
-
-    if (program->string_count > 0) {
-        program->strings = calloc(program->string_count, sizeof(char*));
-        if (!program->strings) {
-            free(bytes);
-            morphl_vm_program_free(program);
-            return false;
-        }
-    }
-
-    for (uint32_t i = 0; i < program->string_count; ++i) {
-        uint32_t len = 0;
-        if (!read_u32(bytes, (size_t)file_size, &off, &len) || (off + len) > (size_t)file_size) {
-            free(bytes);
-            morphl_vm_program_free(program);
-            return false;
+    if (program->version_major != MORPHL_VM_VERSION_MAJOR) {
+        if (err_stream) {
+            fprintf(err_stream,
+                    "runtime error: bytecode format %u.%u is not supported (expected %u.x)\n",
+                    program->version_major,
+                    program->version_minor,
+                    MORPHL_VM_VERSION_MAJOR);
         }
-
-        char* text = malloc((size_t)len + 1);
-        if (!text) {
-            free(bytes);
-            morphl_vm_program_free(program);
-            return false;
-        }
-        memcpy(text, bytes + off, len);
-        text[len] = '\0';
-        off += len;
-        program->strings[i] = text;
+        morphl_vm_program_free(program);
+        return false;
     }
 
-    if (!read_u32(bytes, (size_t)file_size, &off, &metadata_count)) {
-        free(bytes);
+    const uint8_t* function_table = NULL;
+    if (!vm_bind_strings(program, &off) || !vm_bind_constants(program, &off) ||
+        !vm_bind_function_table(program, &off, &function_table)) {
         morphl_vm_program_free(program);
         return false;
     }
 
-    for (uint32_t i = 0; i < metadata_count; ++i) {
-        uint32_t key = 0;
-        uint32_t value = 0;
-        if (!read_u32(bytes, (size_t)file_size, &off, &key) ||
-            !read_u32(bytes, (size_t)file_size, &off, &value)) {
-            free(bytes);
-            morphl_vm_program_free(program);
-            return false;
-        }
+    uint32_t metadata_count = 0;
+    if (!read_u32(bytes, len, &off, &metadata_count) || metadata_count > (len - off) / 8) {
+        morphl_vm_program_free(program);
+        return false;
     }
+    off += (size_t)metadata_count * 8;
 
-    if (!read_u32(bytes, (size_t)file_size, &off, &program->code_len) ||
-        (off + program->code_len) > (size_t)file_size) {
-        free(bytes);
+    uint32_t code_len = 0;
+    if (!read_u32(bytes, len, &off, &code_len) || code_len > len - off) {
         morphl_vm_program_free(program);
         return false;
     }
 
-    if (program->code_len > 0) {
-        program->code = malloc(program->code_len);
-        if (!program->code) {
-            free(bytes);
+    const uint8_t* code = bytes + off;
+    off += code_len;
+
+    // Format 4.3 added the line table after the code.
+    uint32_t line_count = 0;
+    const uint8_t* line_table = NULL;
+    if (program->version_minor >= 3) {
+        if (!read_u32(bytes, len, &off, &line_count) || line_count > (len - off) / VM_LINE_ENTRY_SIZE) {
             morphl_vm_program_free(program);
             return false;
         }
-        memcpy(program->code, bytes + off, program->code_len);
+        line_table = bytes + off;
     }
 
-    free(bytes);
+    if (!vm_load_code(program, code, code_len, function_table, line_table, line_count, err_stream) ||
+        !vm_verify_program(program, err_stream)) {
+        morphl_vm_program_free(program);
+        return false;
+    }
     *out_program = program;
     return true;
 }
 
+bool morphl_vm_program_load(const char* path, MorphlVmProgram** out_program) {
+    return vm_program_load(path, out_program, NULL);
+}
+
 void morphl_vm_program_free(MorphlVmProgram* program) {
     if (!program) {
         return;
     }
 
-    for (uint32_t i = 0; i < program->string_count; ++i) {
-        free(program->strings[i]);
-    }
-    free(program->strings);
-    free(program->code);
+    free(program->instrs);
+    free(program->functions);
+    free(program->lines);
+    vm_image_close(program);
     free(program);
 }
 
+uint32_t morphl_vm_program_instruction_count(const MorphlVmProgram* program) {
+    return program ? program->instr_count : 0;
+}
+
+const VmLineInfo* vm_program_line(const MorphlVmProgram* program, uint32_t instr) {
+    // Last entry starting at or before instr.
+    uint32_t lo = 0;
+    uint32_t hi = program->line_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (program->lines[mid].instr <= instr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo > 0) ? &program->lines[lo - 1] : NULL;
+}
+
+uint32_t vm_program_function_at(const MorphlVmProgram* program, uint32_t instr) {
+    uint32_t lo = 0;
+    uint32_t hi = program->function_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (program->functions[mid].entry <= instr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo > 0) ? lo - 1 : 0;
+}
+
+bool morphl_vm_program_source_location(const MorphlVmProgram* program,
+                                       uint32_t instr_index,
+                                       const char** out_file,
+                                       uint32_t* out_row,
+                                       uint32_t* out_col) {
+    if (!program || instr_index >= program->instr_count) {
+        return false;
+    }
+    const VmLineInfo* line = vm_program_line(program, instr_index);
+    if (!line) {
+        return false;
+    }
+    if (out_file) {
+        *out_file = line->file;
+    }
+    if (out_row) {
+        *out_row = line->row;
+    }
+    if (out_col) {
+        *out_col = line->col;
+    }
+    return true;
+}
+
 MorphlVm* morphl_vm_new(const MorphlVmProgram* program) {
     if (!program) {
         return NULL;
     }
 
     MorphlVm* vm = calloc(1, sizeof(MorphlVm));
-    if (!vm) {
+    VmCallFrame* frames = malloc(VM_MAX_CALL_DEPTH * sizeof(VmCallFrame));
+    if (!vm || !frames) {
+        free(vm);
+        free(frames);
         return NULL;
     }
+    vm->call_frames = frames;
     vm->program = program;
+    vm->engine = MORPHL_VM_ENGINE_TYPED;
     return vm;
 }
 
+void morphl_vm_set_engine(MorphlVm* vm, MorphlVmEngine engine) {
+    if (vm) {
+        vm->engine = engine;
+    }
+}
+
 void morphl_vm_free(MorphlVm* vm) {
     if (!vm) {
         return;
     }
 
-    for (size_t i = 0; i < vm->stack_count; ++i) {
-        vm_value_free(&vm->stack[i]);
-    }
+    vm_text_clear(vm);
     free(vm->stack);
-
-    for (size_t i = 0; i < vm->slot_count; ++i) {
-        free(vm->slots[i].name);
-        vm_value_free(&vm->slots[i].value);
-    }
     free(vm->slots);
+    free(vm->locals);
+
+    vm_typed_reset(vm);
 
-    for (size_t i = 0; i < vm->call_frame_count; ++i) {
-        // no heap allocations in call frames currently, but if we add any in the future we should free them here
-    }
     free(vm->call_frames);
+    vm_sampler_free(vm->sampler);
+#ifdef MORPHL_VM_PROFILE
+    vm_profile_free(vm->profile);
+#endif
 
     free(vm);
 }
 
-morphl_exit_code_t morphl_vm_execute(MorphlVm* vm, FILE* err_stream) {
-    if (!vm || !vm->program || !vm->program->code) {
-        report_error(err_stream, "invalid VM state");
-        return 1;
-    }
+static morphl_exit_code_t vm_text_execute(MorphlVm* vm, FILE* err_stream) {
+    vm_text_clear(vm);
 
     // initialize main call frame
     if (!vm_init_call_frame(vm, err_stream)) {
-        report_error(err_stream, "failed to initialize call frame");
+        vm_report_error(err_stream, "failed to initialize call frame");
         return 1;
     }
 
-    while (vm->ip < vm->program->code_len) {
-        uint8_t op = vm->program->code[vm->ip++];
+    for (;;) {
+        const VmInstr* in = &vm->program->instrs[vm->ip++];
+        uint8_t op = in->op;
+        VM_PROFILE_RECORD(vm, vm->ip - 1, op);
+
+        if (op == VM_INSTR_END) {
+            break;
+        }
 
         if (op == VM_OP_HALT) {
             return 0;
         }
 
         if (op == VM_OP_PUSH_NULL) {
-            VmValue value = {.kind = VM_VALUE_NULL, .text = NULL, .items = NULL, .item_count = 0};
+            VmValue value = {.kind = VM_VALUE_NULL};
             if (!vm_stack_push(vm, &value)) {
-                report_error(err_stream, "out of memory during PUSH_NULL");
+                vm_report_error(err_stream, "out of memory during PUSH_NULL");
                 return 1;
             }
             continue;
         }
 
-        if (op == VM_OP_PUSH_LITERAL || op == VM_OP_PUSH_IDENT) {
-            uint32_t idx = 0;
-            if ((vm->ip + 4) > vm->program->code_len) {
-                report_error(err_stream, "truncated PUSH payload");
+        if (op == VM_OP_POP) {
+            VmValue value = {0};
+            if (!vm_stack_pop(vm, &value)) {
+                vm_report_error(err_stream, "POP requires a value on stack");
                 return 1;
             }
-            idx = (uint32_t)vm->program->code[vm->ip] |
-                  ((uint32_t)vm->program->code[vm->ip + 1] << 8) |
-                  ((uint32_t)vm->program->code[vm->ip + 2] << 16) |
-                  ((uint32_t)vm->program->code[vm->ip + 3] << 24);
-            vm->ip += 4;
-
-            if (idx >= vm->program->string_count) {
-                report_error(err_stream, "string index out of bounds");
+            vm_value_free(&value);
+            continue;
+        }
+
+        if (op == VM_OP_JUMP || op == VM_OP_LOOP) {
+            // The loader resolved the target to an instruction index.
+            vm->ip = in->a;
+            continue;
+        }
+
+        if (op == VM_OP_JUMP_IF_FALSE) {
+            VmValue cond = {0};
+            if (!vm_stack_pop(vm, &cond)) {
+                vm_report_error(err_stream, "JUMP_IF_FALSE requires a condition on stack");
                 return 1;
             }
+            if (!vm_value_truthy(vm_resolve_value(vm, &cond))) {
+                vm->ip = in->a;
+            }
+            vm_value_free(&cond);
+            continue;
+        }
 
+        if (op == VM_OP_PUSH_LITERAL || op == VM_OP_PUSH_IDENT) {
+            // String table entries live in the image, so the value borrows them.
             VmValue value = {
                 .kind = (op == VM_OP_PUSH_LITERAL) ? VM_VALUE_LITERAL : VM_VALUE_IDENT,
-                .text = vm->program->strings[idx],
-                .items = NULL,
-                .item_count = 0,
+                .text = vm_program_string(vm->program, in->a),
             };
             if (!vm_stack_push(vm, &value)) {
-                report_error(err_stream, "out of memory during PUSH");
+                vm_report_error(err_stream, "out of memory during PUSH");
                 return 1;
             }
             continue;
         }
 
-        if (op == VM_OP_MAKE_GROUP) {
-            uint32_t arity = 0;
-            if ((vm->ip + 4) > vm->program->code_len) {
-                report_error(err_stream, "truncated MAKE_GROUP payload");
+        if (op == VM_OP_PUSH_CONST_I64 || op == VM_OP_PUSH_CONST_F64) {
+            // The text engine keeps every scalar as text, so render the constant once per push.
+            char buffer[32];
+            int written = (op == VM_OP_PUSH_CONST_I64)
+                              ? snprintf(buffer, sizeof(buffer), "%lld", (long long)in->ref.i)
+                              : snprintf(buffer, sizeof(buffer), "%.17g", in->ref.f);
+            VmValue value = {0};
+            bool ok = written > 0 && (size_t)written < sizeof(buffer) &&
+                      vm_value_new_literal(buffer, (size_t)written, &value) && vm_stack_push(vm, &value);
+            vm_value_free(&value);
+            if (!ok) {
+                vm_report_error(err_stream, "out of memory during PUSH_CONST");
                 return 1;
             }
-            arity = (uint32_t)vm->program->code[vm->ip] |
-                    ((uint32_t)vm->program->code[vm->ip + 1] << 8) |
-                    ((uint32_t)vm->program->code[vm->ip + 2] << 16) |
-                    ((uint32_t)vm->program->code[vm->ip + 3] << 24);
-            vm->ip += 4;
+            continue;
+        }
 
+        if (op == VM_OP_MAKE_GROUP) {
+            uint32_t arity = in->a;
             if ((size_t)arity > vm->stack_count) {
-                report_error(err_stream, "MAKE_GROUP arity exceeds stack depth");
+                vm_report_error(err_stream, "MAKE_GROUP arity exceeds stack depth");
                 return 1;
             }
 
-            VmValue group = {.kind = VM_VALUE_GROUP, .text = NULL, .items = NULL, .item_count = arity};
-            if (arity > 0) {
-                group.items = calloc(arity, sizeof(VmValue));
-                if (!group.items) {
-                    report_error(err_stream, "out of memory during MAKE_GROUP");
-                    return 1;
-                }
-            }
-
-            for (size_t i = 0; i < arity; ++i) {
-                VmValue item = {0};
-                if (!vm_stack_pop(vm, &item)) {
-                    vm_value_free(&group);
-                    report_error(err_stream, "stack underflow during MAKE_GROUP");
-                    return 1;
-                }
-                group.items[arity - i - 1] = item;
+            // The operands move into the group, so building it copies no text or nested items.
+            VmValueGroup* items = malloc(sizeof(VmValueGroup) + (size_t)arity * sizeof(VmValue));
+            if (!items) {
+                vm_report_error(err_stream, "out of memory during MAKE_GROUP");
+                return 1;
             }
+            items->refs = 1;
+            items->count = arity;
+            vm->stack_count -= arity;
+            memcpy(items->items, &vm->stack[vm->stack_count], (size_t)arity * sizeof(VmValue));
 
-            if (!vm_stack_push(vm, &group)) {
-                vm_value_free(&group);
-                report_error(err_stream, "out of memory pushing group");
+            VmValue group = {.kind = VM_VALUE_GROUP, .group = items};
+            bool ok = vm_stack_push(vm, &group);
+            vm_value_free(&group);
+            if (!ok) {
+                vm_report_error(err_stream, "out of memory pushing group");
                 return 1;
             }
-            vm_value_free(&group);
             continue;
         }
 
         if (op == VM_OP_SET_SLOT) {
-            uint32_t idx = 0;
-            if ((vm->ip + 4) > vm->program->code_len) {
-                report_error(err_stream, "truncated SET_SLOT payload");
-                return 1;
-            }
-            idx = (uint32_t)vm->program->code[vm->ip] |
-                  ((uint32_t)vm->program->code[vm->ip + 1] << 8) |
-                  ((uint32_t)vm->program->code[vm->ip + 2] << 16) |
-                  ((uint32_t)vm->program->code[vm->ip + 3] << 24);
-            vm->ip += 4;
-
-            if (idx >= vm->program->string_count) {
-                report_error(err_stream, "SET_SLOT index out of bounds");
-                return 1;
-            }
-
             VmValue value = {0};
             if (!vm_stack_pop(vm, &value)) {
-                report_error(err_stream, "SET_SLOT requires a value on stack");
+                vm_report_error(err_stream, "SET_SLOT requires a value on stack");
                 return 1;
             }
 
-            bool ok = vm_set_slot(vm, vm->program->strings[idx], &value);
+            bool ok = vm_set_slot(vm, in->ref.name, &value);
             if (ok) {
                 ok = vm_stack_push(vm, &value);
             }
             vm_value_free(&value);
             if (!ok) {
-                report_error(err_stream, "failed to assign slot");
+                vm_report_error(err_stream, "failed to assign slot");
+                return 1;
+            }
+            continue;
+        }
+
+        if (op == VM_OP_LOAD_LOCAL || op == VM_OP_STORE_LOCAL) {
+            size_t base = vm->call_frames[vm->call_frame_count - 1].local_base;
+            if (base + in->a >= vm->local_count) {
+                vm_report_error(err_stream, "local slot index out of bounds");
+                return 1;
+            }
+
+            VmValue* local = &vm->locals[base + in->a];
+            if (op == VM_OP_LOAD_LOCAL) {
+                if (!vm_stack_push(vm, local)) {
+                    vm_report_error(err_stream, "out of memory during LOAD_LOCAL");
+                    return 1;
+                }
+                continue;
+            }
+
+            if (vm->stack_count == 0) {
+                vm_report_error(err_stream, "STORE_LOCAL requires a value on stack");
                 return 1;
             }
+            VmValue copy = vm_value_share(vm_resolve_value(vm, &vm->stack[vm->stack_count - 1]));
+            vm_value_free(local);
+            *local = copy;
             continue;
         }
 
-        if (op == VM_OP_OPERATOR) {
-            uint32_t idx = 0;
-            if ((vm->ip + 4) > vm->program->code_len) {
-                report_error(err_stream, "truncated OPERATOR payload");
+        if (op == VM_OP_STORE_LOCAL_POP || op == VM_OP_INC_LOCAL || op == VM_OP_ADD_LOCAL_CONST) {
+            size_t base = vm->call_frames[vm->call_frame_count - 1].local_base;
+            if (base + in->a >= vm->local_count) {
+                vm_report_error(err_stream, "local slot index out of bounds");
                 return 1;
             }
-            idx = (uint32_t)vm->program->code[vm->ip] |
-                  ((uint32_t)vm->program->code[vm->ip + 1] << 8) |
-                  ((uint32_t)vm->program->code[vm->ip + 2] << 16) |
-                  ((uint32_t)vm->program->code[vm->ip + 3] << 24);
-            vm->ip += 4;
-
-            if (idx >= vm->program->string_count) {
-                report_error(err_stream, "OPERATOR index out of bounds");
+
+            // The text engine runs the fused forms as the sequences they replace. They stand for $sub
+            // as well as $add, so a non-numeric local is reported here rather than by $add.
+            if (op != VM_OP_STORE_LOCAL_POP) {
+                double number = 0;
+                if (!vm_value_to_number(vm_resolve_value(vm, &vm->locals[base + in->a]), &number)) {
+                    vm_report_error(err_stream, "$add/$sub currently supports numeric literal operands only");
+                    return 1;
+                }
+                char buffer[32];
+                int written = snprintf(buffer, sizeof(buffer), "%lld", (long long)in->ref.i);
+                VmValue amount = {0};
+                bool ok = vm_stack_push(vm, &vm->locals[base + in->a]) && written > 0 &&
+                          vm_value_new_literal(buffer, (size_t)written, &amount) && vm_stack_push(vm, &amount);
+                vm_value_free(&amount);
+                if (!ok) {
+                    vm_report_error(err_stream, "out of memory during ADD_LOCAL_CONST");
+                    return 1;
+                }
+                if (!vm_execute_operator(vm, VM_OP_ADD, err_stream)) {
+                    return 1;
+                }
+            }
+
+            VmValue value = {0};
+            if (!vm_stack_pop(vm, &value)) {
+                vm_report_error(err_stream, "STORE_LOCAL_POP requires a value on stack");
                 return 1;
             }
+            VmValue* local = &vm->locals[base + in->a];
+            VmValue copy = vm_value_share(vm_resolve_value(vm, &value));
+            vm_value_free(&value);
+            vm_value_free(local);
+            *local = copy;
+            continue;
+        }
 
-            if (!vm_execute_operator(vm, vm->program->strings[idx], err_stream)) {
+        if (op >= VM_OP_FIRST_OPERATOR && op <= VM_OP_LAST_OPERATOR) {
+            if (!vm_execute_operator(vm, op, err_stream)) {
                 return 1;
             }
             continue;
@@ -789,14 +1310,14 @@ morphl_exit_code_t morphl_vm_execute(MorphlVm* vm, FILE* err_stream) {
             if (vm->call_frame_count == 1) {
                 VmValue exit_value = {0};
                 if (!vm_stack_pop(vm, &exit_value)) {
-                    report_error(err_stream, "stack underflow while trying to read exit code");
+                    vm_report_error(err_stream, "stack underflow while trying to read exit code");
                     return 1;
                 }
 
                 double exit_num = 0;
                 if (!vm_value_to_number(&exit_value, &exit_num) || exit_num < 0 || exit_num > 255) {
                     vm_value_free(&exit_value);
-                    report_error(err_stream, "invalid exit code (must be a number between 0 and 255)");
+                    vm_report_error(err_stream, "invalid exit code (must be a number between 0 and 255)");
                     return 1;
                 }
 
@@ -806,53 +1327,133 @@ morphl_exit_code_t morphl_vm_execute(MorphlVm* vm, FILE* err_stream) {
 
             // otherwise, return from current function
             if (!vm_return(vm, err_stream)) {
-                report_error(err_stream, "failed to return from function");
+                vm_report_error(err_stream, "failed to return from function");
                 return 1;
             }
+            continue;
         }
 
         if (op == VM_OP_CALL) {
-            uint32_t func_index = 0;
-            if ((vm->ip + 4) > vm->program->code_len) {
-                report_error(err_stream, "truncated CALL payload");
+            if (!vm_call(vm, in->a, err_stream)) {
+                vm_report_error(err_stream, "failed to call function");
                 return 1;
             }
-            func_index = (uint32_t)vm->program->code[vm->ip] |
-                         ((uint32_t)vm->program->code[vm->ip + 1] << 8) |
-                         ((uint32_t)vm->program->code[vm->ip + 2] << 16) |
-                         ((uint32_t)vm->program->code[vm->ip + 3] << 24);
-            vm->ip += 4;
-
-            if (!vm_call(vm, func_index, err_stream)) {
-                report_error(err_stream, "failed to call function");
+            continue;
+        }
+
+        if (op == VM_OP_TAIL_CALL) {
+            if (!vm_tail_call(vm, in->a, err_stream)) {
+                vm_report_error(err_stream, "failed to call function");
                 return 1;
             }
             continue;
         }
 
         if (op == VM_OP_NODE_META) {
-            report_error(err_stream, "NODE_META execution is not supported in V0.1 runtime");
+            vm_report_error(err_stream, "NODE_META execution is not supported in V0.1 runtime");
             return 1;
         }
 
-        report_error(err_stream, "unknown opcode");
+        vm_report_error(err_stream, "unknown opcode");
         return 1;
     }
 
-    report_error(err_stream, "program terminated without HALT");
+    vm_report_error(err_stream, "program terminated without HALT");
     return 1;
 }
 
+morphl_exit_code_t morphl_vm_execute(MorphlVm* vm, FILE* err_stream) {
+    return morphl_vm_call(vm, NULL, NULL, 0, err_stream);
+}
+
+morphl_exit_code_t morphl_vm_call(MorphlVm* vm,
+                                  const char* entry,
+                                  const MorphlVmArg* args,
+                                  uint32_t arg_count,
+                                  FILE* err_stream) {
+    if (!vm || !vm->program || !vm->program->instrs) {
+        vm_report_error(err_stream, "invalid VM state");
+        return 1;
+    }
+
+    const MorphlVmProgram* program = vm->program;
+    uint32_t func_index = 0;
+    if (entry) {
+        while (func_index < program->function_count && strcmp(program->functions[func_index].name, entry) != 0) {
+            func_index++;
+        }
+        if (func_index == program->function_count) {
+            FILE* err = err_stream ? err_stream : stderr;
+            fprintf(err, "runtime error: no function named '%s'\n", entry);
+            return 1;
+        }
+    }
+    if (arg_count != program->functions[func_index].param_count || (arg_count > 0 && !args)) {
+        vm_report_error(err_stream, "argument count does not match the entry function");
+        return 1;
+    }
+    if (vm->engine == MORPHL_VM_ENGINE_TEXT && func_index != 0) {
+        vm_report_error(err_stream, "the text engine only runs the main program");
+        return 1;
+    }
+
+#ifdef MORPHL_VM_PROFILE
+    if (vm->profile) {
+        vm->profile->run = 0;
+    }
+#endif
+    // Without a sampler the program still runs, unsampled.
+    bool sampling = vm->sampler && vm_sample_start(vm, err_stream);
+    morphl_exit_code_t code = (vm->engine == MORPHL_VM_ENGINE_TEXT)
+                                  ? vm_text_execute(vm, err_stream)
+                                  : vm_typed_execute(vm, func_index, args, arg_count, err_stream);
+    if (sampling) {
+        vm_sample_stop(vm);
+        vm_sample_write(vm, err_stream);
+    }
+#ifdef MORPHL_VM_PROFILE
+    // The profile does not change the program's exit code, even when it cannot be written.
+    if (vm->profile) {
+        vm_profile_write(vm->profile, vm->engine, err_stream);
+    }
+#endif
+    return code;
+}
+
 morphl_exit_code_t morphl_vm_run_file(const char* path, FILE* err_stream) {
+    return morphl_vm_run_file_with(path, NULL, err_stream);
+}
+
+morphl_exit_code_t morphl_vm_run_file_with(const char* path, const MorphlVmRunOptions* options, FILE* err_stream) {
     MorphlVmProgram* program = NULL;
-    if (!morphl_vm_program_load(path, &program)) {
-        report_error(err_stream, "failed to load bytecode file");
+    if (!vm_program_load(path, &program, err_stream ? err_stream : stderr)) {
+        vm_report_error(err_stream, "failed to load bytecode file");
         return 1;
     }
 
     MorphlVm* vm = morphl_vm_new(program);
     if (!vm) {
-        report_error(err_stream, "failed to initialize VM");
+        vm_report_error(err_stream, "failed to initialize VM");
+        morphl_vm_program_free(program);
+        return 1;
+    }
+    if (options) {
+        morphl_vm_set_engine(vm, options->engine);
+    }
+    if (options && options->sample_path &&
+        !morphl_vm_set_sample_output(vm, options->sample_path, options->sample_interval_us)) {
+        vm_report_error(err_stream,
+                        morphl_vm_sampling_available() ? "out of memory enabling the sampling profiler"
+                                                       : "the sampling profiler is not supported on this platform");
+        morphl_vm_free(vm);
+        morphl_vm_program_free(program);
+        return 1;
+    }
+    if (options && options->profile_path && !morphl_vm_set_profile_output(vm, options->profile_path)) {
+        vm_report_error(err_stream,
+                        morphl_vm_profile_available() ? "out of memory enabling the opcode profile"
+                                                      : "opcode profiling is not compiled in (configure with -DMORPHL_VM_PROFILE=ON)");
+        morphl_vm_free(vm);
         morphl_vm_program_free(program);
         return 1;
     }
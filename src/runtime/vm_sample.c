@@ -0,0 +1,328 @@
+#include "runtime/runtime.h"
+#include "vm_internal.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MORPHL_VM_HAVE_SAMPLER 1
+#include <signal.h>
+#include <sys/time.h>
+#else
+#define MORPHL_VM_HAVE_SAMPLER 0
+#endif
+
+// Linux can point a CPU-time timer at a single thread; elsewhere the process-wide ITIMER_PROF is used.
+#if MORPHL_VM_HAVE_SAMPLER && defined(__linux__)
+#define MORPHL_VM_SAMPLE_THREAD_TIMER 1
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#else
+#define MORPHL_VM_SAMPLE_THREAD_TIMER 0
+#endif
+
+// Sample buffer size in words; at the default rate this holds minutes of samples of typical depth.
+#define VM_SAMPLE_WORDS (1u << 20)
+// Deeper call stacks keep their innermost frames.
+#define VM_SAMPLE_MAX_DEPTH 256u
+#define VM_SAMPLE_DEFAULT_INTERVAL_US 1000u
+
+void vm_sampler_free(VmSampler* sampler) {
+    if (!sampler) {
+        return;
+    }
+    free(sampler->path);
+    free(sampler->words);
+    free(sampler);
+}
+
+#if MORPHL_VM_HAVE_SAMPLER
+
+// The VM being sampled. The SIGPROF handler is process-wide, so there is at most one.
+static _Atomic(MorphlVm*) g_sampled_vm;
+static struct sigaction g_previous_action;
+#if MORPHL_VM_SAMPLE_THREAD_TIMER
+static timer_t g_sample_timer;
+#endif
+
+// Set on the thread that runs the sampled VM. A SIGPROF delivered to any other thread (the
+// process-wide timer's, or anyone else's) is ignored, so the handler never reads a VM that another
+// thread is running and never runs on two threads at once.
+static _Thread_local volatile sig_atomic_t t_sampling_thread;
+
+// Record the current instruction and each caller's CALL. Runs in signal context: it only reads VM
+// state and appends to the preallocated buffer. A text engine frame that is being pushed may still
+// hold a zero return_ip; that frame is left out of the sample.
+static void vm_sample_signal(int signo) {
+    (void)signo;
+    if (!t_sampling_thread) {
+        return;
+    }
+    MorphlVm* vm = atomic_load_explicit(&g_sampled_vm, memory_order_relaxed);
+    if (!vm || vm->ip == 0) {
+        return;
+    }
+    VmSampler* sampler = vm->sampler;
+    size_t frame_count = vm->call_frame_count;
+    size_t depth = (frame_count > 0) ? frame_count : 1;
+    if (depth > VM_SAMPLE_MAX_DEPTH) {
+        depth = VM_SAMPLE_MAX_DEPTH;
+    }
+    size_t used = sampler->used;
+    if (sampler->capacity - used < depth + 1) {
+        sampler->dropped++;
+        return;
+    }
+
+    uint32_t* sample = &sampler->words[used];
+    uint32_t stored = 0;
+    sample[1 + stored++] = (uint32_t)(vm->ip - 1);
+    for (size_t k = 1; k < depth; ++k) {
+        size_t return_ip = vm->call_frames[frame_count - k].return_ip;
+        if (return_ip != 0) {
+            sample[1 + stored++] = (uint32_t)(return_ip - 1);
+        }
+    }
+    sample[0] = stored;
+    sampler->used = used + 1 + stored;
+}
+
+// Fire SIGPROF every interval microseconds of CPU time. On Linux the timer counts the calling
+// thread's CPU time and signals only that thread; elsewhere it counts the whole process's.
+static bool vm_sample_arm(uint32_t interval) {
+#if MORPHL_VM_SAMPLE_THREAD_TIMER
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &g_sample_timer) != 0) {
+        return false;
+    }
+    struct itimerspec timer = {
+        .it_interval = {.tv_sec = interval / 1000000u, .tv_nsec = (long)(interval % 1000000u) * 1000},
+        .it_value = {.tv_sec = interval / 1000000u, .tv_nsec = (long)(interval % 1000000u) * 1000},
+    };
+    if (timer_settime(g_sample_timer, 0, &timer, NULL) != 0) {
+        timer_delete(g_sample_timer);
+        return false;
+    }
+    return true;
+#else
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = interval / 1000000u, .tv_usec = interval % 1000000u},
+        .it_value = {.tv_sec = interval / 1000000u, .tv_usec = interval % 1000000u},
+    };
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#endif
+}
+
+static void vm_sample_disarm(void) {
+#if MORPHL_VM_SAMPLE_THREAD_TIMER
+    timer_delete(g_sample_timer);
+#else
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+#endif
+}
+
+bool vm_sample_start(MorphlVm* vm, FILE* err_stream) {
+    MorphlVm* expected = NULL;
+    if (!atomic_compare_exchange_strong(&g_sampled_vm, &expected, vm)) {
+        vm_report_error(err_stream, "another VM is already being sampled; running without sampling");
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = vm_sample_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &g_previous_action) != 0) {
+        atomic_store(&g_sampled_vm, NULL);
+        vm_report_error(err_stream, "cannot install the sampling signal handler");
+        return false;
+    }
+    t_sampling_thread = 1;
+    if (!vm_sample_arm(vm->sampler->interval_us)) {
+        t_sampling_thread = 0;
+        sigaction(SIGPROF, &g_previous_action, NULL);
+        atomic_store(&g_sampled_vm, NULL);
+        vm_report_error(err_stream, "cannot start the sampling timer");
+        return false;
+    }
+    return true;
+}
+
+// Must run on the thread that called vm_sample_start.
+void vm_sample_stop(MorphlVm* vm) {
+    vm_sample_disarm();
+    // A signal already pending still finds the VM, so the handler goes only after that.
+    sigaction(SIGPROF, &g_previous_action, NULL);
+    t_sampling_thread = 0;
+    atomic_store(&g_sampled_vm, NULL);
+    (void)vm;
+}
+
+// Append the frame for instruction instr to buf: the function name and, when the line table has
+// it, the source file's base name and row.
+static size_t vm_sample_frame(const MorphlVmProgram* program, uint32_t instr, char* buf, size_t size) {
+    if (instr >= program->instr_count) {
+        return (size_t)snprintf(buf, size, "?");
+    }
+    const VmFunction* fn = &program->functions[vm_program_function_at(program, instr)];
+    const VmLineInfo* line = vm_program_line(program, instr);
+    if (!line || line->instr < fn->entry) {
+        return (size_t)snprintf(buf, size, "%s", fn->name);
+    }
+    const char* base = line->file;
+    for (const char* at = line->file; *at; ++at) {
+        if (*at == '/' || *at == '\\') {
+            base = at + 1;
+        }
+    }
+    return (size_t)snprintf(buf, size, "%s (%s:%u)", fn->name, base, line->row);
+}
+
+static int vm_sample_compare(const void* lhs, const void* rhs) {
+    return strcmp(*(char* const*)lhs, *(char* const*)rhs);
+}
+
+bool vm_sample_write(const MorphlVm* vm, FILE* err_stream) {
+    const VmSampler* sampler = vm->sampler;
+    size_t used = sampler->used;
+
+    size_t sample_count = 0;
+    for (size_t at = 0; at < used; at += 1 + sampler->words[at]) {
+        sample_count++;
+    }
+    char** stacks = calloc(sample_count + 1, sizeof(char*));
+    bool ok = stacks != NULL;
+
+    // One line per sample, outermost frame first, then sorted so equal stacks are adjacent.
+    size_t index = 0;
+    for (size_t at = 0; ok && at < used; at += 1 + sampler->words[at]) {
+        uint32_t depth = sampler->words[at];
+        size_t len = 0;
+        for (uint32_t k = depth; k > 0; --k) {
+            len += vm_sample_frame(vm->program, sampler->words[at + k], NULL, 0) + 1;
+        }
+        char* stack = malloc(len + 1);
+        if (!stack) {
+            ok = false;
+            break;
+        }
+        size_t pos = 0;
+        for (uint32_t k = depth; k > 0; --k) {
+            pos += vm_sample_frame(vm->program, sampler->words[at + k], stack + pos, len + 1 - pos);
+            if (k > 1) {
+                stack[pos++] = ';';
+            }
+        }
+        stack[pos] = '\0';
+        stacks[index++] = stack;
+    }
+
+    FILE* out = ok ? fopen(sampler->path, "w") : NULL;
+    if (ok && !out) {
+        FILE* err = err_stream ? err_stream : stderr;
+        fprintf(err, "runtime error: cannot write samples to '%s'\n", sampler->path);
+    }
+    if (out) {
+        qsort(stacks, index, sizeof(char*), vm_sample_compare);
+        for (size_t i = 0; i < index;) {
+            size_t run = 1;
+            while (i + run < index && strcmp(stacks[i], stacks[i + run]) == 0) {
+                run++;
+            }
+            fprintf(out, "%s %zu\n", stacks[i], run);
+            i += run;
+        }
+        ok = !ferror(out);
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            vm_report_error(err_stream, "failed to write samples");
+        }
+    } else if (!stacks || index < sample_count) {
+        vm_report_error(err_stream, "out of memory writing samples");
+    }
+    if (out && sampler->dropped != 0) {
+        FILE* err = err_stream ? err_stream : stderr;
+        fprintf(err, "runtime warning: %llu samples were dropped\n", (unsigned long long)sampler->dropped);
+    }
+
+    for (size_t i = 0; i < index; ++i) {
+        free(stacks[i]);
+    }
+    free(stacks);
+    return ok && out != NULL;
+}
+
+bool morphl_vm_sampling_available(void) {
+    return true;
+}
+
+bool morphl_vm_set_sample_output(MorphlVm* vm, const char* path, uint32_t interval_us) {
+    if (!vm) {
+        return false;
+    }
+    vm_sampler_free(vm->sampler);
+    vm->sampler = NULL;
+    if (!path) {
+        return true;
+    }
+
+    VmSampler* sampler = calloc(1, sizeof(VmSampler));
+    size_t len = strlen(path);
+    char* copy = malloc(len + 1);
+    uint32_t* words = malloc(VM_SAMPLE_WORDS * sizeof(uint32_t));
+    if (!sampler || !copy || !words) {
+        free(sampler);
+        free(copy);
+        free(words);
+        return false;
+    }
+    memcpy(copy, path, len + 1);
+    sampler->path = copy;
+    sampler->interval_us = (interval_us == 0) ? VM_SAMPLE_DEFAULT_INTERVAL_US : interval_us;
+    sampler->words = words;
+    sampler->capacity = VM_SAMPLE_WORDS;
+    vm->sampler = sampler;
+    return true;
+}
+
+#else
+
+bool vm_sample_start(MorphlVm* vm, FILE* err_stream) {
+    (void)vm;
+    (void)err_stream;
+    return false;
+}
+
+void vm_sample_stop(MorphlVm* vm) {
+    (void)vm;
+}
+
+bool vm_sample_write(const MorphlVm* vm, FILE* err_stream) {
+    (void)vm;
+    (void)err_stream;
+    return false;
+}
+
+bool morphl_vm_sampling_available(void) {
+    return false;
+}
+
+bool morphl_vm_set_sample_output(MorphlVm* vm, const char* path, uint32_t interval_us) {
+    (void)vm;
+    (void)interval_us;
+    return path == NULL;
+}
+
+#endif
@@ -0,0 +1,559 @@
+#include "vm_internal.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Dispatch strategy for vm_typed_execute: GCC/Clang labels-as-values (threaded code, one indirect
+// jump per handler) unless MORPHL_VM_SWITCH_DISPATCH asks for the portable switch.
+#if defined(__GNUC__) && !defined(MORPHL_VM_SWITCH_DISPATCH)
+#define VM_TYPED_COMPUTED_GOTO 1
+#else
+#define VM_TYPED_COMPUTED_GOTO 0
+#endif
+
+#if VM_TYPED_COMPUTED_GOTO
+#define VM_TYPED_CASE(opcode) vm_label_##opcode
+#define VM_TYPED_DEFAULT vm_label_unknown
+#define VM_TYPED_TARGET(opcode) [opcode] = &&vm_label_##opcode
+#define VM_TYPED_NEXT()                         \
+    do {                                        \
+        in = &program->instrs[vm->ip++];        \
+        VM_PROFILE_RECORD(vm, vm->ip - 1, in->op); \
+        goto *kDispatch[in->op];                \
+    } while (0)
+// The dispatch table fills every slot with the fallback first, then overrides the known opcodes.
+#if defined(__clang__)
+#define VM_TYPED_IGNORE_OVERRIDE_INIT_BEGIN \
+    _Pragma("clang diagnostic push") _Pragma("clang diagnostic ignored \"-Winitializer-overrides\"")
+#define VM_TYPED_IGNORE_OVERRIDE_INIT_END _Pragma("clang diagnostic pop")
+#else
+#define VM_TYPED_IGNORE_OVERRIDE_INIT_BEGIN \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Woverride-init\"")
+#define VM_TYPED_IGNORE_OVERRIDE_INIT_END _Pragma("GCC diagnostic pop")
+#endif
+#else
+#define VM_TYPED_CASE(opcode) case opcode
+#define VM_TYPED_DEFAULT default
+#define VM_TYPED_NEXT() break
+#endif
+
+const char* morphl_vm_dispatch_name(void) {
+    return VM_TYPED_COMPUTED_GOTO ? "computed-goto" : "switch";
+}
+
+// Groups are immutable and shared by reference: copying a value retains its group, and the last
+// release frees it along with its items.
+static void vm_typed_free(VmTypedValue* value) {
+    if (!value) {
+        return;
+    }
+    if (value->kind == VM_TYPED_GROUP && value->as.group && --value->as.group->refs == 0) {
+        for (size_t i = 0; i < value->as.group->count; ++i) {
+            vm_typed_free(&value->as.group->items[i]);
+        }
+        free(value->as.group);
+    }
+    value->kind = VM_TYPED_NULL;
+    value->as.i = 0;
+}
+
+// Return another reference to src. O(1) for every kind, and never allocates.
+static VmTypedValue vm_typed_share(const VmTypedValue* src) {
+    if (src->kind == VM_TYPED_GROUP) {
+        src->as.group->refs++;
+    }
+    return *src;
+}
+
+void vm_typed_clear(MorphlVm* vm) {
+    for (size_t i = 0; i < vm->tstack_count; ++i) {
+        vm_typed_free(&vm->tstack[i]);
+    }
+    vm->tstack_count = 0;
+
+    for (size_t i = 0; i < vm->tslot_count; ++i) {
+        vm_typed_free(&vm->tslots[i].value);
+    }
+    vm->tslot_count = 0;
+
+    vm->call_frame_count = 0;
+    vm->ip = 0;
+}
+
+void vm_typed_reset(MorphlVm* vm) {
+    vm_typed_clear(vm);
+    free(vm->tstack);
+    vm->tstack = NULL;
+    vm->tstack_capacity = 0;
+    free(vm->tslots);
+    vm->tslots = NULL;
+    vm->tslot_capacity = 0;
+}
+
+// Push a value, taking ownership of it. Returns false when the stack is full (the value is released).
+static bool vm_typed_push(MorphlVm* vm, VmTypedValue value) {
+    if (vm->tstack_count == vm->tstack_capacity) {
+        vm_typed_free(&value);
+        return false;
+    }
+    vm->tstack[vm->tstack_count++] = value;
+    return true;
+}
+
+// Pop one of the current frame's operands; its locals below are never popped.
+static bool vm_typed_pop(MorphlVm* vm, VmTypedValue* out) {
+    if (vm->tstack_count <= vm->call_frames[vm->call_frame_count - 1].base) {
+        return false;
+    }
+    *out = vm->tstack[--vm->tstack_count];
+    return true;
+}
+
+static VmTypedSlot* vm_typed_find_slot(MorphlVm* vm, uint32_t name_index) {
+    for (size_t i = vm->tslot_count; i > 0; --i) {
+        if (vm->tslots[i - 1].name_index == name_index) {
+            return &vm->tslots[i - 1];
+        }
+    }
+    return NULL;
+}
+
+// Resolve identifiers through slot bindings; other values resolve to themselves.
+static const VmTypedValue* vm_typed_resolve(MorphlVm* vm, const VmTypedValue* value) {
+    if (value->kind != VM_TYPED_IDENT) {
+        return value;
+    }
+    VmTypedSlot* slot = vm_typed_find_slot(vm, value->as.str);
+    return slot ? &slot->value : value;
+}
+
+// Store a reference to value in the named slot.
+static bool vm_typed_set_slot(MorphlVm* vm, uint32_t name_index, const VmTypedValue* value) {
+    VmTypedValue copy = vm_typed_share(value);
+
+    VmTypedSlot* slot = vm_typed_find_slot(vm, name_index);
+    if (slot) {
+        vm_typed_free(&slot->value);
+        slot->value = copy;
+        return true;
+    }
+
+    if (vm->tslot_count == vm->tslot_capacity) {
+        size_t new_capacity = (vm->tslot_capacity == 0) ? 16 : vm->tslot_capacity * 2;
+        VmTypedSlot* grown = realloc(vm->tslots, new_capacity * sizeof(VmTypedSlot));
+        if (!grown) {
+            vm_typed_free(&copy);
+            return false;
+        }
+        vm->tslots = grown;
+        vm->tslot_capacity = new_capacity;
+    }
+    vm->tslots[vm->tslot_count].name_index = name_index;
+    vm->tslots[vm->tslot_count].value = copy;
+    vm->tslot_count++;
+    return true;
+}
+
+static bool vm_typed_is_number(const VmTypedValue* value) {
+    return value->kind == VM_TYPED_INT || value->kind == VM_TYPED_FLOAT;
+}
+
+static double vm_typed_as_float(const VmTypedValue* value) {
+    return (value->kind == VM_TYPED_INT) ? (double)value->as.i : value->as.f;
+}
+
+static bool vm_typed_equal(const MorphlVmProgram* program, const VmTypedValue* lhs, const VmTypedValue* rhs) {
+    if (vm_typed_is_number(lhs) && vm_typed_is_number(rhs)) {
+        if (lhs->kind == VM_TYPED_INT && rhs->kind == VM_TYPED_INT) {
+            return lhs->as.i == rhs->as.i;
+        }
+        return vm_typed_as_float(lhs) == vm_typed_as_float(rhs);
+    }
+    if (lhs->kind != rhs->kind) {
+        return false;
+    }
+    switch (lhs->kind) {
+        case VM_TYPED_NULL:
+            return true;
+        case VM_TYPED_BOOL:
+            return lhs->as.b == rhs->as.b;
+        case VM_TYPED_STRING:
+        case VM_TYPED_IDENT:
+            return lhs->as.str == rhs->as.str ||
+                   strcmp(vm_program_string(program, lhs->as.str), vm_program_string(program, rhs->as.str)) == 0;
+        case VM_TYPED_GROUP:
+            if (lhs->as.group->count != rhs->as.group->count) {
+                return false;
+            }
+            for (size_t i = 0; i < lhs->as.group->count; ++i) {
+                if (!vm_typed_equal(program, &lhs->as.group->items[i], &rhs->as.group->items[i])) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Integer arithmetic wraps on overflow instead of invoking undefined behaviour.
+static int64_t vm_wrap_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static int64_t vm_wrap_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static int64_t vm_wrap_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+// Evaluate a unary or binary operator on resolved operands. On failure *error names the problem.
+static bool vm_typed_eval(const MorphlVmProgram* program,
+                          uint8_t op,
+                          const VmTypedValue* lhs,
+                          const VmTypedValue* rhs,
+                          VmTypedValue* out,
+                          const char** error) {
+    bool both_int = rhs && lhs->kind == VM_TYPED_INT && rhs->kind == VM_TYPED_INT;
+    bool both_num = rhs && vm_typed_is_number(lhs) && vm_typed_is_number(rhs);
+    bool both_bool = rhs && lhs->kind == VM_TYPED_BOOL && rhs->kind == VM_TYPED_BOOL;
+
+    switch (op) {
+        case VM_OP_ADD:
+        case VM_OP_SUB:
+        case VM_OP_MUL:
+        case VM_OP_DIV:
+            if (both_int) {
+                out->kind = VM_TYPED_INT;
+                if (op == VM_OP_ADD) {
+                    out->as.i = vm_wrap_add(lhs->as.i, rhs->as.i);
+                } else if (op == VM_OP_SUB) {
+                    out->as.i = vm_wrap_sub(lhs->as.i, rhs->as.i);
+                } else if (op == VM_OP_MUL) {
+                    out->as.i = vm_wrap_mul(lhs->as.i, rhs->as.i);
+                } else {
+                    if (rhs->as.i == 0) {
+                        *error = "integer division by zero";
+                        return false;
+                    }
+                    out->as.i = (rhs->as.i == -1) ? vm_wrap_sub(0, lhs->as.i) : lhs->as.i / rhs->as.i;
+                }
+                return true;
+            }
+            if (both_num) {
+                double a = vm_typed_as_float(lhs);
+                double b = vm_typed_as_float(rhs);
+                out->kind = VM_TYPED_FLOAT;
+                out->as.f = (op == VM_OP_ADD) ? a + b : (op == VM_OP_SUB) ? a - b : (op == VM_OP_MUL) ? a * b : a / b;
+                return true;
+            }
+            *error = "arithmetic operator requires numeric operands";
+            return false;
+        case VM_OP_FADD:
+        case VM_OP_FSUB:
+        case VM_OP_FMUL:
+        case VM_OP_FDIV:
+            if (!both_num) {
+                *error = "float operator requires numeric operands";
+                return false;
+            }
+            {
+                double a = vm_typed_as_float(lhs);
+                double b = vm_typed_as_float(rhs);
+                out->kind = VM_TYPED_FLOAT;
+                out->as.f = (op == VM_OP_FADD) ? a + b : (op == VM_OP_FSUB) ? a - b : (op == VM_OP_FMUL) ? a * b : a / b;
+            }
+            return true;
+        case VM_OP_MOD:
+        case VM_OP_REM:
+            if (!both_int) {
+                *error = "$mod/$rem require integer operands";
+                return false;
+            }
+            if (rhs->as.i == 0) {
+                *error = "integer modulo by zero";
+                return false;
+            }
+            out->kind = VM_TYPED_INT;
+            out->as.i = (rhs->as.i == -1) ? 0 : lhs->as.i % rhs->as.i;
+            if (op == VM_OP_MOD && out->as.i != 0 && ((out->as.i < 0) != (rhs->as.i < 0))) {
+                out->as.i += rhs->as.i;
+            }
+            return true;
+        case VM_OP_EQ:
+        case VM_OP_NEQ:
+            out->kind = VM_TYPED_BOOL;
+            out->as.b = vm_typed_equal(program, lhs, rhs) == (op == VM_OP_EQ);
+            return true;
+        case VM_OP_LT:
+        case VM_OP_GT:
+        case VM_OP_LTE:
+        case VM_OP_GTE: {
+            if (!both_num) {
+                *error = "comparison requires numeric operands";
+                return false;
+            }
+            int cmp;
+            if (both_int) {
+                cmp = (lhs->as.i > rhs->as.i) - (lhs->as.i < rhs->as.i);
+            } else {
+                double a = vm_typed_as_float(lhs);
+                double b = vm_typed_as_float(rhs);
+                cmp = (a > b) - (a < b);
+            }
+            out->kind = VM_TYPED_BOOL;
+            out->as.b = (op == VM_OP_LT) ? cmp < 0 : (op == VM_OP_GT) ? cmp > 0 : (op == VM_OP_LTE) ? cmp <= 0 : cmp >= 0;
+            return true;
+        }
+        case VM_OP_AND:
+        case VM_OP_OR:
+            if (!both_bool) {
+                *error = "logical operator requires bool operands";
+                return false;
+            }
+            out->kind = VM_TYPED_BOOL;
+            out->as.b = (op == VM_OP_AND) ? (lhs->as.b && rhs->as.b) : (lhs->as.b || rhs->as.b);
+            return true;
+        case VM_OP_NOT:
+            if (lhs->kind != VM_TYPED_BOOL) {
+                *error = "$not requires a bool operand";
+                return false;
+            }
+            out->kind = VM_TYPED_BOOL;
+            out->as.b = !lhs->as.b;
+            return true;
+        case VM_OP_BNOT:
+            if (lhs->kind != VM_TYPED_INT) {
+                *error = "$bnot requires an integer operand";
+                return false;
+            }
+            out->kind = VM_TYPED_INT;
+            out->as.i = ~lhs->as.i;
+            return true;
+        case VM_OP_BAND:
+        case VM_OP_BOR:
+        case VM_OP_BXOR:
+            if (!both_int) {
+                *error = "bitwise operator requires integer operands";
+                return false;
+            }
+            out->kind = VM_TYPED_INT;
+            out->as.i = (op == VM_OP_BAND) ? (lhs->as.i & rhs->as.i) : (op == VM_OP_BOR) ? (lhs->as.i | rhs->as.i) : (lhs->as.i ^ rhs->as.i);
+            return true;
+        case VM_OP_LSHIFT:
+        case VM_OP_RSHIFT:
+            if (!both_int) {
+                *error = "shift operator requires integer operands";
+                return false;
+            }
+            if (rhs->as.i < 0 || rhs->as.i > 63) {
+                *error = "shift amount out of range";
+                return false;
+            }
+            out->kind = VM_TYPED_INT;
+            out->as.i = (op == VM_OP_LSHIFT) ? (int64_t)((uint64_t)lhs->as.i << rhs->as.i) : (lhs->as.i >> rhs->as.i);
+            return true;
+        default:
+            *error = "operator cannot be evaluated";
+            return false;
+    }
+}
+
+// Apply an operator opcode to the top of the stack. Verified programs pass checked=false: the
+// verifier has proven the operands are present, and the result reuses an operand's stack slot.
+static inline bool vm_typed_execute_operator(MorphlVm* vm, uint8_t op, bool checked, FILE* err_stream) {
+    const VmOperatorInfo* info = vm_operator_info(op);
+    uint8_t arity = info->arity;
+
+    VmTypedValue rhs = {0};
+    VmTypedValue lhs = {0};
+    if (checked) {
+        if (arity == 2 && !vm_typed_pop(vm, &rhs)) {
+            vm_report_error(err_stream, "operator stack underflow");
+            return false;
+        }
+        if (!vm_typed_pop(vm, &lhs)) {
+            vm_typed_free(&rhs);
+            vm_report_error(err_stream, "operator stack underflow");
+            return false;
+        }
+    } else {
+        if (arity == 2) {
+            rhs = vm->tstack[--vm->tstack_count];
+        }
+        lhs = vm->tstack[--vm->tstack_count];
+    }
+
+    if (op == VM_OP_SET) {
+        if (lhs.kind != VM_TYPED_IDENT) {
+            vm_typed_free(&rhs);
+            vm_typed_free(&lhs);
+            vm_report_error(err_stream, "$set lhs must be an identifier");
+            return false;
+        }
+        VmTypedValue value = vm_typed_share(vm_typed_resolve(vm, &rhs));
+        vm_typed_free(&rhs);
+        bool ok = vm_typed_set_slot(vm, lhs.as.str, &value) && vm_typed_push(vm, value);
+        if (!ok) {
+            vm_report_error(err_stream, "failed to write slot during $set");
+        }
+        return ok;
+    }
+
+    VmTypedValue result = {0};
+    const char* error = NULL;
+    bool ok = vm_typed_eval(vm->program,
+                            op,
+                            vm_typed_resolve(vm, &lhs),
+                            (arity == 2) ? vm_typed_resolve(vm, &rhs) : NULL,
+                            &result,
+                            &error);
+    vm_typed_free(&rhs);
+    vm_typed_free(&lhs);
+    if (!ok) {
+        FILE* out = err_stream ? err_stream : stderr;
+        fprintf(out, "runtime error: %s: %s\n", info->name, error);
+        return false;
+    }
+    if (!checked) {
+        vm->tstack[vm->tstack_count++] = result;
+        return true;
+    }
+    if (!vm_typed_push(vm, result)) {
+        vm_report_error(err_stream, "stack overflow pushing operator result");
+        return false;
+    }
+    return true;
+}
+
+// Convert a top-level return value to a process exit code.
+static bool vm_typed_exit_code(const VmTypedValue* value, morphl_exit_code_t* out) {
+    if (value->kind == VM_TYPED_INT && value->as.i >= 0 && value->as.i <= 255) {
+        *out = (morphl_exit_code_t)value->as.i;
+        return true;
+    }
+    if (value->kind == VM_TYPED_FLOAT && value->as.f >= 0 && value->as.f <= 255 &&
+        value->as.f == (double)(int)value->as.f) {
+        *out = (morphl_exit_code_t)(int)value->as.f;
+        return true;
+    }
+    return false;
+}
+
+// Enter function func_index. Its arguments, on top of the stack, become the first locals of the new
+// frame in place, with identifiers resolved; the other locals start null and the frame's operands
+// go above them. The stack was allocated whole, so the only cost of a deeper call is one guard:
+// the frame, and for verified programs its deepest operand stack, must fit.
+static bool vm_typed_enter(MorphlVm* vm, uint32_t func_index, FILE* err_stream) {
+    const VmFunction* fn = &vm->program->functions[func_index];
+    size_t local_base = vm->tstack_count - fn->param_count;
+    size_t base = local_base + fn->local_count;
+    if (base + fn->max_stack > vm->tstack_capacity || vm->call_frame_count == VM_MAX_CALL_DEPTH) {
+        vm_report_error(err_stream, "stack overflow");
+        return false;
+    }
+
+    VmTypedValue* locals = &vm->tstack[local_base];
+    for (uint32_t i = 0; i < fn->param_count; ++i) {
+        if (locals[i].kind == VM_TYPED_IDENT) {
+            locals[i] = vm_typed_share(vm_typed_resolve(vm, &locals[i]));
+        }
+    }
+    for (uint32_t i = fn->param_count; i < fn->local_count; ++i) {
+        locals[i] = (VmTypedValue){.kind = VM_TYPED_NULL};
+    }
+    vm->tstack_count = base;
+
+    VmCallFrame* frame = &vm->call_frames[vm->call_frame_count];
+    frame->func_index = func_index;
+    frame->base = base;
+    frame->local_base = local_base;
+    frame->return_ip = vm->ip;
+    frame->scope_depth = (vm->call_frame_count > 0) ? frame[-1].scope_depth + 1 : 0;
+    // The sampler reads every counted frame, so count this one only once it is filled in.
+    atomic_signal_fence(memory_order_release);
+    vm->call_frame_count++;
+    vm->ip = fn->entry;
+    return true;
+}
+
+// Leave the current function frame, releasing its operands and locals, and push result for the
+// caller where the arguments were. That slot is below the callee's frame, so this cannot fail.
+static void vm_typed_leave(MorphlVm* vm, VmTypedValue result) {
+    const VmCallFrame* frame = &vm->call_frames[--vm->call_frame_count];
+    while (vm->tstack_count > frame->local_base) {
+        vm_typed_free(&vm->tstack[--vm->tstack_count]);
+    }
+    vm->ip = frame->return_ip;
+    vm->tstack[vm->tstack_count++] = result;
+}
+
+// Replace the current frame with one for func_index: the caller's locals and operands are released,
+// the arguments move down to where its locals started, and the new frame returns straight to the
+// caller's caller. A chain of tail calls therefore runs in one frame.
+static bool vm_typed_tail_enter(MorphlVm* vm, uint32_t func_index, FILE* err_stream) {
+    const VmFunction* fn = &vm->program->functions[func_index];
+    const VmCallFrame* frame = &vm->call_frames[--vm->call_frame_count];
+    size_t args_at = vm->tstack_count - fn->param_count;
+    for (size_t i = frame->local_base; i < args_at; ++i) {
+        vm_typed_free(&vm->tstack[i]);
+    }
+    memmove(&vm->tstack[frame->local_base], &vm->tstack[args_at], fn->param_count * sizeof(VmTypedValue));
+    vm->tstack_count = frame->local_base + fn->param_count;
+    vm->ip = frame->return_ip;
+    return vm_typed_enter(vm, func_index, err_stream);
+}
+
+// The dispatch loop is instantiated twice. The checked loop guards every stack access. The verified
+// loop relies on vm_verify_program: operands are known to be present and the stack is preallocated
+// to the program's maximum depth.
+#define VM_TYPED_LOOP_NAME vm_typed_run_checked
+#define VM_TYPED_CHECKED 1
+#include "vm_typed_loop.h"
+#undef VM_TYPED_LOOP_NAME
+#undef VM_TYPED_CHECKED
+
+#define VM_TYPED_LOOP_NAME vm_typed_run_verified
+#define VM_TYPED_CHECKED 0
+#include "vm_typed_loop.h"
+#undef VM_TYPED_LOOP_NAME
+#undef VM_TYPED_CHECKED
+
+morphl_exit_code_t vm_typed_execute(MorphlVm* vm,
+                                    uint32_t func_index,
+                                    const MorphlVmArg* args,
+                                    uint32_t arg_count,
+                                    FILE* err_stream) {
+    const MorphlVmProgram* program = vm->program;
+    vm_typed_clear(vm);
+    if (!vm->tstack) {
+        vm->tstack = malloc(VM_TYPED_STACK_VALUES * sizeof(VmTypedValue));
+        if (!vm->tstack) {
+            vm_report_error(err_stream, "out of memory allocating value stack");
+            return 1;
+        }
+        vm->tstack_capacity = VM_TYPED_STACK_VALUES;
+    }
+
+    // The arguments go on the stack as if a CALL were about to enter the function.
+    for (uint32_t i = 0; i < arg_count; ++i) {
+        VmTypedValue value = {.kind = VM_TYPED_NULL};
+        switch (args[i].kind) {
+            case MORPHL_VM_ARG_INT:
+                value = (VmTypedValue){.kind = VM_TYPED_INT, .as.i = args[i].as.i};
+                break;
+            case MORPHL_VM_ARG_FLOAT:
+                value = (VmTypedValue){.kind = VM_TYPED_FLOAT, .as.f = args[i].as.f};
+                break;
+            case MORPHL_VM_ARG_BOOL:
+                value = (VmTypedValue){.kind = VM_TYPED_BOOL, .as.b = args[i].as.b};
+                break;
+        }
+        if (!vm_typed_push(vm, value)) {
+            vm_report_error(err_stream, "stack overflow passing arguments");
+            return 1;
+        }
+    }
+    if (!vm_typed_enter(vm, func_index, err_stream)) {
+        return 1;
+    }
+    if (program->verified) {
+        return vm_typed_run_verified(vm, err_stream);
+    }
+    return vm_typed_run_checked(vm, err_stream);
+}
@@ -0,0 +1,379 @@
+// Typed engine dispatch loop. vm_typed.c includes this file twice, once per VM_TYPED_CHECKED value,
+// with VM_TYPED_LOOP_NAME naming the generated function. It deliberately has no include guard.
+//
+// VM_TYPED_CHECKED 1: every stack access is guarded; used for programs the verifier did not accept.
+// VM_TYPED_CHECKED 0: the verifier proved operand presence and entering a frame checked that its
+//                     max_stack slots fit, so pushes and pops touch the stack directly.
+
+#if VM_TYPED_CHECKED
+#define VM_TYPED_PUSH(value) vm_typed_push(vm, (value))
+#define VM_TYPED_NEEDS(n) (vm->tstack_count >= vm->call_frames[vm->call_frame_count - 1].base + (size_t)(n))
+#else
+#define VM_TYPED_PUSH(value) (vm->tstack[vm->tstack_count++] = (value), true)
+#define VM_TYPED_NEEDS(n) true
+#endif
+
+static morphl_exit_code_t VM_TYPED_LOOP_NAME(MorphlVm* vm, FILE* err_stream) {
+    const MorphlVmProgram* program = vm->program;
+    // Locals of the current frame; refreshed whenever a CALL or RET switches frames.
+    VmTypedValue* locals = &vm->tstack[vm->call_frames[vm->call_frame_count - 1].local_base];
+
+#if VM_TYPED_COMPUTED_GOTO
+    // Opcodes without a handler land on the unknown-opcode label.
+    VM_TYPED_IGNORE_OVERRIDE_INIT_BEGIN
+    static const void* const kDispatch[256] = {
+        [0 ... 255] = &&vm_label_unknown,
+        VM_TYPED_TARGET(VM_OP_HALT),
+        VM_TYPED_TARGET(VM_OP_PUSH_NULL),
+        VM_TYPED_TARGET(VM_OP_PUSH_LITERAL),
+        VM_TYPED_TARGET(VM_OP_PUSH_IDENT),
+        VM_TYPED_TARGET(VM_OP_MAKE_GROUP),
+        VM_TYPED_TARGET(VM_OP_SET_SLOT),
+        VM_TYPED_TARGET(VM_OP_LOAD_LOCAL),
+        VM_TYPED_TARGET(VM_OP_STORE_LOCAL),
+        VM_TYPED_TARGET(VM_OP_PUSH_CONST_I64),
+        VM_TYPED_TARGET(VM_OP_PUSH_CONST_F64),
+        VM_TYPED_TARGET(VM_OP_POP),
+        VM_TYPED_TARGET(VM_OP_STORE_LOCAL_POP),
+        VM_TYPED_TARGET(VM_OP_INC_LOCAL),
+        VM_TYPED_TARGET(VM_OP_ADD_LOCAL_CONST),
+        VM_TYPED_TARGET(VM_OP_JUMP),
+        VM_TYPED_TARGET(VM_OP_JUMP_IF_FALSE),
+        VM_TYPED_TARGET(VM_OP_LOOP),
+        VM_TYPED_TARGET(VM_OP_ADD),
+        VM_TYPED_TARGET(VM_OP_SUB),
+        VM_TYPED_TARGET(VM_OP_MUL),
+        VM_TYPED_TARGET(VM_OP_DIV),
+        VM_TYPED_TARGET(VM_OP_MOD),
+        VM_TYPED_TARGET(VM_OP_REM),
+        VM_TYPED_TARGET(VM_OP_FADD),
+        VM_TYPED_TARGET(VM_OP_FSUB),
+        VM_TYPED_TARGET(VM_OP_FMUL),
+        VM_TYPED_TARGET(VM_OP_FDIV),
+        VM_TYPED_TARGET(VM_OP_EQ),
+        VM_TYPED_TARGET(VM_OP_NEQ),
+        VM_TYPED_TARGET(VM_OP_LT),
+        VM_TYPED_TARGET(VM_OP_GT),
+        VM_TYPED_TARGET(VM_OP_LTE),
+        VM_TYPED_TARGET(VM_OP_GTE),
+        VM_TYPED_TARGET(VM_OP_AND),
+        VM_TYPED_TARGET(VM_OP_OR),
+        VM_TYPED_TARGET(VM_OP_NOT),
+        VM_TYPED_TARGET(VM_OP_BAND),
+        VM_TYPED_TARGET(VM_OP_BOR),
+        VM_TYPED_TARGET(VM_OP_BXOR),
+        VM_TYPED_TARGET(VM_OP_BNOT),
+        VM_TYPED_TARGET(VM_OP_LSHIFT),
+        VM_TYPED_TARGET(VM_OP_RSHIFT),
+        VM_TYPED_TARGET(VM_OP_SET),
+        VM_TYPED_TARGET(VM_OP_RET),
+        VM_TYPED_TARGET(VM_OP_CALL),
+        VM_TYPED_TARGET(VM_OP_TAIL_CALL),
+        VM_TYPED_TARGET(VM_OP_NODE_META),
+        VM_TYPED_TARGET(VM_INSTR_END),
+    };
+    VM_TYPED_IGNORE_OVERRIDE_INIT_END
+    const VmInstr* in = NULL;
+    VM_TYPED_NEXT();
+    {
+        {
+#else
+    for (;;) {
+        const VmInstr* in = &program->instrs[vm->ip++];
+        VM_PROFILE_RECORD(vm, vm->ip - 1, in->op);
+
+        switch (in->op) {
+#endif
+            VM_TYPED_CASE(VM_OP_HALT):
+                return 0;
+
+            VM_TYPED_CASE(VM_OP_PUSH_NULL): {
+                VmTypedValue value = {.kind = VM_TYPED_NULL};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow during PUSH_NULL");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_PUSH_LITERAL): {
+                // Numbers come from the constant pool, so a literal string is only ever a string.
+                VmTypedValue value = {.kind = VM_TYPED_STRING, .as.str = in->a};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow during PUSH");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_PUSH_CONST_I64): {
+                VmTypedValue value = {.kind = VM_TYPED_INT, .as.i = in->ref.i};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow during PUSH_CONST_I64");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_PUSH_CONST_F64): {
+                VmTypedValue value = {.kind = VM_TYPED_FLOAT, .as.f = in->ref.f};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow during PUSH_CONST_F64");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_PUSH_IDENT): {
+                VmTypedValue value = {.kind = VM_TYPED_IDENT, .as.str = in->a};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow during PUSH");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_POP): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "POP requires a value on stack");
+                    return 1;
+                }
+                vm_typed_free(&vm->tstack[--vm->tstack_count]);
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_JUMP):
+            VM_TYPED_CASE(VM_OP_LOOP):
+                // The loader resolved the target to an instruction index.
+                vm->ip = in->a;
+                VM_TYPED_NEXT();
+
+            VM_TYPED_CASE(VM_OP_JUMP_IF_FALSE): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "JUMP_IF_FALSE requires a condition on stack");
+                    return 1;
+                }
+                VmTypedValue cond = vm->tstack[--vm->tstack_count];
+                const VmTypedValue* resolved = vm_typed_resolve(vm, &cond);
+                if (resolved->kind != VM_TYPED_BOOL) {
+                    vm_typed_free(&cond);
+                    vm_report_error(err_stream, "branch condition must be bool");
+                    return 1;
+                }
+                if (!resolved->as.b) {
+                    vm->ip = in->a;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_MAKE_GROUP): {
+                uint32_t arity = in->a;
+                if (!VM_TYPED_NEEDS(arity)) {
+                    vm_report_error(err_stream, "MAKE_GROUP arity exceeds stack depth");
+                    return 1;
+                }
+
+                VmTypedGroup* group = malloc(sizeof(VmTypedGroup) + (size_t)arity * sizeof(VmTypedValue));
+                if (!group) {
+                    vm_report_error(err_stream, "out of memory during MAKE_GROUP");
+                    return 1;
+                }
+                // The operands move into the group; identifiers are resolved here since groups
+                // capture by value.
+                VmTypedValue* items = &vm->tstack[vm->tstack_count - arity];
+                group->refs = 1;
+                group->count = arity;
+                for (uint32_t i = 0; i < arity; ++i) {
+                    group->items[i] = (items[i].kind == VM_TYPED_IDENT) ? vm_typed_share(vm_typed_resolve(vm, &items[i]))
+                                                                        : items[i];
+                }
+                vm->tstack_count -= arity;
+
+                VmTypedValue value = {.kind = VM_TYPED_GROUP, .as.group = group};
+                if (!VM_TYPED_PUSH(value)) {
+                    vm_report_error(err_stream, "stack overflow pushing group");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_SET_SLOT): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "SET_SLOT requires a value on stack");
+                    return 1;
+                }
+
+                // The assigned value stays on the stack as the result of the declaration.
+                VmTypedValue* top = &vm->tstack[vm->tstack_count - 1];
+                VmTypedValue value = vm_typed_share(vm_typed_resolve(vm, top));
+                vm_typed_free(top);
+                *top = value;
+                if (!vm_typed_set_slot(vm, in->a, top)) {
+                    vm_report_error(err_stream, "failed to assign slot");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_LOAD_LOCAL): {
+                // The loader checked in->a against the local count of the enclosing function.
+                if (!VM_TYPED_PUSH(vm_typed_share(&locals[in->a]))) {
+                    vm_report_error(err_stream, "stack overflow during LOAD_LOCAL");
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_STORE_LOCAL): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "STORE_LOCAL requires a value on stack");
+                    return 1;
+                }
+
+                // Like SET_SLOT, the stored value stays on the stack as the expression result.
+                VmTypedValue* top = &vm->tstack[vm->tstack_count - 1];
+                if (top->kind == VM_TYPED_IDENT) {
+                    *top = vm_typed_share(vm_typed_resolve(vm, top));
+                }
+                VmTypedValue stored = vm_typed_share(top);
+                vm_typed_free(&locals[in->a]);
+                locals[in->a] = stored;
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_STORE_LOCAL_POP): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "STORE_LOCAL_POP requires a value on stack");
+                    return 1;
+                }
+
+                // The stack's reference moves into the local.
+                VmTypedValue value = vm->tstack[--vm->tstack_count];
+                if (value.kind == VM_TYPED_IDENT) {
+                    value = vm_typed_share(vm_typed_resolve(vm, &value));
+                }
+                vm_typed_free(&locals[in->a]);
+                locals[in->a] = value;
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_INC_LOCAL):
+            VM_TYPED_CASE(VM_OP_ADD_LOCAL_CONST): {
+                // Fused LOAD_LOCAL; PUSH_CONST_I64; ADD|SUB; STORE_LOCAL_POP. The loader put the amount in ref.i,
+                // negated for SUB, so a failure cannot tell which of the two the source used.
+                VmTypedValue* local = &locals[in->a];
+                if (local->kind == VM_TYPED_INT) {
+                    local->as.i = vm_wrap_add(local->as.i, in->ref.i);
+                    VM_TYPED_NEXT();
+                }
+                VmTypedValue amount = {.kind = VM_TYPED_INT, .as.i = in->ref.i};
+                VmTypedValue result = {0};
+                const char* error = NULL;
+                if (!vm_typed_eval(program, VM_OP_ADD, local, &amount, &result, &error)) {
+                    fprintf(err_stream ? err_stream : stderr, "runtime error: $add/$sub: %s\n", error);
+                    return 1;
+                }
+                vm_typed_free(local);
+                *local = result;
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_ADD):
+            VM_TYPED_CASE(VM_OP_SUB):
+            VM_TYPED_CASE(VM_OP_MUL):
+            VM_TYPED_CASE(VM_OP_DIV):
+            VM_TYPED_CASE(VM_OP_MOD):
+            VM_TYPED_CASE(VM_OP_REM):
+            VM_TYPED_CASE(VM_OP_FADD):
+            VM_TYPED_CASE(VM_OP_FSUB):
+            VM_TYPED_CASE(VM_OP_FMUL):
+            VM_TYPED_CASE(VM_OP_FDIV):
+            VM_TYPED_CASE(VM_OP_EQ):
+            VM_TYPED_CASE(VM_OP_NEQ):
+            VM_TYPED_CASE(VM_OP_LT):
+            VM_TYPED_CASE(VM_OP_GT):
+            VM_TYPED_CASE(VM_OP_LTE):
+            VM_TYPED_CASE(VM_OP_GTE):
+            VM_TYPED_CASE(VM_OP_AND):
+            VM_TYPED_CASE(VM_OP_OR):
+            VM_TYPED_CASE(VM_OP_NOT):
+            VM_TYPED_CASE(VM_OP_BAND):
+            VM_TYPED_CASE(VM_OP_BOR):
+            VM_TYPED_CASE(VM_OP_BXOR):
+            VM_TYPED_CASE(VM_OP_BNOT):
+            VM_TYPED_CASE(VM_OP_LSHIFT):
+            VM_TYPED_CASE(VM_OP_RSHIFT):
+            VM_TYPED_CASE(VM_OP_SET):
+                if (!vm_typed_execute_operator(vm, in->op, VM_TYPED_CHECKED, err_stream)) {
+                    return 1;
+                }
+                VM_TYPED_NEXT();
+
+            VM_TYPED_CASE(VM_OP_RET): {
+                if (!VM_TYPED_NEEDS(1)) {
+                    vm_report_error(err_stream, "stack underflow while trying to read exit code");
+                    return 1;
+                }
+                if (vm->call_frame_count > 1) {
+                    // The value is resolved now, before the callee's state goes away.
+                    VmTypedValue result = vm->tstack[--vm->tstack_count];
+                    if (result.kind == VM_TYPED_IDENT) {
+                        result = vm_typed_share(vm_typed_resolve(vm, &result));
+                    }
+                    vm_typed_leave(vm, result);
+                    locals = &vm->tstack[vm->call_frames[vm->call_frame_count - 1].local_base];
+                    VM_TYPED_NEXT();
+                }
+
+                VmTypedValue exit_value = vm->tstack[--vm->tstack_count];
+                morphl_exit_code_t code = 0;
+                bool ok = vm_typed_exit_code(vm_typed_resolve(vm, &exit_value), &code);
+                vm_typed_free(&exit_value);
+                if (!ok) {
+                    vm_report_error(err_stream, "invalid exit code (must be a number between 0 and 255)");
+                    return 1;
+                }
+                return code;
+            }
+
+            VM_TYPED_CASE(VM_OP_CALL): {
+                if (!VM_TYPED_NEEDS(program->functions[in->a].param_count)) {
+                    vm_report_error(err_stream, "CALL requires the function's arguments on stack");
+                    return 1;
+                }
+                if (!vm_typed_enter(vm, in->a, err_stream)) {
+                    return 1;
+                }
+                locals = &vm->tstack[vm->call_frames[vm->call_frame_count - 1].local_base];
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_TAIL_CALL): {
+                if (!VM_TYPED_NEEDS(program->functions[in->a].param_count)) {
+                    vm_report_error(err_stream, "TAIL_CALL requires the function's arguments on stack");
+                    return 1;
+                }
+                if (!vm_typed_tail_enter(vm, in->a, err_stream)) {
+                    return 1;
+                }
+                locals = &vm->tstack[vm->call_frames[vm->call_frame_count - 1].local_base];
+                VM_TYPED_NEXT();
+            }
+
+            VM_TYPED_CASE(VM_OP_NODE_META):
+                vm_report_error(err_stream, "NODE_META execution is not supported");
+                return 1;
+
+            VM_TYPED_CASE(VM_INSTR_END):
+                vm_report_error(err_stream, "program terminated without HALT");
+                return 1;
+
+            VM_TYPED_DEFAULT:
+                vm_report_error(err_stream, "unknown opcode");
+                return 1;
+        }
+    }
+}
+
+#undef VM_TYPED_PUSH
+#undef VM_TYPED_NEEDS
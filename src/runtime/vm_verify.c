@@ -0,0 +1,192 @@
+#include "vm_internal.h"
+
+#include <stdlib.h>
+
+// Stack effect of one instruction: how many values it needs on the stack, and the net change.
+typedef struct {
+    uint32_t needs;
+    int64_t delta;
+    bool ends_block;    // no fall-through successor (HALT, RET, TAIL_CALL, JUMP, LOOP, end of code)
+    bool branches;      // instruction a is a successor too (jumps)
+    bool verifiable;    // false for instructions whose effect the verifier cannot model yet
+} VmStackEffect;
+
+static VmStackEffect vm_stack_effect(const MorphlVmProgram* program, const VmInstr* in) {
+    VmStackEffect effect = {.needs = 0, .delta = 0, .ends_block = false, .branches = false, .verifiable = true};
+
+    const VmOperatorInfo* info = vm_operator_info(in->op);
+    if (info) {
+        effect.needs = info->arity;
+        effect.delta = 1 - (int64_t)info->arity;
+        return effect;
+    }
+
+    switch (in->op) {
+        case VM_OP_HALT:
+        case VM_INSTR_END:
+            effect.ends_block = true;
+            break;
+        case VM_OP_PUSH_NULL:
+        case VM_OP_PUSH_LITERAL:
+        case VM_OP_PUSH_CONST_I64:
+        case VM_OP_PUSH_CONST_F64:
+        case VM_OP_PUSH_IDENT:
+        case VM_OP_LOAD_LOCAL:
+            effect.delta = 1;
+            break;
+        case VM_OP_MAKE_GROUP:
+            effect.needs = in->a;
+            effect.delta = 1 - (int64_t)in->a;
+            break;
+        case VM_OP_SET_SLOT:
+        case VM_OP_STORE_LOCAL:
+            effect.needs = 1;
+            break;
+        case VM_OP_INC_LOCAL:
+        case VM_OP_ADD_LOCAL_CONST:
+            break;
+        case VM_OP_POP:
+        case VM_OP_STORE_LOCAL_POP:
+            effect.needs = 1;
+            effect.delta = -1;
+            break;
+        case VM_OP_JUMP:
+        case VM_OP_LOOP:
+            effect.ends_block = true;
+            effect.branches = true;
+            break;
+        case VM_OP_JUMP_IF_FALSE:
+            effect.needs = 1;
+            effect.delta = -1;
+            effect.branches = true;
+            break;
+        case VM_OP_RET:
+            effect.needs = 1;
+            effect.delta = -1;
+            effect.ends_block = true;
+            break;
+        case VM_OP_CALL:
+            // The arguments are replaced by the return value; the callee is verified on its own.
+            effect.needs = program->functions[in->a].param_count;
+            effect.delta = 1 - (int64_t)effect.needs;
+            break;
+        case VM_OP_TAIL_CALL:
+            // The callee's frame replaces this one, so nothing after it runs here.
+            effect.needs = program->functions[in->a].param_count;
+            effect.delta = -(int64_t)effect.needs;
+            effect.ends_block = true;
+            break;
+        default:
+            // Scope management and NODE_META have no modelled stack effect yet.
+            effect.verifiable = false;
+            break;
+    }
+    return effect;
+}
+
+static bool vm_verify_fail(FILE* err_stream, const char* message, uint32_t index) {
+    if (err_stream) {
+        fprintf(err_stream, "runtime error: %s at instruction %u\n", message, index);
+    }
+    return false;
+}
+
+// Walk the body of function f from its entry at depth 0 and record the deepest stack it reaches.
+// depth_at and blocks are scratch arrays of instr_count + 1 entries.
+static bool vm_verify_function(MorphlVmProgram* program,
+                               uint32_t f,
+                               int64_t* depth_at,
+                               uint32_t* blocks,
+                               bool* verifiable,
+                               FILE* err_stream) {
+    VmFunction* fn = &program->functions[f];
+
+    // depth_at[i] is the stack depth on entry to instruction i, or -1 until a path reaches it.
+    // Each basic block is walked once from its entry; every other path into it must agree on depth.
+    for (uint32_t i = fn->entry; i <= fn->end; ++i) {
+        depth_at[i] = -1;
+    }
+
+    bool ok = true;
+    int64_t max_depth = 0;
+    size_t block_count = 0;
+    depth_at[fn->entry] = 0;
+    blocks[block_count++] = fn->entry;
+
+    while (ok && *verifiable && block_count > 0) {
+        uint32_t i = blocks[--block_count];
+        int64_t depth = depth_at[i];
+        for (;;) {
+            VmStackEffect effect = vm_stack_effect(program, &program->instrs[i]);
+            if (!effect.verifiable) {
+                *verifiable = false;
+                break;
+            }
+            if (depth < (int64_t)effect.needs) {
+                ok = vm_verify_fail(err_stream, "stack underflow", i);
+                break;
+            }
+            depth += effect.delta;
+            if (depth > max_depth) {
+                max_depth = depth;
+            }
+            if (effect.branches) {
+                // The loader keeps jump targets inside the function.
+                uint32_t target = program->instrs[i].a;
+                if (depth_at[target] < 0) {
+                    depth_at[target] = depth;
+                    blocks[block_count++] = target;
+                } else if (depth_at[target] != depth) {
+                    ok = vm_verify_fail(err_stream, "stack depth mismatch", target);
+                    break;
+                }
+            }
+            if (effect.ends_block) {
+                break;
+            }
+
+            // Only the last body may run into the end-of-code sentinel.
+            uint32_t next = i + 1;
+            if (next == fn->end && next != program->instr_count) {
+                ok = vm_verify_fail(err_stream, "falls through into another function", i);
+                break;
+            }
+            if (depth_at[next] >= 0) {
+                if (depth_at[next] != depth) {
+                    ok = vm_verify_fail(err_stream, "stack depth mismatch", next);
+                }
+                break;
+            }
+            depth_at[next] = depth;
+            i = next;
+        }
+    }
+
+    fn->max_stack = (uint32_t)max_depth;
+    return ok;
+}
+
+bool vm_verify_program(MorphlVmProgram* program, FILE* err_stream) {
+    program->verified = false;
+
+    size_t slots = (size_t)program->instr_count + 1;
+    int64_t* depth_at = malloc(slots * sizeof(int64_t));
+    uint32_t* blocks = malloc(slots * sizeof(uint32_t));
+    if (!depth_at || !blocks) {
+        free(depth_at);
+        free(blocks);
+        return false;
+    }
+
+    bool ok = true;
+    bool verifiable = true;
+    for (uint32_t f = 0; ok && verifiable && f < program->function_count; ++f) {
+        ok = vm_verify_function(program, f, depth_at, blocks, &verifiable, err_stream);
+    }
+    free(depth_at);
+    free(blocks);
+
+    // Programs the verifier cannot model are still valid; they just run on the checked path.
+    program->verified = ok && verifiable;
+    return ok;
+}
@@ -0,0 +1,74 @@
+#include "tokens/tokens.h"
+
+#include <stdlib.h>
+
+#include "util/sources.h"
+
+void token_stream_init(TokenStream* stream) {
+  *stream = (TokenStream){0};
+}
+
+void token_stream_free(TokenStream* stream) {
+  if (!stream) return;
+  free(stream->kinds);
+  free(stream->starts);
+  free(stream->lens);
+  free(stream->files);
+  free(stream->sources);
+  token_stream_init(stream);
+}
+
+bool token_stream_add_source(TokenStream* stream, const char* filename, Str text, uint32_t* out_file) {
+  if (text.len >= UINT32_MAX || stream->source_count >= UINT32_MAX) return false;
+  if (filename && !morphl_sources_add(filename, text)) return false;
+  if (stream->source_count == stream->source_capacity) {
+    size_t new_cap = stream->source_capacity ? stream->source_capacity * 2 : 4;
+    TokenSource* resized = realloc(stream->sources, new_cap * sizeof(TokenSource));
+    if (!resized) return false;
+    stream->sources = resized;
+    stream->source_capacity = new_cap;
+  }
+  stream->sources[stream->source_count] = (TokenSource){.filename = filename, .text = text};
+  *out_file = (uint32_t)stream->source_count++;
+  return true;
+}
+
+// Each array is resized on its own; a failure leaves the ones already grown larger, which is
+// harmless because capacity only moves once all four have room.
+static bool grow_array(void** array, size_t elem_size, size_t cap) {
+  void* resized = realloc(*array, cap * elem_size);
+  if (!resized) return false;
+  *array = resized;
+  return true;
+}
+
+bool token_stream_reserve(TokenStream* stream, size_t needed) {
+  if (stream->capacity >= needed) return true;
+  size_t new_cap = stream->capacity ? stream->capacity * 2 : 64;
+  while (new_cap < needed) new_cap *= 2;
+  if (!grow_array((void**)&stream->kinds, sizeof(TokenKind), new_cap) ||
+      !grow_array((void**)&stream->starts, sizeof(uint32_t), new_cap) ||
+      !grow_array((void**)&stream->lens, sizeof(uint32_t), new_cap) ||
+      !grow_array((void**)&stream->files, sizeof(uint32_t), new_cap)) {
+    return false;
+  }
+  stream->capacity = new_cap;
+  return true;
+}
+
+void token_stream_locate(const TokenStream* stream, size_t i, size_t* row, size_t* col) {
+  if (!morphl_sources_locate(stream->sources[stream->files[i]].filename, stream->starts[i], row, col)) {
+    // A source without a filename has no index: report everything on row 1.
+    *row = 1;
+    *col = (size_t)stream->starts[i] + 1;
+  }
+}
+
+struct token token_stream_token(const TokenStream* stream, size_t i) {
+  return (struct token){
+    .kind = stream->kinds[i],
+    .lexeme = token_stream_lexeme(stream, i),
+    .filename = stream->sources[stream->files[i]].filename,
+    .offset = stream->starts[i],
+  };
+}
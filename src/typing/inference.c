@@ -10,7 +10,7 @@
 
 static MorphlSpan span_from_node(const AstNode* node) {
   if (!node) return morphl_span_unknown();
-  return morphl_span_from_loc(node->filename, node->row, node->col);
+  return morphl_span_from_offset(node->filename, node->offset, node->offset + node->value.len);
 }
 
 #define MORPHL_ERR_AT(node, code, fmt, ...) \
@@ -1049,8 +1049,7 @@ MorphlType* morphl_infer_type_of_ast(TypeContext* ctx, AstNode* node) {
       node->child_count = chosen->child_count;
       node->child_capacity = chosen->child_capacity;
       node->filename = chosen->filename;
-      node->row = chosen->row;
-      node->col = chosen->col;
+      node->offset = chosen->offset;
 
       chosen->children = NULL;
       chosen->child_count = 0;
@@ -0,0 +1,398 @@
+#include "typing/optimize.h"
+#include "typing/inference.h"
+#include "parser/operators.h"
+#include "lexer/lexer.h"
+#include "util/util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A compile-time value. Bools never become literals (the language has no bool literal), but they
+// decide constant `$if`/`$while` conditions and feed folded `$and`/`$or`/`$not`.
+typedef enum {
+  FOLD_INT,
+  FOLD_FLOAT,
+  FOLD_BOOL,
+} FoldKind;
+
+typedef struct {
+  FoldKind kind;
+  union {
+    int64_t i;
+    double f;
+    bool b;
+  } as;
+} FoldValue;
+
+// Operator enum of a builtin node.
+static bool builtin_op(const AstNode* node, enum Operator* out) {
+  if (!node || node->kind != AST_BUILTIN || !node->op) return false;
+  const OperatorInfo* info = operator_info_lookup(node->op);
+  if (!info) return false;
+  *out = info->op_enum;
+  return true;
+}
+
+// Operand count of a foldable runtime operator, or 0 if the operator is not folded.
+static size_t fold_arity(enum Operator op) {
+  switch (op) {
+    case NOT:
+    case BNOT:
+      return 1;
+    case ADD: case SUB: case MUL: case DIV: case MOD: case REM:
+    case FADD: case FSUB: case FMUL: case FDIV:
+    case EQ: case NEQ: case LT: case GT: case LTE: case GTE:
+    case AND: case OR:
+    case BAND: case BOR: case BXOR: case LSHIFT: case RSHIFT:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+static bool literal_value(TypeContext* ctx, AstNode* node, FoldValue* out) {
+  if (node->value.len == 0 || node->value.len >= 64) return false;
+  MorphlType* type = morphl_infer_type_of_ast(ctx, node);
+  if (!type || (type->kind != MORPHL_TYPE_INT && type->kind != MORPHL_TYPE_FLOAT)) return false;
+
+  char text[64];
+  memcpy(text, node->value.ptr, node->value.len);
+  text[node->value.len] = '\0';
+  char* end = NULL;
+  errno = 0;
+  if (type->kind == MORPHL_TYPE_INT) {
+    // Literals too wide for int64 are left to the backends.
+    long long parsed = strtoll(text, &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    out->kind = FOLD_INT;
+    out->as.i = (int64_t)parsed;
+    return true;
+  }
+  double parsed = strtod(text, &end);
+  if (errno != 0 || *end != '\0') return false;
+  out->kind = FOLD_FLOAT;
+  out->as.f = parsed;
+  return true;
+}
+
+// Integer arithmetic wraps like the VM's.
+static int64_t fold_wrap_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static int64_t fold_wrap_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static int64_t fold_wrap_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+static bool fold_is_number(const FoldValue* value) {
+  return value->kind == FOLD_INT || value->kind == FOLD_FLOAT;
+}
+
+static double fold_as_float(const FoldValue* value) {
+  return (value->kind == FOLD_INT) ? (double)value->as.i : value->as.f;
+}
+
+// Evaluate op the way the typed VM engine does. Returns false for anything that would be a
+// runtime error there, so the error still happens at run time.
+static bool fold_eval(enum Operator op, const FoldValue* lhs, const FoldValue* rhs, FoldValue* out) {
+  bool both_int = rhs && lhs->kind == FOLD_INT && rhs->kind == FOLD_INT;
+  bool both_num = rhs && fold_is_number(lhs) && fold_is_number(rhs);
+  bool both_bool = rhs && lhs->kind == FOLD_BOOL && rhs->kind == FOLD_BOOL;
+
+  switch (op) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+      if (both_int) {
+        out->kind = FOLD_INT;
+        if (op == ADD) {
+          out->as.i = fold_wrap_add(lhs->as.i, rhs->as.i);
+        } else if (op == SUB) {
+          out->as.i = fold_wrap_sub(lhs->as.i, rhs->as.i);
+        } else if (op == MUL) {
+          out->as.i = fold_wrap_mul(lhs->as.i, rhs->as.i);
+        } else {
+          if (rhs->as.i == 0) return false;
+          out->as.i = (rhs->as.i == -1) ? fold_wrap_sub(0, lhs->as.i) : lhs->as.i / rhs->as.i;
+        }
+        return true;
+      }
+      // Mixed numbers behave like the float operators.
+      // fallthrough
+    case FADD:
+    case FSUB:
+    case FMUL:
+    case FDIV: {
+      if (!both_num) return false;
+      double a = fold_as_float(lhs);
+      double b = fold_as_float(rhs);
+      out->kind = FOLD_FLOAT;
+      if (op == ADD || op == FADD) {
+        out->as.f = a + b;
+      } else if (op == SUB || op == FSUB) {
+        out->as.f = a - b;
+      } else if (op == MUL || op == FMUL) {
+        out->as.f = a * b;
+      } else {
+        out->as.f = a / b;
+      }
+      return true;
+    }
+    case MOD:
+    case REM:
+      if (!both_int || rhs->as.i == 0) return false;
+      out->kind = FOLD_INT;
+      out->as.i = (rhs->as.i == -1) ? 0 : lhs->as.i % rhs->as.i;
+      if (op == MOD && out->as.i != 0 && ((out->as.i < 0) != (rhs->as.i < 0))) {
+        out->as.i += rhs->as.i;
+      }
+      return true;
+    case EQ:
+    case NEQ:
+    case LT:
+    case GT:
+    case LTE:
+    case GTE: {
+      int cmp;
+      if (both_int) {
+        cmp = (lhs->as.i > rhs->as.i) - (lhs->as.i < rhs->as.i);
+      } else if (both_num) {
+        double a = fold_as_float(lhs);
+        double b = fold_as_float(rhs);
+        if (isnan(a) || isnan(b)) return false;
+        cmp = (a > b) - (a < b);
+      } else if (both_bool && (op == EQ || op == NEQ)) {
+        cmp = (lhs->as.b != rhs->as.b);
+      } else {
+        return false;
+      }
+      out->kind = FOLD_BOOL;
+      switch (op) {
+        case EQ: out->as.b = cmp == 0; break;
+        case NEQ: out->as.b = cmp != 0; break;
+        case LT: out->as.b = cmp < 0; break;
+        case GT: out->as.b = cmp > 0; break;
+        case LTE: out->as.b = cmp <= 0; break;
+        default: out->as.b = cmp >= 0; break;
+      }
+      return true;
+    }
+    case AND:
+    case OR:
+      if (!both_bool) return false;
+      out->kind = FOLD_BOOL;
+      out->as.b = (op == AND) ? (lhs->as.b && rhs->as.b) : (lhs->as.b || rhs->as.b);
+      return true;
+    case NOT:
+      if (lhs->kind != FOLD_BOOL) return false;
+      out->kind = FOLD_BOOL;
+      out->as.b = !lhs->as.b;
+      return true;
+    case BNOT:
+      if (lhs->kind != FOLD_INT) return false;
+      out->kind = FOLD_INT;
+      out->as.i = ~lhs->as.i;
+      return true;
+    case BAND:
+    case BOR:
+    case BXOR:
+      if (!both_int) return false;
+      out->kind = FOLD_INT;
+      out->as.i = (op == BAND) ? (lhs->as.i & rhs->as.i) : (op == BOR) ? (lhs->as.i | rhs->as.i) : (lhs->as.i ^ rhs->as.i);
+      return true;
+    case LSHIFT:
+    case RSHIFT:
+      if (!both_int || rhs->as.i < 0 || rhs->as.i > 63) return false;
+      out->kind = FOLD_INT;
+      out->as.i = (op == LSHIFT) ? (int64_t)((uint64_t)lhs->as.i << rhs->as.i) : (lhs->as.i >> rhs->as.i);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Compile-time value of a numeric literal or of a foldable operator over constant operands.
+static bool constant_value(TypeContext* ctx, AstNode* node, FoldValue* out) {
+  if (!node) return false;
+  if (node->kind == AST_LITERAL) return literal_value(ctx, node, out);
+
+  enum Operator op;
+  if (!builtin_op(node, &op)) return false;
+  size_t arity = fold_arity(op);
+  if (arity == 0 || node->child_count != arity) return false;
+
+  FoldValue operands[2];
+  for (size_t i = 0; i < arity; ++i) {
+    if (!constant_value(ctx, node->children[i], &operands[i])) return false;
+  }
+  return fold_eval(op, &operands[0], (arity == 2) ? &operands[1] : NULL, out);
+}
+
+static void free_children(AstNode* node) {
+  for (size_t i = 0; i < node->child_count; ++i) {
+    ast_free(node->children[i]);
+  }
+  free(node->children);
+  node->children = NULL;
+  node->child_count = 0;
+  node->child_capacity = 0;
+}
+
+// Turn node into a NUMBER or FLOAT literal leaf. The text is interned, so it lives as long as the
+// intern table, like every other leaf's text.
+static bool replace_with_literal(TypeContext* ctx, AstNode* node, const FoldValue* value) {
+  char text[64];
+  const char* kind = LEXER_KIND_NUMBER;
+  if (value->kind == FOLD_INT) {
+    snprintf(text, sizeof(text), "%lld", (long long)value->as.i);
+  } else {
+    if (!isfinite(value->as.f)) return true;  // no literal spells it; leave the expression
+    snprintf(text, sizeof(text), "%.17g", value->as.f);
+    if (!strpbrk(text, ".eE")) strcat(text, ".0");
+    kind = LEXER_KIND_FLOAT;
+  }
+
+  Sym text_sym = interns_intern(ctx->interns, str_from(text, strlen(text)));
+  Sym kind_sym = interns_intern(ctx->interns, str_from(kind, strlen(kind)));
+  if (!text_sym || !kind_sym) return false;
+
+  free_children(node);
+  node->kind = AST_LITERAL;
+  node->op = kind_sym;
+  node->value = interns_lookup(ctx->interns, text_sym);
+  return true;
+}
+
+// Replace node by a detached replacement, which is consumed.
+static void become(AstNode* node, AstNode* replacement) {
+  free_children(node);
+  node->kind = replacement->kind;
+  node->op = replacement->op;
+  node->value = replacement->value;
+  node->children = replacement->children;
+  node->child_count = replacement->child_count;
+  node->child_capacity = replacement->child_capacity;
+  if (replacement->filename) {
+    node->filename = replacement->filename;
+    node->offset = replacement->offset;
+  }
+  free(replacement);
+}
+
+// Replace node by the subtree at *slot (detached here), or by an empty block (value null) when
+// slot is NULL.
+static bool become_slot(AstNode* node, AstNode** slot) {
+  AstNode* replacement = slot ? *slot : NULL;
+  if (slot) *slot = NULL;
+  if (!replacement) replacement = ast_new(AST_BLOCK);
+  if (!replacement) return false;
+  become(node, replacement);
+  return true;
+}
+
+static bool is_decl(const AstNode* node) {
+  enum Operator op;
+  if (!node || node->child_count != 2 || !node->children[0] || node->children[0]->kind != AST_IDENT) {
+    return false;
+  }
+  return node->kind == AST_DECL || (builtin_op(node, &op) && op == DECL);
+}
+
+// Evaluating node has no effect and cannot fail at run time.
+static bool is_pure(const AstNode* node) {
+  if (!node) return true;
+  switch (node->kind) {
+    case AST_LITERAL:
+    case AST_IDENT:
+    case AST_FUNC:
+      return true;
+    case AST_GROUP:
+      break;
+    case AST_BUILTIN: {
+      enum Operator op;
+      if (!builtin_op(node, &op) || fold_arity(op) == 0 ||
+          op == DIV || op == MOD || op == REM || op == LSHIFT || op == RSHIFT) {
+        return false;
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+  for (size_t i = 0; i < node->child_count; ++i) {
+    if (!is_pure(node->children[i])) return false;
+  }
+  return true;
+}
+
+// Whether any identifier in the subtree other than skip spells name.
+static bool mentions(const AstNode* node, Str name, const AstNode* skip) {
+  if (!node) return false;
+  if (node != skip && node->kind == AST_IDENT && str_eq(node->value, name)) return true;
+  for (size_t i = 0; i < node->child_count; ++i) {
+    if (mentions(node->children[i], name, skip)) return true;
+  }
+  return false;
+}
+
+// Drop unread declarations of pure values from a function body. The last statement is the body's
+// value and always stays. Walking backwards lets a dropped declaration free the ones it read.
+static void drop_dead_decls(AstNode* func) {
+  AstNode* body = (func->child_count > 1) ? func->children[1] : NULL;
+  if (!body || body->kind != AST_BLOCK || body->child_count < 2) return;
+
+  for (size_t i = body->child_count - 1; i-- > 0;) {
+    AstNode* stmt = body->children[i];
+    if (!is_decl(stmt) || !is_pure(stmt->children[1])) continue;
+    if (mentions(func, stmt->children[0]->value, stmt->children[0])) continue;
+
+    ast_free(stmt);
+    memmove(&body->children[i], &body->children[i + 1], (body->child_count - i - 1) * sizeof(AstNode*));
+    body->child_count--;
+  }
+}
+
+static bool optimize_node(TypeContext* ctx, AstNode* node) {
+  if (!node) return true;
+  for (size_t i = 0; i < node->child_count; ++i) {
+    if (!optimize_node(ctx, node->children[i])) return false;
+  }
+
+  FoldValue value;
+  switch (node->kind) {
+    case AST_BUILTIN: {
+      enum Operator op;
+      if (!builtin_op(node, &op)) return true;
+      if (op == WHILE && node->child_count == 2 && constant_value(ctx, node->children[0], &value) &&
+          value.kind == FOLD_BOOL && !value.as.b) {
+        return become_slot(node, NULL);
+      }
+      if (fold_arity(op) != 0 && constant_value(ctx, node, &value) && value.kind != FOLD_BOOL) {
+        return replace_with_literal(ctx, node, &value);
+      }
+      return true;
+    }
+    case AST_IF: {
+      // children: condition, then `then` or the group (then, else)
+      if (node->child_count != 2 || !constant_value(ctx, node->children[0], &value) || value.kind != FOLD_BOOL) {
+        return true;
+      }
+      AstNode* then_else = node->children[1];
+      bool has_else = then_else && then_else->kind == AST_GROUP && then_else->child_count == 2;
+      if (value.as.b) {
+        return become_slot(node, has_else ? &then_else->children[0] : &node->children[1]);
+      }
+      return become_slot(node, has_else ? &then_else->children[1] : NULL);
+    }
+    case AST_FUNC:
+      drop_dead_decls(node);
+      return true;
+    default:
+      return true;
+  }
+}
+
+bool morphl_optimize_ast(TypeContext* ctx, AstNode* root) {
+  if (!ctx || !root) return true;
+  return optimize_node(ctx, root);
+}
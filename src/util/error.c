@@ -1,12 +1,13 @@
 #include "util/error.h"
 #include "util/file.h"
+#include "util/sources.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-// Global sink
-static MorphlErrorSink g_global_sink = { NULL, NULL };
+// Global sink, per thread so a compile that swaps it (overload resolution does) only affects itself
+static _Thread_local MorphlErrorSink g_global_sink = { NULL, NULL };
 
 void morphl_error_set_global_sink(MorphlErrorSink sink) {
     g_global_sink = sink;
@@ -93,6 +94,15 @@ size_t morphl_error_format(const MorphlError *err, char *out, size_t out_cap) {
     const char *path = err->span.path ? err->span.path : "<unknown>";
     uint32_t line = err->span.line;
     uint32_t col  = err->span.col;
+    if (line == 0 && err->span.end != 0) {
+        // Offsets only: find the row and column now, the one time they are needed
+        size_t row = 0;
+        size_t column = 0;
+        if (morphl_sources_locate(err->span.path, err->span.start, &row, &column)) {
+            line = (row > UINT32_MAX) ? UINT32_MAX : (uint32_t)row;
+            col = (column > UINT32_MAX) ? UINT32_MAX : (uint32_t)column;
+        }
+    }
 
     // Format: file:line:col: severity[code]: message
     // If line/col unknown, omit.
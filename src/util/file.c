@@ -1,9 +1,17 @@
 #include "util/file.h"
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 bool morphl_file_read_all(const char* path, char** buffer, size_t* len) {
   if (!buffer) return false;
   *buffer = NULL;
@@ -42,6 +50,25 @@ bool morphl_file_read_all(const char* path, char** buffer, size_t* len) {
   return true;
 }
 
+bool morphl_file_read_fd(int fd, char* buf, size_t cap, size_t* got) {
+  if (!buf || !got) return false;
+  *got = 0;
+#ifdef _WIN32
+  int n;
+  do {
+    n = _read(fd, buf, (unsigned)(cap > INT_MAX ? INT_MAX : cap));
+  } while (n < 0 && errno == EINTR);
+#else
+  ssize_t n;
+  do {
+    n = read(fd, buf, cap > SSIZE_MAX ? SSIZE_MAX : cap);
+  } while (n < 0 && errno == EINTR);
+#endif
+  if (n < 0) return false;
+  *got = (size_t)n;
+  return true;
+}
+
 const char* morphl_file_get_line(const char* path, size_t line_number) {
   if (!path || line_number == 0) return NULL;
 
@@ -0,0 +1,89 @@
+#include "util/line_index.h"
+
+#include <stdlib.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
+static bool reserve_lines(MorphlLineIndex* index, size_t needed) {
+  if (index->capacity >= needed) return true;
+  size_t new_cap = index->capacity ? index->capacity * 2 : 16;
+  while (new_cap < needed) new_cap *= 2;
+  size_t* resized = realloc(index->starts, new_cap * sizeof(size_t));
+  if (!resized) return false;
+  index->starts = resized;
+  index->capacity = new_cap;
+  return true;
+}
+
+// Record the start of the line after the newline at `newline`.
+static inline bool push_line(MorphlLineIndex* index, size_t newline) {
+  if (index->count == index->capacity && !reserve_lines(index, index->count + 1)) return false;
+  index->starts[index->count++] = newline + 1;
+  return true;
+}
+
+// One pass over the text: lines are short, so a memchr call per line costs more than it scans.
+static bool index_newlines(MorphlLineIndex* index, size_t base, Str text) {
+  size_t at = 0;
+#if defined(__SSE2__) && defined(__GNUC__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; at + 16 <= text.len; at += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(text.ptr + at));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+    while (mask) {
+      if (!push_line(index, base + at + (size_t)__builtin_ctz(mask))) return false;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; at < text.len; ++at) {
+    if (text.ptr[at] == '\n' && !push_line(index, base + at)) return false;
+  }
+  return true;
+}
+
+bool morphl_line_index_build(MorphlLineIndex* index, Str text) {
+  *index = (MorphlLineIndex){0};
+  // Lines are seldom shorter than 32 bytes, so the table rarely has to grow.
+  if (!reserve_lines(index, text.len / 32 + 16) || !morphl_line_index_append(index, 0, text)) {
+    morphl_line_index_free(index);
+    return false;
+  }
+  return true;
+}
+
+bool morphl_line_index_append(MorphlLineIndex* index, size_t base, Str chunk) {
+  if (index->count == 0) {
+    if (!reserve_lines(index, 1)) return false;
+    index->starts[index->count++] = 0;
+  }
+  return index_newlines(index, base, chunk);
+}
+
+void morphl_line_index_free(MorphlLineIndex* index) {
+  free(index->starts);
+  *index = (MorphlLineIndex){0};
+}
+
+void morphl_line_index_locate(const MorphlLineIndex* index, size_t offset, size_t* row, size_t* col) {
+  if (index->count == 0) {
+    *row = 1;
+    *col = offset + 1;
+    return;
+  }
+  // The last line starting at or before offset.
+  size_t lo = 0;
+  size_t hi = index->count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->starts[mid] <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  *row = lo + 1;
+  *col = offset - index->starts[lo] + 1;
+}
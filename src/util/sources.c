@@ -0,0 +1,125 @@
+#include "util/sources.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/line_index.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MORPHL_SOURCES_HAVE_THREAD_EXIT 1
+#include <pthread.h>
+#else
+#define MORPHL_SOURCES_HAVE_THREAD_EXIT 0
+#endif
+
+typedef struct {
+  char* path;
+  MorphlLineIndex lines;
+} SourceEntry;
+
+static _Thread_local SourceEntry* g_sources = NULL;
+static _Thread_local size_t g_source_count = 0;
+static _Thread_local size_t g_source_capacity = 0;
+
+// A compile touches a handful of files, so a linear scan is enough; lookups for one file come in
+// runs, so the last hit is tried first.
+static _Thread_local size_t g_last_hit = 0;
+
+#if MORPHL_SOURCES_HAVE_THREAD_EXIT
+// A thread that added sources clears them when it exits, through the destructor of this key.
+static pthread_key_t g_exit_key;
+static pthread_once_t g_exit_once = PTHREAD_ONCE_INIT;
+static bool g_exit_key_ok = false;
+
+static void sources_thread_exit(void* unused) {
+  (void)unused;
+  morphl_sources_clear();
+}
+
+static void sources_make_exit_key(void) {
+  g_exit_key_ok = pthread_key_create(&g_exit_key, sources_thread_exit) == 0;
+}
+#endif
+
+static SourceEntry* find_source(const char* path) {
+  if (!path) return NULL;
+  if (g_last_hit < g_source_count && strcmp(g_sources[g_last_hit].path, path) == 0) {
+    return &g_sources[g_last_hit];
+  }
+  for (size_t i = 0; i < g_source_count; ++i) {
+    if (strcmp(g_sources[i].path, path) == 0) {
+      g_last_hit = i;
+      return &g_sources[i];
+    }
+  }
+  return NULL;
+}
+
+// The entry for path, added with an empty index when there is none yet.
+static SourceEntry* find_or_add_source(const char* path) {
+  SourceEntry* existing = find_source(path);
+  if (existing) return existing;
+
+  if (g_source_count == g_source_capacity) {
+#if MORPHL_SOURCES_HAVE_THREAD_EXIT
+    if (!g_sources) {
+      // The key needs a non-NULL value for its destructor to run at thread exit.
+      pthread_once(&g_exit_once, sources_make_exit_key);
+      if (g_exit_key_ok) pthread_setspecific(g_exit_key, &g_sources);
+    }
+#endif
+    size_t new_cap = g_source_capacity ? g_source_capacity * 2 : 4;
+    SourceEntry* resized = realloc(g_sources, new_cap * sizeof(SourceEntry));
+    if (!resized) return NULL;
+    g_sources = resized;
+    g_source_capacity = new_cap;
+  }
+  size_t path_len = strlen(path);
+  char* copy = malloc(path_len + 1);
+  if (!copy) return NULL;
+  memcpy(copy, path, path_len + 1);
+  g_sources[g_source_count] = (SourceEntry){.path = copy};
+  g_last_hit = g_source_count;
+  return &g_sources[g_source_count++];
+}
+
+bool morphl_sources_add(const char* path, Str text) {
+  if (!path) return false;
+  MorphlLineIndex lines;
+  if (!morphl_line_index_build(&lines, text)) return false;
+  SourceEntry* source = find_or_add_source(path);
+  if (!source) {
+    morphl_line_index_free(&lines);
+    return false;
+  }
+  morphl_line_index_free(&source->lines);
+  source->lines = lines;
+  return true;
+}
+
+bool morphl_sources_append(const char* path, size_t base, Str chunk) {
+  if (!path) return false;
+  SourceEntry* source = find_or_add_source(path);
+  if (!source) return false;
+  if (base == 0) morphl_line_index_free(&source->lines);
+  return morphl_line_index_append(&source->lines, base, chunk);
+}
+
+bool morphl_sources_locate(const char* path, size_t offset, size_t* row, size_t* col) {
+  SourceEntry* source = find_source(path);
+  if (!source) return false;
+  morphl_line_index_locate(&source->lines, offset, row, col);
+  return true;
+}
+
+void morphl_sources_clear(void) {
+  for (size_t i = 0; i < g_source_count; ++i) {
+    free(g_sources[i].path);
+    morphl_line_index_free(&g_sources[i].lines);
+  }
+  free(g_sources);
+  g_sources = NULL;
+  g_source_count = 0;
+  g_source_capacity = 0;
+  g_last_hit = 0;
+}
@@ -5,6 +5,7 @@
 
 extern "C" {
 #include "util/error.h"
+#include "util/sources.h"
 }
 
 // Test fixture to collect errors
@@ -160,6 +161,39 @@ static void test_morphl_error_format_basic() {
     printf("  Formatted: %s\n", buf);
 }
 
+// ============================================================================
+// Test: morphl_error_format (offsets only)
+// ============================================================================
+static void test_morphl_error_format_offset() {
+    const char *text = "a := 1;\nb := \"two\nlines\";\n  c";
+    assert(morphl_sources_add("offset.mpl", str_from(text, std::strlen(text))));
+
+    // The line and column come from the source table, only when the error is formatted.
+    MorphlSpan span = morphl_span_from_offset("offset.mpl", 28, 29);
+    assert(span.line == 0 && span.col == 0);
+    MorphlError err = MORPHL_ERR_SPAN(MORPHL_E_PARSE, MORPHL_SEV_ERROR, span, "unexpected token");
+    char buf[512];
+    assert(morphl_error_format(&err, buf, sizeof(buf)) > 0);
+    assert(std::strncmp(buf, "offset.mpl:4:3: ", 16) == 0);
+
+    // A token spanning lines is placed where it starts.
+    size_t row = 0;
+    size_t col = 0;
+    assert(morphl_sources_locate("offset.mpl", 13, &row, &col));
+    assert(row == 2 && col == 6);
+
+    // Empty spans still count as known, and files never added stay without a line.
+    assert(morphl_span_from_offset("offset.mpl", 0, 0).end == 1);
+    err.span = morphl_span_from_offset("missing.mpl", 3, 4);
+    morphl_error_format(&err, buf, sizeof(buf));
+    assert(std::strncmp(buf, "missing.mpl: ", 13) == 0);
+
+    morphl_sources_clear();
+    assert(!morphl_sources_locate("offset.mpl", 0, &row, &col));
+
+    printf("✓ test_morphl_error_format_offset passed\n");
+}
+
 // ============================================================================
 // Test: morphl_error_format (with NULL error)
 // ============================================================================
@@ -346,6 +380,7 @@ int main(void) {
     test_morphl_error_make_macros();
     test_morphl_error_makev();
     test_morphl_error_format_basic();
+    test_morphl_error_format_offset();
     test_morphl_error_format_null();
     test_morphl_error_format_ok();
     test_morphl_error_format_small_buffer();
@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include "lexer/lexer.h"
+#include "util/sources.h"
+#include "util/util.h"
+}
+
+// Measures lexer throughput in MB/s on a generated source, once per scanning strategy the CPU
+// supports, once in parallel chunks and once for the TokenStream layout, and checks that every
+// variant produces the tokens the scalar one does.
+//
+// usage: lexer_bench [megabytes] [repetitions]
+
+static const LexerScan kScans[] = {LEXER_SCAN_SCALAR, LEXER_SCAN_SSE2, LEXER_SCAN_AVX2};
+
+// Declarations, calls, loops and strings in the shape of machine-generated Morphl, with long and
+// short runs of every kind so the vector loops and their scalar tails are both exercised.
+static std::string generate_source(size_t bytes) {
+  std::string source = "$syntax \"grammar_sample.txt\";\n";
+  char line[512];
+  for (unsigned i = 0; source.size() < bytes; ++i) {
+    std::snprintf(line,
+                  sizeof(line),
+                  "generated_function_number_%u := (argument_value_%u := %u) => {\n"
+                  "    accumulator_%u := argument_value_%u * %u.%02u + $add x%u 1;\n"
+                  "\tif (accumulator_%u <= 123456789012345678) { return \"label %u: a string that is "
+                  "longer than one vector of bytes\"; };\r\n"
+                  "    while (i <= %u) { i = i + 1; s = \"multi\nline\"; };\n"
+                  "    return accumulator_%u;\n"
+                  "};\n\n",
+                  i, i, i % 1000, i, i, i % 97, i % 100, i, i, i, i % 50, i);
+    source += line;
+  }
+  return source;
+}
+
+static bool tokenize(const std::string& source, LexerScan scan, InternTable* interns, struct token** tokens, size_t* count) {
+  LexerOptions options = {};
+  options.scan = scan;
+  return lexer_tokenize_with("<bench>", str_from(source.data(), source.size()), interns, &options, tokens, count);
+}
+
+static bool same_tokens(const struct token* a, size_t a_count, const struct token* b, size_t b_count) {
+  if (a_count != b_count) return false;
+  for (size_t i = 0; i < a_count; ++i) {
+    if (a[i].kind != b[i].kind || a[i].lexeme.ptr != b[i].lexeme.ptr || a[i].lexeme.len != b[i].lexeme.len ||
+        a[i].offset != b[i].offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every prefix of a sample that mixes all token kinds, so each run is also cut off at every length.
+static void check_prefixes(InternTable* interns) {
+  const std::string sample =
+      "  \t$add abcdefghijklmnopqrstuvwxyz_0123456789ABCDEFGHIJ 12345678901234567890123456789012.5 "
+      "x1 $ $_y \"a string with\nnewlines\n inside it, longer than thirty-two bytes\" 3.x \xc3\xa9t\xc3\xa9 "
+      "0.000000000000000000000000000001;\r\n                                      end";
+  for (size_t len = 0; len <= sample.size(); ++len) {
+    std::string prefix = sample.substr(0, len);
+    struct token* expected = NULL;
+    size_t expected_count = 0;
+    bool expected_ok = tokenize(prefix, LEXER_SCAN_SCALAR, interns, &expected, &expected_count);
+    for (LexerScan scan : kScans) {
+      if (!lexer_scan_available(scan)) continue;
+      struct token* tokens = NULL;
+      size_t count = 0;
+      bool ok = tokenize(prefix, scan, interns, &tokens, &count);
+      assert(ok == expected_ok);
+      assert(!ok || same_tokens(expected, expected_count, tokens, count));
+      free(tokens);
+    }
+    free(expected);
+  }
+}
+
+int main(int argc, char** argv) {
+  double megabytes = (argc > 1) ? std::atof(argv[1]) : 64.0;
+  if (megabytes <= 0) megabytes = 1;
+  int repetitions = (argc > 2) ? std::atoi(argv[2]) : 5;
+  if (repetitions <= 0) repetitions = 1;
+
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+  assert(lexer_scan_available(LEXER_SCAN_SCALAR));
+  assert(lexer_scan_available(LEXER_SCAN_AUTO));
+  check_prefixes(interns);
+
+  std::string source = generate_source((size_t)(megabytes * 1024 * 1024));
+  struct token* reference = NULL;
+  size_t reference_count = 0;
+  assert(tokenize(source, LEXER_SCAN_SCALAR, interns, &reference, &reference_count));
+
+  for (LexerScan scan : kScans) {
+    if (!lexer_scan_available(scan)) {
+      continue;
+    }
+    double best = 0;
+    for (int i = 0; i < repetitions; ++i) {
+      struct token* tokens = NULL;
+      size_t count = 0;
+      auto start = std::chrono::steady_clock::now();
+      assert(tokenize(source, scan, interns, &tokens, &count));
+      auto stop = std::chrono::steady_clock::now();
+      assert(same_tokens(reference, reference_count, tokens, count));
+      free(tokens);
+      double seconds = std::chrono::duration<double>(stop - start).count();
+      if (best == 0 || seconds < best) best = seconds;
+    }
+    std::printf("scan=%s bytes=%zu tokens=%zu seconds=%.6f MB/s=%.1f\n",
+                lexer_scan_name(scan),
+                source.size(),
+                reference_count,
+                best,
+                best > 0 ? (double)source.size() / best / (1024.0 * 1024.0) : 0.0);
+  }
+  std::printf("auto=%s\n", lexer_scan_name(LEXER_SCAN_AUTO));
+
+  // Parallel chunks, one per hardware thread (at least two, so the split is always exercised).
+  unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+  LexerOptions parallel = {};
+  parallel.threads = threads;
+  double parallel_best = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    struct token* tokens = NULL;
+    size_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    assert(lexer_tokenize_with("<bench>", str_from(source.data(), source.size()), interns, &parallel, &tokens, &count));
+    auto stop = std::chrono::steady_clock::now();
+    assert(same_tokens(reference, reference_count, tokens, count));
+    free(tokens);
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    if (parallel_best == 0 || seconds < parallel_best) parallel_best = seconds;
+  }
+  std::printf("threads=%u seconds=%.6f MB/s=%.1f\n",
+              threads,
+              parallel_best,
+              parallel_best > 0 ? (double)source.size() / parallel_best / (1024.0 * 1024.0) : 0.0);
+
+  // The structure-of-arrays layout: same tokens, a third of the memory.
+  double best = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    TokenStream stream;
+    token_stream_init(&stream);
+    auto start = std::chrono::steady_clock::now();
+    assert(lexer_tokenize_stream("<bench>", str_from(source.data(), source.size()), interns, NULL, &stream));
+    auto stop = std::chrono::steady_clock::now();
+    assert(stream.count == reference_count);
+    for (size_t t = 0; t < reference_count; t += 9973) {
+      assert(stream.kinds[t] == reference[t].kind);
+      assert(str_eq(token_stream_lexeme(&stream, t), reference[t].lexeme) || reference[t].lexeme.ptr == NULL);
+    }
+    token_stream_free(&stream);
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    if (best == 0 || seconds < best) best = seconds;
+  }
+  size_t stream_token_bytes = sizeof(TokenKind) + 3 * sizeof(uint32_t);
+  std::printf("layout=stream bytes/token=%zu (array %zu) seconds=%.6f MB/s=%.1f\n",
+              stream_token_bytes,
+              sizeof(struct token),
+              best,
+              best > 0 ? (double)source.size() / best / (1024.0 * 1024.0) : 0.0);
+
+  free(reference);
+  interns_free(interns);
+  morphl_sources_clear();
+  return 0;
+}
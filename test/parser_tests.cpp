@@ -6,10 +6,16 @@
 #include <cstdlib>
 #include <ctime>
 #include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 extern "C" {
 #include "parser/parser.h"
+#include "parser/builtin_parser.h"
 #include "lexer/lexer.h"
+#include "util/sources.h"
 #include "util/util.h"
 #include "ast/ast.h"
 }
@@ -82,6 +88,7 @@ end
   grammar_free(&grammar);
   arena_free(&arena);
   interns_free(interns);
+  morphl_sources_clear();
   std::remove(grammar_path.c_str());
 }
 
@@ -129,6 +136,7 @@ end
   grammar_free(&grammar);
   arena_free(&arena);
   interns_free(interns);
+  morphl_sources_clear();
   std::remove(grammar_path.c_str());
 }
 
@@ -171,6 +179,7 @@ end
   grammar_free(&grammar);
   arena_free(&arena);
   interns_free(interns);
+  morphl_sources_clear();
   std::remove(grammar_path.c_str());
 }
 
@@ -209,14 +218,266 @@ end
   grammar_free(&grammar);
   arena_free(&arena);
   interns_free(interns);
+  morphl_sources_clear();
   std::remove(grammar_path.c_str());
 }
 
+// The structure-of-arrays stream holds the same tokens as the array, with rows and columns
+// recovered on demand from offsets, and the grammar parser builds the same tree from it.
+static void test_token_stream() {
+  const char* grammar_src = R"GRAM(rule expr:
+    %IDENT => ident
+    %NUMBER => number
+    $expr lhs "+" $expr[1] rhs => add lhs rhs
+end
+)GRAM";
+
+  std::string grammar_path = write_temp_file(grammar_src);
+
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+
+  Arena arena;
+  arena_init(&arena, 4096);
+
+  Grammar grammar;
+  assert(grammar_load_file(&grammar, grammar_path.c_str(), interns, &arena));
+
+  const char* source = "foo +\n  2 +\n\t\tbar";
+  struct token* tokens = NULL;
+  size_t token_count = 0;
+  assert(lexer_tokenize("<test>", str_from(source, strlen(source)), interns, &tokens, &token_count));
+  TokenStream stream;
+  token_stream_init(&stream);
+  assert(lexer_tokenize_stream("<test>", str_from(source, strlen(source)), interns, NULL, &stream));
+  assert(stream.count == token_count);
+  for (size_t i = 0; i < token_count; ++i) {
+    struct token tok = token_stream_token(&stream, i);
+    assert(tok.kind == tokens[i].kind);
+    assert(str_eq(tok.lexeme, tokens[i].lexeme));
+    assert(tok.filename == tokens[i].filename || std::strcmp(tok.filename, tokens[i].filename) == 0);
+    assert(tok.offset == tokens[i].offset);
+  }
+  size_t row = 0;
+  size_t col = 0;
+  token_stream_locate(&stream, 4, &row, &col);
+  assert(row == 3 && col == 3);
+  assert(morphl_sources_locate("<test>", tokens[4].offset, &row, &col));
+  assert(row == 3 && col == 3);
+
+  assert(grammar_parse_stream(&grammar, 0, &stream));
+  AstNode* root = NULL;
+  AstNode* stream_root = NULL;
+  assert(grammar_parse_ast(&grammar, 0, tokens, token_count, &root));
+  assert(grammar_parse_ast_stream(&grammar, 0, &stream, &stream_root));
+  assert(stream_root->kind == root->kind && stream_root->op == root->op);
+  assert(stream_root->child_count == 2 && root->child_count == 2);
+  AstNode* leaf = stream_root->children[1];
+  assert(leaf->kind == AST_IDENT && leaf->offset == tokens[4].offset);
+  assert(root->children[1]->offset == leaf->offset);
+
+  // A second source gets its own file id and line index.
+  const char* second = "\n\nbaz";
+  assert(lexer_tokenize_stream("<second>", str_from(second, strlen(second)), interns, NULL, &stream));
+  assert(stream.source_count == 2);
+  assert(stream.count == token_count + 2);
+  struct token baz = token_stream_token(&stream, token_count);
+  assert(std::strcmp(baz.filename, "<second>") == 0 && baz.offset == 2);
+  token_stream_locate(&stream, token_count, &row, &col);
+  assert(row == 3 && col == 1);
+
+  ast_free(root);
+  ast_free(stream_root);
+  token_stream_free(&stream);
+  free(tokens);
+  grammar_free(&grammar);
+  arena_free(&arena);
+  interns_free(interns);
+  morphl_sources_clear();
+  std::remove(grammar_path.c_str());
+}
+
+// Same shape and leaf text, whichever token source the builtin parser read.
+static bool same_tree(const AstNode* a, const AstNode* b) {
+  if (a->kind != b->kind || a->op != b->op || a->child_count != b->child_count) return false;
+  if (a->value.len != b->value.len || (a->value.len && std::memcmp(a->value.ptr, b->value.ptr, a->value.len) != 0)) {
+    return false;
+  }
+  for (size_t i = 0; i < a->child_count; ++i) {
+    if (!same_tree(a->children[i], b->children[i])) return false;
+  }
+  return true;
+}
+
+// The pull-based reader yields the tokens lexer_tokenize does for any window size, including
+// windows smaller than a token, and the builtin parser builds the same tree from either.
+static void test_lexer_reader() {
+  const char* source =
+      "$decl counter_with_a_long_name 12.5;\r\n"
+      "$add counter_with_a_long_name 7 $mul 3 4.25;\n"
+      "$decl label \"a string longer\nthan the smallest windows\";\n"
+      "$group 1 2 3 $ 12. x1\t\t";
+  std::string path = write_temp_file(source);
+
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+  struct token* tokens = NULL;
+  size_t token_count = 0;
+  assert(lexer_tokenize(path.c_str(), str_from(source, strlen(source)), interns, &tokens, &token_count));
+
+  const size_t windows[] = {1, 2, 3, 5, 16, 64, 0};
+  for (size_t window : windows) {
+    int fd = open(path.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    LexerReader* reader = lexer_reader_new(path.c_str(), fd, interns, NULL, window);
+    assert(reader != nullptr);
+    for (size_t i = 0; i < token_count; ++i) {
+      struct token peeked;
+      struct token tok;
+      assert(lexer_peek_token(reader, &peeked));
+      assert(lexer_next_token(reader, &tok));
+      assert(peeked.kind == tok.kind && peeked.offset == tok.offset);
+      assert(tok.kind == tokens[i].kind);
+      assert(str_eq(tok.lexeme, tokens[i].lexeme) || (tok.lexeme.len == 0 && tokens[i].lexeme.len == 0));
+      assert(tok.offset == tokens[i].offset);
+      assert(tok.filename == path.c_str());
+    }
+    struct token again;
+    assert(lexer_next_token(reader, &again) && again.kind == tokens[token_count - 1].kind);
+    lexer_reader_free(reader);
+    close(fd);
+
+    // The file's lines were indexed chunk by chunk as they were read.
+    size_t row = 0;
+    size_t col = 0;
+    assert(morphl_sources_locate(path.c_str(), tokens[token_count - 2].offset, &row, &col));
+    assert(row == 5 && col == 20);
+  }
+
+  Arena arena;
+  arena_init(&arena, 256);
+  AstNode* from_array = NULL;
+  AstNode* from_reader = NULL;
+  const char* program = "$decl x 1; $add x $mul 2.5 \"some text\"; $group a b c";
+  std::string program_path = write_temp_file(program);
+  struct token* program_tokens = NULL;
+  size_t program_count = 0;
+  assert(lexer_tokenize(program_path.c_str(), str_from(program, strlen(program)), interns, &program_tokens, &program_count));
+  assert(builtin_parse_ast(program_tokens, program_count, interns, &from_array));
+  int fd = open(program_path.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  LexerReader* reader = lexer_reader_new(program_path.c_str(), fd, interns, NULL, 4);
+  assert(builtin_parse_reader(reader, interns, &arena, &from_reader));
+  lexer_reader_free(reader);
+  close(fd);
+  assert(from_reader->kind == AST_BLOCK && from_reader->child_count == 3);
+  assert(same_tree(from_array, from_reader));
+
+  // An unterminated string is an error, not an early EOF.
+  std::string bad_path = write_temp_file("$decl s \"no closing quote");
+  fd = open(bad_path.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  reader = lexer_reader_new(bad_path.c_str(), fd, interns, NULL, 8);
+  AstNode* bad = NULL;
+  assert(!builtin_parse_reader(reader, interns, &arena, &bad));
+  lexer_reader_free(reader);
+  close(fd);
+
+  ast_free(from_array);
+  ast_free(from_reader);
+  free(program_tokens);
+  free(tokens);
+  arena_free(&arena);
+  interns_free(interns);
+  morphl_sources_clear();
+  std::remove(path.c_str());
+  std::remove(program_path.c_str());
+  std::remove(bad_path.c_str());
+}
+
+static bool tokenize_threads(const char* filename, const std::string& text, InternTable* interns, LexerScan scan,
+                             unsigned threads, struct token** tokens, size_t* count) {
+  LexerOptions options = {};
+  options.scan = scan;
+  options.threads = threads;
+  options.min_chunk = 1;
+  return lexer_tokenize_with(filename, str_from(text.data(), text.size()), interns, &options, tokens, count);
+}
+
+static void expect_parallel_matches_serial_with(const char* filename, const std::string& text, InternTable* interns,
+                                                LexerScan scan) {
+  struct token* serial = NULL;
+  size_t serial_count = 0;
+  bool serial_ok = tokenize_threads(filename, text, interns, scan, 1, &serial, &serial_count);
+  const unsigned thread_counts[] = {2, 3, 8, 64};
+  for (unsigned threads : thread_counts) {
+    struct token* parallel = NULL;
+    size_t parallel_count = 0;
+    bool parallel_ok = tokenize_threads(filename, text, interns, scan, threads, &parallel, &parallel_count);
+    assert(parallel_ok == serial_ok);
+    if (serial_ok) {
+      assert(parallel_count == serial_count);
+      for (size_t i = 0; i < serial_count; ++i) {
+        assert(parallel[i].kind == serial[i].kind);
+        assert(parallel[i].lexeme.ptr == serial[i].lexeme.ptr && parallel[i].lexeme.len == serial[i].lexeme.len);
+        assert(parallel[i].offset == serial[i].offset);
+        assert(parallel[i].filename == serial[i].filename);
+      }
+    }
+    free(parallel);
+  }
+  free(serial);
+}
+
+// Every scanner splits at the same places; one this CPU lacks fails serially and in parallel alike.
+static void expect_parallel_matches_serial(const char* filename, const std::string& text, InternTable* interns) {
+  for (LexerScan scan : {LEXER_SCAN_SCALAR, LEXER_SCAN_SSE2, LEXER_SCAN_AVX2}) {
+    expect_parallel_matches_serial_with(filename, text, interns, scan);
+  }
+}
+
+// Lexing in parallel chunks gives exactly the serial tokens, on every example and on sources whose
+// string literals hold the newlines a naive split would cut at.
+static void test_parallel_lexing() {
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+
+  DIR* dir = opendir(MORPHL_EXAMPLES_DIR);
+  assert(dir != nullptr);
+  size_t files = 0;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = std::string(MORPHL_EXAMPLES_DIR) + "/" + entry->d_name;
+    struct stat info;
+    if (entry->d_name[0] == '.' || stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) continue;
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    expect_parallel_matches_serial(path.c_str(), contents.str(), interns);
+    files++;
+  }
+  closedir(dir);
+  assert(files > 0);
+
+  std::string strings;
+  for (int i = 0; i < 50; ++i) {
+    strings += "$decl s" + std::to_string(i) + " \"line one\nline two\n\n\";\n\"\"\n$x 1.5 \"\n\"\n";
+  }
+  expect_parallel_matches_serial("<strings>", strings, interns);
+  expect_parallel_matches_serial("<unterminated>", strings + "$decl bad \"no end\n\n\n", interns);
+  expect_parallel_matches_serial("<empty>", "", interns);
+
+  interns_free(interns);
+  morphl_sources_clear();
+}
+
 int main() {
   test_grammar_loading();
   test_parser_accept_reject();
   test_parser_ast_build();
   test_float_literal_token_kind();
+  test_token_stream();
+  test_lexer_reader();
+  test_parallel_lexing();
   std::puts("All parser tests passed.");
   return 0;
 }
@@ -12,6 +12,8 @@ extern "C" {
 #include "typing/typing.h"
 #include "typing/type_context.h"
 #include "typing/inference.h"
+#include "typing/optimize.h"
+#include "util/sources.h"
 #include "util/util.h"
 #include "parser/operators.h"
 #include "parser/scoped_parser.h"
@@ -74,12 +76,12 @@ static AstNode* make_ident(InternTable* interns, const char* name) {
 // Helper: create literal AST node
 static AstNode* make_literal(const char* text) {
   size_t len = strlen(text);
-  return ast_make_leaf(AST_LITERAL, str_from(text, len), "<test>", 1, 1);
+  return ast_make_leaf(AST_LITERAL, str_from(text, len), "<test>", 0);
 }
 
 static AstNode* make_literal_with_kind(InternTable* interns, const char* text, const char* kind_name) {
   size_t len = strlen(text);
-  AstNode* node = ast_make_leaf(AST_LITERAL, str_from(text, len), "<test>", 1, 1);
+  AstNode* node = ast_make_leaf(AST_LITERAL, str_from(text, len), "<test>", 0);
   if (!node) return NULL;
   node->op = interns_intern(interns, str_from(kind_name, strlen(kind_name)));
   return node;
@@ -758,6 +760,7 @@ static void test_import_block_fields() {
   scoped_parser_free(&parser_ctx);
   interns_free(interns);
   arena_free(&arena);
+  morphl_sources_clear();
   std::remove(module_path.c_str());
   printf("\u2713 test_import_block_fields passed\n");
 }
@@ -913,6 +916,80 @@ static void test_overload_resolution() {
   printf("\u2713 test_overload_resolution passed\n");
 }
 
+// ============================================================================
+// Test: Constant folding and dead declaration removal
+// ============================================================================
+static void test_optimize_folding() {
+  Arena arena = create_test_arena();
+  InternTable* interns = create_test_interns();
+  assert(operator_registry_init(interns));
+  TypeContext* ctx = type_context_new(&arena, interns);
+  assert(ctx != NULL);
+  Sym number_kind = interns_intern(interns, str_from(LEXER_KIND_NUMBER, strlen(LEXER_KIND_NUMBER)));
+  Sym float_kind = interns_intern(interns, str_from(LEXER_KIND_FLOAT, strlen(LEXER_KIND_FLOAT)));
+
+  // $mul ($add 1 2) 4 -> 12
+  AstNode* sum = make_builtin(interns, "$mul", {
+      make_builtin(interns, "$add", {make_literal_with_kind(interns, "1", LEXER_KIND_NUMBER),
+                                     make_literal_with_kind(interns, "2", LEXER_KIND_NUMBER)}),
+      make_literal_with_kind(interns, "4", LEXER_KIND_NUMBER)});
+  assert(morphl_optimize_ast(ctx, sum));
+  assert(sum->kind == AST_LITERAL && sum->op == number_kind && sum->child_count == 0);
+  assert(str_eq(sum->value, str_from("12", 2)));
+
+  // Mixed operands fold to a float literal, as in the VM
+  AstNode* mixed = make_builtin(interns, "$fadd", {make_literal_with_kind(interns, "1", LEXER_KIND_NUMBER),
+                                                   make_literal_with_kind(interns, "0.5", LEXER_KIND_FLOAT)});
+  assert(morphl_optimize_ast(ctx, mixed));
+  assert(mixed->kind == AST_LITERAL && mixed->op == float_kind);
+  assert(str_eq(mixed->value, str_from("1.5", 3)));
+
+  // Division by zero still fails at run time
+  AstNode* div = make_builtin(interns, "$div", {make_literal_with_kind(interns, "1", LEXER_KIND_NUMBER),
+                                                make_literal_with_kind(interns, "0", LEXER_KIND_NUMBER)});
+  assert(morphl_optimize_ast(ctx, div));
+  assert(div->kind == AST_BUILTIN && div->child_count == 2);
+
+  // $if with a constant condition becomes the branch taken
+  AstNode* branches = ast_new(AST_GROUP);
+  ast_append_child(branches, make_literal_with_kind(interns, "10", LEXER_KIND_NUMBER));
+  ast_append_child(branches, make_literal_with_kind(interns, "20", LEXER_KIND_NUMBER));
+  AstNode* if_node = ast_new(AST_IF);
+  if_node->op = interns_intern(interns, str_from("$if", 3));
+  ast_append_child(if_node, make_builtin(interns, "$gt", {make_literal_with_kind(interns, "1", LEXER_KIND_NUMBER),
+                                                          make_literal_with_kind(interns, "2", LEXER_KIND_NUMBER)}));
+  ast_append_child(if_node, branches);
+  assert(morphl_optimize_ast(ctx, if_node));
+  assert(if_node->kind == AST_LITERAL && str_eq(if_node->value, str_from("20", 2)));
+
+  // Unread pure declarations in a function body are dropped; the body's value is kept
+  AstNode* body = ast_new(AST_BLOCK);
+  AstNode* dead = ast_new(AST_DECL);
+  ast_append_child(dead, make_ident(interns, "unused"));
+  ast_append_child(dead, make_literal_with_kind(interns, "1", LEXER_KIND_NUMBER));
+  AstNode* live = ast_new(AST_DECL);
+  ast_append_child(live, make_ident(interns, "used"));
+  ast_append_child(live, make_literal_with_kind(interns, "2", LEXER_KIND_NUMBER));
+  ast_append_child(body, dead);
+  ast_append_child(body, live);
+  ast_append_child(body, make_ident(interns, "used"));
+  AstNode* func = ast_new(AST_FUNC);
+  ast_append_child(func, ast_new(AST_GROUP));
+  ast_append_child(func, body);
+  assert(morphl_optimize_ast(ctx, func));
+  assert(body->child_count == 2 && body->children[0] == live);
+
+  ast_free(sum);
+  ast_free(mixed);
+  ast_free(div);
+  ast_free(if_node);
+  ast_free(func);
+  type_context_free(ctx);
+  interns_free(interns);
+  arena_free(&arena);
+  printf("✓ test_optimize_folding passed\n");
+}
+
 // ============================================================================
 // Main Test Runner
 // ============================================================================
@@ -939,6 +1016,7 @@ int main() {
   test_pp_while();
   test_overload_resolution();
   test_pp_prop();
+  test_optimize_folding();
   // Note: Recursion is tested via examples/test_recursion.mpl
   // Unit testing recursion requires full parser integration
 
@@ -0,0 +1,123 @@
+#include <assert.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+#include "backend/vm.h"
+#include "runtime/runtime.h"
+}
+
+// Measures typed-engine dispatch throughput. The same source is linked against a computed-goto and
+// a switch build of the runtime (vm_dispatch_bench_goto / vm_dispatch_bench_switch); compare the
+// Minstr/s lines of the two binaries.
+//
+// usage: vm_dispatch_bench [repetitions]
+
+static const uint32_t kChainLength = 50000;
+
+static void put_u32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) out.push_back((char)((value >> (8 * i)) & 0xFF));
+}
+
+static void put_op(std::string& code, uint8_t op) { code.push_back((char)op); }
+
+static void put_op_u32(std::string& code, uint8_t op, uint32_t operand) {
+  put_op(code, op);
+  put_u32(code, operand);
+}
+
+// x := 0; x = x + 1 + 1 + ... (kChainLength times); return $band x 255
+// Returns the number of instructions one run executes.
+static uint64_t write_program(const std::string& path) {
+  static const int64_t constants[] = {0, 1, 255};
+
+  std::string code;
+  uint64_t instructions = 0;
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 0);
+  put_op_u32(code, VM_OP_STORE_LOCAL, 0);
+  instructions += 2;
+  for (uint32_t i = 0; i < kChainLength; ++i) {
+    put_op_u32(code, VM_OP_PUSH_CONST_I64, 1);
+    put_op(code, VM_OP_ADD);
+    instructions += 2;
+  }
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 2);
+  put_op(code, VM_OP_BAND);
+  put_op(code, VM_OP_RET);
+  instructions += 3;
+
+  std::string image = MORPHL_VM_MAGIC;
+  image.push_back((char)MORPHL_VM_VERSION_MAJOR);
+  image.push_back(0);
+  image.push_back((char)MORPHL_VM_VERSION_MINOR);
+  image.push_back(0);
+  put_u32(image, 0);
+
+  // A string table holding only the function name, then the constant pool.
+  const std::string name = "<main>";
+  put_u32(image, 1);
+  put_u32(image, (uint32_t)(4 + name.size() + 1));
+  put_u32(image, 0);
+  put_u32(image, (uint32_t)name.size());
+  image += name;
+  image.push_back('\0');
+  put_u32(image, 3);
+  for (int64_t value : constants) {
+    image.push_back((char)VM_CONST_I64);
+    put_u32(image, (uint32_t)(uint64_t)value);
+    put_u32(image, (uint32_t)((uint64_t)value >> 32));
+  }
+  // Function table: the top-level code only, with x in local 0.
+  put_u32(image, 1);
+  put_u32(image, 0);
+  put_u32(image, 0);
+  put_u32(image, 0);
+  put_u32(image, 1);
+  put_u32(image, 0);
+  put_u32(image, (uint32_t)code.size());
+  image += code;
+  put_u32(image, 0);
+
+  FILE* file = std::fopen(path.c_str(), "wb");
+  assert(file != nullptr);
+  assert(std::fwrite(image.data(), 1, image.size(), file) == image.size());
+  std::fclose(file);
+  return instructions;
+}
+
+int main(int argc, char** argv) {
+  int repetitions = (argc > 1) ? std::atoi(argv[1]) : 200;
+  if (repetitions <= 0) repetitions = 1;
+
+  const char* tmpdir = std::getenv("TMP");
+  if (!tmpdir) tmpdir = "/tmp";
+  std::string path = std::string(tmpdir) + "/morphl_vm_dispatch_bench.mbc";
+  uint64_t per_run = write_program(path);
+
+  MorphlVmProgram* program = nullptr;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+  std::remove(path.c_str());
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    MorphlVm* vm = morphl_vm_new(program);
+    assert(vm != nullptr);
+    morphl_exit_code_t code = morphl_vm_execute(vm, stderr);
+    assert(code == (morphl_exit_code_t)(kChainLength & 255));
+    (void)code;
+    morphl_vm_free(vm);
+  }
+  auto stop = std::chrono::steady_clock::now();
+  morphl_vm_program_free(program);
+
+  double seconds = std::chrono::duration<double>(stop - start).count();
+  uint64_t total = per_run * (uint64_t)repetitions;
+  std::printf("dispatch=%s instructions=%llu seconds=%.6f Minstr/s=%.2f\n",
+              morphl_vm_dispatch_name(),
+              (unsigned long long)total,
+              seconds,
+              seconds > 0 ? (double)total / seconds / 1e6 : 0.0);
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+extern "C" {
+#include "backend/backend.h"
+#include "lexer/lexer.h"
+#include "parser/operators.h"
+#include "parser/scoped_parser.h"
+#include "runtime/runtime.h"
+#include "util/sources.h"
+#include "util/util.h"
+}
+
+static std::string temp_path(const char* suffix) {
+  const char* tmpdir = std::getenv("TMP");
+  if (!tmpdir) tmpdir = std::getenv("TEMP");
+#ifdef _WIN32
+  const char* fallback = "C:/Windows/Temp";
+#else
+  const char* fallback = "/tmp";
+#endif
+  if (!tmpdir) tmpdir = fallback;
+
+  static unsigned counter = 0;
+  std::ostringstream name;
+  name << tmpdir << "/morphl_vm_profile_test_" << (unsigned)std::time(nullptr) << "_" << std::rand() << "_" << counter++
+       << suffix;
+  return name.str();
+}
+
+// Run the full front end over `source` and write VM bytecode to a temp file.
+static std::string compile_vm(const char* source) {
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+  assert(operator_registry_init(interns));
+
+  Arena arena;
+  arena_init(&arena, 65536);
+
+  std::string source_path = std::string(MORPHL_EXAMPLES_DIR) + "/vm_profile_test.mpl";
+  ScopedParserContext ctx;
+  assert(scoped_parser_init(&ctx, interns, &arena, source_path.c_str()));
+
+  struct token* tokens = NULL;
+  size_t token_count = 0;
+  assert(lexer_tokenize(source_path.c_str(), str_from(source, strlen(source)), interns, &tokens, &token_count));
+
+  AstNode* root = NULL;
+  assert(scoped_parse_ast(&ctx, tokens, token_count, &root));
+
+  std::string out_path = temp_path(".mbc");
+  MorphlBackendContext backend_ctx;
+  backend_ctx.tree = root;
+  backend_ctx.out_file = out_path.c_str();
+  backend_ctx.type_context = ctx.type_context;
+  backend_ctx.no_peephole = false;
+  assert(morphl_register_backend(MORPHL_BACKEND_TYPE_VM));
+  assert(morphl_compile(&backend_ctx));
+
+  ast_free(root);
+  free(tokens);
+  scoped_parser_free(&ctx);
+  arena_free(&arena);
+  interns_free(interns);
+  morphl_sources_clear();
+  return out_path;
+}
+
+static std::string read_file(const std::string& path) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::ostringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+static const char* kLoop =
+    "$syntax \"grammar_sample.txt\";\n"
+    "i := 0;\n"
+    "s := 0;\n"
+    "while (i <= 9) { s = s + i; i = i + 1; };\n"
+    "return s;\n";
+
+static void test_profile_counts_opcodes_and_sequences() {
+  assert(morphl_vm_profile_available());
+  std::string bytecode = compile_vm(kLoop);
+  std::string profile_path = temp_path(".json");
+  MorphlVmRunOptions options = {};
+  options.profile_path = profile_path.c_str();
+  assert(morphl_vm_run_file_with(bytecode.c_str(), &options, stderr) == 45);
+
+  std::string json = read_file(profile_path);
+  assert(json.find("\"engine\": \"typed\"") != std::string::npos);
+  // `i = i + 1` is fused and runs once per iteration; the loop test runs once more than that.
+  assert(json.find("\"INC_LOCAL\": 10") != std::string::npos);
+  assert(json.find("\"LTE\": 11") != std::string::npos);
+  assert(json.find("\"$lte\": 11") != std::string::npos);
+  // The condition is LOAD_LOCAL i; PUSH_CONST_I64 9; LTE, executed adjacently on every test.
+  assert(json.find("{\"ops\": [\"LOAD_LOCAL\", \"PUSH_CONST_I64\", \"LTE\"], \"count\": 11}") != std::string::npos);
+  assert(json.find("{\"ops\": [\"PUSH_CONST_I64\", \"LTE\"], \"count\": 11}") != std::string::npos);
+  // LOOP jumps back to the condition, so no sequence continues across it.
+  assert(json.find("[\"LOOP\", ") == std::string::npos);
+  assert(json.find("\"dropped_sequences\": 0") != std::string::npos);
+  std::remove(profile_path.c_str());
+  std::remove(bytecode.c_str());
+}
+
+static void test_profile_text_engine() {
+  std::string bytecode = compile_vm(
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 40;\n"
+      "return x + 2;\n");
+  std::string profile_path = temp_path(".json");
+  MorphlVmRunOptions options = {};
+  options.engine = MORPHL_VM_ENGINE_TEXT;
+  options.profile_path = profile_path.c_str();
+  assert(morphl_vm_run_file_with(bytecode.c_str(), &options, stderr) == 42);
+
+  std::string json = read_file(profile_path);
+  assert(json.find("\"engine\": \"text\"") != std::string::npos);
+  assert(json.find("\"ADD\": 1") != std::string::npos);
+  assert(json.find("\"$add\": 1") != std::string::npos);
+  std::remove(profile_path.c_str());
+  std::remove(bytecode.c_str());
+}
+
+static void test_profile_set_on_vm() {
+  std::string bytecode = compile_vm(kLoop);
+  std::string profile_path = temp_path(".json");
+  MorphlVmProgram* program = NULL;
+  assert(morphl_vm_program_load(bytecode.c_str(), &program));
+
+  MorphlVm* vm = morphl_vm_new(program);
+  assert(vm != NULL);
+  assert(morphl_vm_set_profile_output(vm, profile_path.c_str()));
+  assert(morphl_vm_execute(vm, stderr) == 45);
+  morphl_vm_free(vm);
+  assert(read_file(profile_path).find("\"INC_LOCAL\": 10") != std::string::npos);
+  std::remove(profile_path.c_str());
+
+  // Clearing the output turns profiling back off.
+  vm = morphl_vm_new(program);
+  assert(vm != NULL);
+  assert(morphl_vm_set_profile_output(vm, profile_path.c_str()));
+  assert(morphl_vm_set_profile_output(vm, NULL));
+  assert(morphl_vm_execute(vm, stderr) == 45);
+  morphl_vm_free(vm);
+  std::FILE* stale = std::fopen(profile_path.c_str(), "rb");
+  assert(stale == NULL);
+
+  morphl_vm_program_free(program);
+  std::remove(bytecode.c_str());
+}
+
+int main() {
+  test_profile_counts_opcodes_and_sequences();
+  test_profile_text_engine();
+  test_profile_set_on_vm();
+  std::puts("All VM profile tests passed.");
+  return 0;
+}
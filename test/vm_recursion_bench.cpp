@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+#include "backend/vm.h"
+#include "runtime/runtime.h"
+}
+
+// Measures calls per second for a deep recursion, and counts allocator calls while it runs: the
+// value stack and call frames are allocated before the first run, so later runs should make none.
+//
+// usage: vm_recursion_bench [repetitions] [depth]
+
+// Count malloc/calloc/realloc by interposing them, where glibc lets us forward to its own versions.
+// Sanitizers interpose them too, so counting is off in sanitizer builds.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define MORPHL_COUNT_ALLOCATIONS 1
+static std::atomic<unsigned long> g_allocations(0);
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) noexcept {
+  g_allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+  g_allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+  g_allocations++;
+  return __libc_realloc(ptr, size);
+}
+}
+#else
+#define MORPHL_COUNT_ALLOCATIONS 0
+#endif
+
+static void put_u32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) out.push_back((char)((value >> (8 * i)) & 0xFF));
+}
+
+static void put_op(std::string& code, uint8_t op) { code.push_back((char)op); }
+
+static void put_op_u32(std::string& code, uint8_t op, uint32_t operand) {
+  put_op(code, op);
+  put_u32(code, operand);
+}
+
+// down := (n) => { if (n <= 0) return 0; return down(n - 1) + 1; }; return $band down(depth) 255
+static void write_program(const std::string& path, uint32_t depth) {
+  const int64_t constants[] = {0, 1, 255, (int64_t)depth};
+
+  std::string code;
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 3);
+  put_op_u32(code, VM_OP_CALL, 1);
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 2);
+  put_op(code, VM_OP_BAND);
+  put_op(code, VM_OP_RET);
+
+  uint32_t down = (uint32_t)code.size();
+  put_op_u32(code, VM_OP_LOAD_LOCAL, 0);
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 0);
+  put_op(code, VM_OP_LTE);
+  put_op_u32(code, VM_OP_JUMP_IF_FALSE, 6);
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 0);
+  put_op(code, VM_OP_RET);
+  put_op_u32(code, VM_OP_LOAD_LOCAL, 0);
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 1);
+  put_op(code, VM_OP_SUB);
+  put_op_u32(code, VM_OP_CALL, 1);
+  put_op_u32(code, VM_OP_PUSH_CONST_I64, 1);
+  put_op(code, VM_OP_ADD);
+  put_op(code, VM_OP_RET);
+
+  std::string image = MORPHL_VM_MAGIC;
+  image.push_back((char)MORPHL_VM_VERSION_MAJOR);
+  image.push_back(0);
+  image.push_back((char)MORPHL_VM_VERSION_MINOR);
+  image.push_back(0);
+  put_u32(image, 0);
+
+  // A string table holding the two function names, then the constant pool.
+  const std::string names[] = {"<main>", "down"};
+  std::string data;
+  std::string offsets;
+  for (const std::string& name : names) {
+    put_u32(offsets, (uint32_t)data.size());
+    put_u32(data, (uint32_t)name.size());
+    data += name;
+    data.push_back('\0');
+  }
+  put_u32(image, 2);
+  put_u32(image, (uint32_t)data.size());
+  image += offsets;
+  image += data;
+  put_u32(image, 4);
+  for (int64_t value : constants) {
+    image.push_back((char)VM_CONST_I64);
+    put_u32(image, (uint32_t)(uint64_t)value);
+    put_u32(image, (uint32_t)((uint64_t)value >> 32));
+  }
+  // Function table: the top-level code, then down with n in local 0.
+  put_u32(image, 2);
+  put_u32(image, 0);
+  put_u32(image, 0);
+  put_u32(image, 0);
+  put_u32(image, 0);
+  put_u32(image, 1);
+  put_u32(image, down);
+  put_u32(image, 1);
+  put_u32(image, 1);
+  put_u32(image, 0);
+  put_u32(image, (uint32_t)code.size());
+  image += code;
+  put_u32(image, 0);
+
+  FILE* file = std::fopen(path.c_str(), "wb");
+  assert(file != nullptr);
+  assert(std::fwrite(image.data(), 1, image.size(), file) == image.size());
+  std::fclose(file);
+}
+
+int main(int argc, char** argv) {
+  int repetitions = (argc > 1) ? std::atoi(argv[1]) : 200;
+  if (repetitions <= 0) repetitions = 1;
+  int depth = (argc > 2) ? std::atoi(argv[2]) : 10000;
+  if (depth <= 0) depth = 1;
+
+  const char* tmpdir = std::getenv("TMP");
+  if (!tmpdir) tmpdir = "/tmp";
+  std::string path = std::string(tmpdir) + "/morphl_vm_recursion_bench.mbc";
+  write_program(path, (uint32_t)depth);
+
+  MorphlVmProgram* program = nullptr;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+  std::remove(path.c_str());
+  MorphlVm* vm = morphl_vm_new(program);
+  assert(vm != nullptr);
+
+  // The first run allocates the value stack; every later one reuses it.
+  morphl_exit_code_t code = morphl_vm_execute(vm, stderr);
+  assert(code == (morphl_exit_code_t)(depth & 255));
+
+#if MORPHL_COUNT_ALLOCATIONS
+  unsigned long allocations_before = g_allocations.load();
+#endif
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    code = morphl_vm_execute(vm, stderr);
+    assert(code == (morphl_exit_code_t)(depth & 255));
+  }
+  auto stop = std::chrono::steady_clock::now();
+#if MORPHL_COUNT_ALLOCATIONS
+  unsigned long allocations = g_allocations.load() - allocations_before;
+#endif
+  (void)code;
+  morphl_vm_free(vm);
+  morphl_vm_program_free(program);
+
+  double seconds = std::chrono::duration<double>(stop - start).count();
+  uint64_t calls = (uint64_t)(depth + 1) * (uint64_t)repetitions;
+  std::printf("depth=%d calls=%llu seconds=%.6f Mcalls/s=%.2f",
+              depth,
+              (unsigned long long)calls,
+              seconds,
+              seconds > 0 ? (double)calls / seconds / 1e6 : 0.0);
+#if MORPHL_COUNT_ALLOCATIONS
+  std::printf(" allocations=%lu\n", allocations);
+  assert(allocations == 0);
+#else
+  std::printf(" allocations=unknown\n");
+#endif
+  return 0;
+}
@@ -0,0 +1,809 @@
+#include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "backend/backend.h"
+#include "lexer/lexer.h"
+#include "parser/operators.h"
+#include "parser/scoped_parser.h"
+#include "runtime/runtime.h"
+#include "util/sources.h"
+#include "util/util.h"
+}
+
+static std::string temp_path(const char* suffix) {
+  const char* tmpdir = std::getenv("TMP");
+  if (!tmpdir) tmpdir = std::getenv("TEMP");
+#ifdef _WIN32
+  const char* fallback = "C:/Windows/Temp";
+#else
+  const char* fallback = "/tmp";
+#endif
+  if (!tmpdir) tmpdir = fallback;
+
+  static unsigned counter = 0;
+  std::ostringstream name;
+  name << tmpdir << "/morphl_vm_test_" << (unsigned)std::time(nullptr) << "_" << std::rand() << "_" << counter++ << suffix;
+  return name.str();
+}
+
+// Run the full front end over `source` and write VM bytecode to a temp file.
+// The source pretends to live in examples/ so `$syntax "grammar_sample.txt"` resolves.
+// Compile source to VM bytecode at *out_path; false when the front end or the backend rejects it.
+static bool try_compile_vm(const char* source, bool peephole, std::string* out_path) {
+  InternTable* interns = interns_new();
+  assert(interns != nullptr);
+  assert(operator_registry_init(interns));
+
+  Arena arena;
+  arena_init(&arena, 65536);
+
+  std::string source_path = std::string(MORPHL_EXAMPLES_DIR) + "/vm_test.mpl";
+  ScopedParserContext ctx;
+  assert(scoped_parser_init(&ctx, interns, &arena, source_path.c_str()));
+
+  struct token* tokens = NULL;
+  size_t token_count = 0;
+  assert(lexer_tokenize(source_path.c_str(), str_from(source, strlen(source)), interns, &tokens, &token_count));
+
+  AstNode* root = NULL;
+  assert(scoped_parse_ast(&ctx, tokens, token_count, &root));
+
+  *out_path = temp_path(".mbc");
+  MorphlBackendContext backend_ctx;
+  backend_ctx.tree = root;
+  backend_ctx.out_file = out_path->c_str();
+  backend_ctx.type_context = ctx.type_context;
+  backend_ctx.no_peephole = !peephole;
+  assert(morphl_register_backend(MORPHL_BACKEND_TYPE_VM));
+  bool ok = morphl_compile(&backend_ctx);
+
+  ast_free(root);
+  free(tokens);
+  scoped_parser_free(&ctx);
+  arena_free(&arena);
+  interns_free(interns);
+  morphl_sources_clear();
+  return ok;
+}
+
+static std::string compile_vm(const char* source, bool peephole = true) {
+  std::string out_path;
+  assert(try_compile_vm(source, peephole, &out_path));
+  return out_path;
+}
+
+static morphl_exit_code_t run_vm(const char* source, MorphlVmEngine engine) {
+  std::string path = compile_vm(source);
+  MorphlVmRunOptions options = {};
+  options.engine = engine;
+  morphl_exit_code_t code = morphl_vm_run_file_with(path.c_str(), &options, stderr);
+  std::remove(path.c_str());
+  return code;
+}
+
+static void test_engines_agree_on_integer_arithmetic() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 40;\n"
+      "y := x + 1;\n"
+      "return y + 1;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 42);
+  assert(run_vm(source, MORPHL_VM_ENGINE_TEXT) == 42);
+}
+
+static void test_typed_float_arithmetic() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 1.5;\n"
+      "y := x + 2.5;\n"
+      "return y;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 4);
+}
+
+static void test_typed_mutation_and_operators() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := mut 3;\n"
+      "x = x * 5 - 1;\n"
+      "return $band x 12;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 12);
+}
+
+static void test_typed_division_by_zero_fails() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 0;\n"
+      "return 7 / x;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 1);
+}
+
+static void test_locals_shadow_in_blocks() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 5;\n"
+      "y := mut 0;\n"
+      "{ x := 30; y = x + 1; };\n"
+      "return x + y;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 36);
+
+  // The text engine has no $mut, so check plain shadowing there.
+  const char* shadow =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 5;\n"
+      "{ x := 30; };\n"
+      "return x + 1;\n";
+  assert(run_vm(shadow, MORPHL_VM_ENGINE_TYPED) == 6);
+  assert(run_vm(shadow, MORPHL_VM_ENGINE_TEXT) == 6);
+}
+
+static void put_u32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) out.push_back((char)((value >> (8 * i)) & 0xFF));
+}
+
+struct PoolEntry {
+  uint8_t kind;
+  uint64_t bits;
+};
+
+struct FunctionEntry {
+  uint32_t entry_point;
+  uint32_t param_count;
+  uint32_t local_count;
+};
+
+struct LineEntry {
+  uint32_t offset;
+  uint32_t file_index;
+  uint32_t row;
+  uint32_t col;
+};
+
+// Write a minimal bytecode image with the given string table, code section, constant pool,
+// function table and line table. A name string for the functions is appended after the given strings.
+static std::string write_image(const std::vector<std::string>& strings,
+                               const std::string& code,
+                               uint8_t major = MORPHL_VM_VERSION_MAJOR,
+                               const std::vector<PoolEntry>& constants = {},
+                               const std::vector<FunctionEntry>& functions = {{0, 0, 1}},
+                               const std::vector<LineEntry>& lines = {}) {
+  std::string image = MORPHL_VM_MAGIC;
+  image.push_back((char)major);
+  image.push_back(0);
+  image.push_back((char)MORPHL_VM_VERSION_MINOR);
+  image.push_back(0);
+  put_u32(image, 0);
+
+  std::vector<std::string> all_strings = strings;
+  all_strings.push_back("<fn>");
+  std::string index;
+  std::string data;
+  for (const std::string& text : all_strings) {
+    put_u32(index, (uint32_t)data.size());
+    put_u32(data, (uint32_t)text.size());
+    data += text;
+    data.push_back('\0');
+  }
+  put_u32(image, (uint32_t)all_strings.size());
+  put_u32(image, (uint32_t)data.size());
+  image += index;
+  image += data;
+  put_u32(image, (uint32_t)constants.size());
+  for (const PoolEntry& entry : constants) {
+    image.push_back((char)entry.kind);
+    put_u32(image, (uint32_t)entry.bits);
+    put_u32(image, (uint32_t)(entry.bits >> 32));
+  }
+  put_u32(image, (uint32_t)functions.size());
+  for (const FunctionEntry& entry : functions) {
+    put_u32(image, (uint32_t)strings.size());
+    put_u32(image, entry.entry_point);
+    put_u32(image, entry.param_count);
+    put_u32(image, entry.local_count);
+  }
+  put_u32(image, 0);
+  put_u32(image, (uint32_t)code.size());
+  image += code;
+  put_u32(image, (uint32_t)lines.size());
+  for (const LineEntry& entry : lines) {
+    put_u32(image, entry.offset);
+    put_u32(image, entry.file_index);
+    put_u32(image, entry.row);
+    put_u32(image, entry.col);
+  }
+
+  std::string path = temp_path(".mbc");
+  FILE* file = std::fopen(path.c_str(), "wb");
+  assert(file != nullptr);
+  assert(std::fwrite(image.data(), 1, image.size(), file) == image.size());
+  std::fclose(file);
+  return path;
+}
+
+static bool image_loads(const std::vector<std::string>& strings,
+                        const std::string& code,
+                        uint8_t major = MORPHL_VM_VERSION_MAJOR,
+                        const std::vector<PoolEntry>& constants = {},
+                        const std::vector<FunctionEntry>& functions = {{0, 0, 1}},
+                        const std::vector<LineEntry>& lines = {}) {
+  std::string path = write_image(strings, code, major, constants, functions, lines);
+  MorphlVmProgram* program = nullptr;
+  bool ok = morphl_vm_program_load(path.c_str(), &program);
+  assert(ok == (program != nullptr));
+  morphl_vm_program_free(program);
+  std::remove(path.c_str());
+  return ok;
+}
+
+static void test_unknown_operator_rejected_at_load() {
+  // A single OPERATOR instruction naming an operator the VM does not know.
+  std::string code;
+  code.push_back((char)VM_OP_OPERATOR);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_HALT);
+  assert(!image_loads({"$frobnicate"}, code));
+}
+
+static void test_malformed_code_rejected_at_load() {
+  std::string code;
+  code.push_back((char)VM_OP_PUSH_LITERAL);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_RET);
+  assert(image_loads({"7"}, code));
+
+  // Images from an older major format version are refused.
+  assert(!image_loads({"7"}, code, MORPHL_VM_VERSION_MAJOR - 1));
+
+  // String index past the end of the table.
+  std::string bad_index;
+  bad_index.push_back((char)VM_OP_PUSH_LITERAL);
+  put_u32(bad_index, 99);
+  bad_index.push_back((char)VM_OP_RET);
+  assert(!image_loads({"7"}, bad_index));
+
+  // Operand cut off by the end of the code section.
+  std::string truncated;
+  truncated.push_back((char)VM_OP_PUSH_LITERAL);
+  truncated.push_back(0);
+  assert(!image_loads({"7"}, truncated));
+
+  // Opcode with no meaning.
+  assert(!image_loads({}, std::string(1, (char)0x7F)));
+
+  // The verifier rejects code that would pop more values than it pushed.
+  std::string underflow;
+  underflow.push_back((char)VM_OP_PUSH_LITERAL);
+  put_u32(underflow, 0);
+  underflow.push_back((char)VM_OP_ADD);
+  underflow.push_back((char)VM_OP_RET);
+  assert(!image_loads({"7"}, underflow));
+}
+
+static void test_operators_lower_to_opcodes() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "a := 7;\n"
+      "b := $lshift a 2;\n"
+      "c := $rem b 5;\n"
+      "d := b - 20;\n"
+      "return $bor c d;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 11);
+  assert(run_vm("$syntax \"grammar_sample.txt\";\nreturn 42 - 5 + 5;\n", MORPHL_VM_ENGINE_TYPED) == 42);
+}
+
+static void test_numeric_literals_use_constant_pool() {
+  // Literals wider than 32 bits and repeated literals travel through the pool unchanged.
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "a := 4000000000;\n"
+      "b := a - 3999999990;\n"
+      "c := 0.75 + 0.75;\n"
+      "d := c * 4.0;\n"
+      "return b * 4;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 40);
+  assert(run_vm("$syntax \"grammar_sample.txt\";\nreturn 40 + 2;\n", MORPHL_VM_ENGINE_TEXT) == 42);
+
+  std::string code;
+  code.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_RET);
+  assert(image_loads({}, code, MORPHL_VM_VERSION_MAJOR, {{VM_CONST_I64, 7}}));
+
+  // The entry kind must match the opcode, and the index must be inside the pool.
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, {{VM_CONST_F64, 7}}));
+  assert(!image_loads({}, code));
+
+  // A pool that claims more entries than the file holds is refused.
+  std::string short_pool;
+  short_pool.push_back((char)VM_OP_HALT);
+  std::vector<std::string> no_strings;
+  std::string path = write_image(no_strings, short_pool, MORPHL_VM_VERSION_MAJOR, {{VM_CONST_I64, 1}});
+  FILE* file = std::fopen(path.c_str(), "r+b");
+  assert(file != nullptr);
+  std::fseek(file, 33, SEEK_SET);  // after the header and a string table holding only "<fn>"
+  const unsigned char huge[4] = {0xFF, 0xFF, 0xFF, 0x0F};
+  assert(std::fwrite(huge, 1, 4, file) == 4);
+  std::fclose(file);
+  MorphlVmProgram* program = nullptr;
+  assert(!morphl_vm_program_load(path.c_str(), &program));
+  std::remove(path.c_str());
+}
+
+static void test_many_distinct_literals() {
+  // Enough distinct constants and names to grow the emitter's hash indexes several times.
+  std::string source = "$syntax \"grammar_sample.txt\";\n";
+  for (int i = 0; i < 3000; ++i) {
+    source += "v" + std::to_string(i) + " := " + std::to_string((i + 43) % 1500) + ";\n";
+  }
+  source += "return v2999;\n";
+  assert(run_vm(source.c_str(), MORPHL_VM_ENGINE_TYPED) == 42);
+}
+
+static void test_groups_are_shared() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "t := 1, 2, 3;\n"
+      "u := t;\n"
+      "v := u, t;\n"
+      "return 7;\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 7);
+  assert(run_vm(source, MORPHL_VM_ENGINE_TEXT) == 7);
+
+  // g := null; repeat { g = (g, 1) }; return 42 -- every LOAD_LOCAL of g shares the nested group.
+  std::string code;
+  code.push_back((char)VM_OP_PUSH_NULL);
+  code.push_back((char)VM_OP_STORE_LOCAL);
+  put_u32(code, 0);
+  for (int i = 0; i < 2000; ++i) {
+    code.push_back((char)VM_OP_LOAD_LOCAL);
+    put_u32(code, 0);
+    code.push_back((char)VM_OP_PUSH_CONST_I64);
+    put_u32(code, 0);
+    code.push_back((char)VM_OP_MAKE_GROUP);
+    put_u32(code, 2);
+    code.push_back((char)VM_OP_STORE_LOCAL);
+    put_u32(code, 0);
+  }
+  code.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(code, 1);
+  code.push_back((char)VM_OP_RET);
+  std::string path = write_image({}, code, MORPHL_VM_VERSION_MAJOR, {{VM_CONST_I64, 1}, {VM_CONST_I64, 42}});
+  for (MorphlVmEngine engine : {MORPHL_VM_ENGINE_TYPED, MORPHL_VM_ENGINE_TEXT}) {
+    MorphlVmRunOptions options = {};
+    options.engine = engine;
+    assert(morphl_vm_run_file_with(path.c_str(), &options, stderr) == 42);
+  }
+  std::remove(path.c_str());
+}
+
+static void test_functions_are_called_by_index() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "inc := (n := 0) => { return n + 1; };\n"
+      "twice := (n := 0) => { return inc(inc(n)); };\n"
+      "return twice(40);\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 42);
+  assert(run_vm(source, MORPHL_VM_ENGINE_TEXT) == 42);
+
+  // Missing arguments take the parameter default, and callee locals do not leak into the caller.
+  const char* defaults =
+      "$syntax \"grammar_sample.txt\";\n"
+      "n := 5;\n"
+      "f := (n := 30) => { m := n + 7; return m; };\n"
+      "a := f(());\n"
+      "return a + n;\n";
+  assert(run_vm(defaults, MORPHL_VM_ENGINE_TYPED) == 42);
+  assert(run_vm(defaults, MORPHL_VM_ENGINE_TEXT) == 42);
+}
+
+static void test_function_table_validated_at_load() {
+  // main: PUSH_CONST_I64 42; CALL 1; RET.  function 1: LOAD_LOCAL 0; RET.
+  std::string code;
+  code.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_CALL);
+  put_u32(code, 1);
+  code.push_back((char)VM_OP_RET);
+  uint32_t callee = (uint32_t)code.size();
+  code.push_back((char)VM_OP_LOAD_LOCAL);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_RET);
+  std::vector<PoolEntry> pool = {{VM_CONST_I64, 42}};
+
+  std::string path = write_image({}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 0}, {callee, 1, 1}});
+  for (MorphlVmEngine engine : {MORPHL_VM_ENGINE_TYPED, MORPHL_VM_ENGINE_TEXT}) {
+    MorphlVmRunOptions options = {};
+    options.engine = engine;
+    assert(morphl_vm_run_file_with(path.c_str(), &options, stderr) == 42);
+  }
+  std::remove(path.c_str());
+
+  // No function table, an entry point inside an instruction, and entries out of order.
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, pool, {}));
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 0}, {callee + 1, 1, 1}}));
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, pool, {{callee, 1, 1}, {0, 0, 0}}));
+  // A call index past the table, and a local slot past the callee's frame.
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 0}}));
+  assert(!image_loads({}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 0}, {callee, 0, 0}}));
+  // The verifier refuses a body that runs off its end into the next function.
+  std::string falls = code;
+  falls[callee - 1] = (char)VM_OP_PUSH_NULL;
+  assert(!image_loads({}, falls, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 0}, {callee, 1, 1}}));
+}
+
+static void test_branches_and_loops() {
+  const char* factorial =
+      "$syntax \"grammar_sample.txt\";\n"
+      "fact := (n := 0) => {\n"
+      "  if (n <= 1) { return 1; } else { return n * fact(n - 1); };\n"
+      "};\n"
+      "return fact(5);\n";
+  assert(run_vm(factorial, MORPHL_VM_ENGINE_TYPED) == 120);
+
+  const char* loop =
+      "$syntax \"grammar_sample.txt\";\n"
+      "i := 0;\n"
+      "s := 0;\n"
+      "while (i <= 9) { s = s + i; i = i + 1; };\n"
+      "return s;\n";
+  assert(run_vm(loop, MORPHL_VM_ENGINE_TYPED) == 45);
+
+  // if is an expression; without else the missing branch is null.
+  const char* value =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 3;\n"
+      "y := if (x <= 2) 10 else 20;\n"
+      "return y + 1;\n";
+  assert(run_vm(value, MORPHL_VM_ENGINE_TYPED) == 21);
+}
+
+// Recursion runs on the preallocated stack up to VM_MAX_CALL_DEPTH frames, and fails cleanly past it.
+static void test_deep_recursion() {
+  // The call is an operand of `+`, not in tail position, so every level keeps its frame.
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "down := (n := 0) => {\n"
+      "  if (n <= 0) { return 7; } else { return 0 + down(n - 1); };\n"
+      "};\n"
+      "return down(%d);\n";
+  char text[512];
+  std::snprintf(text, sizeof(text), source, 10000);
+  assert(run_vm(text, MORPHL_VM_ENGINE_TYPED) == 7);
+
+  std::snprintf(text, sizeof(text), source, 100000);
+  std::string path = compile_vm(text);
+  std::FILE* err = std::tmpfile();
+  assert(err != nullptr);
+  assert(morphl_vm_run_file(path.c_str(), err) == 1);
+  std::rewind(err);
+  char message[256] = {0};
+  assert(std::fgets(message, sizeof(message), err) != nullptr);
+  assert(std::strstr(message, "stack overflow") != nullptr);
+  std::fclose(err);
+  std::remove(path.c_str());
+}
+
+// A function body cannot see the top level's locals, so the backend rejects names only they declare.
+static void test_function_reads_top_level_name() {
+  const char* literal =
+      "$syntax \"grammar_sample.txt\";\n"
+      "f := (n := 0) => { return n + 5; };\n"
+      "return f(1);\n";
+  assert(run_vm(literal, MORPHL_VM_ENGINE_TYPED) == 6);
+
+  const char* outer =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 5;\n"
+      "f := (n := 0) => { return n + x; };\n"
+      "return f(1);\n";
+  std::string path;
+  assert(!try_compile_vm(outer, true, &path));
+  std::remove(path.c_str());
+
+  // A parameter that shadows the outer name is the function's own.
+  const char* shadowed =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 5;\n"
+      "f := (x := 0) => { return x + 1; };\n"
+      "return f(41);\n";
+  assert(run_vm(shadowed, MORPHL_VM_ENGINE_TYPED) == 42);
+}
+
+// `return f(...)` reuses the frame, so tail recursion goes far past VM_MAX_CALL_DEPTH.
+static void test_tail_calls() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "down := (n := 0) => {\n"
+      "  if (n <= 0) { return 7; } else { return down(n - 1); };\n"
+      "};\n"
+      "return down(1000000);\n";
+  assert(run_vm(source, MORPHL_VM_ENGINE_TYPED) == 7);
+
+  // A tail call from the top level, on both engines.
+  const char* top =
+      "$syntax \"grammar_sample.txt\";\n"
+      "plus2 := (n := 0) => { return n + 2; };\n"
+      "x := 40;\n"
+      "return plus2(x);\n";
+  assert(run_vm(top, MORPHL_VM_ENGINE_TYPED) == 42);
+  assert(run_vm(top, MORPHL_VM_ENGINE_TEXT) == 42);
+}
+
+static std::string read_example(const char* name) {
+  std::string path = std::string(MORPHL_EXAMPLES_DIR) + "/" + name;
+  FILE* file = std::fopen(path.c_str(), "rb");
+  assert(file != nullptr);
+  std::string text;
+  char buffer[4096];
+  size_t n = 0;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, n);
+  }
+  std::fclose(file);
+  return text;
+}
+
+static uint32_t instruction_count(const std::string& path) {
+  MorphlVmProgram* program = nullptr;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+  uint32_t count = morphl_vm_program_instruction_count(program);
+  morphl_vm_program_free(program);
+  return count;
+}
+
+static void test_peephole_superinstructions() {
+  // Stores followed by POP, `x = x + k` and the loop's dropped null all fuse; results are unchanged.
+  const char* loop =
+      "$syntax \"grammar_sample.txt\";\n"
+      "i := 0;\n"
+      "s := 0;\n"
+      "while (i <= 9) { s = s + i; i = i + 1; };\n"
+      "j := 50;\n"
+      "j = j - 3;\n"
+      "return s + j;\n";
+  std::string fused = compile_vm(loop);
+  std::string plain = compile_vm(loop, false);
+  assert(instruction_count(fused) == 22);
+  assert(instruction_count(plain) == 36);
+  for (MorphlVmEngine engine : {MORPHL_VM_ENGINE_TYPED, MORPHL_VM_ENGINE_TEXT}) {
+    MorphlVmRunOptions options = {};
+    options.engine = engine;
+    assert(morphl_vm_run_file_with(fused.c_str(), &options, nullptr) ==
+           morphl_vm_run_file_with(plain.c_str(), &options, nullptr));
+  }
+  MorphlVmRunOptions typed = {};
+  assert(morphl_vm_run_file_with(fused.c_str(), &typed, stderr) == 92);
+  std::remove(fused.c_str());
+  std::remove(plain.c_str());
+
+  // A float local still adds as a float.
+  const char* floats =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 1.5;\n"
+      "x = x + 1;\n"
+      "y := x + 0.5;\n"
+      "return y;\n";
+  assert(run_vm(floats, MORPHL_VM_ENGINE_TYPED) == 3);
+
+  // A fused `x = x - k` that fails does not claim to be an $add.
+  const char* strings =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := \"a\";\n"
+      "x = x - 3;\n"
+      "return 0;\n";
+  std::string bad = compile_vm(strings);
+  for (MorphlVmEngine engine : {MORPHL_VM_ENGINE_TYPED, MORPHL_VM_ENGINE_TEXT}) {
+    MorphlVmRunOptions options = {};
+    options.engine = engine;
+    std::FILE* err = std::tmpfile();
+    assert(err != nullptr);
+    assert(morphl_vm_run_file_with(bad.c_str(), &options, err) == 1);
+    std::rewind(err);
+    char message[256] = {0};
+    assert(std::fgets(message, sizeof(message), err) != nullptr);
+    assert(std::strstr(message, "$add/$sub") != nullptr);
+    std::fclose(err);
+  }
+  std::remove(bad.c_str());
+
+  // Every example the VM loads gets no longer, and the examples get shorter overall.
+  const char* examples[] = {"factorial.mpl", "mut_sample.mpl", "test_mut.mpl", "else.mpl", "program.src"};
+  uint32_t total_fused = 0;
+  uint32_t total_plain = 0;
+  for (const char* name : examples) {
+    std::string source = read_example(name);
+    std::string with = compile_vm(source.c_str());
+    std::string without = compile_vm(source.c_str(), false);
+    uint32_t n_with = instruction_count(with);
+    uint32_t n_without = instruction_count(without);
+    std::printf("peephole %-16s %3u -> %3u instructions\n", name, n_without, n_with);
+    assert(n_with <= n_without);
+    total_fused += n_with;
+    total_plain += n_without;
+    std::remove(with.c_str());
+    std::remove(without.c_str());
+  }
+  assert(total_fused < total_plain);
+}
+
+static void test_jumps_validated_at_load() {
+  // PUSH_CONST_I64 0; JUMP +5; PUSH_CONST_I64 0; RET
+  std::vector<PoolEntry> pool = {{VM_CONST_I64, 42}};
+  auto skip = [](uint32_t offset) {
+    std::string code;
+    code.push_back((char)VM_OP_PUSH_CONST_I64);
+    put_u32(code, 0);
+    code.push_back((char)VM_OP_JUMP);
+    put_u32(code, offset);
+    code.push_back((char)VM_OP_PUSH_CONST_I64);
+    put_u32(code, 0);
+    code.push_back((char)VM_OP_RET);
+    return code;
+  };
+  assert(image_loads({}, skip(5), MORPHL_VM_VERSION_MAJOR, pool));
+  // Into the middle of an instruction, and past the end of the code.
+  assert(!image_loads({}, skip(4), MORPHL_VM_VERSION_MAJOR, pool));
+  assert(!image_loads({}, skip(1000), MORPHL_VM_VERSION_MAJOR, pool));
+
+  // LOOP back past the start of the code.
+  std::string back;
+  back.push_back((char)VM_OP_LOOP);
+  put_u32(back, 6);
+  assert(!image_loads({}, back, MORPHL_VM_VERSION_MAJOR, pool));
+
+  // The two successors of a JUMP_IF_FALSE reach RET at different depths.
+  std::string uneven;
+  uneven.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(uneven, 0);
+  uneven.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(uneven, 0);
+  uneven.push_back((char)VM_OP_JUMP_IF_FALSE);
+  put_u32(uneven, 5);
+  uneven.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(uneven, 0);
+  uneven.push_back((char)VM_OP_RET);
+  assert(!image_loads({}, uneven, MORPHL_VM_VERSION_MAJOR, pool));
+}
+
+static void test_line_table() {
+  // `g` starts on line 3 and its loop body sits on line 5.
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 1;\n"
+      "g := (n := 0) => {\n"
+      "  i := 0;\n"
+      "  while (i <= n) { i = i + 2; };\n"
+      "  return i;\n"
+      "};\n"
+      "return g(10) + x;\n";
+  for (bool peephole : {true, false}) {
+    std::string path = compile_vm(source, peephole);
+    MorphlVmProgram* program = nullptr;
+    assert(morphl_vm_program_load(path.c_str(), &program));
+    uint32_t count = morphl_vm_program_instruction_count(program);
+    const char* file = nullptr;
+    uint32_t row = 0;
+    uint32_t col = 0;
+    assert(morphl_vm_program_source_location(program, 0, &file, &row, &col));
+    assert(std::strstr(file, "vm_test.mpl") != nullptr);
+    assert(row == 2);
+    assert(!morphl_vm_program_source_location(program, count, &file, &row, &col));
+
+    // Every instruction has a line, rows stay within the file, and the loop body's line shows up.
+    bool saw_body = false;
+    for (uint32_t i = 0; i < count; ++i) {
+      assert(morphl_vm_program_source_location(program, i, &file, &row, &col));
+      assert(row >= 1 && row <= 8);
+      saw_body = saw_body || row == 5;
+    }
+    assert(saw_body);
+    morphl_vm_program_free(program);
+
+    MorphlVmRunOptions options = {};
+    assert(morphl_vm_run_file_with(path.c_str(), &options, stderr) == 13);
+    std::remove(path.c_str());
+  }
+
+  // Line entries must start at increasing instruction boundaries and name a string.
+  std::string code;
+  code.push_back((char)VM_OP_PUSH_CONST_I64);
+  put_u32(code, 0);
+  code.push_back((char)VM_OP_RET);
+  std::vector<PoolEntry> pool = {{VM_CONST_I64, 1}};
+  assert(image_loads({"a.mpl"}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 1}}, {{0, 0, 1, 1}, {5, 0, 2, 1}}));
+  assert(!image_loads({"a.mpl"}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 1}}, {{2, 0, 1, 1}}));
+  assert(!image_loads({"a.mpl"}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 1}}, {{5, 0, 1, 1}, {0, 0, 2, 1}}));
+  assert(!image_loads({"a.mpl"}, code, MORPHL_VM_VERSION_MAJOR, pool, {{0, 0, 1}}, {{0, 9, 1, 1}}));
+}
+
+static void test_sampling_profiler() {
+  if (!morphl_vm_sampling_available()) {
+    return;
+  }
+  // Nearly all the time goes to the loop on line 5, inside `spin` called from line 8. The call is
+  // not a tail call, so the top-level frame stays on the stack.
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "spin := (n := 0) => {\n"
+      "  i := 0;\n"
+      "  s := 0;\n"
+      "  while (i <= n) { s = s + i; i = i + 1; };\n"
+      "  return 7;\n"
+      "};\n"
+      "r := spin(3000000);\n"
+      "return r;\n";
+  std::string path = compile_vm(source);
+  std::string samples_path = temp_path(".folded");
+  MorphlVmRunOptions options = {};
+  options.sample_path = samples_path.c_str();
+  options.sample_interval_us = 200;
+  assert(morphl_vm_run_file_with(path.c_str(), &options, stderr) == 7);
+
+  std::FILE* in = std::fopen(samples_path.c_str(), "r");
+  assert(in != nullptr);
+  char line[512];
+  unsigned long hot = 0;
+  unsigned long total = 0;
+  while (std::fgets(line, sizeof(line), in)) {
+    char* space = std::strrchr(line, ' ');
+    assert(space != nullptr);
+    unsigned long count = std::strtoul(space + 1, nullptr, 10);
+    assert(count > 0);
+    assert(std::strncmp(line, "<main> (vm_test.mpl:", 20) == 0);
+    total += count;
+    if (std::strstr(line, "<main> (vm_test.mpl:8);spin (vm_test.mpl:5) ") == line) {
+      hot += count;
+    }
+  }
+  std::fclose(in);
+  assert(total > 0);
+  assert(hot * 2 > total);
+  std::remove(samples_path.c_str());
+  std::remove(path.c_str());
+}
+
+static void test_profile_not_compiled_in() {
+  // The default runtime carries no profiler; asking for one fails instead of silently doing nothing.
+  assert(!morphl_vm_profile_available());
+  std::string path = compile_vm("$syntax \"grammar_sample.txt\";\nreturn 7;\n");
+  std::string profile_path = temp_path(".json");
+  MorphlVmRunOptions options = {};
+  options.profile_path = profile_path.c_str();
+  assert(morphl_vm_run_file_with(path.c_str(), &options, nullptr) != 7);
+  options.profile_path = NULL;
+  assert(morphl_vm_run_file_with(path.c_str(), &options, nullptr) == 7);
+  std::remove(path.c_str());
+}
+
+int main() {
+  test_engines_agree_on_integer_arithmetic();
+  test_typed_float_arithmetic();
+  test_typed_mutation_and_operators();
+  test_typed_division_by_zero_fails();
+  test_locals_shadow_in_blocks();
+  test_unknown_operator_rejected_at_load();
+  test_malformed_code_rejected_at_load();
+  test_operators_lower_to_opcodes();
+  test_numeric_literals_use_constant_pool();
+  test_many_distinct_literals();
+  test_groups_are_shared();
+  test_functions_are_called_by_index();
+  test_function_table_validated_at_load();
+  test_branches_and_loops();
+  test_deep_recursion();
+  test_function_reads_top_level_name();
+  test_tail_calls();
+  test_jumps_validated_at_load();
+  test_peephole_superinstructions();
+  test_line_table();
+  test_sampling_profiler();
+  test_profile_not_compiled_in();
+  std::puts("All VM tests passed.");
+  return 0;
+}
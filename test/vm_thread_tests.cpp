@@ -0,0 +1,304 @@
+#include <assert.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "backend/backend.h"
+#include "lexer/lexer.h"
+#include "parser/operators.h"
+#include "parser/scoped_parser.h"
+#include "runtime/runtime.h"
+#include "util/sources.h"
+#include "util/util.h"
+}
+
+static std::string temp_path(unsigned worker, const char* suffix) {
+  const char* tmpdir = std::getenv("TMP");
+  if (!tmpdir) tmpdir = std::getenv("TEMP");
+#ifdef _WIN32
+  const char* fallback = "C:/Windows/Temp";
+#else
+  const char* fallback = "/tmp";
+#endif
+  if (!tmpdir) tmpdir = fallback;
+
+  std::ostringstream name;
+  name << tmpdir << "/morphl_vm_thread_test_" << (unsigned)std::time(nullptr) << "_" << worker << suffix;
+  return name.str();
+}
+
+static unsigned worker_count() {
+  unsigned cores = std::thread::hardware_concurrency();
+  return (cores < 2) ? 2 : cores;
+}
+
+static std::string read_file(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "rb");
+  assert(file != nullptr);
+  std::string text;
+  char buffer[4096];
+  size_t n = 0;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, n);
+  }
+  std::fclose(file);
+  return text;
+}
+
+// Run the full front end over `source` with state owned by the caller's thread and write the
+// output of `type` to out_path. Returns false instead of asserting so workers can report failure.
+static bool compile_to(const char* source, enum MorphlBackendType type, const std::string& out_path) {
+  InternTable* interns = interns_new();
+  if (!interns || !operator_registry_init(interns)) {
+    interns_free(interns);
+    return false;
+  }
+
+  Arena arena;
+  arena_init(&arena, 65536);
+
+  std::string source_path = std::string(MORPHL_EXAMPLES_DIR) + "/vm_test.mpl";
+  ScopedParserContext ctx;
+  bool ok = scoped_parser_init(&ctx, interns, &arena, source_path.c_str());
+
+  struct token* tokens = NULL;
+  size_t token_count = 0;
+  AstNode* root = NULL;
+  ok = ok && lexer_tokenize(source_path.c_str(), str_from(source, strlen(source)), interns, &tokens, &token_count);
+  ok = ok && scoped_parse_ast(&ctx, tokens, token_count, &root);
+  if (ok) {
+    MorphlBackendContext backend_ctx;
+    backend_ctx.tree = root;
+    backend_ctx.out_file = out_path.c_str();
+    backend_ctx.type_context = ctx.type_context;
+    backend_ctx.no_peephole = false;
+    ok = morphl_compile_with(&backend_ctx, type);
+  }
+
+  ast_free(root);
+  free(tokens);
+  scoped_parser_free(&ctx);
+  arena_free(&arena);
+  interns_free(interns);
+  morphl_sources_clear();
+  return ok;
+}
+
+static const char* kProgram =
+    "$syntax \"grammar_sample.txt\";\n"
+    "fact := (n := 0) => {\n"
+    "  if (n <= 1) { return 1; } else { return n * fact(n - 1); };\n"
+    "};\n"
+    "i := 0;\n"
+    "s := 0;\n"
+    "while (i <= 20000) { s = s + fact(5) - 119; i = i + 1; };\n"
+    "return s - 19960;\n";
+
+// One program, loaded once, run by a VM per thread on every core at the same time.
+static void test_shared_program_on_every_core() {
+  std::string path = temp_path(0, ".mbc");
+  assert(compile_to(kProgram, MORPHL_BACKEND_TYPE_VM, path));
+  MorphlVmProgram* program = NULL;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+
+  unsigned workers = worker_count();
+  std::atomic<unsigned> ready(0);
+  std::atomic<unsigned> failures(0);
+  std::vector<std::thread> threads;
+  for (unsigned w = 0; w < workers; ++w) {
+    threads.emplace_back([&]() {
+      ready++;
+      while (ready.load() < workers) {
+        std::this_thread::yield();
+      }
+      for (int run = 0; run < 8; ++run) {
+        MorphlVm* vm = morphl_vm_new(program);
+        if (!vm || morphl_vm_execute(vm, stderr) != 41) {
+          failures++;
+        }
+        morphl_vm_free(vm);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  assert(failures.load() == 0);
+
+  morphl_vm_program_free(program);
+  std::remove(path.c_str());
+}
+
+// Every thread compiles with its own intern table: the VM output must run, and the C output must
+// match a compile done alone.
+static void test_concurrent_compiles() {
+  std::string reference_path = temp_path(0, ".c");
+  assert(compile_to(kProgram, MORPHL_BACKEND_TYPE_C, reference_path));
+  std::string reference = read_file(reference_path);
+  assert(!reference.empty());
+  std::remove(reference_path.c_str());
+
+  unsigned workers = worker_count();
+  std::atomic<unsigned> failures(0);
+  std::vector<std::string> c_outputs(workers);
+  std::vector<std::thread> threads;
+  for (unsigned w = 0; w < workers; ++w) {
+    threads.emplace_back([&, w]() {
+      std::string vm_path = temp_path(w + 1, ".mbc");
+      std::string c_path = temp_path(w + 1, ".c");
+      if (!compile_to(kProgram, MORPHL_BACKEND_TYPE_VM, vm_path) ||
+          morphl_vm_run_file(vm_path.c_str(), stderr) != 41 ||
+          !compile_to(kProgram, MORPHL_BACKEND_TYPE_C, c_path)) {
+        failures++;
+      } else {
+        c_outputs[w] = read_file(c_path);
+      }
+      std::remove(vm_path.c_str());
+      std::remove(c_path.c_str());
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  assert(failures.load() == 0);
+  for (const std::string& output : c_outputs) {
+    assert(output == reference);
+  }
+}
+
+// A function called directly sees only its arguments; the VM starts clean for every call.
+static void test_call_entry_function() {
+  std::string path = temp_path(0, ".mbc");
+  assert(compile_to(kProgram, MORPHL_BACKEND_TYPE_VM, path));
+  MorphlVmProgram* program = NULL;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+  MorphlVm* vm = morphl_vm_new(program);
+  assert(vm != nullptr);
+
+  MorphlVmArg arg = {};
+  arg.kind = MORPHL_VM_ARG_INT;
+  arg.as.i = 5;
+  assert(morphl_vm_call(vm, "fact", &arg, 1, stderr) == 120);
+  arg.as.i = 4;
+  assert(morphl_vm_call(vm, "fact", &arg, 1, stderr) == 24);
+  assert(morphl_vm_call(vm, NULL, NULL, 0, stderr) == 41);
+  assert(morphl_vm_execute(vm, stderr) == 41);
+
+  assert(morphl_vm_call(vm, "fact", NULL, 0, NULL) == 1);
+  assert(morphl_vm_call(vm, "missing", NULL, 0, NULL) == 1);
+  morphl_vm_set_engine(vm, MORPHL_VM_ENGINE_TEXT);
+  assert(morphl_vm_call(vm, "fact", &arg, 1, NULL) == 1);
+
+  morphl_vm_free(vm);
+  morphl_vm_program_free(program);
+  std::remove(path.c_str());
+}
+
+// The text engine also starts every run from a clean state: no stack, slots or frames carry over.
+static void test_text_engine_repeat_execute() {
+  const char* source =
+      "$syntax \"grammar_sample.txt\";\n"
+      "x := 1;\n"
+      "y := x + 1;\n"
+      "return y + 1;\n";
+  std::string path = temp_path(0, ".mbc");
+  assert(compile_to(source, MORPHL_BACKEND_TYPE_VM, path));
+  MorphlVmProgram* program = NULL;
+  assert(morphl_vm_program_load(path.c_str(), &program));
+  MorphlVm* vm = morphl_vm_new(program);
+  assert(vm != nullptr);
+  morphl_vm_set_engine(vm, MORPHL_VM_ENGINE_TEXT);
+
+  for (int run = 0; run < 3; ++run) {
+    assert(morphl_vm_execute(vm, stderr) == 3);
+  }
+  assert(morphl_vm_call(vm, NULL, NULL, 0, stderr) == 3);
+
+  morphl_vm_free(vm);
+  morphl_vm_program_free(program);
+  std::remove(path.c_str());
+}
+
+// Many short jobs over two programs; every job gets its own exit code back.
+static void test_pool_runs_jobs() {
+  const char* other =
+      "$syntax \"grammar_sample.txt\";\n"
+      "twice := (n := 0) => { return n + n; };\n"
+      "return 7;\n";
+  std::string fact_path = temp_path(0, ".mbc");
+  std::string other_path = temp_path(1, ".mbc");
+  assert(compile_to(kProgram, MORPHL_BACKEND_TYPE_VM, fact_path));
+  assert(compile_to(other, MORPHL_BACKEND_TYPE_VM, other_path));
+  MorphlVmProgram* fact_program = NULL;
+  MorphlVmProgram* other_program = NULL;
+  assert(morphl_vm_program_load(fact_path.c_str(), &fact_program));
+  assert(morphl_vm_program_load(other_path.c_str(), &other_program));
+
+  // 0 asks for a worker per CPU; the jobs below use at least two so stealing happens.
+  MorphlVmPool* pool = morphl_vm_pool_new(0, stderr);
+  assert(pool != nullptr);
+  assert(morphl_vm_pool_worker_count(pool) > 0);
+  morphl_vm_pool_free(pool);
+  pool = morphl_vm_pool_new(worker_count(), stderr);
+  assert(pool != nullptr);
+
+  const size_t job_count = 20000;
+  std::vector<MorphlVmArg> args(job_count);
+  std::vector<MorphlVmJob> jobs(job_count);
+  for (size_t i = 0; i < job_count; ++i) {
+    args[i].kind = MORPHL_VM_ARG_INT;
+    args[i].as.i = (int64_t)(i % 6);
+    MorphlVmJob& job = jobs[i];
+    job.program = (i % 2 == 0) ? fact_program : other_program;
+    job.entry = (i % 2 == 0) ? "fact" : "twice";
+    job.args = &args[i];
+    job.arg_count = 1;
+    job.exit_code = 255;
+    if (i % 1000 == 0) {
+      // The main programs, which take no arguments; one of them loops for a while.
+      job.entry = NULL;
+      job.arg_count = 0;
+    }
+    assert(morphl_vm_pool_submit(pool, &job));
+  }
+  morphl_vm_pool_wait(pool);
+
+  static const int factorials[] = {1, 1, 2, 6, 24, 120};
+  for (size_t i = 0; i < job_count; ++i) {
+    int expected = (i % 2 == 0) ? factorials[i % 6] : (int)(2 * (i % 6));
+    if (i % 1000 == 0) {
+      expected = 41;
+    }
+    assert(jobs[i].exit_code == expected);
+  }
+
+  // The pool can be reused after waiting, and freeing it runs what is still queued.
+  MorphlVmJob last = {};
+  last.program = other_program;
+  last.exit_code = 255;
+  assert(morphl_vm_pool_submit(pool, &last));
+  morphl_vm_pool_free(pool);
+  assert(last.exit_code == 7);
+
+  morphl_vm_program_free(fact_program);
+  morphl_vm_program_free(other_program);
+  std::remove(fact_path.c_str());
+  std::remove(other_path.c_str());
+}
+
+int main() {
+  test_shared_program_on_every_core();
+  test_concurrent_compiles();
+  test_call_entry_function();
+  test_text_engine_repeat_execute();
+  test_pool_runs_jobs();
+  std::puts("All VM thread tests passed.");
+  return 0;
+}